@@ -38,6 +38,8 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/timerfd.h>
 #include <stdlib.h>
 #include <private/android_filesystem_config.h>
 
@@ -45,6 +47,7 @@
 
 #include <hardware/bluetooth.h>
 #include "data_types.h"
+#include "bt_target.h"
 #include "bd.h"
 #include "btif_api.h"
 #include "btif_config.h"
@@ -54,11 +57,16 @@
 #include "btif_util.h"
 
 //#define UNIT_TEST
+#ifndef CFG_PATH
 #define CFG_PATH "/data/misc/bluedroid/"
+#endif
 #define CFG_FILE_NAME "bt_config"
 #define CFG_FILE_EXT ".xml"
 #define CFG_FILE_EXT_OLD ".old"
 #define CFG_FILE_EXT_NEW ".new"
+#define CFG_FILE_EXT_JOURNAL ".journal"
+#define CFG_FILE_EXT_SNAPSHOT ".bin"
+#define CFG_FILE_EXT_SNAPSHOT_NEW ".bin.new"
 #define CFG_GROW_SIZE (10*sizeof(cfg_node))
 #define GET_CHILD_MAX_COUNT(node) (short)((int)(node)->bytes / sizeof(cfg_node))
 #define GET_CHILD_COUNT(p) (short)((int)(p)->used / sizeof(cfg_node))
@@ -66,8 +74,21 @@
 #define DEC_CHILD_COUNT(p, c) (p)->used -= (short)((c)*sizeof(cfg_node))
 #define GET_NODE_COUNT(bytes) (bytes / sizeof(cfg_node))
 #define GET_NODE_BYTES(c) (c * sizeof(cfg_node))
+//a node's children are followed in the same block by an open addressed index of
+//child positions + 1, sized from the children capacity so it needs no extra field
+#define GET_INDEX(p) ((short*)((char*)(p)->child + (p)->bytes))
+#define GET_INDEX_SIZE(bytes) index_size(GET_NODE_COUNT(bytes))
 #define MAX_NODE_BYTES 32000
 #define CFG_CMD_SAVE 1
+//mutations are appended to the journal and folded into the xml once it grows past this
+#ifndef CFG_JOURNAL_MAX_BYTES
+#define CFG_JOURNAL_MAX_BYTES (64*1024)
+#endif
+#define CFG_JOURNAL_MAGIC 0x4a42 //"BJ"
+#define CFG_JOURNAL_SET 1
+#define CFG_JOURNAL_REMOVE 2
+#define CFG_SNAPSHOT_MAGIC 0x53434442 //"BDCS"
+#define CFG_SNAPSHOT_VERSION 2
 
 #ifndef FALSE
 #define TRUE 1
@@ -84,18 +105,65 @@ typedef struct cfg_node_s
     short bytes;
     short type;
     short used;
-    short flag;
+    short hash; //hash of the name, compared before the name itself
 } cfg_node;
 
+//journal record header, followed by the section, key and name strings (with their
+//terminating 0) and the value bytes. name_bytes is 0 when a whole key is removed.
+typedef struct
+{
+    uint16_t magic;
+    uint8_t op;
+    uint8_t reserved;
+    uint16_t type;
+    uint16_t value_bytes;
+    uint16_t section_bytes;
+    uint16_t key_bytes;
+    uint16_t name_bytes;
+    uint16_t reserved2;
+    uint32_t crc; //crc32 of the header, with crc set to 0, and the payload
+} cfg_journal_rec;
+
+//binary snapshot header. The body is each section as a uint16 name size and key
+//count followed by the name, each key the same way with its value count, and each
+//value as uint16 name size, type and value size followed by the name, zero padding
+//up to a 4 byte body offset and the value, so that values can be read in place.
+//The header and all sizes are written little endian, names with their terminating 0.
+#define CFG_SNAPSHOT_HDR_BYTES 16
+typedef struct
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t section_count;
+    uint32_t body_bytes;
+    uint32_t crc; //crc32 of the body
+} cfg_snapshot_hdr;
+
 static pthread_mutex_t slot_lock;
 static int pth = -1; //poll thread handle
 static cfg_node root;
 static int cached_change;
 static int save_cmds_queued;
+//deferred save, and when the oldest change it is holding back was saved (0 if none).
+//The timer is CLOCK_MONOTONIC and polled by the sock thread, so it never takes a
+//wake lock or wakes the device; time spent suspended does not count.
+static int save_timer_fd = -1;
+static uint64_t save_pending_ms;
+static int saves_requested;
+static int saves_performed;
+static int journal_fd = -1;
+static int journal_bytes;
+static int journal_unsynced;
+//the snapshot stays mapped, copy on write, and loaded names and values point into it
+static char* snapshot_map;
+static int snapshot_bytes;
 static void cfg_cmd_callback(int cmd_fd, int type, int flags, uint32_t user_id);
+static void cfg_timer_callback(int fd, int type, int flags, uint32_t user_id);
+static void cfg_post_save();
 static inline short alloc_node(cfg_node* p, short grow);
 static inline void free_node(cfg_node* p);
 static inline short find_inode(const cfg_node* p, const char* name);
+static void index_rebuild(cfg_node* p);
 static cfg_node* find_node(const char* section, const char* key, const char* name);
 static int remove_node(const char* section, const char* key, const char* name);
 static int remove_filter_node(const char* section, const char* filter[], int filter_count, int max_allowed);
@@ -104,6 +172,13 @@ static int set_node(const char* section, const char* key, const char* name,
                         const char* value, short bytes, short type);
 static int save_cfg();
 static void load_cfg();
+static void record_change(int op, const char* section, const char* key, const char* name,
+                          const char* value, int bytes, int type);
+static void journal_load();
+static void journal_sync();
+static void journal_reset();
+static int load_snapshot(const char* file_name);
+static int save_snapshot(const char* file_name);
 static short find_next_node(const cfg_node* p, short start, char* name, int* bytes);
 #ifdef UNIT_TEST
 static void cfg_test_load();
@@ -118,8 +193,8 @@ static inline void dump_node(const char* title, const cfg_node* p)
     if(p) {
         bdld("%s, p->name:%s, child/value:%p, bytes:%d",
                           title, p->name, p->child, p->bytes);
-        bdld("p->used:%d, type:%x, p->flag:%d",
-                          p->used, p->type, p->flag);
+        bdld("p->used:%d, type:%x, p->hash:%x",
+                          p->used, p->type, (unsigned short)p->hash);
     } else bdld("%s is NULL", title);
 }
 
@@ -140,7 +215,11 @@ int btif_config_init()
         root.name = "Bluedroid";
         alloc_node(&root, CFG_GROW_SIZE);
         dump_node("root", &root);
-        pth = btsock_thread_create(NULL, cfg_cmd_callback);
+        pth = btsock_thread_create(cfg_timer_callback, cfg_cmd_callback);
+        save_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if(save_timer_fd < 0)
+            bdle("cannot create the save timer:%s, saving without delay", strerror(errno));
+        else btsock_thread_add_fd(pth, save_timer_fd, 0, SOCK_THREAD_FD_RD, 0);
         load_cfg();
         unlock_slot(&slot_lock);
         #ifdef UNIT_TEST
@@ -230,7 +309,7 @@ int btif_config_set(const char* section, const char* key, const char* name, cons
         lock_slot(&slot_lock);
         ret = set_node(section, key, name, value, (short)bytes, (short)type);
         if(ret && !(type & BTIF_CFG_TYPE_VOLATILE))
-            cached_change++;
+            record_change(CFG_JOURNAL_SET, section, key, name, value, bytes, type);
         unlock_slot(&slot_lock);
     }
     return ret;
@@ -245,7 +324,7 @@ int btif_config_remove(const char* section, const char* key, const char* name)
          lock_slot(&slot_lock);
          ret = remove_node(section, key, name);
          if(ret)
-            cached_change++;
+            record_change(CFG_JOURNAL_REMOVE, section, key, name, NULL, 0, 0);
          unlock_slot(&slot_lock);
     }
     return ret;
@@ -260,9 +339,8 @@ int btif_config_filter_remove(const char* section, const char* filter[], int fil
     if(section && *section && max_allowed > 0)
     {
          lock_slot(&slot_lock);
+         //remove_filter_node records each key it removes
          ret = remove_filter_node(section, filter, filter_count, max_allowed);
-         if(ret)
-            cached_change++;
          unlock_slot(&slot_lock);
     }
     return ret;
@@ -338,32 +416,73 @@ int btif_config_enum(btif_config_enum_callback cb, void* user_data)
     unlock_slot(&slot_lock);
     return TRUE;
 }
+static uint64_t cfg_now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+static inline int need_save()
+{
+    return cached_change > 0 || journal_unsynced || journal_bytes > CFG_JOURNAL_MAX_BYTES;
+}
+static void set_save_timer(uint64_t delay_ms)
+{
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = delay_ms / 1000;
+    its.it_value.tv_nsec = (delay_ms % 1000) * 1000000;
+    if(timerfd_settime(save_timer_fd, 0, &its, NULL) != 0)
+        bdle("cannot set the save timer:%s", strerror(errno));
+}
 int btif_config_save()
 {
-    int post_cmd = 0;
+    int post = FALSE;
+    uint64_t delay = 0;
     lock_slot(&slot_lock);
-    bdld("save_cmds_queued:%d, cached_change:%d", save_cmds_queued, cached_change);
-    if((save_cmds_queued == 0) && (cached_change > 0))
+    saves_requested++;
+    if(need_save())
     {
-        post_cmd = 1;
-        save_cmds_queued++;
-        bdld("post_cmd set to 1, save_cmds_queued:%d", save_cmds_queued);
+        //push the write back with every request, but not past the oldest one's bound
+        uint64_t now = cfg_now_ms();
+        if(!save_pending_ms)
+            save_pending_ms = now;
+        uint64_t deadline = now + BTIF_CONFIG_SAVE_DELAY_MS;
+        if(deadline > save_pending_ms + BTIF_CONFIG_SAVE_MAX_DELAY_MS)
+            deadline = save_pending_ms + BTIF_CONFIG_SAVE_MAX_DELAY_MS;
+        delay = deadline > now ? deadline - now : 0;
+        //a zero timer value disarms it, so a save that is due goes out now
+        if(save_timer_fd >= 0 && delay > 0)
+            set_save_timer(delay);
+        else post = TRUE;
     }
+    bdld("saves requested:%d, performed:%d, delay:%d ms", saves_requested, saves_performed, (int)delay);
     unlock_slot(&slot_lock);
-    /* don't hold lock when invoking send or else a deadlock could
-     * occur when the socket thread tries to do the actual saving.
-     */
-    if (post_cmd)
-        btsock_thread_post_cmd(pth, CFG_CMD_SAVE, NULL, 0, 0);
-
+    if(post)
+        cfg_post_save();
     return TRUE;
 }
 void btif_config_flush()
 {
+    int compact;
+    //whatever the deferred save is holding back gets written here
     lock_slot(&slot_lock);
-    if(cached_change > 0)
-        save_cfg();
+    if(save_timer_fd >= 0)
+        set_save_timer(0);
+    saves_requested++;
+    if(cached_change > 0 || journal_unsynced)
+    {
+        if(cached_change > 0)
+            save_cfg();
+        else journal_sync();
+        saves_performed++;
+    }
+    save_pending_ms = 0;
+    compact = journal_bytes > CFG_JOURNAL_MAX_BYTES;
     unlock_slot(&slot_lock);
+    //the journal is already durable, fold it into the xml in the background
+    if(compact)
+        btif_config_save();
 }
 
 /*******************************************************************************
@@ -406,12 +525,53 @@ BOOLEAN btif_get_address_type(const BD_ADDR bd_addr, int *p_addr_type)
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////
+static inline void free_unmapped(const void* p)
+{
+    //a value of 0 bytes may point just past the end of the snapshot
+    if(!snapshot_map || (const char*)p < snapshot_map || (const char*)p > snapshot_map + snapshot_bytes)
+        free((void*)p);
+}
+static inline uint32_t name_hash(const char* name)
+{
+    uint32_t h = 2166136261u; //fnv-1a
+    while(*name)
+        h = (h ^ (uint8_t)*name++) * 16777619u;
+    return h;
+}
+static inline int index_size(int count)
+{
+    int size = 8;
+    while(size < 2 * count)
+        size <<= 1;
+    return size;
+}
+static void index_insert(cfg_node* p, short i)
+{
+    short* index = GET_INDEX(p);
+    int mask = GET_INDEX_SIZE(p->bytes) - 1;
+    int slot = (unsigned short)p->child[i].hash & mask;
+    while(index[slot])
+        slot = (slot + 1) & mask;
+    index[slot] = i + 1;
+}
+static void index_rebuild(cfg_node* p)
+{
+    int i;
+    if(!p->child)
+        return;
+    memset(GET_INDEX(p), 0, GET_INDEX_SIZE(p->bytes) * sizeof(short));
+    for(i = 0; i < GET_CHILD_COUNT(p); i++)
+    {
+        if(p->child[i].name)
+            index_insert(p, (short)i);
+    }
+}
 static inline short alloc_node(cfg_node* p, short grow)
 {
     int new_bytes = p->bytes + grow;
     if(grow > 0 && new_bytes < MAX_NODE_BYTES)
     {
-        char* value = (char*)realloc(p->value, new_bytes);
+        char* value = (char*)realloc(p->value, new_bytes + GET_INDEX_SIZE(new_bytes) * sizeof(short));
         if(value)
         {
             short old_bytes = p->bytes;
@@ -419,6 +579,8 @@ static inline short alloc_node(cfg_node* p, short grow)
             memset(value + old_bytes, 0, grow);
             p->bytes = old_bytes + grow;
             p->value = value;
+            //positions are unchanged but the index is resized with the children
+            index_rebuild(p);
             return old_bytes;//return the previous size
         }
         else bdle("realloc failed, old_bytes:%d, grow:%d, total:%d", p->bytes, grow,  p->bytes + grow);
@@ -431,31 +593,31 @@ static inline void free_node(cfg_node* p)
     {
         if(p->child)
         {
-            free(p->child);
+            free_unmapped(p->child);
             p->child = NULL;
         }
         if(p->name)
         {
-            free((void*)p->name);
+            free_unmapped(p->name);
             p->name = 0;
         }
-        p->used = p->bytes = p->flag = p->type = 0;
+        p->used = p->bytes = p->hash = p->type = 0;
     }
 }
 static inline short find_inode(const cfg_node* p, const char* name)
 {
     if(p && p->child && name && *name)
     {
-        int i;
-        int count = GET_CHILD_COUNT(p);
-        //bdld("parent name:%s, child name:%s, child count:%d", p->name, name, count);
-        for(i = 0; i < count; i++)
+        const short* index = GET_INDEX(p);
+        int mask = GET_INDEX_SIZE(p->bytes) - 1;
+        short hash = (short)name_hash(name);
+        int slot = (unsigned short)hash & mask;
+        //bdld("parent name:%s, child name:%s, child count:%d", p->name, name, GET_CHILD_COUNT(p));
+        for(; index[slot]; slot = (slot + 1) & mask)
         {
-            if(p->child[i].name && *p->child[i].name &&
-                strcmp(p->child[i].name, name) == 0)
-            {
-                  return (short)i;
-            }
+            const cfg_node* child = &p->child[index[slot] - 1];
+            if(child->hash == hash && child->name && strcmp(child->name, name) == 0)
+                  return (short)(index[slot] - 1);
         }
     }
     return -1;
@@ -489,7 +651,11 @@ static cfg_node* find_add_node(cfg_node* p, const char* name)
     }
     else node = &p->child[i];
     if(node && (!node->name))
+    {
         node->name = strdup(name);
+        node->hash = (short)name_hash(name);
+        index_insert(p, (short)(node - p->child));
+    }
     return node;
 }
 static int set_node(const char* section, const char* key, const char* name,
@@ -508,7 +674,7 @@ static int set_node(const char* section, const char* key, const char* name,
                 if(value_node->bytes < bytes)
                 {
                     if(value_node->value)
-                        free(value_node->value);
+                        free_unmapped(value_node->value);
                     value_node->value = (char*)malloc(bytes);
                     if(value_node->value)
                         value_node->bytes = bytes;
@@ -605,11 +771,13 @@ static void free_child(cfg_node* p, int ichild, int count)
     if(i < child_count)
     {
         int mv_count = child_count - i;
+        int rm_count = i - ichild;
         memmove(p->child + ichild, p->child + i, GET_NODE_BYTES(mv_count));
-        //cleanup the buffer of already moved children
-        memset(p->child + i, 0, GET_NODE_BYTES(mv_count));
+        //cleanup the buffer of already moved children, the tail they left behind
+        memset(p->child + ichild + mv_count, 0, GET_NODE_BYTES(rm_count));
     }
     DEC_CHILD_COUNT(p, i - ichild);
+    index_rebuild(p);
 }
 static int remove_node(const char* section, const char* key, const char* name)
 {
@@ -719,6 +887,8 @@ static int remove_filter_node(const char* section, const char* filter[], int fil
     {
         if(!value_in_filter(&s->child[i], filter, filter_count))
         {
+            if(s->child[i].name)
+                record_change(CFG_JOURNAL_REMOVE, section, s->child[i].name, NULL, NULL, 0, 0);
             free_child(&s->child[i], 0, GET_CHILD_COUNT(&s->child[i]));
             free_node(&s->child[i]);
             rm_count++;
@@ -730,33 +900,514 @@ static int remove_filter_node(const char* section, const char* filter[], int fil
     {
         pack_child(s);
         DEC_CHILD_COUNT(s, rm_count);
+        index_rebuild(s);
         return TRUE;
     }
     return FALSE;
 }
 
+static void sync_cfg_dir()
+{
+    int fd = open(CFG_PATH, O_RDONLY | O_DIRECTORY);
+    if(fd >= 0)
+    {
+        if(fsync(fd) != 0)
+            bdle("cannot sync %s:%s", CFG_PATH, strerror(errno));
+        close(fd);
+    }
+}
 static int save_cfg()
 {
     const char* file_name = CFG_PATH CFG_FILE_NAME CFG_FILE_EXT;
     const char* file_name_new = CFG_PATH CFG_FILE_NAME CFG_FILE_EXT_NEW;
     const char* file_name_old = CFG_PATH CFG_FILE_NAME CFG_FILE_EXT_OLD;
+    const char* snapshot_name = CFG_PATH CFG_FILE_NAME CFG_FILE_EXT_SNAPSHOT;
+    const char* snapshot_name_new = CFG_PATH CFG_FILE_NAME CFG_FILE_EXT_SNAPSHOT_NEW;
     int ret = FALSE;
     if(access(file_name_old,  F_OK) == 0)
         unlink(file_name_old);
     if(access(file_name_new, F_OK) == 0)
         unlink(file_name_new);
+    //the xml is still written for migration and as the fallback if the snapshot is lost
+    int snapshot_saved = save_snapshot(snapshot_name_new);
    if(btif_config_save_file(file_name_new))
     {
         cached_change = 0;
         chown(file_name_new, -1, AID_NET_BT_STACK);
         chmod(file_name_new, 0660);
+        //the new xml has to be on disk before the journal it replaces is dropped
+        int fd = open(file_name_new, O_RDONLY);
+        if(fd >= 0)
+        {
+            fsync(fd);
+            close(fd);
+        }
+        //never leave a snapshot older than the xml, load_cfg would prefer it, so the
+        //old one is gone for good before the new xml goes in
+        unlink(snapshot_name);
+        sync_cfg_dir();
         rename(file_name, file_name_old);
         rename(file_name_new, file_name);
+        if(snapshot_saved)
+            rename(snapshot_name_new, snapshot_name);
+        //the renames have to be on disk too, or a crash can bring back the old xml
+        //without the journal that was replayed on top of it
+        sync_cfg_dir();
+        journal_reset();
         ret = TRUE;
     }
     else bdle("btif_config_save_file failed");
+    unlink(snapshot_name_new);
+    return ret;
+}
+
+static uint32_t journal_crc(uint32_t crc, const void* data, int bytes)
+{
+    static uint32_t table[256];
+    const uint8_t* p = (const uint8_t*)data;
+    uint32_t i, j, c;
+    if(!table[1])
+    {
+        for(i = 0; i < 256; i++)
+        {
+            for(c = i, j = 0; j < 8; j++)
+                c = (c >> 1) ^ (0xedb88320 & -(c & 1));
+            table[i] = c;
+        }
+    }
+    crc = ~crc;
+    while(bytes-- > 0)
+        crc = (crc >> 8) ^ table[(crc ^ *p++) & 0xff];
+    return ~crc;
+}
+static int journal_append(int op, const char* section, const char* key, const char* name,
+                          const char* value, int bytes, int type)
+{
+    cfg_journal_rec rec;
+    struct iovec iov[5];
+    int section_bytes = strlen(section) + 1;
+    int key_bytes = strlen(key) + 1;
+    int name_bytes = name ? strlen(name) + 1 : 0;
+    int i, total = sizeof(rec);
+    if(journal_fd < 0)
+        return FALSE;
+    if(section_bytes >= MAX_NODE_BYTES || key_bytes >= MAX_NODE_BYTES ||
+       name_bytes >= MAX_NODE_BYTES || bytes < 0 || bytes >= MAX_NODE_BYTES)
+        return FALSE;
+    if(value == NULL)
+        bytes = 0;
+    memset(&rec, 0, sizeof(rec));
+    rec.magic = CFG_JOURNAL_MAGIC;
+    rec.op = (uint8_t)op;
+    rec.type = (uint16_t)type;
+    rec.value_bytes = (uint16_t)bytes;
+    rec.section_bytes = (uint16_t)section_bytes;
+    rec.key_bytes = (uint16_t)key_bytes;
+    rec.name_bytes = (uint16_t)name_bytes;
+    iov[0].iov_base = &rec;
+    iov[0].iov_len = sizeof(rec);
+    iov[1].iov_base = (void*)section;
+    iov[1].iov_len = section_bytes;
+    iov[2].iov_base = (void*)key;
+    iov[2].iov_len = key_bytes;
+    iov[3].iov_base = (void*)name;
+    iov[3].iov_len = name_bytes;
+    iov[4].iov_base = (void*)value;
+    iov[4].iov_len = bytes;
+    rec.crc = journal_crc(0, &rec, sizeof(rec));
+    for(i = 1; i < 5; i++)
+    {
+        rec.crc = journal_crc(rec.crc, iov[i].iov_base, iov[i].iov_len);
+        total += iov[i].iov_len;
+    }
+    //a record is one writev on an O_APPEND fd; a partial one is cut off again
+    if(writev(journal_fd, iov, 5) != total)
+    {
+        bdle("journal write failed:%s, fall back to saving the xml", strerror(errno));
+        if(ftruncate(journal_fd, journal_bytes) != 0)
+        {
+            close(journal_fd);
+            journal_fd = -1;
+        }
+        return FALSE;
+    }
+    journal_bytes += total;
+    journal_unsynced = TRUE;
+    return TRUE;
+}
+static void record_change(int op, const char* section, const char* key, const char* name,
+                          const char* value, int bytes, int type)
+{
+    if(!journal_append(op, section, key, name, value, bytes, type))
+        cached_change++;
+}
+static void journal_sync()
+{
+    if(journal_fd >= 0 && journal_unsynced)
+    {
+        if(fdatasync(journal_fd) == 0)
+            journal_unsynced = FALSE;
+        else bdle("journal sync failed:%s", strerror(errno));
+    }
+}
+static void journal_reset()
+{
+    if(journal_fd < 0)
+    {
+        //not appending, but whatever is on disk is now older than the xml
+        truncate(CFG_PATH CFG_FILE_NAME CFG_FILE_EXT_JOURNAL, 0);
+    }
+    else if(ftruncate(journal_fd, 0) != 0)
+    {
+        bdle("journal truncate failed:%s", strerror(errno));
+        close(journal_fd);
+        journal_fd = -1;
+    }
+    journal_bytes = 0;
+    journal_unsynced = FALSE;
+}
+static int replay_record(const char* rec_data, int bytes)
+{
+    cfg_journal_rec rec;
+    uint32_t crc;
+    if(bytes < (int)sizeof(rec))
+        return 0;
+    memcpy(&rec, rec_data, sizeof(rec));
+    int total = sizeof(rec) + rec.section_bytes + rec.key_bytes + rec.name_bytes + rec.value_bytes;
+    if(rec.magic != CFG_JOURNAL_MAGIC || total > bytes)
+        return 0;
+    crc = rec.crc;
+    rec.crc = 0;
+    if(journal_crc(journal_crc(0, &rec, sizeof(rec)), rec_data + sizeof(rec), total - sizeof(rec)) != crc)
+        return 0;
+    const char* section = rec_data + sizeof(rec);
+    const char* key = section + rec.section_bytes;
+    const char* name = key + rec.key_bytes;
+    const char* value = name + rec.name_bytes;
+    if(rec.section_bytes < 2 || section[rec.section_bytes - 1] ||
+       rec.key_bytes < 2 || key[rec.key_bytes - 1] ||
+       (rec.name_bytes && (rec.name_bytes < 2 || name[rec.name_bytes - 1])))
+        return 0;
+    if(rec.op == CFG_JOURNAL_SET && rec.name_bytes)
+        set_node(section, key, name, value, (short)rec.value_bytes, (short)rec.type);
+    else if(rec.op == CFG_JOURNAL_REMOVE)
+        remove_node(section, key, rec.name_bytes ? name : NULL);
+    else return 0;
+    return total;
+}
+/*
+ * Replays the journal on top of the loaded xml and keeps it open for appending.
+ * Records are sets and removes of whole values or keys, so replaying a journal
+ * that already made it into the xml (a crash between the rename and the
+ * truncate in save_cfg) gives the same tree.
+ */
+static void journal_load()
+{
+    const char* file_name = CFG_PATH CFG_FILE_NAME CFG_FILE_EXT_JOURNAL;
+    struct stat st;
+    char* data = NULL;
+    int size = 0, pos = 0, count = 0, rec_bytes;
+    journal_fd = open(file_name, O_RDWR | O_APPEND | O_CREAT, 0660);
+    if(journal_fd < 0)
+    {
+        bdle("cannot open %s:%s, changes are saved to the xml only", file_name, strerror(errno));
+        return;
+    }
+    fchown(journal_fd, -1, AID_NET_BT_STACK);
+    if(fstat(journal_fd, &st) == 0)
+        size = (int)st.st_size;
+    if(size > 0 && ((data = (char*)malloc(size)) == NULL || pread(journal_fd, data, size, 0) != size))
+    {
+        //leave it alone, the next save of the xml supersedes it
+        bdle("cannot read %s, %d bytes, changes are saved to the xml only", file_name, size);
+        free(data);
+        close(journal_fd);
+        journal_fd = -1;
+        return;
+    }
+    while(pos < size && (rec_bytes = replay_record(data + pos, size - pos)) > 0)
+    {
+        pos += rec_bytes;
+        count++;
+    }
+    free(data);
+    if(pos < size)
+    {
+        //a torn or corrupt tail, most likely from losing power in the middle of a write
+        bdle("dropping %d bytes at the end of %s", size - pos, file_name);
+        ftruncate(journal_fd, pos);
+    }
+    journal_bytes = pos;
+    bdld("replayed %d records, %d bytes from %s", count, pos, file_name);
+}
+
+static inline char* put_u16(char* p, int v)
+{
+    p[0] = (char)(v & 0xff);
+    p[1] = (char)((v >> 8) & 0xff);
+    return p + 2;
+}
+static inline int get_u16(const char* p)
+{
+    return (uint8_t)p[0] | ((uint8_t)p[1] << 8);
+}
+static inline char* put_u32(char* p, uint32_t v)
+{
+    p = put_u16(p, (int)(v & 0xffff));
+    return put_u16(p, (int)(v >> 16));
+}
+static inline uint32_t get_u32(const char* p)
+{
+    return (uint32_t)get_u16(p) | ((uint32_t)get_u16(p + 2) << 16);
+}
+//bytes of padding that bring a body offset to the 4 byte alignment of a value
+static inline int value_pad(int offset)
+{
+    return -offset & 3;
+}
+static inline int is_saved(const cfg_node* value_node)
+{
+    return value_node->name && !(value_node->type & BTIF_CFG_TYPE_VOLATILE);
+}
+/*
+ * Walks the tree twice, once to size the body and once to fill it, so that the
+ * whole snapshot goes out in one write.
+ */
+static int build_snapshot(char* body, uint16_t* section_count)
+{
+    int si, ki, vi, bytes = 0, sections = 0;
+    for(si = 0; si < GET_CHILD_COUNT(&root); si++)
+    {
+        const cfg_node* section_node = &root.child[si];
+        if(!section_node->name)
+            continue;
+        int section_bytes = strlen(section_node->name) + 1;
+        if(body)
+        {
+            char* p = put_u16(body + bytes, section_bytes);
+            put_u16(p, GET_CHILD_COUNT(section_node));
+            memcpy(p + 2, section_node->name, section_bytes);
+        }
+        bytes += 4 + section_bytes;
+        sections++;
+        for(ki = 0; ki < GET_CHILD_COUNT(section_node); ki++)
+        {
+            const cfg_node* key_node = &section_node->child[ki];
+            int key_bytes = key_node->name ? strlen(key_node->name) + 1 : 1;
+            int values = 0;
+            for(vi = 0; vi < GET_CHILD_COUNT(key_node); vi++)
+                values += is_saved(&key_node->child[vi]);
+            //keep the position of unnamed keys so that the counts stay right
+            if(body)
+            {
+                char* p = put_u16(body + bytes, key_bytes);
+                put_u16(p, values);
+                memcpy(p + 2, key_node->name ? key_node->name : "", key_bytes);
+            }
+            bytes += 4 + key_bytes;
+            for(vi = 0; vi < GET_CHILD_COUNT(key_node); vi++)
+            {
+                const cfg_node* value_node = &key_node->child[vi];
+                if(!is_saved(value_node))
+                    continue;
+                int name_bytes = strlen(value_node->name) + 1;
+                int pad = value_pad(bytes + 6 + name_bytes);
+                if(body)
+                {
+                    char* p = put_u16(body + bytes, name_bytes);
+                    p = put_u16(p, (uint16_t)value_node->type);
+                    p = put_u16(p, value_node->used);
+                    memcpy(p, value_node->name, name_bytes);
+                    memset(p + name_bytes, 0, pad);
+                    if(value_node->used > 0)
+                        memcpy(p + name_bytes + pad, value_node->value, value_node->used);
+                }
+                bytes += 6 + name_bytes + pad + value_node->used;
+            }
+        }
+    }
+    *section_count = (uint16_t)sections;
+    return bytes;
+}
+static int save_snapshot(const char* file_name)
+{
+    cfg_snapshot_hdr hdr;
+    int fd, ret = FALSE;
+    memset(&hdr, 0, sizeof(hdr));
+    int body_bytes = build_snapshot(NULL, &hdr.section_count);
+    char* data = (char*)malloc(CFG_SNAPSHOT_HDR_BYTES + body_bytes);
+    if(!data)
+    {
+        bdle("no memory for a %d bytes snapshot", body_bytes);
+        return FALSE;
+    }
+    build_snapshot(data + CFG_SNAPSHOT_HDR_BYTES, &hdr.section_count);
+    hdr.magic = CFG_SNAPSHOT_MAGIC;
+    hdr.version = CFG_SNAPSHOT_VERSION;
+    hdr.body_bytes = body_bytes;
+    hdr.crc = journal_crc(0, data + CFG_SNAPSHOT_HDR_BYTES, body_bytes);
+    char* p = put_u32(data, hdr.magic);
+    p = put_u16(p, hdr.version);
+    p = put_u16(p, hdr.section_count);
+    p = put_u32(p, hdr.body_bytes);
+    put_u32(p, hdr.crc);
+    fd = open(file_name, O_WRONLY | O_CREAT | O_TRUNC, 0660);
+    if(fd >= 0)
+    {
+        fchown(fd, -1, AID_NET_BT_STACK);
+        fchmod(fd, 0660);
+        if(write(fd, data, CFG_SNAPSHOT_HDR_BYTES + body_bytes) == CFG_SNAPSHOT_HDR_BYTES + body_bytes &&
+           fsync(fd) == 0)
+            ret = TRUE;
+        close(fd);
+    }
+    if(!ret)
+        bdle("cannot write %s:%s", file_name, strerror(errno));
+    free(data);
     return ret;
 }
+static cfg_node* add_mapped_node(cfg_node* p, const char* name, int children)
+{
+    cfg_node* node = find_free_node(p);
+    if(!node)
+    {
+        int old_size = alloc_node(p, CFG_GROW_SIZE);
+        if(old_size < 0)
+            return NULL;
+        node = &p->child[GET_NODE_COUNT(old_size)];
+    }
+    ADD_CHILD_COUNT(p, 1);
+    node->name = name;
+    node->hash = (short)name_hash(name);
+    index_insert(p, (short)(node - p->child));
+    //size the children once instead of growing them ten at a time
+    if(children > 0 && alloc_node(node, GET_NODE_BYTES(children)) < 0)
+        return NULL;
+    return node;
+}
+/*
+ * Checks the snapshot body and, when build is set, links its names and values
+ * into the tree in place. Only the child arrays are allocated.
+ */
+static int parse_snapshot(char* body, int bytes, int section_count, int build)
+{
+    char* p = body;
+    char* end = body + bytes;
+    int si, ki, vi;
+    for(si = 0; si < section_count; si++)
+    {
+        if(end - p < 4)
+            return FALSE;
+        int name_bytes = get_u16(p);
+        int key_count = get_u16(p + 2);
+        char* section = p + 4;
+        if(name_bytes < 2 || end - section < name_bytes || section[name_bytes - 1] ||
+           GET_NODE_BYTES(key_count) >= MAX_NODE_BYTES)
+            return FALSE;
+        p = section + name_bytes;
+        cfg_node* section_node = NULL;
+        if(build && !(section_node = add_mapped_node(&root, section, key_count)))
+            return FALSE;
+        for(ki = 0; ki < key_count; ki++)
+        {
+            if(end - p < 4)
+                return FALSE;
+            name_bytes = get_u16(p);
+            int value_count = get_u16(p + 2);
+            char* key = p + 4;
+            if(name_bytes < 1 || end - key < name_bytes || key[name_bytes - 1] ||
+               GET_NODE_BYTES(value_count) >= MAX_NODE_BYTES)
+                return FALSE;
+            p = key + name_bytes;
+            cfg_node* key_node = NULL;
+            if(build && *key && !(key_node = add_mapped_node(section_node, key, value_count)))
+                return FALSE;
+            for(vi = 0; vi < value_count; vi++)
+            {
+                if(end - p < 6)
+                    return FALSE;
+                name_bytes = get_u16(p);
+                int type = get_u16(p + 2);
+                int value_bytes = get_u16(p + 4);
+                char* name = p + 6;
+                int pad = value_pad(name + name_bytes - body);
+                if(name_bytes < 2 || value_bytes >= MAX_NODE_BYTES ||
+                   end - name < name_bytes + pad + value_bytes || name[name_bytes - 1])
+                    return FALSE;
+                p = name + name_bytes + pad + value_bytes;
+                if(key_node)
+                {
+                    cfg_node* value_node = add_mapped_node(key_node, name, 0);
+                    if(!value_node)
+                        return FALSE;
+                    value_node->value = name + name_bytes + pad;
+                    value_node->bytes = value_node->used = (short)value_bytes;
+                    value_node->type = (short)type;
+                }
+            }
+        }
+    }
+    return p == end;
+}
+static int load_snapshot(const char* file_name)
+{
+    cfg_snapshot_hdr hdr;
+    struct stat st;
+    char* map;
+    int fd = open(file_name, O_RDONLY);
+    if(fd < 0)
+        return FALSE;
+    if(fstat(fd, &st) != 0 || st.st_size < CFG_SNAPSHOT_HDR_BYTES)
+    {
+        close(fd);
+        return FALSE;
+    }
+    map = (char*)mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+    {
+        bdle("cannot map %s:%s", file_name, strerror(errno));
+        return FALSE;
+    }
+    hdr.magic = get_u32(map);
+    hdr.version = (uint16_t)get_u16(map + 4);
+    hdr.section_count = (uint16_t)get_u16(map + 6);
+    hdr.body_bytes = get_u32(map + 8);
+    hdr.crc = get_u32(map + 12);
+    //the mapping is page aligned, so a 4 byte body offset is a 4 byte address
+    char* body = map + CFG_SNAPSHOT_HDR_BYTES;
+    if(hdr.magic != CFG_SNAPSHOT_MAGIC || hdr.version != CFG_SNAPSHOT_VERSION ||
+       hdr.body_bytes != st.st_size - CFG_SNAPSHOT_HDR_BYTES ||
+       journal_crc(0, body, hdr.body_bytes) != hdr.crc ||
+       !parse_snapshot(body, hdr.body_bytes, hdr.section_count, FALSE))
+    {
+        bdle("%s is corrupt, falling back to the xml", file_name);
+        munmap(map, st.st_size);
+        return FALSE;
+    }
+    snapshot_map = map;
+    snapshot_bytes = st.st_size;
+    if(!parse_snapshot(body, hdr.body_bytes, hdr.section_count, TRUE))
+    {
+        //out of memory, drop the partial tree before it loses its mapping
+        bdle("cannot build the tree from %s", file_name);
+        int si, ki;
+        for(si = 0; si < GET_CHILD_COUNT(&root); si++)
+        {
+            cfg_node* section_node = &root.child[si];
+            for(ki = 0; ki < GET_CHILD_COUNT(section_node); ki++)
+                free_child(&section_node->child[ki], 0, GET_CHILD_COUNT(&section_node->child[ki]));
+            free_child(section_node, 0, GET_CHILD_COUNT(section_node));
+        }
+        free_child(&root, 0, GET_CHILD_COUNT(&root));
+        munmap(map, st.st_size);
+        snapshot_map = NULL;
+        snapshot_bytes = 0;
+        return FALSE;
+    }
+    bdld("loaded %d sections, %d bytes from %s", hdr.section_count, (int)st.st_size, file_name);
+    return TRUE;
+}
 
 static int load_bluez_cfg()
 {
@@ -816,7 +1467,14 @@ static void load_cfg()
     const char* file_name = CFG_PATH CFG_FILE_NAME CFG_FILE_EXT;
     const char* file_name_new = CFG_PATH CFG_FILE_NAME CFG_FILE_EXT_NEW;
     const char* file_name_old = CFG_PATH CFG_FILE_NAME CFG_FILE_EXT_OLD;
-    if(!btif_config_load_file(file_name))
+    if(load_snapshot(CFG_PATH CFG_FILE_NAME CFG_FILE_EXT_SNAPSHOT))
+        cached_change = 0;
+    else if(btif_config_load_file(file_name))
+    {
+        //the snapshot is missing or bad, the next save writes it from the xml tree
+        cached_change = 1;
+    }
+    else
     {
         unlink(file_name);
         if(!btif_config_load_file(file_name_old))
@@ -826,6 +1484,7 @@ static void load_cfg()
                 remove_bluez_cfg();
         }
     }
+    journal_load();
     int bluez_migration_done = 0;
     btif_config_get_int("Local", "Adapter", "BluezMigrationDone", &bluez_migration_done);
     if(!bluez_migration_done)
@@ -836,6 +1495,36 @@ static void load_cfg()
         btif_config_save();
     }
 }
+static void cfg_post_save()
+{
+    int post_cmd = FALSE;
+    lock_slot(&slot_lock);
+    if(save_cmds_queued == 0)
+    {
+        post_cmd = TRUE;
+        save_cmds_queued++;
+    }
+    unlock_slot(&slot_lock);
+    //the write itself runs on the sock thread, as it always has
+    if(post_cmd)
+        btsock_thread_post_cmd(pth, CFG_CMD_SAVE, NULL, 0, 0);
+}
+//called with slot_lock held
+static void deferred_save()
+{
+    //a flush may have written everything since the save was scheduled
+    if(need_save())
+    {
+        journal_sync();
+        bdld("writing the bt_config.xml now, cached change:%d, journal bytes:%d",
+             cached_change, journal_bytes);
+        if(cached_change > 0 || journal_bytes > CFG_JOURNAL_MAX_BYTES)
+            save_cfg();
+        saves_performed++;
+    }
+    save_pending_ms = 0;
+    bdld("saves requested:%d, performed:%d", saves_requested, saves_performed);
+}
 static void cfg_cmd_callback(int cmd_fd, int type, int size, uint32_t user_id)
 {
     UNUSED(cmd_fd);
@@ -846,37 +1535,30 @@ static void cfg_cmd_callback(int cmd_fd, int type, int size, uint32_t user_id)
     {
         case CFG_CMD_SAVE:
         {
-            int i;
-            int last_cached_change;
-
-            // grab lock while accessing cached_change.
             lock_slot(&slot_lock);
             bdla(save_cmds_queued > 0);
             save_cmds_queued--;
-            last_cached_change = cached_change;
-            //hold the file saving until no more change in last 3 seconds.
-            bdld("wait until no more changes in short time, cached change:%d", cached_change);
-            for(i = 0; i < 100; i ++) //5 minutes max waiting
-            {
-                // don't sleep if there is nothing to do
-                if(cached_change == 0)
-                    break;
-                // release lock during sleep
-                unlock_slot(&slot_lock);
-                sleep(3);
-                lock_slot(&slot_lock);
-                if(last_cached_change == cached_change)
-                    break;
-                last_cached_change = cached_change;
-            }
-            bdld("writing the bt_config.xml now, cached change:%d", cached_change);
-            if(cached_change > 0)
-                save_cfg();
+            deferred_save();
             unlock_slot(&slot_lock);
             break;
         }
     }
 }
+static void cfg_timer_callback(int fd, int type, int flags, uint32_t user_id)
+{
+    UNUSED(type);
+    UNUSED(user_id);
+    uint64_t expirations;
+    if(fd != save_timer_fd)
+        return;
+    //the sock thread stops polling an fd once it fired, watch it again
+    read(fd, &expirations, sizeof(expirations));
+    if(!(flags & SOCK_THREAD_FD_EXCEPTION))
+        btsock_thread_add_fd(pth, fd, 0, SOCK_THREAD_FD_RD | SOCK_THREAD_ADD_FD_SYNC, 0);
+    lock_slot(&slot_lock);
+    deferred_save();
+    unlock_slot(&slot_lock);
+}
 #ifdef UNIT_TEST
 static void cfg_test_load()
 {
@@ -27,6 +27,8 @@
  ***********************************************************************************/
 
 #include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
 #include <hardware/bluetooth.h>
 #include <string.h>
 #include <sys/types.h>
@@ -69,6 +71,9 @@
 
 #define BTIF_TASK_STR        ((INT8 *) "BTIF")
 
+/* Number of (callback, event) pairs tracked by the context switch counters */
+#define BTIF_CONTEXT_STATS_MAX  64
+
 /************************************************************************************
 **  Local type definitions
 ************************************************************************************/
@@ -95,6 +100,40 @@ typedef union {
   btif_storage_write_t write_req;
 } btif_storage_req_t;
 
+/* A pre-allocated context switch slot. Small events are copied into |param|;
+*  large or deep-copied events carry a GKI message in |p_buf| instead. */
+typedef struct {
+    tBTIF_CBACK                *p_cb;
+    tBTIF_CONTEXT_SWITCH_CBACK *p_buf;
+    UINT16                     event;
+    union {
+        UINT64  align;
+        void    *p_align;
+        char    data[BTIF_CONTEXT_SLOT_PARAM_SIZE];
+    } param;
+} btif_context_slot_t;
+
+typedef struct {
+    tBTIF_CBACK *p_cb;
+    UINT16      event;
+    UINT32      fast;
+    UINT32      fallback;
+} btif_context_stats_t;
+
+/* Context switch ring consumed by btif_task. Messages posted while the ring
+*  is full go to |overflow|, and further posts follow them there until the
+*  overflow drains, so events are always delivered in the order posted. */
+typedef struct {
+    btif_context_slot_t  slot[BTIF_CONTEXT_RING_SLOTS];
+    UINT16               head;
+    UINT16               count;
+    BUFFER_Q             overflow;
+    UINT16               max_depth;
+    UINT32               overflowed;
+    btif_context_stats_t stats[BTIF_CONTEXT_STATS_MAX];
+    UINT32               untracked;
+} btif_context_ring_t;
+
 typedef enum {
     BTIF_CORE_STATE_DISABLED = 0,
     BTIF_CORE_STATE_INITIALIZED,
@@ -127,14 +166,18 @@ static int btif_pending_mode = BT_SCAN_MODE_NONE;
 */
 static UINT8 btif_dut_mode = 0;
 
+static pthread_mutex_t btif_context_lock = PTHREAD_MUTEX_INITIALIZER;
+static btif_context_ring_t btif_context_ring;
+
 /************************************************************************************
 **  Static functions
 ************************************************************************************/
 static bt_status_t btif_associate_evt(void);
 static bt_status_t btif_disassociate_evt(void);
 
-/* sends message to btif task */
-static void btif_sendmsg(void *p_msg);
+static void btif_context_ring_init(void);
+static void btif_context_ring_release(void);
+static void btif_context_ring_drain(void);
 
 /************************************************************************************
 **  Externs
@@ -192,6 +235,86 @@ static void btif_context_switched(void *p_msg)
 }
 
 
+/*******************************************************************************
+**
+** Function         btif_context_count
+**
+** Description      Counts a context switch of (p_cb, event) on the fast slot
+**                  path or on the GKI fallback path. Called with
+**                  btif_context_lock held.
+**
+** Returns          void
+**
+*******************************************************************************/
+
+static void btif_context_count(tBTIF_CBACK *p_cb, UINT16 event, BOOLEAN fast)
+{
+    btif_context_stats_t *p_stats;
+    UINT32 i, idx;
+
+    idx = (((UINT32)(uintptr_t)p_cb >> 2) ^ (event * 31u)) % BTIF_CONTEXT_STATS_MAX;
+
+    for (i = 0; i < BTIF_CONTEXT_STATS_MAX; i++)
+    {
+        p_stats = &btif_context_ring.stats[(idx + i) % BTIF_CONTEXT_STATS_MAX];
+
+        if (p_stats->p_cb == NULL)
+        {
+            p_stats->p_cb = p_cb;
+            p_stats->event = event;
+        }
+
+        if (p_stats->p_cb == p_cb && p_stats->event == event)
+        {
+            if (fast)
+                p_stats->fast++;
+            else
+                p_stats->fallback++;
+            return;
+        }
+    }
+
+    btif_context_ring.untracked++;
+}
+
+/*******************************************************************************
+**
+** Function         btif_context_alloc_msg
+**
+** Description      Builds a GKI context switch message, the path taken for
+**                  events that do not fit in a ring slot
+**
+** Returns          the message, NULL if no buffer is available
+**
+*******************************************************************************/
+
+static tBTIF_CONTEXT_SWITCH_CBACK *btif_context_alloc_msg(tBTIF_CBACK *p_cback, UINT16 event,
+                                                          char* p_params, int param_len,
+                                                          tBTIF_COPY_CBACK *p_copy_cback)
+{
+    tBTIF_CONTEXT_SWITCH_CBACK *p_msg;
+
+    if ((p_msg = (tBTIF_CONTEXT_SWITCH_CBACK *) GKI_getbuf(sizeof(tBTIF_CONTEXT_SWITCH_CBACK) + param_len)) == NULL)
+        return NULL;
+
+    p_msg->hdr.event = BT_EVT_CONTEXT_SWITCH_EVT; /* internal event */
+    p_msg->p_cb = p_cback;
+
+    p_msg->event = event;                         /* callback event */
+
+    /* check if caller has provided a copy callback to do the deep copy */
+    if (p_copy_cback)
+    {
+        p_copy_cback(event, p_msg->p_param, p_params);
+    }
+    else if (p_params)
+    {
+        memcpy(p_msg->p_param, p_params, param_len);  /* callback parameter data */
+    }
+
+    return p_msg;
+}
+
 /*******************************************************************************
 **
 ** Function         btif_transfer_context
@@ -204,13 +327,21 @@ static void btif_context_switched(void *p_msg)
 **                  param_len : length of parameter area
 **                  p_copy_cback : If set this function will be invoked for deep copy
 **
+**                  Events up to BTIF_CONTEXT_SLOT_PARAM_SIZE bytes without a
+**                  copy callback are copied into a pre-allocated ring slot;
+**                  anything else, or any event posted while the ring is full,
+**                  is carried in a GKI buffer as before.
+**
 ** Returns          void
 **
 *******************************************************************************/
 
 bt_status_t btif_transfer_context (tBTIF_CBACK *p_cback, UINT16 event, char* p_params, int param_len, tBTIF_COPY_CBACK *p_copy_cback)
 {
-    tBTIF_CONTEXT_SWITCH_CBACK *p_msg;
+    tBTIF_CONTEXT_SWITCH_CBACK *p_msg = NULL;
+    btif_context_slot_t *p_slot;
+    BOOLEAN was_idle, has_slot;
+    UINT16 depth;
 
     BTIF_TRACE_VERBOSE("btif_transfer_context event %d, len %d", event, param_len);
 
@@ -219,32 +350,215 @@ bt_status_t btif_transfer_context (tBTIF_CBACK *p_cback, UINT16 event, char* p_p
         BTIF_TRACE_WARNING("btif_transfer_context: BT-IF thread already exited");
         return BT_STATUS_FAIL;
     }
-    /* allocate and send message that will be executed in btif context */
-    if ((p_msg = (tBTIF_CONTEXT_SWITCH_CBACK *) GKI_getbuf(sizeof(tBTIF_CONTEXT_SWITCH_CBACK) + param_len)) != NULL)
+
+    /* do the deep copy outside of the ring lock */
+    if (p_copy_cback || param_len > BTIF_CONTEXT_SLOT_PARAM_SIZE)
     {
-        p_msg->hdr.event = BT_EVT_CONTEXT_SWITCH_EVT; /* internal event */
-        p_msg->p_cb = p_cback;
+        if ((p_msg = btif_context_alloc_msg(p_cback, event, p_params, param_len, p_copy_cback)) == NULL)
+        {
+            /* let caller deal with a failed allocation */
+            return BT_STATUS_NOMEM;
+        }
+    }
 
-        p_msg->event = event;                         /* callback event */
+    pthread_mutex_lock(&btif_context_lock);
 
-        /* check if caller has provided a copy callback to do the deep copy */
-        if (p_copy_cback)
+    was_idle = (btif_context_ring.count == 0) && GKI_queue_is_empty(&btif_context_ring.overflow);
+    has_slot = (btif_context_ring.count < BTIF_CONTEXT_RING_SLOTS) &&
+               GKI_queue_is_empty(&btif_context_ring.overflow);
+
+    if (p_msg == NULL && !has_slot)
+    {
+        /* ring is full, fall back to a GKI buffer */
+        if ((p_msg = btif_context_alloc_msg(p_cback, event, p_params, param_len, NULL)) == NULL)
         {
-            p_copy_cback(event, p_msg->p_param, p_params);
+            pthread_mutex_unlock(&btif_context_lock);
+            return BT_STATUS_NOMEM;
         }
-        else if (p_params)
+        btif_context_ring.overflowed++;
+    }
+
+    if (has_slot)
+    {
+        p_slot = &btif_context_ring.slot[(btif_context_ring.head + btif_context_ring.count)
+                                         % BTIF_CONTEXT_RING_SLOTS];
+        p_slot->p_cb = p_cback;
+        p_slot->event = event;
+        p_slot->p_buf = p_msg;
+
+        if (p_msg == NULL && p_params && param_len > 0)
+            memcpy(p_slot->param.data, p_params, param_len);
+
+        btif_context_ring.count++;
+    }
+    else
+    {
+        GKI_enqueue(&btif_context_ring.overflow, p_msg);
+    }
+
+    btif_context_count(p_cback, event, p_msg == NULL);
+
+    depth = btif_context_ring.count + btif_context_ring.overflow.count;
+    if (depth > btif_context_ring.max_depth)
+        btif_context_ring.max_depth = depth;
+
+    pthread_mutex_unlock(&btif_context_lock);
+
+    /* btif_task keeps draining until the ring is empty, so only the post
+    *  that finds it idle needs to wake it up */
+    if (was_idle)
+        GKI_send_event(BTIF_TASK, BT_EVT_CONTEXT_SWITCH_RING);
+
+    return BT_STATUS_SUCCESS;
+}
+
+/*******************************************************************************
+**
+** Function         btif_context_ring_init
+**
+** Description      Resets the context switch ring and its counters. Events
+**                  left over from a previous btif_task instance were already
+**                  released by btif_context_ring_release when it exited.
+**
+** Returns          void
+**
+*******************************************************************************/
+
+static void btif_context_ring_init(void)
+{
+    pthread_mutex_lock(&btif_context_lock);
+    memset(&btif_context_ring, 0, sizeof(btif_context_ring));
+    GKI_init_q(&btif_context_ring.overflow);
+    pthread_mutex_unlock(&btif_context_lock);
+}
+
+/*******************************************************************************
+**
+** Function         btif_context_ring_release
+**
+** Description      Frees the GKI messages of the events btif_task did not get
+**                  to run, in ring slots and in the overflow queue, and
+**                  empties the ring. Called by btif_task as it exits, while
+**                  the GKI pools the messages come from still exist.
+**
+** Returns          void
+**
+*******************************************************************************/
+
+static void btif_context_ring_release(void)
+{
+    btif_context_slot_t *p_slot;
+    void *p_msg;
+
+    pthread_mutex_lock(&btif_context_lock);
+
+    while (btif_context_ring.count > 0)
+    {
+        p_slot = &btif_context_ring.slot[btif_context_ring.head];
+        if (p_slot->p_buf)
+            GKI_freebuf(p_slot->p_buf);
+        btif_context_ring.head = (btif_context_ring.head + 1) % BTIF_CONTEXT_RING_SLOTS;
+        btif_context_ring.count--;
+    }
+
+    while ((p_msg = GKI_dequeue(&btif_context_ring.overflow)) != NULL)
+        GKI_freebuf(p_msg);
+
+    pthread_mutex_unlock(&btif_context_lock);
+}
+
+/*******************************************************************************
+**
+** Function         btif_context_ring_drain
+**
+** Description      Runs every event queued in the context switch ring, then in
+**                  the overflow queue. Callbacks run without the ring lock
+**                  held; a slot is only released once its callback returns.
+**
+** Returns          void
+**
+*******************************************************************************/
+
+static void btif_context_ring_drain(void)
+{
+    btif_context_slot_t *p_slot;
+    tBTIF_CONTEXT_SWITCH_CBACK *p_msg;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&btif_context_lock);
+
+        if (btif_context_ring.count > 0)
         {
-            memcpy(p_msg->p_param, p_params, param_len);  /* callback parameter data */
+            p_slot = &btif_context_ring.slot[btif_context_ring.head];
+            pthread_mutex_unlock(&btif_context_lock);
+
+            if (p_slot->p_buf)
+            {
+                btif_context_switched(p_slot->p_buf);
+                GKI_freebuf(p_slot->p_buf);
+            }
+            else if (p_slot->p_cb)
+            {
+                p_slot->p_cb(p_slot->event, p_slot->param.data);
+            }
+
+            pthread_mutex_lock(&btif_context_lock);
+            btif_context_ring.head = (btif_context_ring.head + 1) % BTIF_CONTEXT_RING_SLOTS;
+            btif_context_ring.count--;
+            pthread_mutex_unlock(&btif_context_lock);
         }
+        else if ((p_msg = GKI_dequeue(&btif_context_ring.overflow)) != NULL)
+        {
+            pthread_mutex_unlock(&btif_context_lock);
 
-        btif_sendmsg(p_msg);
-        return BT_STATUS_SUCCESS;
+            btif_context_switched(p_msg);
+            GKI_freebuf(p_msg);
+        }
+        else
+        {
+            pthread_mutex_unlock(&btif_context_lock);
+            break;
+        }
     }
-    else
+}
+
+/*******************************************************************************
+**
+** Function         btif_dump_context_stats
+**
+** Description      Writes the context switch ring depth and the per event
+**                  count of fast slot and GKI fallback switches to fd
+**
+** Returns          void
+**
+*******************************************************************************/
+
+void btif_dump_context_stats(int fd)
+{
+    btif_context_stats_t *p_stats;
+    int i;
+
+    pthread_mutex_lock(&btif_context_lock);
+
+    dprintf(fd, "BTIF context switch ring: %d slots of %d bytes, max depth %u, overflowed %u\n",
+            BTIF_CONTEXT_RING_SLOTS, BTIF_CONTEXT_SLOT_PARAM_SIZE,
+            btif_context_ring.max_depth, btif_context_ring.overflowed);
+
+    for (i = 0; i < BTIF_CONTEXT_STATS_MAX; i++)
     {
-        /* let caller deal with a failed allocation */
-        return BT_STATUS_NOMEM;
+        p_stats = &btif_context_ring.stats[i];
+        if (p_stats->p_cb == NULL)
+            continue;
+
+        dprintf(fd, "  cb %p event %5u fast %10u fallback %10u\n",
+                p_stats->p_cb, p_stats->event, p_stats->fast, p_stats->fallback);
     }
+
+    if (btif_context_ring.untracked)
+        dprintf(fd, "  untracked %u\n", btif_context_ring.untracked);
+
+    pthread_mutex_unlock(&btif_context_lock);
 }
 
 /*******************************************************************************
@@ -291,7 +605,6 @@ int btif_is_enabled(void)
 static void btif_task(UINT32 params)
 {
     UINT16   event;
-    BT_HDR   *p_msg;
     UNUSED(params);
 
     BTIF_TRACE_DEBUG("btif task starting");
@@ -307,7 +620,7 @@ static void btif_task(UINT32 params)
          * Wait for the trigger to init chip and stack. This trigger will
          * be received by btu_task once the UART is opened and ready
          */
-        if (event == BT_EVT_TRIGGER_STACK_INIT)
+        if (event & BT_EVT_TRIGGER_STACK_INIT)
         {
             BTIF_TRACE_DEBUG("btif_task: received trigger stack init event");
             #if (BLE_INCLUDED == TRUE)
@@ -320,7 +633,7 @@ static void btif_task(UINT32 params)
          * Failed to initialize controller hardware, reset state and bring
          * down all threads
          */
-        if (event == BT_EVT_HARDWARE_INIT_FAIL)
+        if (event & BT_EVT_HARDWARE_INIT_FAIL)
         {
             lock_slot(&mutex_bt_disable);
             BTIF_TRACE_DEBUG("btif_task: mutex_bt_disable lock");
@@ -329,6 +642,7 @@ static void btif_task(UINT32 params)
                 BTIF_TRACE_DEBUG("btif_task: hardware init failed");
                 bte_main_disable();
                 btif_queue_release();
+                btif_context_ring_release();
                 GKI_task_self_cleanup(BTIF_TASK);
                 bte_main_shutdown();
                 btif_dut_mode = 0;
@@ -343,27 +657,13 @@ static void btif_task(UINT32 params)
         }
 
         if (event & EVENT_MASK(GKI_SHUTDOWN_EVT))
-            break;
-
-        if(event & TASK_MBOX_1_EVT_MASK)
         {
-            while((p_msg = GKI_read_mbox(BTU_BTIF_MBOX)) != NULL)
-            {
-                BTIF_TRACE_VERBOSE("btif task fetched event %x", p_msg->event);
-
-                switch (p_msg->event)
-                {
-                    case BT_EVT_CONTEXT_SWITCH_EVT:
-                        btif_context_switched(p_msg);
-                        break;
-                    default:
-                        BTIF_TRACE_ERROR("unhandled btif event (%d)", p_msg->event & BT_EVT_MASK);
-                        break;
-                }
-
-                GKI_freebuf(p_msg);
-            }
+            btif_context_ring_release();
+            break;
         }
+
+        if (event & BT_EVT_CONTEXT_SWITCH_RING)
+            btif_context_ring_drain();
     }
 
     btif_disassociate_evt();
@@ -372,21 +672,6 @@ static void btif_task(UINT32 params)
 }
 
 
-/*******************************************************************************
-**
-** Function         btif_sendmsg
-**
-** Description      Sends msg to BTIF task
-**
-** Returns          void
-**
-*******************************************************************************/
-
-void btif_sendmsg(void *p_msg)
-{
-    GKI_send_msg(BTIF_TASK, BTU_BTIF_MBOX, p_msg);
-}
-
 static void btif_fetch_local_bdaddr(bt_bdaddr_t *local_addr)
 {
     char val[256];
@@ -508,6 +793,8 @@ bt_status_t btif_init_bluetooth()
     memset(&btif_local_bd_addr, 0, sizeof(bt_bdaddr_t));
     btif_fetch_local_bdaddr(&btif_local_bd_addr);
 
+    btif_context_ring_init();
+
     /* start btif task */
     status = GKI_create_task(btif_task, BTIF_TASK, BTIF_TASK_STR,
                 (UINT16 *) ((UINT8 *)btif_task_stack + BTIF_TASK_STACK_SIZE),
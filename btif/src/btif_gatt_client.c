@@ -29,6 +29,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <stddef.h>
 #include <string.h>
 
 #define LOG_TAG "BtGatt.btif"
@@ -42,6 +43,7 @@
 #include <hardware/bt_gatt.h>
 #include "bta_api.h"
 #include "bta_gatt_api.h"
+#include "btu.h"
 #include "bd.h"
 #include "btif_storage.h"
 #include "btif_config.h"
@@ -112,6 +114,18 @@ typedef enum {
 } btif_gattc_event_t;
 
 #define BTIF_GATT_MAX_OBSERVED_DEV 40
+#define BTIF_GATT_DEV_HASH_SIZE    64
+
+/* Advertising data copied from each scan result */
+#define BTIF_GATTC_ADV_DATA_LEN    62
+
+#define BTIF_GATTC_SCAN_HASH_SIZE  (BTIF_GATTC_SCAN_BATCH_MAX * 2)
+
+/* The batch count, the hash entries (index + 1) and the size passed to
+*  btif_gattc_bda_hash are all uint8_t, so the hash table must fit in 255. */
+#if (BTIF_GATTC_SCAN_BATCH_MAX < 1) || (BTIF_GATTC_SCAN_BATCH_MAX > 127)
+#error "BTIF_GATTC_SCAN_BATCH_MAX must be between 1 and 127"
+#endif
 
 #define BTIF_GATT_OBSERVE_EVT   0x1000
 #define BTIF_GATTC_RSSI_EVT     0x1001
@@ -229,8 +243,37 @@ typedef struct
     btif_gattc_dev_t remote_dev[BTIF_GATT_MAX_OBSERVED_DEV];
     uint8_t            addr_type;
     uint8_t            next_storage_idx;
+    uint8_t            hash_head[BTIF_GATT_DEV_HASH_SIZE]; /* remote_dev index + 1, 0 if empty */
+    uint8_t            hash_next[BTIF_GATT_MAX_OBSERVED_DEV];
 }__attribute__((packed)) btif_gattc_dev_cb_t;
 
+typedef struct
+{
+    bt_bdaddr_t     bd_addr;
+    int8_t          rssi;
+    uint8_t         addr_type;
+    uint8_t         flag;
+    tBT_DEVICE_TYPE device_type;
+    uint8_t         value[BTIF_GATTC_ADV_DATA_LEN + 1]; /* zero terminated EIR */
+} __attribute__((packed)) btif_gattc_scan_result_t;
+
+/* Scan results passed to btif in one BTIF_GATT_OBSERVE_EVT */
+typedef struct
+{
+    uint8_t                  num_results;
+    btif_gattc_scan_result_t results[BTIF_GATTC_SCAN_BATCH_MAX];
+} __attribute__((packed)) btif_gattc_scan_batch_t;
+
+/* Scan results collected in BTU context, one per address, until the batch
+*  window expires or the batch fills up */
+typedef struct
+{
+    btif_gattc_scan_batch_t batch;
+    uint8_t                 hash[BTIF_GATTC_SCAN_HASH_SIZE]; /* results index + 1, 0 if empty */
+    TIMER_LIST_ENT          tle;
+    BOOLEAN                 timer_running;
+} btif_gattc_scan_batch_cb_t;
+
 /*******************************************************************************
 **  Static variables
 ********************************************************************************/
@@ -238,8 +281,13 @@ typedef struct
 extern const btgatt_callbacks_t *bt_gatt_callbacks;
 static btif_gattc_dev_cb_t  btif_gattc_dev_cb;
 static btif_gattc_dev_cb_t  *p_dev_cb = &btif_gattc_dev_cb;
+static btif_gattc_scan_batch_cb_t btif_gattc_scan_batch_cb;
 static uint8_t rssi_request_client_if;
 
+/* Time to collect LE scan results before passing them up, 0 to pass each one
+*  up as it arrives. Set from the BLE stack configuration file. */
+UINT16 btif_gattc_scan_batch_window_ms = BTIF_GATTC_SCAN_BATCH_WINDOW_MS;
+
 /*******************************************************************************
 **  Static functions
 ********************************************************************************/
@@ -330,15 +378,41 @@ static void btapp_gattc_free_req_data(UINT16 event, tBTA_GATTC *p_data)
     }
 }
 
+static uint8_t btif_gattc_bda_hash(const uint8_t *p_bda, uint8_t size)
+{
+    UINT32 hash = 2166136261u;
+    uint8_t i;
+
+    for (i = 0; i < BD_ADDR_LEN; i++)
+        hash = (hash ^ p_bda[i]) * 16777619u;
+
+    return (uint8_t)(hash % size);
+}
+
 static void btif_gattc_init_dev_cb(void)
 {
     memset(p_dev_cb, 0, sizeof(btif_gattc_dev_cb_t));
 }
 
+static void btif_gattc_unlink_remote_bdaddr(uint8_t idx)
+{
+    uint8_t *p_link = &p_dev_cb->hash_head[btif_gattc_bda_hash(
+                            p_dev_cb->remote_dev[idx].bd_addr.address, BTIF_GATT_DEV_HASH_SIZE)];
+
+    while (*p_link)
+    {
+        if (*p_link == idx + 1)
+        {
+            *p_link = p_dev_cb->hash_next[idx];
+            break;
+        }
+        p_link = &p_dev_cb->hash_next[*p_link - 1];
+    }
+}
+
 static void btif_gattc_add_remote_bdaddr (BD_ADDR p_bda, uint8_t addr_type)
 {
-    BOOLEAN found=FALSE;
-    uint8_t i;
+    uint8_t i, bucket;
     for (i = 0; i < BTIF_GATT_MAX_OBSERVED_DEV; i++)
     {
         if (!p_dev_cb->remote_dev[i].in_use )
@@ -354,6 +428,7 @@ static void btif_gattc_add_remote_bdaddr (BD_ADDR p_bda, uint8_t addr_type)
     if ( i == BTIF_GATT_MAX_OBSERVED_DEV)
     {
         i= p_dev_cb->next_storage_idx;
+        btif_gattc_unlink_remote_bdaddr(i);
         memcpy(p_dev_cb->remote_dev[i].bd_addr.address, p_bda, BD_ADDR_LEN);
         p_dev_cb->addr_type = addr_type;
         p_dev_cb->remote_dev[i].in_use = TRUE;
@@ -362,23 +437,26 @@ static void btif_gattc_add_remote_bdaddr (BD_ADDR p_bda, uint8_t addr_type)
         if (p_dev_cb->next_storage_idx >= BTIF_GATT_MAX_OBSERVED_DEV)
                p_dev_cb->next_storage_idx = 0;
     }
+
+    bucket = btif_gattc_bda_hash(p_bda, BTIF_GATT_DEV_HASH_SIZE);
+    p_dev_cb->hash_next[i] = p_dev_cb->hash_head[bucket];
+    p_dev_cb->hash_head[bucket] = i + 1;
 }
 
 static BOOLEAN btif_gattc_find_bdaddr (BD_ADDR p_bda)
 {
-    uint8_t i;
-    for (i = 0; i < BTIF_GATT_MAX_OBSERVED_DEV; i++)
+    uint8_t idx = p_dev_cb->hash_head[btif_gattc_bda_hash(p_bda, BTIF_GATT_DEV_HASH_SIZE)];
+
+    while (idx)
     {
-        if (p_dev_cb->remote_dev[i].in_use &&
-            !memcmp(p_dev_cb->remote_dev[i].bd_addr.address, p_bda, BD_ADDR_LEN))
-        {
+        if (!memcmp(p_dev_cb->remote_dev[idx - 1].bd_addr.address, p_bda, BD_ADDR_LEN))
             return TRUE;
-        }
+        idx = p_dev_cb->hash_next[idx - 1];
     }
     return FALSE;
 }
 
-static void btif_gattc_update_properties ( btif_gattc_cb_t *p_btif_cb )
+static void btif_gattc_update_properties ( btif_gattc_scan_result_t *p_btif_cb )
 {
     uint8_t remote_name_len;
     uint8_t *p_eir_remote_name=NULL;
@@ -407,6 +485,53 @@ static void btif_gattc_update_properties ( btif_gattc_cb_t *p_btif_cb )
     btif_storage_set_remote_addr_type( &p_btif_cb->bd_addr, p_btif_cb->addr_type);
 }
 
+static void btif_gattc_process_scan_result(btif_gattc_scan_result_t *p_btif_cb)
+{
+    uint8_t remote_name_len;
+    uint8_t *p_eir_remote_name=NULL;
+    bt_device_type_t dev_type;
+    bt_property_t properties;
+
+    p_eir_remote_name = BTA_CheckEirData(p_btif_cb->value,
+                                 BTM_EIR_COMPLETE_LOCAL_NAME_TYPE, &remote_name_len);
+
+    if (p_eir_remote_name == NULL)
+    {
+        p_eir_remote_name = BTA_CheckEirData(p_btif_cb->value,
+                        BT_EIR_SHORTENED_LOCAL_NAME_TYPE, &remote_name_len);
+    }
+
+    if ((p_btif_cb->addr_type != BLE_ADDR_RANDOM) || (p_eir_remote_name))
+    {
+       if (!btif_gattc_find_bdaddr(p_btif_cb->bd_addr.address))
+       {
+          static const char* exclude_filter[] =
+                {"LinkKey", "LE_KEY_PENC", "LE_KEY_PID", "LE_KEY_PCSRK", "LE_KEY_LENC", "LE_KEY_LCSRK"};
+
+          btif_gattc_add_remote_bdaddr(p_btif_cb->bd_addr.address, p_btif_cb->addr_type);
+          btif_gattc_update_properties(p_btif_cb);
+          btif_config_filter_remove("Remote", exclude_filter, sizeof(exclude_filter)/sizeof(char*),
+          BTIF_STORAGE_MAX_ALLOWED_REMOTE_DEVICE);
+       }
+
+    }
+
+    if (( p_btif_cb->device_type == BT_DEVICE_TYPE_DUMO)&&
+       (p_btif_cb->flag & BTA_BLE_DMT_CONTROLLER_SPT) &&
+       (p_btif_cb->flag & BTA_BLE_DMT_HOST_SPT))
+     {
+        btif_storage_set_dmt_support_type (&(p_btif_cb->bd_addr), TRUE);
+     }
+
+     dev_type =  p_btif_cb->device_type;
+     BTIF_STORAGE_FILL_PROPERTY(&properties,
+                BT_PROPERTY_TYPE_OF_DEVICE, sizeof(dev_type), &dev_type);
+     btif_storage_set_remote_device_property(&(p_btif_cb->bd_addr), &properties);
+
+    HAL_CBACK(bt_gatt_callbacks, client->scan_result_cb,
+              &p_btif_cb->bd_addr, p_btif_cb->rssi, p_btif_cb->value);
+}
+
 static void btif_gattc_upstreams_evt(uint16_t event, char* p_param)
 {
     BTIF_TRACE_EVENT("%s: Event %d", __FUNCTION__, event);
@@ -562,50 +687,11 @@ static void btif_gattc_upstreams_evt(uint16_t event, char* p_param)
 
         case BTIF_GATT_OBSERVE_EVT:
         {
-            btif_gattc_cb_t *p_btif_cb = (btif_gattc_cb_t*) p_param;
-            uint8_t remote_name_len;
-            uint8_t *p_eir_remote_name=NULL;
-            bt_device_type_t dev_type;
-            bt_property_t properties;
-
-            p_eir_remote_name = BTA_CheckEirData(p_btif_cb->value,
-                                         BTM_EIR_COMPLETE_LOCAL_NAME_TYPE, &remote_name_len);
-
-            if (p_eir_remote_name == NULL)
-            {
-                p_eir_remote_name = BTA_CheckEirData(p_btif_cb->value,
-                                BT_EIR_SHORTENED_LOCAL_NAME_TYPE, &remote_name_len);
-            }
+            btif_gattc_scan_batch_t *p_batch = (btif_gattc_scan_batch_t*) p_param;
+            uint8_t i;
 
-            if ((p_btif_cb->addr_type != BLE_ADDR_RANDOM) || (p_eir_remote_name))
-            {
-               if (!btif_gattc_find_bdaddr(p_btif_cb->bd_addr.address))
-               {
-                  static const char* exclude_filter[] =
-                        {"LinkKey", "LE_KEY_PENC", "LE_KEY_PID", "LE_KEY_PCSRK", "LE_KEY_LENC", "LE_KEY_LCSRK"};
-
-                  btif_gattc_add_remote_bdaddr(p_btif_cb->bd_addr.address, p_btif_cb->addr_type);
-                  btif_gattc_update_properties(p_btif_cb);
-                  btif_config_filter_remove("Remote", exclude_filter, sizeof(exclude_filter)/sizeof(char*),
-                  BTIF_STORAGE_MAX_ALLOWED_REMOTE_DEVICE);
-               }
-
-            }
-
-            if (( p_btif_cb->device_type == BT_DEVICE_TYPE_DUMO)&&
-               (p_btif_cb->flag & BTA_BLE_DMT_CONTROLLER_SPT) &&
-               (p_btif_cb->flag & BTA_BLE_DMT_HOST_SPT))
-             {
-                btif_storage_set_dmt_support_type (&(p_btif_cb->bd_addr), TRUE);
-             }
-
-             dev_type =  p_btif_cb->device_type;
-             BTIF_STORAGE_FILL_PROPERTY(&properties,
-                        BT_PROPERTY_TYPE_OF_DEVICE, sizeof(dev_type), &dev_type);
-             btif_storage_set_remote_device_property(&(p_btif_cb->bd_addr), &properties);
-
-            HAL_CBACK(bt_gatt_callbacks, client->scan_result_cb,
-                      &p_btif_cb->bd_addr, p_btif_cb->rssi, p_btif_cb->value);
+            for (i = 0; i < p_batch->num_results; i++)
+                btif_gattc_process_scan_result(&p_batch->results[i]);
             break;
         }
 
@@ -959,23 +1045,84 @@ static void bta_batch_scan_reports_cb(tBTA_DM_BLE_REF_VALUE ref_value, UINT8 rep
         GKI_freebuf(btif_scan_track_cb.read_reports.p_rep_data);
 }
 
+static void btif_gattc_scan_batch_flush(void)
+{
+    btif_gattc_scan_batch_cb_t *p_cb = &btif_gattc_scan_batch_cb;
+
+#if defined(QUICK_TIMER_TICKS_PER_SEC) && (QUICK_TIMER_TICKS_PER_SEC > 0)
+    if (p_cb->timer_running)
+    {
+        btu_stop_quick_timer(&p_cb->tle);
+        p_cb->timer_running = FALSE;
+    }
+#endif
+
+    if (p_cb->batch.num_results == 0)
+        return;
+
+    btif_transfer_context(btif_gattc_upstreams_evt, BTIF_GATT_OBSERVE_EVT, (char*) &p_cb->batch,
+                          offsetof(btif_gattc_scan_batch_t, results) +
+                          p_cb->batch.num_results * sizeof(btif_gattc_scan_result_t), NULL);
+
+    p_cb->batch.num_results = 0;
+    memset(p_cb->hash, 0, sizeof(p_cb->hash));
+}
+
+#if defined(QUICK_TIMER_TICKS_PER_SEC) && (QUICK_TIMER_TICKS_PER_SEC > 0)
+static void btif_gattc_scan_batch_timeout(void *p_tle)
+{
+    UNUSED(p_tle);
+    btif_gattc_scan_batch_cb.timer_running = FALSE;
+    btif_gattc_scan_batch_flush();
+}
+#endif
+
+/* Returns the batch entry for p_bda, so a device that advertises several
+*  times within one window is reported once with its latest data */
+static btif_gattc_scan_result_t *btif_gattc_scan_batch_entry(BD_ADDR p_bda)
+{
+    btif_gattc_scan_batch_cb_t *p_cb = &btif_gattc_scan_batch_cb;
+    btif_gattc_scan_result_t *p_result;
+    uint8_t bucket = btif_gattc_bda_hash(p_bda, BTIF_GATTC_SCAN_HASH_SIZE);
+
+    while (p_cb->hash[bucket])
+    {
+        p_result = &p_cb->batch.results[p_cb->hash[bucket] - 1];
+        if (!memcmp(p_result->bd_addr.address, p_bda, BD_ADDR_LEN))
+            return p_result;
+        bucket = (bucket + 1) % BTIF_GATTC_SCAN_HASH_SIZE;
+    }
+
+    if (p_cb->batch.num_results == BTIF_GATTC_SCAN_BATCH_MAX)
+    {
+        btif_gattc_scan_batch_flush();
+        bucket = btif_gattc_bda_hash(p_bda, BTIF_GATTC_SCAN_HASH_SIZE);
+    }
+
+    p_result = &p_cb->batch.results[p_cb->batch.num_results++];
+    p_cb->hash[bucket] = p_cb->batch.num_results;
+    bdcpy(p_result->bd_addr.address, p_bda);
+    return p_result;
+}
+
 static void bta_scan_results_cb (tBTA_DM_SEARCH_EVT event, tBTA_DM_SEARCH *p_data)
 {
-    btif_gattc_cb_t btif_cb;
+    btif_gattc_scan_result_t *p_result;
     uint8_t len;
 
     switch (event)
     {
         case BTA_DM_INQ_RES_EVT:
         {
-            bdcpy(btif_cb.bd_addr.address, p_data->inq_res.bd_addr);
-            btif_cb.device_type = p_data->inq_res.device_type;
-            btif_cb.rssi = p_data->inq_res.rssi;
-            btif_cb.addr_type = p_data->inq_res.ble_addr_type;
-            btif_cb.flag = p_data->inq_res.flag;
+            p_result = btif_gattc_scan_batch_entry(p_data->inq_res.bd_addr);
+            p_result->device_type = p_data->inq_res.device_type;
+            p_result->rssi = p_data->inq_res.rssi;
+            p_result->addr_type = p_data->inq_res.ble_addr_type;
+            p_result->flag = p_data->inq_res.flag;
+            memset(p_result->value, 0, sizeof(p_result->value));
             if (p_data->inq_res.p_eir)
             {
-                memcpy(btif_cb.value, p_data->inq_res.p_eir, 62);
+                memcpy(p_result->value, p_data->inq_res.p_eir, BTIF_GATTC_ADV_DATA_LEN);
                 if (BTA_CheckEirData(p_data->inq_res.p_eir, BTM_EIR_COMPLETE_LOCAL_NAME_TYPE,
                                       &len))
                 {
@@ -989,6 +1136,7 @@ static void bta_scan_results_cb (tBTA_DM_SEARCH_EVT event, tBTA_DM_SEARCH *p_dat
         {
             BTIF_TRACE_DEBUG("%s  BLE observe complete. Num Resp %d",
                               __FUNCTION__,p_data->inq_cmpl.num_resps);
+            btif_gattc_scan_batch_flush();
             return;
         }
 
@@ -996,8 +1144,25 @@ static void bta_scan_results_cb (tBTA_DM_SEARCH_EVT event, tBTA_DM_SEARCH *p_dat
         BTIF_TRACE_WARNING("%s : Unknown event 0x%x", __FUNCTION__, event);
         return;
     }
-    btif_transfer_context(btif_gattc_upstreams_evt, BTIF_GATT_OBSERVE_EVT,
-                                 (char*) &btif_cb, sizeof(btif_gattc_cb_t), NULL);
+
+#if defined(QUICK_TIMER_TICKS_PER_SEC) && (QUICK_TIMER_TICKS_PER_SEC > 0)
+    if (btif_gattc_scan_batch_window_ms > 0)
+    {
+        btif_gattc_scan_batch_cb_t *p_cb = &btif_gattc_scan_batch_cb;
+
+        if (!p_cb->timer_running)
+        {
+            memset(&p_cb->tle, 0, sizeof(TIMER_LIST_ENT));
+            p_cb->tle.param = (UINT32) btif_gattc_scan_batch_timeout;
+            btu_start_quick_timer(&p_cb->tle, BTU_TTYPE_USER_FUNC,
+                (btif_gattc_scan_batch_window_ms * QUICK_TIMER_TICKS_PER_SEC + 999) / 1000);
+            p_cb->timer_running = TRUE;
+        }
+        return;
+    }
+#endif
+
+    btif_gattc_scan_batch_flush();
 }
 
 static void bta_track_adv_event_cb(int filt_index, tBLE_ADDR_TYPE addr_type, BD_ADDR bda,
@@ -1508,10 +1508,13 @@ int btif_media_task(void *p)
 {
     UINT16 event;
     BT_HDR *p_msg;
+    BUFFER_Q msg_q;
     UNUSED(p);
 
     VERBOSE("================ MEDIA TASK STARTING ================");
 
+    GKI_init_q(&msg_q);
+
     btif_media_task_init();
 
     media_task_running = MEDIA_TASK_STATE_ON;
@@ -1527,7 +1530,8 @@ int btif_media_task(void *p)
         if (event & BTIF_MEDIA_TASK_CMD)
         {
             /* Process all messages in the queue */
-            while ((p_msg = (BT_HDR *) GKI_read_mbox(BTIF_MEDIA_TASK_CMD_MBOX)) != NULL)
+            GKI_read_mbox_all(BTIF_MEDIA_TASK_CMD_MBOX, &msg_q);
+            while ((p_msg = (BT_HDR *) GKI_dequeue_batch(&msg_q)) != NULL)
             {
                 btif_media_task_handle_cmd(p_msg);
             }
@@ -1537,7 +1541,8 @@ int btif_media_task(void *p)
         {
             VERBOSE("================= Received Media Packets %d ===============", event);
             /* Process all messages in the queue */
-            while ((p_msg = (BT_HDR *) GKI_read_mbox(BTIF_MEDIA_TASK_DATA_MBOX)) != NULL)
+            GKI_read_mbox_all(BTIF_MEDIA_TASK_DATA_MBOX, &msg_q);
+            while ((p_msg = (BT_HDR *) GKI_dequeue_batch(&msg_q)) != NULL)
             {
                 btif_media_task_handle_media(p_msg);
             }
@@ -125,6 +125,8 @@ typedef struct _tle
     TIMER_PARAM_TYPE   data;
     UINT16        event;
     UINT8         in_use;
+    UINT16        heap_index;       /* position in a deadline heap while running */
+    UINT64        deadline_ms;      /* expiry for deadline-ordered timer services */
 } TIMER_LIST_ENT;
 
 /* Define a timer list queue
@@ -148,6 +150,36 @@ typedef struct
 
 #define GKI_IS_QUEUE_EMPTY(p_q) ((p_q)->count == 0)
 
+
+/***********************************************************************
+** Mailbox statistics of a task, see GKI_get_task_stats().
+*/
+typedef struct
+{
+    UINT32  msgs_read;          /* messages read from the task's mailboxes */
+    UINT32  msgs_per_sec;       /* average message rate since the last reset */
+    UINT32  wakeups;            /* posts that had to signal the task */
+    UINT32  wakeups_coalesced;  /* posts that found the mailbox already pending */
+    UINT16  max_queue_depth;    /* deepest any mailbox of the task has been */
+    UINT32  avg_dispatch_us;    /* mean time from a post to an empty mailbox until it is read */
+    UINT32  max_dispatch_us;    /* largest such time */
+} tGKI_TASK_STATS;
+
+/***********************************************************************
+** Latency histogram, see GKI_lat_hist_add(). Bucket 0 counts samples
+** below 2 us and bucket i those from 2^i us up to 2^(i+1) us. The last
+** bucket also takes all longer samples.
+*/
+#define GKI_LAT_HIST_BUCKETS    20
+
+typedef struct
+{
+    UINT32  bucket[GKI_LAT_HIST_BUCKETS];
+    UINT32  count;
+    UINT32  max_us;
+    UINT64  total_us;
+} tGKI_LAT_HIST;
+
 /* Task constants
 */
 #ifndef TASKPTR
@@ -182,6 +214,7 @@ GKI_API extern void    GKI_stop(void);
 /* To send buffers and events between tasks
 */
 GKI_API extern void   *GKI_read_mbox  (UINT8);
+GKI_API extern UINT16  GKI_read_mbox_all (UINT8, BUFFER_Q *);
 GKI_API extern void    GKI_send_msg   (UINT8, UINT8, void *);
 GKI_API extern UINT8   GKI_send_event (UINT8, UINT16);
 
@@ -195,12 +228,24 @@ GKI_API extern void   *GKI_getpoolbuf (UINT8);
 GKI_API extern UINT16  GKI_poolcount (UINT8);
 GKI_API extern UINT16  GKI_poolfreecount (UINT8);
 GKI_API extern UINT16  GKI_poolutilization (UINT8);
+GKI_API extern UINT16  GKI_poolcachehitrate (UINT8);
 GKI_API extern UINT8 GKI_get_task_state (UINT8 task_id);
+GKI_API extern BOOLEAN GKI_get_task_stats (UINT8 task_id, tGKI_TASK_STATS *p_stats);
+GKI_API extern void    GKI_reset_task_stats (UINT8 task_id);
+
+/* Latency instrumentation
+*/
+GKI_API extern void    GKI_enable_latency_stats (BOOLEAN enable);
+GKI_API extern BOOLEAN GKI_latency_stats_enabled (void);
+GKI_API extern void    GKI_lat_hist_add (tGKI_LAT_HIST *p_hist, UINT32 us);
+GKI_API extern void    GKI_lat_hist_dump (int fd, const char *p_name, const tGKI_LAT_HIST *p_hist);
+GKI_API extern void    GKI_dump_task_stats (int fd);
 
 
 /* User buffer queue management
 */
 GKI_API extern void   *GKI_dequeue  (BUFFER_Q *);
+GKI_API extern void   *GKI_dequeue_batch (BUFFER_Q *);
 GKI_API extern void    GKI_enqueue (BUFFER_Q *, void *);
 GKI_API extern void    GKI_enqueue_head (BUFFER_Q *, void *);
 GKI_API extern void   *GKI_getfirst (BUFFER_Q *);
@@ -226,6 +271,8 @@ GKI_API extern UINT16  GKI_update_timer_list (TIMER_LIST_Q *, INT32);
 GKI_API extern UINT32  GKI_get_remaining_ticks (TIMER_LIST_Q *, TIMER_LIST_ENT  *);
 GKI_API extern UINT16  GKI_wait(UINT16, UINT32);
 GKI_API extern BOOLEAN GKI_timer_queue_is_empty(const TIMER_LIST_Q *timer_q);
+GKI_API extern UINT64  GKI_get_time_us(void);
+GKI_API extern UINT64  GKI_get_boot_time_ms(void);
 GKI_API extern TIMER_LIST_ENT *GKI_timer_getfirst(const TIMER_LIST_Q *timer_q);
 GKI_API extern INT32 GKI_timer_ticks_getinitial(const TIMER_LIST_ENT *tle);
 
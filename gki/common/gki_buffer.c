@@ -15,6 +15,7 @@
  *  limitations under the License.
  *
  ******************************************************************************/
+#include <string.h>
 #include "gki_int.h"
 #include <cutils/log.h>
 
@@ -24,6 +25,10 @@
 
 static void gki_add_to_pool_list(UINT8 pool_id);
 static void gki_remove_from_pool_list(UINT8 pool_id);
+static void gki_build_size_classes(void);
+#if (GKI_BUF_CACHE_INCLUDED == TRUE) && defined(GKI_USE_DEFERED_ALLOC_BUF_POOLS)
+static void gki_buf_cache_discard(void);
+#endif
 
 /*******************************************************************************
 **
@@ -98,7 +103,7 @@ static BOOLEAN gki_alloc_free_queue(UINT8 id)
     tGKI_COM_CB *p_cb = &gki_cb.com;
     GKI_TRACE("\ngki_alloc_free_queue in, id:%d \n", (int)id );
 
-    Q = &p_cb->freeq[p_cb->pool_list[id]];
+    Q = &p_cb->freeq[id];
 
     if(Q->p_first == 0)
     {
@@ -122,6 +127,11 @@ void gki_dealloc_free_queue(void)
     UINT8   i;
     tGKI_COM_CB *p_cb = &gki_cb.com;
 
+#if (GKI_BUF_CACHE_INCLUDED == TRUE)
+    /* Cached buffers live in the pool memory about to be released */
+    gki_buf_cache_discard();
+#endif
+
     for (i=0; i < p_cb->curr_total_no_of_pools; i++)
     {
         if ( 0 < p_cb->freeq[i].max_cnt )
@@ -143,6 +153,264 @@ void gki_dealloc_free_queue(void)
 #endif
 // btla-specific --
 
+#if (GKI_BUF_CACHE_INCLUDED == TRUE)
+/*******************************************************************************
+**
+** Function         gki_buf_cache_depth
+**
+** Description      Internal function called at startup to size the per-task
+**                  buffer caches of a pool. Task caches together may hold at
+**                  most a quarter of the pool, and pools too small to give
+**                  each task a cache of two buffers are not cached.
+**
+** Returns          the number of buffers each task may cache, 0 if none
+**
+*******************************************************************************/
+static UINT16 gki_buf_cache_depth (UINT16 total)
+{
+    UINT16 depth = total / (GKI_MAX_TASKS * 4);
+
+    if (depth < 2)
+        return (0);
+
+    return ((depth > GKI_BUF_CACHE_MAX_DEPTH) ? GKI_BUF_CACHE_MAX_DEPTH : depth);
+}
+
+/*******************************************************************************
+**
+** Function         gki_buf_cache
+**
+** Description      Internal function to find the buffer cache a task keeps
+**                  for a pool.
+**
+** Returns          the cache, or NULL if the caller is not a GKI task or the
+**                  pool is not cached
+**
+*******************************************************************************/
+static BUF_CACHE_T *gki_buf_cache (UINT8 task_id, UINT8 pool_id)
+{
+    if ((task_id >= GKI_MAX_TASKS) || (gki_cb.com.buf_cache_depth[pool_id] == 0))
+        return (NULL);
+
+    return (&gki_cb.com.buf_cache[task_id][pool_id]);
+}
+
+/*******************************************************************************
+**
+** Function         gki_buf_cache_get
+**
+** Description      Internal function to take a buffer from a task's cache.
+**                  Must only be called by the task owning the cache.
+**
+** Returns          the buffer header, or NULL if the cache is empty
+**
+*******************************************************************************/
+static BUFFER_HDR_T *gki_buf_cache_get (BUF_CACHE_T *p_cache)
+{
+    BUFFER_HDR_T *p_hdr = p_cache->p_first;
+
+    if (p_hdr)
+    {
+        p_cache->p_first = p_hdr->p_next;
+        p_cache->count--;
+        p_cache->hits++;
+    }
+
+    return (p_hdr);
+}
+
+/*******************************************************************************
+**
+** Function         gki_buf_cache_drain
+**
+** Description      Internal function to return buffers from a task's cache
+**                  to the shared free queue of the pool in one batch.
+**
+** Returns          void
+**
+*******************************************************************************/
+static void gki_buf_cache_drain (BUF_CACHE_T *p_cache, UINT8 pool_id, UINT16 count)
+{
+    FREE_QUEUE_T  *Q = &gki_cb.com.freeq[pool_id];
+    BUFFER_HDR_T  *p_hdr;
+
+    GKI_disable();
+
+    while (count-- && (p_hdr = p_cache->p_first) != NULL)
+    {
+        p_cache->p_first = p_hdr->p_next;
+        p_cache->count--;
+
+        if (Q->p_last)
+            Q->p_last->p_next = p_hdr;
+        else
+            Q->p_first = p_hdr;
+
+        Q->p_last     = p_hdr;
+        p_hdr->p_next = NULL;
+        if (Q->cur_cnt > 0)
+            Q->cur_cnt--;
+    }
+
+    GKI_enable();
+}
+
+/*******************************************************************************
+**
+** Function         gki_buf_cache_flush
+**
+** Description      Called internally when a task exits to return all of the
+**                  buffers it has cached to the shared free queues. The cache
+**                  is used without locks, so only the task's own thread can
+**                  flush it; calls from any other thread are ignored.
+**
+** Returns          void
+**
+*******************************************************************************/
+void gki_buf_cache_flush (UINT8 task_id)
+{
+    UINT8   i;
+
+    if ((task_id >= GKI_MAX_TASKS) || (GKI_get_taskid() != task_id))
+        return;
+
+    for (i = 0; i < GKI_NUM_TOTAL_BUF_POOLS; i++)
+    {
+        BUF_CACHE_T *p_cache = &gki_cb.com.buf_cache[task_id][i];
+
+        if (p_cache->count)
+            gki_buf_cache_drain(p_cache, i, p_cache->count);
+    }
+}
+
+#ifdef GKI_USE_DEFERED_ALLOC_BUF_POOLS
+/*******************************************************************************
+**
+** Function         gki_buf_cache_discard
+**
+** Description      Internal function to forget the buffers of every task cache
+**                  when the pool memory they live in is released. The shared
+**                  free queues are reset as well, so nothing is drained.
+**
+** Returns          void
+**
+*******************************************************************************/
+static void gki_buf_cache_discard (void)
+{
+    GKI_disable();
+    memset(gki_cb.com.buf_cache, 0, sizeof(gki_cb.com.buf_cache));
+    GKI_enable();
+}
+#endif
+
+/*******************************************************************************
+**
+** Function         gki_buf_cache_count
+**
+** Description      Internal function to count the free buffers of a pool
+**                  that are held in task caches.
+**
+** Returns          the number of cached buffers
+**
+*******************************************************************************/
+static UINT16 gki_buf_cache_count (UINT8 pool_id)
+{
+    UINT8   i;
+    UINT16  count = 0;
+
+    for (i = 0; i < GKI_MAX_TASKS; i++)
+        count += gki_cb.com.buf_cache[i][pool_id].count;
+
+    return (count);
+}
+#endif
+
+/*******************************************************************************
+**
+** Function         gki_take_free_buf
+**
+** Description      Internal function to take a buffer from the shared free
+**                  queue of a pool. If the calling task caches the pool, its
+**                  cache is refilled in the same lock acquisition.
+**
+**                  Must be called with GKI_disable() held, and only when
+**                  the pool has buffers left (cur_cnt < total).
+**
+** Returns          the buffer header, or NULL if the pool memory could not
+**                  be allocated
+**
+*******************************************************************************/
+static BUFFER_HDR_T *gki_take_free_buf (UINT8 pool_id, UINT8 task_id)
+{
+    FREE_QUEUE_T  *Q = &gki_cb.com.freeq[pool_id];
+    BUFFER_HDR_T  *p_hdr;
+#if (GKI_BUF_CACHE_INCLUDED == TRUE)
+    BUF_CACHE_T   *p_cache = gki_buf_cache(task_id, pool_id);
+    BUFFER_HDR_T  *p_cached;
+    UINT16         batch;
+#endif
+
+// btla-specific ++
+#ifdef GKI_USE_DEFERED_ALLOC_BUF_POOLS
+    if(Q->p_first == 0 && gki_alloc_free_queue(pool_id) != TRUE)
+        return (NULL);
+#endif
+// btla-specific --
+    p_hdr = Q->p_first;
+    Q->p_first = p_hdr->p_next;
+    Q->cur_cnt++;
+
+#if (GKI_BUF_CACHE_INCLUDED == TRUE)
+    gki_cb.com.buf_shared_allocs[pool_id]++;
+
+    /* Refill the task's cache while the lock is held, so the next
+    ** allocations from this pool do not need it */
+    if (p_cache)
+    {
+        for (batch = gki_cb.com.buf_cache_depth[pool_id] / 2;
+             batch && Q->p_first && (Q->cur_cnt < Q->total); batch--)
+        {
+            p_cached = Q->p_first;
+            Q->p_first = p_cached->p_next;
+            Q->cur_cnt++;
+
+            p_cached->p_next = p_cache->p_first;
+            p_cache->p_first = p_cached;
+            p_cache->count++;
+        }
+    }
+#endif
+
+    if (!Q->p_first)
+        Q->p_last = NULL;
+
+    if(Q->cur_cnt > Q->max_cnt)
+        Q->max_cnt = Q->cur_cnt;
+
+    return (p_hdr);
+}
+
+/*******************************************************************************
+**
+** Function         gki_unlink_buf
+**
+** Description      Internal function to hand a buffer taken from a pool
+**                  over to the application.
+**
+** Returns          A pointer to the buffer
+**
+*******************************************************************************/
+static void *gki_unlink_buf (BUFFER_HDR_T *p_hdr, UINT8 task_id)
+{
+    p_hdr->task_id = task_id;
+
+    p_hdr->status  = BUF_STATUS_UNLINKED;
+    p_hdr->p_next  = NULL;
+    p_hdr->Type    = 0;
+
+    return ((void *) ((UINT8 *)p_hdr + BUFFER_HDR_SIZE));
+}
+
 /*******************************************************************************
 **
 ** Function         gki_buffer_init
@@ -165,6 +433,7 @@ void gki_buffer_init(void)
         {
             p_cb->OSTaskQFirst[tt][mb] = NULL;
             p_cb->OSTaskQLast [tt][mb] = NULL;
+            p_cb->OSTaskQCount[tt][mb] = 0;
         }
     }
 
@@ -328,6 +597,20 @@ void gki_buffer_init(void)
 
     p_cb->curr_total_no_of_pools = GKI_NUM_FIXED_BUF_POOLS;
 
+    gki_build_size_classes();
+
+#if (GKI_BUF_CACHE_INCLUDED == TRUE)
+    for (i = 0; i < GKI_NUM_TOTAL_BUF_POOLS; i++)
+    {
+        p_cb->buf_cache_depth[i] = gki_buf_cache_depth(p_cb->freeq[i].total);
+    }
+
+#if (defined(OBX_OVER_L2CAP_INCLUDED) && OBX_OVER_L2CAP_INCLUDED == TRUE)
+    /* Buffers of the OBX pool may be allocated one by one from the O/S */
+    p_cb->buf_cache_depth[GKI_POOL_ID_10] = 0;
+#endif
+#endif
+
     return;
 }
 
@@ -369,9 +652,15 @@ void GKI_init_q (BUFFER_Q *p_q)
 void *GKI_getbuf (UINT16 size)
 {
     UINT8         i;
+    UINT8         pool_id;
+    UINT8         task_id;
     FREE_QUEUE_T  *Q;
     BUFFER_HDR_T  *p_hdr;
     tGKI_COM_CB *p_cb = &gki_cb.com;
+#if (GKI_BUF_CACHE_INCLUDED == TRUE)
+    BUF_CACHE_T   *p_cache;
+    UINT8         j;
+#endif
 
     if (size == 0)
     {
@@ -379,71 +668,86 @@ void *GKI_getbuf (UINT16 size)
         return (NULL);
     }
 
-    /* Make sure the buffers aren't disturbed til finished with allocation */
-    GKI_disable();
+    task_id = GKI_get_taskid();
 
-    /* Find the first buffer pool that is public that can hold the desired size */
-    for (i=0; i < p_cb->curr_total_no_of_pools; i++)
+    /* Look up the first buffer pool that is public that can hold the desired size.
+     * The pool list and pool sizes only change while GKI is initialized. */
+    i = p_cb->size_class_pool[GKI_SIZE_CLASS(size)];
+
+    if (i == GKI_SIZE_CLASS_SCAN)
     {
-        if ( size <= p_cb->freeq[p_cb->pool_list[i]].size )
-            break;
+        /* Size class spans a pool boundary or has no public pool, search the list */
+        for (i=0; i < p_cb->curr_total_no_of_pools; i++)
+        {
+            if ( size <= p_cb->freeq[p_cb->pool_list[i]].size )
+                break;
+        }
+
+        if(i == p_cb->curr_total_no_of_pools)
+        {
+            GKI_exception (GKI_ERROR_BUF_SIZE_TOOBIG, "getbuf: Size is too big");
+            return (NULL);
+        }
+#if (defined(OBX_OVER_L2CAP_INCLUDED) && OBX_OVER_L2CAP_INCLUDED == TRUE)
+        if(i == GKI_POOL_ID_10)
+            return (NULL);
+#endif
     }
 
-    if(i == p_cb->curr_total_no_of_pools)
+#if (GKI_BUF_CACHE_INCLUDED == TRUE)
+    /* Fast path: take a buffer of the first public pool from the task's own
+     * cache without disturbing the other tasks */
+    for (j = i; j < p_cb->curr_total_no_of_pools; j++)
     {
-        GKI_exception (GKI_ERROR_BUF_SIZE_TOOBIG, "getbuf: Size is too big");
-        goto error;
+        pool_id = p_cb->pool_list[j];
+        if (((UINT16)1 << pool_id) & p_cb->pool_access_mask)
+            continue;
+
+        if ((p_cache = gki_buf_cache(task_id, pool_id)) != NULL
+            && (p_hdr = gki_buf_cache_get(p_cache)) != NULL)
+            return (gki_unlink_buf(p_hdr, task_id));
+        break;
     }
-#if (defined(OBX_OVER_L2CAP_INCLUDED) && OBX_OVER_L2CAP_INCLUDED == TRUE)
-    if(i == GKI_POOL_ID_10)
-        goto error;
 #endif
 
+    /* Make sure the buffers aren't disturbed til finished with allocation */
+    GKI_disable();
 
     /* search the public buffer pools that are big enough to hold the size
      * until a free buffer is found */
     for ( ; i < p_cb->curr_total_no_of_pools; i++)
     {
+        pool_id = p_cb->pool_list[i];
+
         /* Only look at PUBLIC buffer pools (bypass RESTRICTED pools) */
-        if (((UINT16)1 << p_cb->pool_list[i]) & p_cb->pool_access_mask)
+        if (((UINT16)1 << pool_id) & p_cb->pool_access_mask)
             continue;
 
-        Q = &p_cb->freeq[p_cb->pool_list[i]];
-
-        if(Q->cur_cnt < Q->total)
+#if (GKI_BUF_CACHE_INCLUDED == TRUE)
+        if ((p_cache = gki_buf_cache(task_id, pool_id)) != NULL
+            && (p_hdr = gki_buf_cache_get(p_cache)) != NULL)
         {
-// btla-specific ++
-        #ifdef GKI_USE_DEFERED_ALLOC_BUF_POOLS
-            if(Q->p_first == 0 && gki_alloc_free_queue(i) != TRUE)
-            {
-                GKI_enable();
-                return NULL;
-            }
-        #endif
-// btla-specific --
-            p_hdr = Q->p_first;
-            Q->p_first = p_hdr->p_next;
+            GKI_enable();
+            return (gki_unlink_buf(p_hdr, task_id));
+        }
+#endif
 
-            if (!Q->p_first)
-                Q->p_last = NULL;
+        Q = &p_cb->freeq[pool_id];
 
-            if(++Q->cur_cnt > Q->max_cnt)
-                Q->max_cnt = Q->cur_cnt;
+        if(Q->cur_cnt < Q->total)
+        {
+            p_hdr = gki_take_free_buf(pool_id, task_id);
 
             GKI_enable();
 
-            p_hdr->task_id = GKI_get_taskid();
-
-            p_hdr->status  = BUF_STATUS_UNLINKED;
-            p_hdr->p_next  = NULL;
-            p_hdr->Type    = 0;
+            if (!p_hdr)
+                return (NULL);
 
-            return ((void *) ((UINT8 *)p_hdr + BUFFER_HDR_SIZE));
+            return (gki_unlink_buf(p_hdr, task_id));
         }
     }
     GKI_exception (GKI_ERROR_OUT_OF_BUFFERS, "getbuf: out of buffers");
 
-error:
     GKI_enable();
     return (NULL);
 }
@@ -468,7 +772,11 @@ void *GKI_getpoolbuf (UINT8 pool_id)
 {
     FREE_QUEUE_T  *Q;
     BUFFER_HDR_T  *p_hdr;
+    UINT8         task_id;
     tGKI_COM_CB *p_cb = &gki_cb.com;
+#if (GKI_BUF_CACHE_INCLUDED == TRUE)
+    BUF_CACHE_T   *p_cache;
+#endif
 
     if (pool_id >= GKI_NUM_TOTAL_BUF_POOLS)
     {
@@ -476,6 +784,15 @@ void *GKI_getpoolbuf (UINT8 pool_id)
         return (NULL);
     }
 
+    task_id = GKI_get_taskid();
+
+#if (GKI_BUF_CACHE_INCLUDED == TRUE)
+    /* Fast path: the task's own cache needs no lock */
+    if ((p_cache = gki_buf_cache(task_id, pool_id)) != NULL
+        && (p_hdr = gki_buf_cache_get(p_cache)) != NULL)
+        return (gki_unlink_buf(p_hdr, task_id));
+#endif
+
     /* Make sure the buffers aren't disturbed til finished with allocation */
     GKI_disable();
 
@@ -512,34 +829,14 @@ void *GKI_getpoolbuf (UINT8 pool_id)
 #endif
 #endif
 
-// btla-specific ++
-#ifdef GKI_USE_DEFERED_ALLOC_BUF_POOLS
-        if(Q->p_first == 0 && gki_alloc_free_queue(pool_id) != TRUE)
-        {
-            GKI_enable();
-            return NULL;
-        }
-#endif
-// btla-specific --
-        p_hdr = Q->p_first;
-        Q->p_first = p_hdr->p_next;
-
-        if (!Q->p_first)
-            Q->p_last = NULL;
-
-        if(++Q->cur_cnt > Q->max_cnt)
-            Q->max_cnt = Q->cur_cnt;
+        p_hdr = gki_take_free_buf(pool_id, task_id);
 
         GKI_enable();
 
+        if (!p_hdr)
+            return (NULL);
 
-        p_hdr->task_id = GKI_get_taskid();
-
-        p_hdr->status  = BUF_STATUS_UNLINKED;
-        p_hdr->p_next  = NULL;
-        p_hdr->Type    = 0;
-
-        return ((void *) ((UINT8 *)p_hdr + BUFFER_HDR_SIZE));
+        return (gki_unlink_buf(p_hdr, task_id));
     }
 
     /* If here, no buffers in the specified pool */
@@ -590,6 +887,10 @@ void GKI_freebuf (void *p_buf)
 {
     FREE_QUEUE_T    *Q;
     BUFFER_HDR_T    *p_hdr;
+#if (GKI_BUF_CACHE_INCLUDED == TRUE)
+    BUF_CACHE_T     *p_cache;
+    UINT16          depth;
+#endif
 
 #if (GKI_ENABLE_BUF_CORRUPTION_CHECK == TRUE)
     if (!p_buf || gki_chk_buf_damage(p_buf))
@@ -613,6 +914,25 @@ void GKI_freebuf (void *p_buf)
         return;
     }
 
+#if (GKI_BUF_CACHE_INCLUDED == TRUE)
+    /* Keep the buffer in the freeing task's cache. When the cache is full,
+    ** half of it goes back to the shared pool in one lock acquisition. */
+    if ((p_cache = gki_buf_cache(GKI_get_taskid(), p_hdr->q_id)) != NULL)
+    {
+        depth = gki_cb.com.buf_cache_depth[p_hdr->q_id];
+        if (p_cache->count >= depth)
+            gki_buf_cache_drain(p_cache, p_hdr->q_id, depth / 2);
+
+        p_hdr->status    = BUF_STATUS_FREE;
+        p_hdr->task_id   = GKI_INVALID_TASK;
+        p_hdr->p_next    = p_cache->p_first;
+        p_cache->p_first = p_hdr;
+        p_cache->count++;
+
+        return;
+    }
+#endif
+
     GKI_disable();
 #if (defined(OBX_OVER_L2CAP_INCLUDED) && OBX_OVER_L2CAP_INCLUDED == TRUE)
 #if (defined(OBX_OVER_L2C_DYNAMIC_POOL_ENABLED) && OBX_OVER_L2C_DYNAMIC_POOL_ENABLED == TRUE)
@@ -725,7 +1045,11 @@ BOOLEAN gki_chk_buf_damage(void *p_buf)
 void GKI_send_msg (UINT8 task_id, UINT8 mbox, void *msg)
 {
     BUFFER_HDR_T    *p_hdr;
+    BOOLEAN         was_empty;
     tGKI_COM_CB *p_cb = &gki_cb.com;
+#if (GKI_TASK_STATS_INCLUDED == TRUE)
+    TASK_STATS_T    *p_stats;
+#endif
 
     /* If task non-existant or not started, drop buffer */
     if ((task_id >= GKI_MAX_TASKS) || (mbox >= NUM_TASK_MBOX) || (p_cb->OSRdyTbl[task_id] == TASK_DEAD))
@@ -753,25 +1077,80 @@ void GKI_send_msg (UINT8 task_id, UINT8 mbox, void *msg)
 
     GKI_disable();
 
-    if (p_cb->OSTaskQFirst[task_id][mbox])
+    was_empty = (p_cb->OSTaskQFirst[task_id][mbox] == NULL);
+
+    if (!was_empty)
         p_cb->OSTaskQLast[task_id][mbox]->p_next = p_hdr;
     else
         p_cb->OSTaskQFirst[task_id][mbox] = p_hdr;
 
     p_cb->OSTaskQLast[task_id][mbox] = p_hdr;
+    p_cb->OSTaskQCount[task_id][mbox]++;
 
     p_hdr->p_next = NULL;
     p_hdr->status = BUF_STATUS_QUEUED;
     p_hdr->task_id = task_id;
 
+#if (GKI_TASK_STATS_INCLUDED == TRUE)
+    p_stats = &p_cb->task_stats[task_id];
+    p_stats->msgs_sent++;
+    if (p_cb->OSTaskQCount[task_id][mbox] > p_stats->max_depth)
+        p_stats->max_depth = p_cb->OSTaskQCount[task_id][mbox];
+
+    if (was_empty)
+    {
+        p_cb->OSTaskQPostTime[task_id][mbox] = GKI_get_time_us();
+        p_stats->wakeups++;
+    }
+    else
+        p_stats->wakeups_coalesced++;
+#endif
 
     GKI_enable();
 
-    GKI_send_event(task_id, (UINT16)EVENT_MASK(mbox));
+    /* A mailbox that was already non-empty has had its event sent and not yet
+    ** been drained; GKI_wait() reports non-empty mailboxes, so the task will
+    ** pick this buffer up without another signal. */
+    if (was_empty)
+        GKI_send_event(task_id, (UINT16)EVENT_MASK(mbox));
 
     return;
 }
 
+#if (GKI_TASK_STATS_INCLUDED == TRUE)
+/*******************************************************************************
+**
+** Function         gki_mbox_read_stats
+**
+** Description      Internal function to account for buffers read from a task
+**                  mailbox. Called with GKI_disable() held. The first read
+**                  after the mailbox became non-empty gives a sample of the
+**                  time it took the task to get to the message.
+**
+** Returns          void
+**
+*******************************************************************************/
+static void gki_mbox_read_stats (UINT8 task_id, UINT8 mbox, UINT16 count)
+{
+    tGKI_COM_CB     *p_cb = &gki_cb.com;
+    TASK_STATS_T    *p_stats = &p_cb->task_stats[task_id];
+    UINT64          latency;
+
+    p_stats->msgs_read += count;
+
+    if (p_cb->OSTaskQPostTime[task_id][mbox])
+    {
+        latency = GKI_get_time_us() - p_cb->OSTaskQPostTime[task_id][mbox];
+        p_cb->OSTaskQPostTime[task_id][mbox] = 0;
+
+        p_stats->dispatch_count++;
+        p_stats->dispatch_total_us += latency;
+        if (latency > p_stats->dispatch_max_us)
+            p_stats->dispatch_max_us = (UINT32)latency;
+    }
+}
+#endif
+
 /*******************************************************************************
 **
 ** Function         GKI_read_mbox
@@ -799,11 +1178,16 @@ void *GKI_read_mbox (UINT8 mbox)
     {
         p_hdr = gki_cb.com.OSTaskQFirst[task_id][mbox];
         gki_cb.com.OSTaskQFirst[task_id][mbox] = p_hdr->p_next;
+        gki_cb.com.OSTaskQCount[task_id][mbox]--;
 
         p_hdr->p_next = NULL;
         p_hdr->status = BUF_STATUS_UNLINKED;
 
         p_buf = (UINT8 *)p_hdr + BUFFER_HDR_SIZE;
+
+#if (GKI_TASK_STATS_INCLUDED == TRUE)
+        gki_mbox_read_stats(task_id, mbox, 1);
+#endif
     }
 
     GKI_enable();
@@ -811,6 +1195,134 @@ void *GKI_read_mbox (UINT8 mbox)
     return (p_buf);
 }
 
+/*******************************************************************************
+**
+** Function         GKI_read_mbox_all
+**
+** Description      Called by applications to take every buffer from one of
+**                  the task mailboxes in a single GKI_disable() section. The
+**                  buffers are appended, in order, to a queue owned by the
+**                  calling task, from which they are taken with
+**                  GKI_dequeue_batch(). A task can only read its own mailbox.
+**
+** Parameters:      mbox  - (input) mailbox ID to read (0, 1, 2, or 3)
+**                  p_q   - (input) task-private queue to receive the buffers
+**
+** Returns          the number of buffers moved to the queue
+**
+*******************************************************************************/
+UINT16 GKI_read_mbox_all (UINT8 mbox, BUFFER_Q *p_q)
+{
+    UINT8           task_id = GKI_get_taskid();
+    BUFFER_HDR_T    *p_first;
+    BUFFER_HDR_T    *p_last;
+    UINT16          count;
+
+    if ((task_id >= GKI_MAX_TASKS) || (mbox >= NUM_TASK_MBOX) || !p_q)
+        return (0);
+
+    GKI_disable();
+
+    p_first = gki_cb.com.OSTaskQFirst[task_id][mbox];
+    p_last  = gki_cb.com.OSTaskQLast[task_id][mbox];
+    count   = gki_cb.com.OSTaskQCount[task_id][mbox];
+
+    gki_cb.com.OSTaskQFirst[task_id][mbox] = NULL;
+    gki_cb.com.OSTaskQLast [task_id][mbox] = NULL;
+    gki_cb.com.OSTaskQCount[task_id][mbox] = 0;
+
+#if (GKI_TASK_STATS_INCLUDED == TRUE)
+    if (count)
+        gki_mbox_read_stats(task_id, mbox, count);
+#endif
+
+    GKI_enable();
+
+    if (!p_first)
+        return (0);
+
+    /* The buffers now belong to the calling task only */
+    if (p_q->p_last)
+        ((BUFFER_HDR_T *)((UINT8 *)p_q->p_last - BUFFER_HDR_SIZE))->p_next = p_first;
+    else
+        p_q->p_first = (UINT8 *)p_first + BUFFER_HDR_SIZE;
+
+    p_q->p_last = (UINT8 *)p_last + BUFFER_HDR_SIZE;
+    p_q->count += count;
+
+    return (count);
+}
+
+/*******************************************************************************
+**
+** Function         GKI_get_task_stats
+**
+** Description      Called by an application to get the mailbox statistics
+**                  of a task.
+**
+** Parameters:      task_id - (input) task id.
+**                  p_stats - (output) statistics of the task
+**
+** Returns          TRUE if statistics were returned
+**
+*******************************************************************************/
+BOOLEAN GKI_get_task_stats (UINT8 task_id, tGKI_TASK_STATS *p_stats)
+{
+#if (GKI_TASK_STATS_INCLUDED == TRUE)
+    TASK_STATS_T    *p_ts;
+    UINT64          elapsed_us;
+
+    if ((task_id >= GKI_MAX_TASKS) || !p_stats)
+        return (FALSE);
+
+    p_ts = &gki_cb.com.task_stats[task_id];
+
+    GKI_disable();
+
+    elapsed_us = GKI_get_time_us() - p_ts->start_us;
+
+    p_stats->msgs_read         = p_ts->msgs_read;
+    p_stats->msgs_per_sec      = elapsed_us ? (UINT32)(((UINT64)p_ts->msgs_read * 1000000) / elapsed_us) : 0;
+    p_stats->wakeups           = p_ts->wakeups;
+    p_stats->wakeups_coalesced = p_ts->wakeups_coalesced;
+    p_stats->max_queue_depth   = p_ts->max_depth;
+    p_stats->avg_dispatch_us   = p_ts->dispatch_count ? (UINT32)(p_ts->dispatch_total_us / p_ts->dispatch_count) : 0;
+    p_stats->max_dispatch_us   = p_ts->dispatch_max_us;
+
+    GKI_enable();
+
+    return (TRUE);
+#else
+    return (FALSE);
+#endif
+}
+
+/*******************************************************************************
+**
+** Function         GKI_reset_task_stats
+**
+** Description      Called to restart the mailbox statistics of a task.
+**
+** Parameters:      task_id - (input) task id.
+**
+** Returns          void
+**
+*******************************************************************************/
+void GKI_reset_task_stats (UINT8 task_id)
+{
+#if (GKI_TASK_STATS_INCLUDED == TRUE)
+    if (task_id >= GKI_MAX_TASKS)
+        return;
+
+    GKI_disable();
+
+    memset(&gki_cb.com.task_stats[task_id], 0, sizeof(TASK_STATS_T));
+    gki_cb.com.task_stats[task_id].start_us = GKI_get_time_us();
+
+    GKI_enable();
+#endif
+}
+
 
 
 /*******************************************************************************
@@ -969,6 +1481,46 @@ void *GKI_dequeue (BUFFER_Q *p_q)
 }
 
 
+/*******************************************************************************
+**
+** Function         GKI_dequeue_batch
+**
+** Description      Dequeue a buffer from the head of a queue filled by
+**                  GKI_read_mbox_all(). The queue is private to the calling
+**                  task, so unlike GKI_dequeue() this does not take the GKI
+**                  lock.
+**
+** Parameters:      p_q  - (input) pointer to a task-private queue.
+**
+** Returns          NULL if queue is empty, else buffer
+**
+*******************************************************************************/
+void *GKI_dequeue_batch (BUFFER_Q *p_q)
+{
+    BUFFER_HDR_T    *p_hdr;
+
+    if (!p_q || !p_q->count)
+        return (NULL);
+
+    p_hdr = (BUFFER_HDR_T *)((UINT8 *)p_q->p_first - BUFFER_HDR_SIZE);
+
+    if (p_hdr->p_next)
+        p_q->p_first = ((UINT8 *)p_hdr->p_next + BUFFER_HDR_SIZE);
+    else
+    {
+        p_q->p_first = NULL;
+        p_q->p_last  = NULL;
+    }
+
+    p_q->count--;
+
+    p_hdr->p_next = NULL;
+    p_hdr->status = BUF_STATUS_UNLINKED;
+
+    return ((UINT8 *)p_hdr + BUFFER_HDR_SIZE);
+}
+
+
 /*******************************************************************************
 **
 ** Function         GKI_remove_from_queue
@@ -1130,6 +1682,8 @@ static void gki_add_to_pool_list(UINT8 pool_id)
 
     p_cb->pool_list[i] = pool_id;
 
+    gki_build_size_classes();
+
     return;
 }
 
@@ -1159,9 +1713,87 @@ static void gki_remove_from_pool_list(UINT8 pool_id)
         i++;
     }
 
+    gki_build_size_classes();
+
     return;
 }
 
+/*******************************************************************************
+**
+** Function         gki_first_public_pool
+**
+** Description      Searches the pool list the way GKI_getbuf did before the
+**                  size class table: the first pool that can hold the size,
+**                  then the first public pool from there on.
+**
+** Returns          index into pool_list, or GKI_SIZE_CLASS_SCAN if no
+**                  public pool can hold the size
+**
+*******************************************************************************/
+static UINT8 gki_first_public_pool(UINT16 size)
+{
+    tGKI_COM_CB *p_cb = &gki_cb.com;
+    UINT8 i;
+
+    for (i=0; i < p_cb->curr_total_no_of_pools; i++)
+    {
+        if (size <= p_cb->freeq[p_cb->pool_list[i]].size)
+            break;
+    }
+
+#if (defined(OBX_OVER_L2CAP_INCLUDED) && OBX_OVER_L2CAP_INCLUDED == TRUE)
+    if (i == GKI_POOL_ID_10)
+        return (GKI_SIZE_CLASS_SCAN);
+#endif
+
+    for ( ; i < p_cb->curr_total_no_of_pools; i++)
+    {
+        if (!(((UINT16)1 << p_cb->pool_list[i]) & p_cb->pool_access_mask))
+            return (i);
+    }
+
+    return (GKI_SIZE_CLASS_SCAN);
+}
+
+/*******************************************************************************
+**
+** Function         gki_build_size_classes
+**
+** Description      Rebuilds the size class table used by GKI_getbuf. Must be
+**                  called whenever the pool list, the pool sizes or the pool
+**                  access mask change.
+**
+**                  Each size class maps to the first public pool that can
+**                  hold every size in the class. Classes spanning a pool
+**                  boundary, or without a public pool, are marked
+**                  GKI_SIZE_CLASS_SCAN so GKI_getbuf searches the list.
+**
+** Returns          void
+**
+*******************************************************************************/
+static void gki_build_size_classes(void)
+{
+    tGKI_COM_CB *p_cb = &gki_cb.com;
+    UINT32  c;
+    UINT32  last;
+    UINT8   first;
+
+    for (c = 0; c < GKI_NUM_SIZE_CLASSES; c++)
+    {
+        last  = (c + 1) << GKI_SIZE_CLASS_SHIFT;
+        if (last > 0xFFFF)
+            last = 0xFFFF;
+
+        /* The search result only moves forward as the size grows, so the
+        ** class is uniform if its smallest and largest sizes agree */
+        first = gki_first_public_pool((UINT16)((c << GKI_SIZE_CLASS_SHIFT) + 1));
+        if (first != gki_first_public_pool((UINT16)last))
+            first = GKI_SIZE_CLASS_SCAN;
+
+        p_cb->size_class_pool[c] = first;
+    }
+}
+
 /*******************************************************************************
 **
 ** Function         GKI_igetpoolbuf
@@ -1207,6 +1839,30 @@ void *GKI_igetpoolbuf (UINT8 pool_id)
     return (NULL);
 }
 
+/*******************************************************************************
+**
+** Function         gki_pool_used_count
+**
+** Description      Internal function to get the number of buffers of a pool
+**                  in use by the application. Buffers held in task caches
+**                  are free as far as the application is concerned.
+**
+** Returns          the number of buffers in use
+**
+*******************************************************************************/
+static UINT16 gki_pool_used_count (UINT8 pool_id)
+{
+    UINT16  used = gki_cb.com.freeq[pool_id].cur_cnt;
+#if (GKI_BUF_CACHE_INCLUDED == TRUE)
+    UINT16  cached = gki_buf_cache_count(pool_id);
+
+    /* The caches are read without the lock, so the counts may briefly disagree */
+    used = (used > cached) ? (UINT16)(used - cached) : 0;
+#endif
+
+    return (used);
+}
+
 /*******************************************************************************
 **
 ** Function         GKI_poolcount
@@ -1248,7 +1904,7 @@ UINT16 GKI_poolfreecount (UINT8 pool_id)
 
     Q  = &gki_cb.com.freeq[pool_id];
 
-    return ((UINT16)(Q->total - Q->cur_cnt));
+    return ((UINT16)(Q->total - gki_pool_used_count(pool_id)));
 }
 
 /*******************************************************************************
@@ -1294,6 +1950,42 @@ UINT16 GKI_poolutilization (UINT8 pool_id)
     if (Q->total == 0)
         return (100);
 
-    return ((Q->cur_cnt * 100) / Q->total);
+    return ((gki_pool_used_count(pool_id) * 100) / Q->total);
+}
+
+/*******************************************************************************
+**
+** Function         GKI_poolcachehitrate
+**
+** Description      Called by an application to get the share of allocations
+**                  from the specified buffer pool that were served from the
+**                  per-task buffer caches without taking the GKI lock.
+**
+** Parameters       pool_id - (input) pool ID to get the hit rate of.
+**
+** Returns          % of allocations served from task caches from 0 to 100
+**
+*******************************************************************************/
+UINT16 GKI_poolcachehitrate (UINT8 pool_id)
+{
+#if (GKI_BUF_CACHE_INCLUDED == TRUE)
+    UINT8   i;
+    UINT64  hits = 0;
+    UINT64  total;
+
+    if (pool_id >= GKI_NUM_TOTAL_BUF_POOLS)
+        return (0);
+
+    for (i = 0; i < GKI_MAX_TASKS; i++)
+        hits += gki_cb.com.buf_cache[i][pool_id].hits;
+
+    total = hits + gki_cb.com.buf_shared_allocs[pool_id];
+    if (total == 0)
+        return (0);
+
+    return ((UINT16)((hits * 100) / total));
+#else
+    return (0);
+#endif
 }
 
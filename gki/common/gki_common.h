@@ -75,6 +75,34 @@ typedef struct _free_queue
 	UINT16		 max_cnt;       /* maximum number of buffers allocated at any time */
 } FREE_QUEUE_T;
 
+#if (GKI_BUF_CACHE_INCLUDED == TRUE)
+/* Per-task cache of free buffers for one pool. Only the owning task adds and
+** removes buffers, so the cache itself is used without GKI_disable().
+*/
+typedef struct
+{
+    BUFFER_HDR_T *p_first;      /* first buffer in the cache */
+    UINT16        count;        /* number of buffers in the cache */
+    UINT32        hits;         /* number of allocations served from the cache */
+} BUF_CACHE_T;
+#endif
+
+#if (GKI_TASK_STATS_INCLUDED == TRUE)
+/* Mailbox statistics of one task. Updated with GKI_disable() held. */
+typedef struct
+{
+    UINT32  msgs_sent;          /* messages posted to the task's mailboxes */
+    UINT32  msgs_read;          /* messages read by the task */
+    UINT32  wakeups;            /* posts that had to signal the task */
+    UINT32  wakeups_coalesced;  /* posts that found the mailbox already pending */
+    UINT16  max_depth;          /* deepest any mailbox of the task has been */
+    UINT32  dispatch_count;     /* number of dispatch latency samples */
+    UINT64  dispatch_total_us;  /* sum of the dispatch latency samples */
+    UINT32  dispatch_max_us;    /* largest dispatch latency sample */
+    UINT64  start_us;           /* time the statistics were last reset */
+} TASK_STATS_T;
+#endif
+
 
 /* Buffer related defines
 */
@@ -84,6 +112,13 @@ typedef struct _free_queue
 #define MAX_USER_BUF_SIZE   ((UINT16)0xffff - BUFFER_PADDING_SIZE)  /* pool size must allow for header */
 #define MAGIC_NO            0xDDBADDBA
 
+/* GKI_getbuf() maps a requested size to a pool through a table of size classes
+*/
+#define GKI_SIZE_CLASS_SHIFT    5                                   /* 32 byte size classes */
+#define GKI_NUM_SIZE_CLASSES    ((0xFFFF >> GKI_SIZE_CLASS_SHIFT) + 1)
+#define GKI_SIZE_CLASS(size)    (((size) - 1) >> GKI_SIZE_CLASS_SHIFT)
+#define GKI_SIZE_CLASS_SCAN     0xFF                                /* class must scan the pool list */
+
 #define BUF_STATUS_FREE     0
 #define BUF_STATUS_UNLINKED 1
 #define BUF_STATUS_QUEUED   2
@@ -298,6 +333,12 @@ typedef struct
     */
     BUFFER_HDR_T    *OSTaskQFirst[GKI_MAX_TASKS][NUM_TASK_MBOX]; /* array of pointers to the first event in the task mailbox */
     BUFFER_HDR_T    *OSTaskQLast [GKI_MAX_TASKS][NUM_TASK_MBOX]; /* array of pointers to the last event in the task mailbox */
+    UINT16           OSTaskQCount[GKI_MAX_TASKS][NUM_TASK_MBOX]; /* number of buffers in each task mailbox */
+
+#if (GKI_TASK_STATS_INCLUDED == TRUE)
+    UINT64           OSTaskQPostTime[GKI_MAX_TASKS][NUM_TASK_MBOX]; /* time the mailbox last became non-empty */
+    TASK_STATS_T     task_stats[GKI_MAX_TASKS];
+#endif
 
     /* Define the buffer pool management variables
     */
@@ -307,6 +348,13 @@ typedef struct
     UINT16   pool_max_count[GKI_NUM_TOTAL_BUF_POOLS];
     UINT16   pool_additions[GKI_NUM_TOTAL_BUF_POOLS];
 
+#if (GKI_BUF_CACHE_INCLUDED == TRUE)
+    /* Per-task free buffer caches in front of the shared free queues */
+    BUF_CACHE_T buf_cache[GKI_MAX_TASKS][GKI_NUM_TOTAL_BUF_POOLS];
+    UINT16      buf_cache_depth[GKI_NUM_TOTAL_BUF_POOLS];   /* max buffers cached per task, 0 if pool is not cached */
+    UINT32      buf_shared_allocs[GKI_NUM_TOTAL_BUF_POOLS]; /* allocations served from the shared free queue */
+#endif
+
     /* Define the buffer pool start addresses
     */
     UINT8   *pool_start[GKI_NUM_TOTAL_BUF_POOLS];   /* array of pointers to the start of each buffer pool */
@@ -318,6 +366,7 @@ typedef struct
     UINT16      pool_access_mask;                   /* Bits are set if the corresponding buffer pool is a restricted pool */
     UINT8       pool_list[GKI_NUM_TOTAL_BUF_POOLS]; /* buffer pools arranged in the order of size */
     UINT8       curr_total_no_of_pools;             /* number of fixed buf pools + current number of dynamic pools */
+    UINT8       size_class_pool[GKI_NUM_SIZE_CLASSES]; /* first public pool_list entry for each size class */
 
     BOOLEAN     timer_nesting;                      /* flag to prevent timer interrupt nesting */
 
@@ -345,6 +394,10 @@ extern void      gki_adjust_timer_count (INT32);
 extern void      gki_dealloc_free_queue(void);
 #endif
 
+#if (GKI_BUF_CACHE_INCLUDED == TRUE)
+extern void      gki_buf_cache_flush(UINT8 task_id);
+#endif
+
 
 /* Debug aids
 */
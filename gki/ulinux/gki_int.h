@@ -64,6 +64,12 @@ typedef struct
 #if (GKI_DEBUG == TRUE)
     pthread_mutex_t     GKI_trace_mutex;
 #endif
+#if (GKI_LATENCY_STATS_INCLUDED == TRUE)
+    BOOLEAN             lat_stats_enabled;              /* TRUE while wake-up latencies are recorded */
+    BOOLEAN             thread_waiting[GKI_MAX_TASKS];  /* task is blocked in GKI_wait() */
+    UINT64              wake_signal_us[GKI_MAX_TASKS];  /* time the blocked task was first signalled */
+    tGKI_LAT_HIST       wake_hist[GKI_MAX_TASKS];       /* signal to wake-up latency of each task */
+#endif
 } tGKI_OS;
 
 extern void gki_system_tick_start_stop_cback(BOOLEAN start);
@@ -27,6 +27,7 @@
 #include "bt_target.h"
 
 #include <assert.h>
+#include <stdio.h>
 #include <sys/times.h>
 
 #include "gki_int.h"
@@ -274,6 +275,12 @@ static void gki_task_entry(UINT32 params)
     /* Call the actual thread entry point */
     (p_pthread_info->task_entry)(p_pthread_info->params);
 
+#if (GKI_BUF_CACHE_INCLUDED == TRUE)
+    /* Give the buffers cached by the task back to the shared pools. Only
+    ** this thread may touch its cache, GKI_exit_task can run elsewhere. */
+    gki_buf_cache_flush(p_pthread_info->task_id);
+#endif
+
     ALOGI("gki_task task_id=%i [%s] terminating\n", p_pthread_info->task_id,
                 gki_cb.com.OSTName[p_pthread_info->task_id]);
 
@@ -346,6 +353,39 @@ UINT32 GKI_get_os_tick_count(void)
     return gki_cb.com.OSTicks;
 }
 
+/*******************************************************************************
+**
+** Function         GKI_get_time_us
+**
+** Description      This function reads the monotonic clock used for the task
+**                  statistics and latency measurements.
+**
+** Returns          Monotonic time in microseconds.
+**
+*******************************************************************************/
+UINT64 GKI_get_time_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((UINT64)ts.tv_sec * USEC_PER_SEC) + (ts.tv_nsec / NSEC_PER_USEC);
+}
+
+/*******************************************************************************
+**
+** Function         GKI_get_boot_time_ms
+**
+** Description      This function reads the clock the GKI timers follow, which
+**                  keeps counting while the system is suspended.
+**
+** Returns          Time since boot in milliseconds.
+**
+*******************************************************************************/
+UINT64 GKI_get_boot_time_ms(void)
+{
+    return now_us() / 1000;
+}
+
 /*******************************************************************************
 **
 ** Function         GKI_create_task
@@ -390,6 +430,8 @@ UINT8 GKI_create_task (TASKPTR task_entry, UINT8 task_id, INT8 *taskname, UINT16
     gki_cb.com.OSWaitTmr[task_id]   = 0;
     gki_cb.com.OSWaitEvt[task_id]   = 0;
 
+    GKI_reset_task_stats(task_id);
+
     /* Initialize mutex and condition variable objects for events and timeouts */
     pthread_condattr_t cond_attr;
     pthread_condattr_init(&cond_attr);
@@ -744,6 +786,29 @@ void GKI_stop (void)
 }
 
 
+/*******************************************************************************
+**
+** Function         gki_refresh_mbox_events
+**
+** Description      Internal function to set the event bit of every non-empty
+**                  mailbox of a task. Called with thread_evt_mutex held.
+**
+** Returns          void
+**
+*******************************************************************************/
+static void gki_refresh_mbox_events (UINT8 rtask)
+{
+    if (gki_cb.com.OSTaskQFirst[rtask][0])
+        gki_cb.com.OSWaitEvt[rtask] |= TASK_MBOX_0_EVT_MASK;
+    if (gki_cb.com.OSTaskQFirst[rtask][1])
+        gki_cb.com.OSWaitEvt[rtask] |= TASK_MBOX_1_EVT_MASK;
+    if (gki_cb.com.OSTaskQFirst[rtask][2])
+        gki_cb.com.OSWaitEvt[rtask] |= TASK_MBOX_2_EVT_MASK;
+    if (gki_cb.com.OSTaskQFirst[rtask][3])
+        gki_cb.com.OSWaitEvt[rtask] |= TASK_MBOX_3_EVT_MASK;
+}
+
+
 /*******************************************************************************
 **
 ** Function         GKI_wait
@@ -778,8 +843,16 @@ UINT16 GKI_wait (UINT16 flag, UINT32 timeout)
     /* protect OSWaitEvt[rtask] from modification from an other thread */
     pthread_mutex_lock(&gki_cb.os.thread_evt_mutex[rtask]);
 
+    /* GKI_send_msg() only signals a mailbox that was empty, so buffers left
+       behind by a partial read must be reported here rather than waited for */
+    gki_refresh_mbox_events(rtask);
+
     if (!(gki_cb.com.OSWaitEvt[rtask] & flag))
     {
+#if (GKI_LATENCY_STATS_INCLUDED == TRUE)
+        gki_cb.os.thread_waiting[rtask] = TRUE;
+#endif
+
         if (timeout)
         {
             clock_gettime(CLOCK_MONOTONIC, &abstime);
@@ -803,6 +876,18 @@ UINT16 GKI_wait (UINT16 flag, UINT32 timeout)
             pthread_cond_wait(&gki_cb.os.thread_evt_cond[rtask], &gki_cb.os.thread_evt_mutex[rtask]);
         }
 
+#if (GKI_LATENCY_STATS_INCLUDED == TRUE)
+        gki_cb.os.thread_waiting[rtask] = FALSE;
+
+        /* Time from the first GKI_send_event() to this task running again */
+        if (gki_cb.os.wake_signal_us[rtask])
+        {
+            GKI_lat_hist_add(&gki_cb.os.wake_hist[rtask],
+                             (UINT32)(GKI_get_time_us() - gki_cb.os.wake_signal_us[rtask]));
+            gki_cb.os.wake_signal_us[rtask] = 0;
+        }
+#endif
+
         /* TODO: check, this is probably neither not needed depending on phtread_cond_wait() implmentation,
          e.g. it looks like it is implemented as a counter in which case multiple cond_signal
          should NOT be lost! */
@@ -811,14 +896,7 @@ UINT16 GKI_wait (UINT16 flag, UINT32 timeout)
            no need to call GKI_disable() here as we know that we will have some events as we've been waking
            up after condition pending or timeout */
 
-        if (gki_cb.com.OSTaskQFirst[rtask][0])
-            gki_cb.com.OSWaitEvt[rtask] |= TASK_MBOX_0_EVT_MASK;
-        if (gki_cb.com.OSTaskQFirst[rtask][1])
-            gki_cb.com.OSWaitEvt[rtask] |= TASK_MBOX_1_EVT_MASK;
-        if (gki_cb.com.OSTaskQFirst[rtask][2])
-            gki_cb.com.OSWaitEvt[rtask] |= TASK_MBOX_2_EVT_MASK;
-        if (gki_cb.com.OSTaskQFirst[rtask][3])
-            gki_cb.com.OSWaitEvt[rtask] |= TASK_MBOX_3_EVT_MASK;
+        gki_refresh_mbox_events(rtask);
 
         if (gki_cb.com.OSRdyTbl[rtask] == TASK_DEAD)
         {
@@ -918,6 +996,14 @@ UINT8 GKI_send_event (UINT8 task_id, UINT16 event)
         /* Set the event bit */
         gki_cb.com.OSWaitEvt[task_id] |= event;
 
+#if (GKI_LATENCY_STATS_INCLUDED == TRUE)
+        if (gki_cb.os.lat_stats_enabled && gki_cb.os.thread_waiting[task_id] &&
+            !gki_cb.os.wake_signal_us[task_id])
+        {
+            gki_cb.os.wake_signal_us[task_id] = GKI_get_time_us();
+        }
+#endif
+
         pthread_cond_signal(&gki_cb.os.thread_evt_cond[task_id]);
 
         pthread_mutex_unlock(&gki_cb.os.thread_evt_mutex[task_id]);
@@ -1157,9 +1243,29 @@ void GKI_os_free (void *p_mem)
 *******************************************************************************/
 void GKI_exit_task (UINT8 task_id)
 {
+#if (GKI_TASK_STATS_INCLUDED == TRUE)
+    tGKI_TASK_STATS stats;
+#endif
+
     GKI_disable();
     gki_cb.com.OSRdyTbl[task_id] = TASK_DEAD;
 
+#if (GKI_TASK_STATS_INCLUDED == TRUE)
+    if (GKI_get_task_stats(task_id, &stats))
+    {
+        ALOGI("GKI task %d: %u msgs (%u/s), %u wakeups, %u coalesced, max depth %u, "
+              "dispatch avg %u us max %u us", task_id, stats.msgs_read, stats.msgs_per_sec,
+              stats.wakeups, stats.wakeups_coalesced, stats.max_queue_depth,
+              stats.avg_dispatch_us, stats.max_dispatch_us);
+    }
+#endif
+
+#if (GKI_BUF_CACHE_INCLUDED == TRUE)
+    /* Give the buffers cached by the task back to the shared pools when the
+    ** task exits itself; otherwise gki_task_entry does it on the task's thread */
+    gki_buf_cache_flush(task_id);
+#endif
+
     /* Destroy mutex and condition variable objects */
     pthread_mutex_destroy(&gki_cb.os.thread_evt_mutex[task_id]);
     pthread_cond_destroy (&gki_cb.os.thread_evt_cond[task_id]);
@@ -1171,3 +1277,172 @@ void GKI_exit_task (UINT8 task_id)
     ALOGI("GKI_exit_task %d done", task_id);
     return;
 }
+
+/*******************************************************************************
+**
+** Function         GKI_enable_latency_stats
+**
+** Description      This function turns recording of the task wake-up latency
+**                  histograms on or off. Turning it on clears the histograms.
+**
+** Parameters:      enable - (input) TRUE to record latencies
+**
+** Returns          void
+**
+*******************************************************************************/
+void GKI_enable_latency_stats (BOOLEAN enable)
+{
+#if (GKI_LATENCY_STATS_INCLUDED == TRUE)
+    UINT8 task_id;
+
+    if (enable && !gki_cb.os.lat_stats_enabled)
+    {
+        for (task_id = 0; task_id < GKI_MAX_TASKS; task_id++)
+            memset(&gki_cb.os.wake_hist[task_id], 0, sizeof(tGKI_LAT_HIST));
+    }
+
+    gki_cb.os.lat_stats_enabled = enable;
+#endif
+}
+
+/*******************************************************************************
+**
+** Function         GKI_latency_stats_enabled
+**
+** Description      This function tells whether latencies are being recorded.
+**                  Callers that time their own handlers use it to skip the
+**                  clock reads when recording is off.
+**
+** Returns          TRUE if latency recording is on
+**
+*******************************************************************************/
+BOOLEAN GKI_latency_stats_enabled (void)
+{
+#if (GKI_LATENCY_STATS_INCLUDED == TRUE)
+    return gki_cb.os.lat_stats_enabled;
+#else
+    return FALSE;
+#endif
+}
+
+/*******************************************************************************
+**
+** Function         GKI_lat_hist_add
+**
+** Description      This function adds a sample to a latency histogram.
+**
+** Parameters:      p_hist - (input) histogram to update
+**                  us     - (input) the sample in microseconds
+**
+** Returns          void
+**
+*******************************************************************************/
+void GKI_lat_hist_add (tGKI_LAT_HIST *p_hist, UINT32 us)
+{
+    UINT32 bucket = (us < 2) ? 0 : (31 - __builtin_clz(us));
+
+    if (bucket >= GKI_LAT_HIST_BUCKETS)
+        bucket = GKI_LAT_HIST_BUCKETS - 1;
+
+    p_hist->bucket[bucket]++;
+    p_hist->count++;
+    p_hist->total_us += us;
+    if (us > p_hist->max_us)
+        p_hist->max_us = us;
+}
+
+/*******************************************************************************
+**
+** Function         GKI_lat_hist_dump
+**
+** Description      This function writes a latency histogram to a file
+**                  descriptor as one summary line and one line of the
+**                  non-empty buckets, each labelled with its upper bound.
+**
+** Parameters:      fd     - (input) file descriptor to write to
+**                  p_name - (input) label of the histogram
+**                  p_hist - (input) histogram to write
+**
+** Returns          void
+**
+*******************************************************************************/
+void GKI_lat_hist_dump (int fd, const char *p_name, const tGKI_LAT_HIST *p_hist)
+{
+    char    line[GKI_LAT_HIST_BUCKETS * 24];
+    int     len = 0;
+    UINT32  i;
+
+    if (p_hist->count == 0)
+        return;
+
+    dprintf(fd, "  %-24s n %u avg %u us max %u us\n", p_name, p_hist->count,
+            (UINT32)(p_hist->total_us / p_hist->count), p_hist->max_us);
+
+    for (i = 0; i < GKI_LAT_HIST_BUCKETS; i++)
+    {
+        if (p_hist->bucket[i] == 0)
+            continue;
+
+        if (i == GKI_LAT_HIST_BUCKETS - 1)
+            len += snprintf(line + len, sizeof(line) - len, " >=%uus:%u", 1U << i, p_hist->bucket[i]);
+        else
+            len += snprintf(line + len, sizeof(line) - len, " <%uus:%u", 2U << i, p_hist->bucket[i]);
+    }
+
+    dprintf(fd, "   %s\n", line);
+}
+
+/*******************************************************************************
+**
+** Function         GKI_dump_task_stats
+**
+** Description      This function writes the mailbox statistics and wake-up
+**                  latency histogram of every running task to a file
+**                  descriptor.
+**
+** Parameters:      fd - (input) file descriptor to write to
+**
+** Returns          void
+**
+*******************************************************************************/
+void GKI_dump_task_stats (int fd)
+{
+    UINT8           task_id;
+#if (GKI_TASK_STATS_INCLUDED == TRUE)
+    tGKI_TASK_STATS stats;
+#endif
+#if (GKI_LATENCY_STATS_INCLUDED == TRUE)
+    tGKI_LAT_HIST   hist;
+#endif
+
+    dprintf(fd, "GKI tasks (latency recording %s)\n",
+            GKI_latency_stats_enabled() ? "on" : "off");
+
+    for (task_id = 0; task_id < GKI_MAX_TASKS; task_id++)
+    {
+        if (gki_cb.com.OSRdyTbl[task_id] == TASK_DEAD)
+            continue;
+
+        dprintf(fd, " %d %s\n", task_id, (char *)gki_cb.com.OSTName[task_id]);
+
+#if (GKI_TASK_STATS_INCLUDED == TRUE)
+        if (GKI_get_task_stats(task_id, &stats))
+        {
+            dprintf(fd, "  msgs %u (%u/s) wakeups %u coalesced %u max depth %u\n",
+                    stats.msgs_read, stats.msgs_per_sec, stats.wakeups,
+                    stats.wakeups_coalesced, stats.max_queue_depth);
+            dprintf(fd, "  mailbox dispatch avg %u us max %u us\n",
+                    stats.avg_dispatch_us, stats.max_dispatch_us);
+        }
+#endif
+
+#if (GKI_LATENCY_STATS_INCLUDED == TRUE)
+        /* Take a consistent copy; the task updates it under its event mutex */
+        pthread_mutex_lock(&gki_cb.os.thread_evt_mutex[task_id]);
+        hist = gki_cb.os.wake_hist[task_id];
+        pthread_mutex_unlock(&gki_cb.os.thread_evt_mutex[task_id]);
+
+        GKI_lat_hist_dump(fd, "wake latency", &hist);
+#endif
+    }
+}
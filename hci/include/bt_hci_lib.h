@@ -56,8 +56,35 @@ typedef enum {
 typedef enum {
     BT_HC_LOGGING_OFF,
     BT_HC_LOGGING_ON,
+    BT_HC_LOGGING_DUMP, /* write the in-memory capture out to the log file */
 } bt_hc_logging_state_t;
 
+/** HCI logging storage */
+typedef enum {
+    BT_HC_LOGGING_MODE_FILE,   /* one log file that grows without bound */
+    BT_HC_LOGGING_MODE_ROTATE, /* numbered log files of at most max_size bytes */
+    BT_HC_LOGGING_MODE_MEMORY, /* last max_size bytes kept in a mapped ring */
+} bt_hc_logging_mode_t;
+
+/* Most entries in each of the HCI logging filter lists */
+#define BT_HC_LOGGING_FILTER_MAX 8
+
+typedef struct {
+    bt_hc_logging_mode_t mode;
+    uint32_t max_size;  /* bytes per file (ROTATE) or in the ring (MEMORY) */
+    uint32_t max_files; /* files kept, including the active one (ROTATE) */
+
+    /* Bytes of ACL/SCO data kept after the HCI header; 0 keeps the whole
+     * packet. ACL packets on fixed L2CAP channels, on the listed handles and
+     * on the listed L2CAP CIDs are always kept whole. */
+    uint16_t acl_snap_len;
+    uint16_t sco_snap_len;
+    uint8_t  num_full_handles;
+    uint16_t full_handles[BT_HC_LOGGING_FILTER_MAX];
+    uint8_t  num_full_cids;
+    uint16_t full_cids[BT_HC_LOGGING_FILTER_MAX];
+} bt_hc_logging_config_t;
+
 /* commands to be used in LSB with MSG_CTRL_TO_HC_CMD */
 typedef enum {
     BT_HC_AUDIO_STATE = 0,
@@ -199,6 +226,10 @@ typedef struct {
      * which would cloese all the client channels
      * and turns off the chip*/
     void  (*ssr_cleanup)(void);
+
+    /** Selects how HCI logging stores captured packets. Takes effect the
+     *  next time logging is turned on. */
+    int (*logging_config)(const bt_hc_logging_config_t *p_config);
 } bt_hc_interface_t;
 
 
@@ -4,7 +4,12 @@
 
 #include "bt_hci_bdroid.h"
 
+void btsnoop_configure(const bt_hc_logging_config_t *p_config);
 void btsnoop_open(const char *p_path, const bool save_existing);
 void btsnoop_close(void);
 
+// Writes the in-memory capture ring out to the log file. Does nothing unless
+// logging is on in BT_HC_LOGGING_MODE_MEMORY.
+void btsnoop_dump(void);
+
 void btsnoop_capture(const HC_BT_HDR *p_buf, bool is_rcvd);
@@ -65,6 +65,26 @@ void userial_close_reader(void);
 // less than |len|. This function will not block.
 uint16_t userial_read(uint16_t msg_id, uint8_t *p_buffer, uint16_t len);
 
+// Points |*p_data| at the next run of received bytes without copying them and
+// returns its length, or 0 if nothing has been received. The bytes stay valid
+// until they are released with |userial_consume|. This function will not block.
+uint16_t userial_peek(uint8_t **p_data);
+
+// Releases the first |len| bytes of the run returned by |userial_peek|.
+void userial_consume(uint16_t len);
+
+typedef struct {
+  uint32_t ring_size;   // Capacity of the receive ring in bytes.
+  uint32_t high_water;  // Most bytes ever waiting in the receive ring.
+  uint32_t overruns;    // Times the reader thread found the ring full.
+  uint32_t rx_bytes;    // Bytes received since the module was initialized.
+} userial_rx_stats_t;
+
+// Copies the receive ring counters into |p_stats|. Counters are updated by the
+// reader thread without locking, so the snapshot is only approximately
+// consistent.
+void userial_get_rx_stats(userial_rx_stats_t *p_stats);
+
 #ifdef QCOM_WCN_SSR
 uint8_t userial_dev_inreset();
 #endif
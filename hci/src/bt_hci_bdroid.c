@@ -439,7 +439,14 @@ static int transmit_buf(TRANSAC transac, UNUSED_ATTR char *p_buf, UNUSED_ATTR in
 static int logging(bt_hc_logging_state_t state, char *p_path, bool save_existing) {
   BTHCDBG("logging %d", state);
 
-  if (state != BT_HC_LOGGING_ON)
+  userial_rx_stats_t rx_stats;
+  userial_get_rx_stats(&rx_stats);
+  ALOGI("%s rx ring: size %u high water %u overruns %u bytes %u", __func__,
+      rx_stats.ring_size, rx_stats.high_water, rx_stats.overruns, rx_stats.rx_bytes);
+
+  if (state == BT_HC_LOGGING_DUMP)
+    btsnoop_dump();
+  else if (state != BT_HC_LOGGING_ON)
     btsnoop_close();
   else if (p_path != NULL)
     btsnoop_open(p_path, save_existing);
@@ -447,6 +454,18 @@ static int logging(bt_hc_logging_state_t state, char *p_path, bool save_existing
   return BT_HC_STATUS_SUCCESS;
 }
 
+/** Selects how HCI logging stores captured packets */
+static int logging_config(const bt_hc_logging_config_t *p_config) {
+  if (p_config == NULL)
+    return BT_HC_STATUS_FAIL;
+
+  BTHCDBG("logging_config mode %d max_size %u max_files %u", p_config->mode,
+      p_config->max_size, p_config->max_files);
+
+  btsnoop_configure(p_config);
+  return BT_HC_STATUS_SUCCESS;
+}
+
 /** sends command HC controller to configure platform specific behaviour */
 static int tx_hc_cmd(TRANSAC transac, char *p_buf, int len) {
   BTHCDBG("tx_hc_cmd: transac %p", transac);
@@ -526,7 +545,8 @@ static const bt_hc_interface_t bluetoothHCLibInterface = {
     logging,
     cleanup,
     tx_hc_cmd,
-    ssr_cleanup
+    ssr_cleanup,
+    logging_config
 };
 
 /*******************************************************************************
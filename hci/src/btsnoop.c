@@ -24,16 +24,23 @@
 #include <cutils/log.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include "bt_hci_bdroid.h"
 #include "bt_utils.h"
+#include "btsnoop.h"
+#include "osi.h"
+#include "semaphore.h"
 #include "utils.h"
 
 typedef enum {
@@ -46,12 +53,111 @@ typedef enum {
 // Epoch in microseconds since 01/01/0000.
 static const uint64_t BTSNOOP_EPOCH_DELTA = 0x00dcddb30f2f8000ULL;
 
+// Size of the ring that decouples packet capture from file I/O. Must be a
+// power of two. Packets that do not fit are dropped and counted rather than
+// stalling the HCI data path.
+#ifndef BTSNOOP_RING_SIZE
+#define BTSNOOP_RING_SIZE (256 * 1024)
+#endif
+
+#define BTSNOOP_RING_MASK (BTSNOOP_RING_SIZE - 1)
+
+// Every slot in the ring starts with a commit word followed by the length of
+// the btsnoop record that follows it. Slots are 8 byte aligned so the commit
+// word of the next slot never straddles the end of the ring.
+#define BTSNOOP_SLOT_HDR_SIZE 8
+#define BTSNOOP_SLOT_ALIGN(len) (((len) + 7) & ~7u)
+
+// Commit word flag for padding that skips to the start of the ring.
+#define BTSNOOP_SLOT_SKIP 0x80000000u
+
+// Most records handed to a single writev(2) call; well below IOV_MAX.
+#define BTSNOOP_WRITEV_MAX_IOVS 256
+
+// Size of the per-packet btsnoop record header, excluding the H4 type byte.
+#define BTSNOOP_RECORD_HDR_SIZE 24
+
+// Header sizes used by the capture filter.
+#define HCI_ACL_HDR_SIZE 4
+#define HCI_SCO_HDR_SIZE 3
+#define L2CAP_HDR_SIZE 4
+
+// L2CAP channels below this CID are fixed (signalling, ATT, SMP, ...).
+#define L2CAP_FIRST_DYNAMIC_CID 0x0040
+
+#define ACL_HANDLE_COUNT 0x1000
+#define ACL_PB_CONTINUATION 0x01
+
+static const char *WRITER_THREAD_NAME = "btsnoop_writer";
+
+static const char BTSNOOP_FILE_HEADER[] = "btsnoop\0\0\0\0\1\0\0\x3\xea";
+
+// Suffix of the file backing the in-memory capture ring.
+static const char *MEM_RING_SUFFIX = ".ring";
+static const char MEM_RING_MAGIC[8] = "btsnpmem";
+
+// Layout of the file backing the in-memory capture ring. Records occupy
+// [tail, head) of the data area, modulo |size|. |tail| is always moved past
+// the records about to be overwritten before any data is copied and |head| is
+// only moved once the new record is complete, so whatever is left in the file
+// after a crash is a valid sequence of btsnoop records.
+typedef struct {
+  char magic[8];
+  uint32_t size;
+  uint32_t reserved;
+  uint64_t head;
+  uint64_t tail;
+  uint8_t data[];
+} mem_ring_t;
+
+static bt_hc_logging_mode_t log_mode = BT_HC_LOGGING_MODE_FILE;
+static uint32_t log_max_size;
+static uint32_t log_max_files;
+static char log_path[256];
+
+// Capture filter; only the snap lengths and lists of |log_filter| are used.
+static bt_hc_logging_config_t log_filter;
+
+// Whether the start fragment last seen on each ACL handle was kept whole,
+// per direction, so that its continuation fragments can be treated the same.
+static uint32_t acl_start_kept[2][ACL_HANDLE_COUNT / 32];
+
+// True while packets should be captured.
+static bool hci_btsnoop_active = false;
+
 // File descriptor for btsnoop file.
 static int hci_btsnoop_fd = -1;
 
+// Bytes written to |hci_btsnoop_fd| in BT_HC_LOGGING_MODE_ROTATE.
+static uint32_t hci_btsnoop_file_size;
+
+// Mapping of the ring file in BT_HC_LOGGING_MODE_MEMORY.
+static mem_ring_t *mem_ring = NULL;
+static size_t mem_ring_map_size;
+
+// Set when the writer thread should dump |mem_ring| to the log file.
+static uint32_t mem_ring_dump_requested;
+
+// Capture ring. Any thread may reserve space by advancing |ring_reserve|; the
+// writer thread is the only one that advances |ring_tail|. A slot is handed to
+// the writer by storing its non-zero length into its commit word, and the
+// writer zeroes everything it has consumed before releasing it.
+static uint8_t ring[BTSNOOP_RING_SIZE] __attribute__((aligned(8)));
+static uint32_t ring_reserve;
+static uint32_t ring_tail;
+
+// Packets that could not be captured because the ring was full.
+static uint32_t ring_drops;
+
+static pthread_t writer_thread;
+static bool writer_thread_valid = false;
+static bool writer_running = false;
+static semaphore_t *writer_sem;
+static uint32_t writer_idle;
+
 void btsnoop_net_open();
 void btsnoop_net_close();
-void btsnoop_net_write(const void *data, size_t length);
+void btsnoop_net_writev(const struct iovec *iov, int iovcnt);
 
 static uint64_t btsnoop_timestamp(void) {
   struct timeval tv;
@@ -64,18 +170,100 @@ static uint64_t btsnoop_timestamp(void) {
   return timestamp;
 }
 
-static void btsnoop_write(const void *data, size_t length) {
-  if (hci_btsnoop_fd != -1)
-    write(hci_btsnoop_fd, data, length);
+static inline uint32_t *slot_commit_word(uint32_t pos) {
+  return (uint32_t *)&ring[pos & BTSNOOP_RING_MASK];
+}
+
+// Reserves |slot_len| contiguous bytes in the ring. Returns the ring position
+// of the slot, or false if the ring does not have enough free space.
+static bool ring_reserve_slot(uint32_t slot_len, uint32_t *p_pos) {
+  uint32_t reserve = __atomic_load_n(&ring_reserve, __ATOMIC_RELAXED);
+  uint32_t pad;
+
+  do {
+    uint32_t tail = __atomic_load_n(&ring_tail, __ATOMIC_ACQUIRE);
+    uint32_t to_end = BTSNOOP_RING_SIZE - (reserve & BTSNOOP_RING_MASK);
+
+    pad = (slot_len > to_end) ? to_end : 0;
+    if (reserve + pad + slot_len - tail > BTSNOOP_RING_SIZE)
+      return false;
+  } while (!__atomic_compare_exchange_n(&ring_reserve, &reserve, reserve + pad + slot_len,
+                                        true, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+  if (pad)
+    __atomic_store_n(slot_commit_word(reserve), pad | BTSNOOP_SLOT_SKIP, __ATOMIC_RELEASE);
+
+  *p_pos = reserve + pad;
+  return true;
+}
+
+static void writer_wake(void) {
+  if (__atomic_exchange_n(&writer_idle, 0, __ATOMIC_SEQ_CST))
+    semaphore_post(writer_sem);
+}
+
+static bool filter_has(const uint16_t *list, uint8_t count, uint16_t value) {
+  for (uint8_t i = 0; i < count; ++i)
+    if (list[i] == value)
+      return true;
+  return false;
+}
+
+// Returns how many of the |length_he| bytes of |packet| (counting the type
+// byte) the capture filter keeps.
+static int btsnoop_snap_length(packet_type_t type, const uint8_t *packet, int length_he, bool is_received) {
+  int keep;
+
+  switch (type) {
+    case kAclPacket: {
+      if (log_filter.acl_snap_len == 0)
+        return length_he;
+
+      uint16_t handle = (packet[0] | (packet[1] << 8)) & 0x0FFF;
+      uint32_t *p_kept = &acl_start_kept[is_received][handle / 32];
+      uint32_t bit = 1u << (handle % 32);
+      bool full;
+
+      if (filter_has(log_filter.full_handles, log_filter.num_full_handles, handle)) {
+        full = true;
+      } else if (((packet[1] >> 4) & 0x03) == ACL_PB_CONTINUATION) {
+        full = !!(*p_kept & bit);
+      } else {
+        uint16_t cid = (length_he >= 1 + HCI_ACL_HDR_SIZE + L2CAP_HDR_SIZE) ?
+            (packet[6] | (packet[7] << 8)) : 0;
+        full = cid < L2CAP_FIRST_DYNAMIC_CID ||
+            filter_has(log_filter.full_cids, log_filter.num_full_cids, cid);
+        if (full)
+          *p_kept |= bit;
+        else
+          *p_kept &= ~bit;
+      }
+
+      if (full)
+        return length_he;
 
-  btsnoop_net_write(data, length);
+      // Always keep the L2CAP header so truncated packets still decode.
+      keep = log_filter.acl_snap_len < L2CAP_HDR_SIZE ? L2CAP_HDR_SIZE : log_filter.acl_snap_len;
+      keep += 1 + HCI_ACL_HDR_SIZE;
+      break;
+    }
+
+    case kScoPacket:
+      if (log_filter.sco_snap_len == 0)
+        return length_he;
+      keep = 1 + HCI_SCO_HDR_SIZE + log_filter.sco_snap_len;
+      break;
+
+    default:
+      return length_he;
+  }
+
+  return keep < length_he ? keep : length_he;
 }
 
 static void btsnoop_write_packet(packet_type_t type, const uint8_t *packet, bool is_received) {
   int length_he = 0;
-  int length;
   int flags;
-  int drops = 0;
   switch (type) {
     case kCommandPacket:
       length_he = packet[2] + 4;
@@ -95,29 +283,383 @@ static void btsnoop_write_packet(packet_type_t type, const uint8_t *packet, bool
       break;
   }
 
+  int included_he = btsnoop_snap_length(type, packet, length_he, is_received);
+  uint32_t record_len = BTSNOOP_RECORD_HDR_SIZE + included_he;
+  uint32_t slot_len = BTSNOOP_SLOT_ALIGN(BTSNOOP_SLOT_HDR_SIZE + record_len);
+  uint32_t pos;
+
+  // This function is called from different contexts; it must never block.
+  if (slot_len > BTSNOOP_RING_SIZE / 2 || !ring_reserve_slot(slot_len, &pos)) {
+    __atomic_fetch_add(&ring_drops, 1, __ATOMIC_RELAXED);
+    return;
+  }
+
   uint64_t timestamp = btsnoop_timestamp();
-  uint32_t time_hi = timestamp >> 32;
-  uint32_t time_lo = timestamp & 0xFFFFFFFF;
+  uint32_t *p_slot = slot_commit_word(pos);
+  uint32_t *p_record = p_slot + 2;
 
-  length = htonl(length_he);
-  flags = htonl(flags);
-  drops = htonl(drops);
-  time_hi = htonl(time_hi);
-  time_lo = htonl(time_lo);
+  p_slot[1] = record_len;
+  p_record[0] = htonl(length_he);
+  p_record[1] = htonl(included_he);
+  p_record[2] = htonl(flags);
+  p_record[3] = htonl(__atomic_load_n(&ring_drops, __ATOMIC_RELAXED));
+  p_record[4] = htonl(timestamp >> 32);
+  p_record[5] = htonl(timestamp & 0xFFFFFFFF);
 
-  // This function is called from different contexts.
-  utils_lock();
+  uint8_t *p_data = (uint8_t *)(p_record + 6);
+  *p_data++ = type;
+  memcpy(p_data, packet, included_he - 1);
 
-  btsnoop_write(&length, 4);
-  btsnoop_write(&length, 4);
-  btsnoop_write(&flags, 4);
-  btsnoop_write(&drops, 4);
-  btsnoop_write(&time_hi, 4);
-  btsnoop_write(&time_lo, 4);
-  btsnoop_write(&type, 1);
-  btsnoop_write(packet, length_he - 1);
+  __atomic_store_n(p_slot, slot_len, __ATOMIC_RELEASE);
+  writer_wake();
+}
+
+// Writes every iovec in full to |fd|, retrying short writes.
+static void write_all(int fd, struct iovec *iov, int iovcnt) {
+  while (iovcnt > 0) {
+    ssize_t ret = writev(fd, iov, iovcnt);
+    if (ret == -1) {
+      if (errno == EINTR)
+        continue;
+      ALOGE("%s error writing btsnoop log: %s", __func__, strerror(errno));
+      return;
+    }
+
+    while (iovcnt > 0 && (size_t)ret >= iov->iov_len) {
+      ret -= iov->iov_len;
+      ++iov;
+      --iovcnt;
+    }
+
+    if (iovcnt > 0) {
+      iov->iov_base = (uint8_t *)iov->iov_base + ret;
+      iov->iov_len -= ret;
+    }
+  }
+}
+
+// Creates |path| holding only the btsnoop file header. Returns the open file
+// descriptor or -1 on error.
+static int create_log_file(const char *path) {
+  int fd = open(path,
+                O_WRONLY | O_CREAT | O_TRUNC,
+                S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
 
-  utils_unlock();
+  if (fd == -1) {
+    ALOGE("%s unable to open '%s': %s", __func__, path, strerror(errno));
+    return -1;
+  }
+
+  write(fd, BTSNOOP_FILE_HEADER, sizeof(BTSNOOP_FILE_HEADER) - 1);
+  return fd;
+}
+
+// Moves <path> to <path>.1, <path>.1 to <path>.2 and so on, discarding the
+// oldest file, and starts a new, empty <path>. Returns false if the new file
+// could not be created, in which case the old one stays active.
+static bool rotate_log_files(void) {
+  char src[sizeof(log_path) + 12];
+  char dst[sizeof(log_path) + 12];
+
+  for (uint32_t i = log_max_files - 1; i > 0; --i) {
+    if (i == 1)
+      strlcpy(src, log_path, sizeof(src));
+    else
+      snprintf(src, sizeof(src), "%s.%u", log_path, i - 1);
+    snprintf(dst, sizeof(dst), "%s.%u", log_path, i);
+    rename(src, dst);
+  }
+
+  // Open the new file before closing the old one so that the descriptor never
+  // goes invalid underneath a concurrent reader of |hci_btsnoop_fd|.
+  int fd = create_log_file(log_path);
+  if (fd == -1)
+    return false;
+
+  if (hci_btsnoop_fd != -1)
+    close(hci_btsnoop_fd);
+  hci_btsnoop_fd = fd;
+  hci_btsnoop_file_size = sizeof(BTSNOOP_FILE_HEADER) - 1;
+  return true;
+}
+
+// Writes records to the active file, starting the next numbered file whenever
+// a record would push the active one past |log_max_size|.
+static void rotate_writev(struct iovec *iov, int iovcnt) {
+  const uint32_t header_size = sizeof(BTSNOOP_FILE_HEADER) - 1;
+
+  while (iovcnt > 0) {
+    // A file always takes at least one record, however large.
+    if (hci_btsnoop_file_size > header_size &&
+        hci_btsnoop_file_size + iov[0].iov_len > log_max_size)
+      rotate_log_files();
+
+    int batch = 1;
+    uint32_t batch_size = iov[0].iov_len;
+    while (batch < iovcnt &&
+           hci_btsnoop_file_size + batch_size + iov[batch].iov_len <= log_max_size) {
+      batch_size += iov[batch].iov_len;
+      ++batch;
+    }
+
+    write_all(hci_btsnoop_fd, iov, batch);
+    hci_btsnoop_file_size += batch_size;
+    iov += batch;
+    iovcnt -= batch;
+  }
+}
+
+static void mem_ring_copy(uint64_t pos, const uint8_t *data, size_t len) {
+  size_t offset = pos % mem_ring->size;
+  size_t to_end = mem_ring->size - offset;
+
+  if (len > to_end) {
+    memcpy(&mem_ring->data[offset], data, to_end);
+    data += to_end;
+    len -= to_end;
+    offset = 0;
+  }
+  memcpy(&mem_ring->data[offset], data, len);
+}
+
+static uint32_t mem_ring_read_u32(uint64_t pos) {
+  uint8_t bytes[4];
+  for (int i = 0; i < 4; ++i)
+    bytes[i] = mem_ring->data[(pos + i) % mem_ring->size];
+  return (bytes[0] << 24) | (bytes[1] << 16) | (bytes[2] << 8) | bytes[3];
+}
+
+// Appends a record to the ring, evicting the oldest records to make room.
+static void mem_ring_append(const uint8_t *record, size_t len) {
+  if (len > mem_ring->size)
+    return;
+
+  uint64_t head = mem_ring->head;
+  uint64_t tail = mem_ring->tail;
+  while (head + len - tail > mem_ring->size) {
+    // Included length of the oldest record.
+    tail += BTSNOOP_RECORD_HDR_SIZE + mem_ring_read_u32(tail + 4);
+  }
+
+  __atomic_store_n(&mem_ring->tail, tail, __ATOMIC_RELEASE);
+  mem_ring_copy(head, record, len);
+  __atomic_store_n(&mem_ring->head, head + len, __ATOMIC_RELEASE);
+}
+
+// Writes the records held in |ring| to a new btsnoop file at |path|.
+static void mem_ring_write_file(const mem_ring_t *ring, const char *path) {
+  int fd = create_log_file(path);
+  if (fd == -1)
+    return;
+
+  struct iovec iov[2];
+  int iovcnt = 0;
+  size_t offset = ring->tail % ring->size;
+  size_t len = ring->head - ring->tail;
+
+  if (offset + len > ring->size) {
+    iov[iovcnt].iov_base = (void *)&ring->data[offset];
+    iov[iovcnt].iov_len = ring->size - offset;
+    len -= iov[iovcnt].iov_len;
+    offset = 0;
+    ++iovcnt;
+  }
+  iov[iovcnt].iov_base = (void *)&ring->data[offset];
+  iov[iovcnt].iov_len = len;
+  ++iovcnt;
+
+  write_all(fd, iov, iovcnt);
+  close(fd);
+}
+
+static bool mem_ring_is_valid(const mem_ring_t *ring, size_t map_size) {
+  return !memcmp(ring->magic, MEM_RING_MAGIC, sizeof(MEM_RING_MAGIC)) &&
+         ring->size > 0 && ring->size <= map_size - sizeof(mem_ring_t) &&
+         ring->tail <= ring->head && ring->head - ring->tail <= ring->size;
+}
+
+// Maps the file backing the in-memory ring. A ring left behind by a previous
+// session that did not shut down cleanly is saved to <path>.last first.
+static bool mem_ring_open(void) {
+  char ring_path[sizeof(log_path) + 8];
+  snprintf(ring_path, sizeof(ring_path), "%s%s", log_path, MEM_RING_SUFFIX);
+
+  int fd = open(ring_path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+  if (fd == -1) {
+    ALOGE("%s unable to open '%s': %s", __func__, ring_path, strerror(errno));
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) == 0 && (size_t)st.st_size > sizeof(mem_ring_t)) {
+    mem_ring_t *old_ring = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (old_ring != MAP_FAILED) {
+      if (mem_ring_is_valid(old_ring, st.st_size) && old_ring->head != old_ring->tail) {
+        char last_path[sizeof(log_path) + 8];
+        snprintf(last_path, sizeof(last_path), "%s.last", log_path);
+        ALOGW("%s recovering capture from an unclean shutdown into '%s'.", __func__, last_path);
+        mem_ring_write_file(old_ring, last_path);
+      }
+      munmap(old_ring, st.st_size);
+    }
+  }
+
+  mem_ring_map_size = sizeof(mem_ring_t) + log_max_size;
+  if (ftruncate(fd, 0) == -1 || ftruncate(fd, mem_ring_map_size) == -1) {
+    ALOGE("%s unable to size '%s': %s", __func__, ring_path, strerror(errno));
+    close(fd);
+    return false;
+  }
+
+  mem_ring = mmap(NULL, mem_ring_map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mem_ring == MAP_FAILED) {
+    ALOGE("%s unable to map '%s': %s", __func__, ring_path, strerror(errno));
+    mem_ring = NULL;
+    return false;
+  }
+
+  memcpy(mem_ring->magic, MEM_RING_MAGIC, sizeof(MEM_RING_MAGIC));
+  mem_ring->size = log_max_size;
+  mem_ring->head = 0;
+  mem_ring->tail = 0;
+  return true;
+}
+
+// Saves the ring to the log file and removes its backing file.
+static void mem_ring_close(void) {
+  char ring_path[sizeof(log_path) + 8];
+
+  mem_ring_write_file(mem_ring, log_path);
+  munmap(mem_ring, mem_ring_map_size);
+  mem_ring = NULL;
+
+  snprintf(ring_path, sizeof(ring_path), "%s%s", log_path, MEM_RING_SUFFIX);
+  unlink(ring_path);
+}
+
+// Hands a batch of records to the network listener and to the configured
+// storage.
+static void btsnoop_writev(struct iovec *iov, int iovcnt) {
+  btsnoop_net_writev(iov, iovcnt);
+
+  switch (log_mode) {
+    case BT_HC_LOGGING_MODE_FILE:
+      if (hci_btsnoop_fd != -1)
+        write_all(hci_btsnoop_fd, iov, iovcnt);
+      break;
+    case BT_HC_LOGGING_MODE_ROTATE:
+      if (hci_btsnoop_fd != -1)
+        rotate_writev(iov, iovcnt);
+      break;
+    case BT_HC_LOGGING_MODE_MEMORY:
+      for (int i = 0; mem_ring != NULL && i < iovcnt; ++i)
+        mem_ring_append(iov[i].iov_base, iov[i].iov_len);
+      break;
+  }
+}
+
+// Writes out one batch of committed records. Returns false if the ring had
+// nothing ready to be written.
+static bool ring_flush(void) {
+  struct iovec iov[BTSNOOP_WRITEV_MAX_IOVS];
+  int iovcnt = 0;
+  uint32_t tail = ring_tail;
+  uint32_t pos = tail;
+
+  while (iovcnt < BTSNOOP_WRITEV_MAX_IOVS) {
+    uint32_t *p_slot = slot_commit_word(pos);
+    uint32_t commit = __atomic_load_n(p_slot, __ATOMIC_ACQUIRE);
+    if (commit == 0)
+      break;
+
+    if (!(commit & BTSNOOP_SLOT_SKIP)) {
+      iov[iovcnt].iov_base = p_slot + 2;
+      iov[iovcnt].iov_len = p_slot[1];
+      ++iovcnt;
+    }
+    pos += commit & ~BTSNOOP_SLOT_SKIP;
+  }
+
+  if (pos == tail)
+    return false;
+
+  btsnoop_writev(iov, iovcnt);
+
+  // Slots are never split across the end of the ring, so the consumed region
+  // is at most two contiguous runs.
+  uint32_t start = tail & BTSNOOP_RING_MASK;
+  uint32_t len = pos - tail;
+  if (start + len > BTSNOOP_RING_SIZE) {
+    memset(&ring[start], 0, BTSNOOP_RING_SIZE - start);
+    len -= BTSNOOP_RING_SIZE - start;
+    start = 0;
+  }
+  memset(&ring[start], 0, len);
+
+  __atomic_store_n(&ring_tail, pos, __ATOMIC_RELEASE);
+  return true;
+}
+
+// Runs one round of writer thread work. Returns false if there was none.
+static bool writer_service(void) {
+  bool busy = ring_flush();
+
+  if (__atomic_exchange_n(&mem_ring_dump_requested, 0, __ATOMIC_SEQ_CST)) {
+    if (mem_ring != NULL)
+      mem_ring_write_file(mem_ring, log_path);
+    busy = true;
+  }
+
+  return busy;
+}
+
+static void *writer_fn(UNUSED_ATTR void *context) {
+  prctl(PR_SET_NAME, (unsigned long)WRITER_THREAD_NAME, 0, 0, 0);
+
+  while (__atomic_load_n(&writer_running, __ATOMIC_ACQUIRE)) {
+    if (writer_service())
+      continue;
+
+    // Announce that we are about to sleep, then look once more so that a
+    // record committed in between is not left waiting for the next packet.
+    __atomic_store_n(&writer_idle, 1, __ATOMIC_SEQ_CST);
+    if (writer_service()) {
+      if (!__atomic_exchange_n(&writer_idle, 0, __ATOMIC_SEQ_CST))
+        semaphore_wait(writer_sem);  // Consume the wakeup a producer posted.
+      continue;
+    }
+    semaphore_wait(writer_sem);
+  }
+
+  while (ring_flush())
+    ;
+
+  return NULL;
+}
+
+void btsnoop_configure(const bt_hc_logging_config_t *p_config) {
+  assert(p_config != NULL);
+
+  if (hci_btsnoop_active) {
+    ALOGW("%s new configuration takes effect when logging is restarted.", __func__);
+  }
+
+  log_mode = p_config->mode;
+  log_max_size = p_config->max_size;
+  log_max_files = p_config->max_files;
+  log_filter = *p_config;
+  if (log_filter.num_full_handles > BT_HC_LOGGING_FILTER_MAX)
+    log_filter.num_full_handles = BT_HC_LOGGING_FILTER_MAX;
+  if (log_filter.num_full_cids > BT_HC_LOGGING_FILTER_MAX)
+    log_filter.num_full_cids = BT_HC_LOGGING_FILTER_MAX;
+
+  if (log_mode != BT_HC_LOGGING_MODE_FILE && log_max_size == 0) {
+    ALOGW("%s no size limit given, falling back to a single log file.", __func__);
+    log_mode = BT_HC_LOGGING_MODE_FILE;
+  }
+  if (log_mode == BT_HC_LOGGING_MODE_ROTATE && log_max_files == 0)
+    log_max_files = 1;
 }
 
 void btsnoop_open(const char *p_path, const bool save_existing) {
@@ -126,32 +668,70 @@ void btsnoop_open(const char *p_path, const bool save_existing) {
 
   btsnoop_net_open();
 
-  if (hci_btsnoop_fd != -1) {
+  if (hci_btsnoop_active) {
     ALOGE("%s btsnoop log file is already open.", __func__);
     return;
   }
 
-  if (save_existing)
-  {
-    char fname_backup[266] = {0};
-    strncat(fname_backup, p_path, 255);
-    strcat(fname_backup, ".last");
-    rename(p_path, fname_backup);
+  strlcpy(log_path, p_path, sizeof(log_path));
+
+  if (log_mode == BT_HC_LOGGING_MODE_MEMORY) {
+    if (!mem_ring_open()) {
+      ALOGE("%s unable to set up in-memory capture, logging to file.", __func__);
+      log_mode = BT_HC_LOGGING_MODE_FILE;
+    }
   }
 
-  hci_btsnoop_fd = open(p_path,
-                        O_WRONLY | O_CREAT | O_TRUNC,
-                        S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
+  if (log_mode == BT_HC_LOGGING_MODE_ROTATE) {
+    // Numbered files already preserve earlier captures.
+    rotate_log_files();
+  } else if (log_mode == BT_HC_LOGGING_MODE_FILE) {
+    if (save_existing)
+    {
+      char fname_backup[266] = {0};
+      strncat(fname_backup, p_path, 255);
+      strcat(fname_backup, ".last");
+      rename(p_path, fname_backup);
+    }
+
+    hci_btsnoop_fd = create_log_file(p_path);
+  }
+
+  if (log_mode != BT_HC_LOGGING_MODE_MEMORY && hci_btsnoop_fd == -1)
+    return;
+
+  __atomic_store_n(&ring_drops, 0, __ATOMIC_RELAXED);
+
+  if (writer_sem == NULL)
+    writer_sem = semaphore_new(0);
 
-  if (hci_btsnoop_fd == -1) {
-    ALOGE("%s unable to open '%s': %s", __func__, p_path, strerror(errno));
+  writer_idle = 0;
+  writer_running = true;
+  writer_thread_valid = writer_sem != NULL &&
+      pthread_create(&writer_thread, NULL, writer_fn, NULL) == 0;
+  if (!writer_thread_valid) {
+    ALOGE("%s unable to start btsnoop writer thread.", __func__);
+    writer_running = false;
+    btsnoop_close();
     return;
   }
 
-  write(hci_btsnoop_fd, "btsnoop\0\0\0\0\1\0\0\x3\xea", 16);
+  hci_btsnoop_active = true;
 }
 
 void btsnoop_close(void) {
+  hci_btsnoop_active = false;
+
+  if (writer_thread_valid) {
+    __atomic_store_n(&writer_running, false, __ATOMIC_RELEASE);
+    semaphore_post(writer_sem);
+    pthread_join(writer_thread, NULL);
+    writer_thread_valid = false;
+  }
+
+  if (mem_ring != NULL)
+    mem_ring_close();
+
   if (hci_btsnoop_fd != -1)
     close(hci_btsnoop_fd);
   hci_btsnoop_fd = -1;
@@ -159,10 +739,19 @@ void btsnoop_close(void) {
   btsnoop_net_close();
 }
 
+void btsnoop_dump(void) {
+  if (!hci_btsnoop_active || log_mode != BT_HC_LOGGING_MODE_MEMORY)
+    return;
+
+  // The writer thread owns the ring; let it write the file between batches.
+  __atomic_store_n(&mem_ring_dump_requested, 1, __ATOMIC_SEQ_CST);
+  writer_wake();
+}
+
 void btsnoop_capture(const HC_BT_HDR *p_buf, bool is_rcvd) {
   const uint8_t *p = (const uint8_t *)(p_buf + 1) + p_buf->offset;
 
-  if (hci_btsnoop_fd == -1)
+  if (!hci_btsnoop_active)
     return;
 
   switch (p_buf->event & MSG_EVT_MASK) {
@@ -28,6 +28,7 @@
 #include <sys/prctl.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 
 #include "osi.h"
 
@@ -72,6 +73,20 @@ void btsnoop_net_write(const void *data, size_t length) {
   pthread_mutex_unlock(&client_socket_lock_);
 }
 
+void btsnoop_net_writev(const struct iovec *iov, int iovcnt) {
+  pthread_mutex_lock(&client_socket_lock_);
+  if (client_socket_ != -1) {
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = (struct iovec *)iov;
+    msg.msg_iovlen = iovcnt;
+    if (sendmsg(client_socket_, &msg, 0) == -1 && errno == ECONNRESET) {
+      safe_close_(&client_socket_);
+    }
+  }
+  pthread_mutex_unlock(&client_socket_lock_);
+}
+
 static void *listen_fn_(UNUSED_ATTR void *context) {
 
   prctl(PR_SET_NAME, (unsigned long)LISTEN_THREAD_NAME_, 0, 0, 0);
@@ -733,6 +733,10 @@ void hci_h4_send_msg(HC_BT_HDR *p_msg)
 ** Description     Construct HCI EVENT/ACL packets and send them to stack once
 **                 complete packet has been received.
 **
+**                 Received bytes are taken from userial a whole chunk at a
+**                 time. Preambles and payloads are copied out of the chunk
+**                 with memcpy rather than one byte per state machine pass.
+**
 ** Returns         Number of read bytes
 **
 *******************************************************************************/
@@ -740,50 +744,62 @@ uint16_t hci_h4_receive_msg(void)
 {
     uint16_t    bytes_read = 0;
     uint8_t     byte;
+    uint8_t     *p_data;
+    uint16_t    avail, pos, copy_len;
     uint16_t    msg_len, len;
     uint8_t     msg_received;
     tHCI_H4_CB  *p_cb=&h4_cb;
 
-    while (TRUE)
+    /* Process everything userial has received so far, one chunk at a time */
+    while ((avail = userial_peek(&p_data)) > 0)
     {
-        /* Read one byte to see if there is anything waiting to be read */
-        if (userial_read(0 /*dummy*/, &byte, 1) == 0)
-        {
-            break;
-        }
-
-        bytes_read++;
-        msg_received = FALSE;
+        pos = 0;
 
-        switch (p_cb->rcv_state)
+        while (pos < avail)
         {
-        case H4_RX_MSGTYPE_ST:
-            /* Start of new message */
-            if ((byte < H4_TYPE_ACL_DATA) || (byte > H4_TYPE_EVENT))
+            msg_received = FALSE;
+
+            switch (p_cb->rcv_state)
             {
-                /* Unknown HCI message type */
-                /* Drop this byte */
-                ALOGE("[h4] Unknown HCI message type drop this byte 0x%x", byte);
+            case H4_RX_MSGTYPE_ST:
+                /* Start of new message */
+                byte = p_data[pos++];
+
+                if ((byte < H4_TYPE_ACL_DATA) || (byte > H4_TYPE_EVENT))
+                {
+                    /* Unknown HCI message type */
+                    /* Drop this byte */
+                    ALOGE("[h4] Unknown HCI message type drop this byte 0x%x", byte);
+                    break;
+                }
+
+                /* Initialize rx parameters */
+                p_cb->rcv_msg_type = byte;
+                p_cb->rcv_len = hci_preamble_table[byte-1];
+                memset(p_cb->preload_buffer, 0 , 6);
+                p_cb->preload_count = 0;
+                p_cb->rcv_state = H4_RX_LEN_ST; /* Next, wait for length to come */
                 break;
-            }
 
-            /* Initialize rx parameters */
-            p_cb->rcv_msg_type = byte;
-            p_cb->rcv_len = hci_preamble_table[byte-1];
-            memset(p_cb->preload_buffer, 0 , 6);
-            p_cb->preload_count = 0;
-            // p_cb->p_rcv_msg = NULL;
-            p_cb->rcv_state = H4_RX_LEN_ST; /* Next, wait for length to come */
-            break;
-
-        case H4_RX_LEN_ST:
-            /* Receiving preamble */
-            p_cb->preload_buffer[p_cb->preload_count++] = byte;
-            p_cb->rcv_len--;
-
-            /* Check if we received entire preamble yet */
-            if (p_cb->rcv_len == 0)
-            {
+            case H4_RX_LEN_ST:
+                /* Receiving preamble */
+                copy_len = avail - pos;
+                if (copy_len > p_cb->rcv_len)
+                    copy_len = p_cb->rcv_len;
+
+                memcpy(p_cb->preload_buffer + p_cb->preload_count, \
+                       p_data + pos, copy_len);
+                p_cb->preload_count += copy_len;
+                p_cb->rcv_len -= copy_len;
+                pos += copy_len;
+
+                /* Check if we received entire preamble yet */
+                if (p_cb->rcv_len != 0)
+                    break;
+
+                /* Last received preamble byte */
+                byte = p_cb->preload_buffer[p_cb->preload_count - 1];
+
                 if (p_cb->rcv_msg_type == H4_TYPE_ACL_DATA)
                 {
                     /* ACL data lengths are 16-bits */
@@ -850,7 +866,7 @@ uint16_t hci_h4_receive_msg(void)
                      "H4: Unable to acquire buffer for incoming HCI message." \
                     );
 
-                    if (msg_len == 0)
+                    if (p_cb->rcv_len == 0)
                     {
                         /* Wait for next message */
                         p_cb->rcv_state = H4_RX_MSGTYPE_ST;
@@ -865,7 +881,7 @@ uint16_t hci_h4_receive_msg(void)
                 }
 
                 /* Message length is valid */
-                if (msg_len)
+                if (p_cb->rcv_len)
                 {
                     /* Read rest of message */
                     p_cb->rcv_state = H4_RX_DATA_ST;
@@ -874,89 +890,100 @@ uint16_t hci_h4_receive_msg(void)
                 {
                     /* Message has no additional parameters.
                      * (Entire message has been received) */
-                    if (p_cb->rcv_msg_type == H4_TYPE_ACL_DATA)
-                        acl_rx_frame_end_chk(); /* to print snoop trace */
-
-                    msg_received = TRUE;
+                    if ((p_cb->rcv_msg_type == H4_TYPE_ACL_DATA) &&
+                        !acl_rx_frame_end_chk())
+                    {
+                        /* Not the end of packet yet. */
+                        p_cb->p_rcv_msg = NULL;
+                    }
+                    else
+                    {
+                        msg_received = TRUE;
+                    }
 
                     /* Next, wait for next message */
                     p_cb->rcv_state = H4_RX_MSGTYPE_ST;
                 }
-            }
-            break;
+                break;
 
-        case H4_RX_DATA_ST:
-            *((uint8_t *)(p_cb->p_rcv_msg + 1) + p_cb->p_rcv_msg->len++) = byte;
-            p_cb->rcv_len--;
+            case H4_RX_DATA_ST:
+                /* Copy as much of the payload as this chunk holds */
+                copy_len = avail - pos;
+                if (copy_len > p_cb->rcv_len)
+                    copy_len = p_cb->rcv_len;
 
-            if (p_cb->rcv_len > 0)
-            {
-                /* Read in the rest of the message */
-                len = userial_read(0 /*dummy*/, \
-                      ((uint8_t *)(p_cb->p_rcv_msg+1) + p_cb->p_rcv_msg->len), \
-                      p_cb->rcv_len);
-                p_cb->p_rcv_msg->len += len;
-                p_cb->rcv_len -= len;
-                bytes_read += len;
-            }
+                memcpy((uint8_t *)(p_cb->p_rcv_msg + 1) + p_cb->p_rcv_msg->len, \
+                       p_data + pos, copy_len);
+                p_cb->p_rcv_msg->len += copy_len;
+                p_cb->rcv_len -= copy_len;
+                pos += copy_len;
 
-            /* Check if we read in entire message yet */
-            if (p_cb->rcv_len == 0)
-            {
-                /* Received entire packet. */
-                /* Check for segmented l2cap packets */
-                if ((p_cb->rcv_msg_type == H4_TYPE_ACL_DATA) &&
-                    !acl_rx_frame_end_chk())
+                /* Check if we read in entire message yet */
+                if (p_cb->rcv_len == 0)
                 {
-                    /* Not the end of packet yet. */
+                    /* Received entire packet. */
+                    /* Check for segmented l2cap packets */
+                    if ((p_cb->rcv_msg_type == H4_TYPE_ACL_DATA) &&
+                        !acl_rx_frame_end_chk())
+                    {
+                        /* Not the end of packet yet. */
+                        p_cb->p_rcv_msg = NULL;
+                    }
+                    else
+                    {
+                        msg_received = TRUE;
+                    }
+
                     /* Next, wait for next message */
                     p_cb->rcv_state = H4_RX_MSGTYPE_ST;
                 }
-                else
+                break;
+
+            case H4_RX_IGNORE_ST:
+                /* Ignore rest of packet */
+                copy_len = avail - pos;
+                if (copy_len > p_cb->rcv_len)
+                    copy_len = p_cb->rcv_len;
+
+                p_cb->rcv_len -= copy_len;
+                pos += copy_len;
+
+                /* Check if we read in entire message yet */
+                if (p_cb->rcv_len == 0)
                 {
-                    msg_received = TRUE;
                     /* Next, wait for next message */
                     p_cb->rcv_state = H4_RX_MSGTYPE_ST;
                 }
+                break;
             }
-            break;
-
 
-        case H4_RX_IGNORE_ST:
-            /* Ignore reset of packet */
-            p_cb->rcv_len--;
 
-            /* Check if we read in entire message yet */
-            if (p_cb->rcv_len == 0)
+            /* If we received entire message, then send it to the task */
+            if (msg_received)
             {
-                /* Next, wait for next message */
-                p_cb->rcv_state = H4_RX_MSGTYPE_ST;
-            }
-            break;
-        }
-
-
-        /* If we received entire message, then send it to the task */
-        if (msg_received)
-        {
-            uint8_t intercepted = FALSE;
+                uint8_t intercepted = FALSE;
 
-            /* generate snoop trace message */
-            /* ACL packet tracing had done in acl_rx_frame_end_chk() */
-            if (p_cb->p_rcv_msg->event != MSG_HC_TO_STACK_HCI_ACL)
-                btsnoop_capture(p_cb->p_rcv_msg, true);
+                /* generate snoop trace message */
+                /* ACL packet tracing had done in acl_rx_frame_end_chk() */
+                if (p_cb->p_rcv_msg->event != MSG_HC_TO_STACK_HCI_ACL)
+                    btsnoop_capture(p_cb->p_rcv_msg, true);
 
-            if (p_cb->p_rcv_msg->event == MSG_HC_TO_STACK_HCI_EVT)
-                intercepted = internal_event_intercept();
+                if (p_cb->p_rcv_msg->event == MSG_HC_TO_STACK_HCI_EVT)
+                    intercepted = internal_event_intercept();
 
-            if ((bt_hc_cbacks) && (intercepted == FALSE))
-            {
-                bt_hc_cbacks->data_ind((TRANSAC) p_cb->p_rcv_msg, \
-                                       (char *) (p_cb->p_rcv_msg + 1), \
-                                       p_cb->p_rcv_msg->len + BT_HC_HDR_SIZE);
+                if ((bt_hc_cbacks) && (intercepted == FALSE))
+                {
+                    bt_hc_cbacks->data_ind((TRANSAC) p_cb->p_rcv_msg, \
+                                           (char *) (p_cb->p_rcv_msg + 1), \
+                                           p_cb->p_rcv_msg->len + BT_HC_HDR_SIZE);
+                }
+                p_cb->p_rcv_msg = NULL;
             }
-            p_cb->p_rcv_msg = NULL;
         }
+
+        /* Whole chunk has been parsed, hand it back to userial */
+        userial_consume(avail);
+        bytes_read += avail;
     }
 
     return (bytes_read);
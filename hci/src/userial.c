@@ -66,6 +66,18 @@ enum {
     USERIAL_RX_EXIT     = 0x8000000000000000ULL
 };
 
+// Size of the receive ring shared by the reader thread and the HCI parser.
+// Must be a power of two and should hold several maximum sized frames so that
+// the reader thread never has to wait on a slow parser.
+#ifndef USERIAL_RX_RING_SIZE
+#define USERIAL_RX_RING_SIZE (64 * 1024)
+#endif
+
+#define USERIAL_RX_RING_MASK (USERIAL_RX_RING_SIZE - 1)
+
+// How long the reader thread backs off when the receive ring is full.
+#define USERIAL_RX_RING_FULL_WAIT_MS 1
+
 /******************************************************************************
 **  Externs
 ******************************************************************************/
@@ -74,13 +86,25 @@ enum {
 **  Local type definitions
 ******************************************************************************/
 
+/* Single-producer/single-consumer receive ring. The reader thread is the only
+ * writer of |head| and the HCI worker thread is the only writer of |tail|.
+ * Both indices run freely and are masked on access. */
+typedef struct
+{
+    uint32_t        head;
+    uint32_t        tail;
+    uint32_t        high_water;
+    uint32_t        overruns;
+    uint32_t        rx_bytes;
+    uint8_t         data[USERIAL_RX_RING_SIZE];
+} tUSERIAL_RX_RING;
+
 typedef struct
 {
     int             fd;
     uint8_t         port;
     pthread_t       read_thread;
-    BUFFER_Q        rx_q;
-    HC_BT_HDR      *p_rx_hdr;
+    tUSERIAL_RX_RING rx_ring;
 } tUSERIAL_CB;
 
 /******************************************************************************
@@ -130,6 +154,39 @@ static inline bool is_event_available(fd_set *set) {
     return !!FD_ISSET(event_fd, set);
 }
 
+/*******************************************************************************
+**
+** Function        wait_for_exit
+**
+** Description     sleep for up to timeout_ms while listening for the
+**                  termination signal
+**
+** Returns         true if the reader thread has been asked to terminate
+**
+*******************************************************************************/
+static bool wait_for_exit(int timeout_ms)
+{
+    fd_set input;
+    struct timeval timeout;
+
+    FD_ZERO(&input);
+    int fd_max = add_event_fd(&input);
+    if (fd_max == -1)
+        return true;
+
+    timeout.tv_sec = 0;
+    timeout.tv_usec = timeout_ms * 1000;
+
+    if (select(fd_max + 1, &input, NULL, NULL, &timeout) > 0 &&
+        is_event_available(&input) && read_event() == USERIAL_RX_EXIT)
+    {
+        USERIALDBG("RX termination");
+        return true;
+    }
+
+    return false;
+}
+
 /*******************************************************************************
 **
 ** Function        select_read
@@ -189,10 +246,55 @@ static int select_read(int fd, uint8_t *pbuf, int len)
     return ret;
 }
 
+/*******************************************************************************
+**
+** Function        rx_ring_reserve
+**
+** Description     find the contiguous free space at the producer end of the
+**                  receive ring
+**
+** Returns         number of bytes that can be written at *pp_data
+**
+*******************************************************************************/
+static uint32_t rx_ring_reserve(uint8_t **pp_data)
+{
+    tUSERIAL_RX_RING *p_ring = &userial_cb.rx_ring;
+    uint32_t head = p_ring->head;
+    uint32_t tail = __atomic_load_n(&p_ring->tail, __ATOMIC_ACQUIRE);
+    uint32_t free_len = USERIAL_RX_RING_SIZE - (head - tail);
+    uint32_t to_end = USERIAL_RX_RING_SIZE - (head & USERIAL_RX_RING_MASK);
+
+    *pp_data = &p_ring->data[head & USERIAL_RX_RING_MASK];
+    return (free_len < to_end) ? free_len : to_end;
+}
+
+/*******************************************************************************
+**
+** Function        rx_ring_commit
+**
+** Description     publish len bytes written at the producer end of the
+**                  receive ring to the consumer
+**
+** Returns         None
+**
+*******************************************************************************/
+static void rx_ring_commit(uint32_t len)
+{
+    tUSERIAL_RX_RING *p_ring = &userial_cb.rx_ring;
+    uint32_t head = p_ring->head + len;
+    uint32_t used = head - __atomic_load_n(&p_ring->tail, __ATOMIC_ACQUIRE);
+
+    if (used > p_ring->high_water)
+        p_ring->high_water = used;
+    p_ring->rx_bytes += len;
+
+    __atomic_store_n(&p_ring->head, head, __ATOMIC_RELEASE);
+}
+
 static void *userial_read_thread(void *arg)
 {
     int rx_length = 0;
-    HC_BT_HDR *p_buf = NULL;
+    uint32_t space;
     uint8_t *p;
     UNUSED(arg);
 
@@ -205,49 +307,33 @@ static void *userial_read_thread(void *arg)
 
     while (userial_running)
     {
-        if (bt_hc_cbacks)
+        space = rx_ring_reserve(&p);
+        if (space == 0)
         {
-            p_buf = (HC_BT_HDR *) bt_hc_cbacks->alloc(
-                        BT_HC_HDR_SIZE + HCI_MAX_FRAME_SIZE + 1); /* H4 HDR = 1 */
+            /* The parser has fallen a full ring behind. Leave the bytes in
+             * the UART until it catches up rather than dropping any. */
+            userial_cb.rx_ring.overruns++;
+            bthc_rx_ready();
+            if (wait_for_exit(USERIAL_RX_RING_FULL_WAIT_MS))
+                break;
+            continue;
         }
-        else
-            p_buf = NULL;
 
-        if (p_buf != NULL)
-        {
-            p_buf->offset = 0;
-            p_buf->layer_specific = 0;
-
-            p = (uint8_t *) (p_buf + 1);
-            int userial_fd = userial_cb.fd;
-            if (userial_fd != -1)
-                rx_length = select_read(userial_fd, p, HCI_MAX_FRAME_SIZE + 1);
-            else
-                rx_length = 0;
-        }
+        int userial_fd = userial_cb.fd;
+        if (userial_fd != -1)
+            rx_length = select_read(userial_fd, p, (int)space);
         else
-        {
             rx_length = 0;
-            utils_delay(100);
-            ALOGW("userial_read_thread() failed to gain buffers");
-            continue;
-        }
-
 
         if (rx_length > 0)
         {
-            p_buf->len = (uint16_t)rx_length;
-            utils_enqueue(&(userial_cb.rx_q), p_buf);
+            rx_ring_commit((uint32_t)rx_length);
             bthc_rx_ready();
         }
         else /* either 0 or < 0 */
         {
             ALOGW("select_read return size <=0:%d, exiting userial_read_thread",\
                  rx_length);
-            /* if we get here, we should have a buffer */
-            if (bt_hc_cbacks)
-                bt_hc_cbacks->dealloc(p_buf);
-
             /* negative value means exit thread */
             break;
         }
@@ -270,7 +356,6 @@ bool userial_init(void)
     USERIALDBG("userial_init");
     memset(&userial_cb, 0, sizeof(tUSERIAL_CB));
     userial_cb.fd = -1;
-    utils_queue_init(&userial_cb.rx_q);
     return true;
 }
 
@@ -320,45 +405,56 @@ error:
 uint16_t userial_read(uint16_t msg_id, uint8_t *p_buffer, uint16_t len)
 {
     uint16_t total_len = 0;
-    uint16_t copy_len = 0;
+    uint16_t copy_len;
     uint8_t *p_data = NULL;
     UNUSED(msg_id);
 
-    do
+    while (total_len < len && (copy_len = userial_peek(&p_data)) > 0)
     {
-        if(userial_cb.p_rx_hdr != NULL)
-        {
-            p_data = ((uint8_t *)(userial_cb.p_rx_hdr + 1)) + \
-                     (userial_cb.p_rx_hdr->offset);
+        if (copy_len > (len - total_len))
+            copy_len = (len - total_len);
 
-            if((userial_cb.p_rx_hdr->len) <= (len - total_len))
-                copy_len = userial_cb.p_rx_hdr->len;
-            else
-                copy_len = (len - total_len);
+        memcpy((p_buffer + total_len), p_data, copy_len);
+        userial_consume(copy_len);
+        total_len += copy_len;
+    }
 
-            memcpy((p_buffer + total_len), p_data, copy_len);
+    return total_len;
+}
 
-            total_len += copy_len;
+uint16_t userial_peek(uint8_t **p_data)
+{
+    tUSERIAL_RX_RING *p_ring = &userial_cb.rx_ring;
+    uint32_t tail = p_ring->tail;
+    uint32_t avail = __atomic_load_n(&p_ring->head, __ATOMIC_ACQUIRE) - tail;
+    uint32_t to_end = USERIAL_RX_RING_SIZE - (tail & USERIAL_RX_RING_MASK);
+
+    if (avail > to_end)
+        avail = to_end;
+    if (avail > UINT16_MAX)
+        avail = UINT16_MAX;
+
+    *p_data = &p_ring->data[tail & USERIAL_RX_RING_MASK];
+    return (uint16_t)avail;
+}
 
-            userial_cb.p_rx_hdr->offset += copy_len;
-            userial_cb.p_rx_hdr->len -= copy_len;
+void userial_consume(uint16_t len)
+{
+    tUSERIAL_RX_RING *p_ring = &userial_cb.rx_ring;
 
-            if(userial_cb.p_rx_hdr->len == 0)
-            {
-                if (bt_hc_cbacks)
-                    bt_hc_cbacks->dealloc(userial_cb.p_rx_hdr);
+    assert(len <= __atomic_load_n(&p_ring->head, __ATOMIC_ACQUIRE) - p_ring->tail);
 
-                userial_cb.p_rx_hdr = NULL;
-            }
-        }
+    __atomic_store_n(&p_ring->tail, p_ring->tail + len, __ATOMIC_RELEASE);
+}
 
-        if(userial_cb.p_rx_hdr == NULL)
-        {
-            userial_cb.p_rx_hdr=(HC_BT_HDR *)utils_dequeue(&(userial_cb.rx_q));
-        }
-    } while ((userial_cb.p_rx_hdr != NULL) && (total_len < len));
+void userial_get_rx_stats(userial_rx_stats_t *p_stats)
+{
+    tUSERIAL_RX_RING *p_ring = &userial_cb.rx_ring;
 
-    return total_len;
+    p_stats->ring_size = USERIAL_RX_RING_SIZE;
+    p_stats->high_water = p_ring->high_water;
+    p_stats->overruns = p_ring->overruns;
+    p_stats->rx_bytes = p_ring->rx_bytes;
 }
 
 uint16_t userial_write(uint16_t msg_id, const uint8_t *p_data, uint16_t len) {
@@ -410,11 +506,8 @@ void userial_close(void) {
     // Ask the vendor-specific library to close the serial port.
     vendor_send_command(BT_VND_OP_USERIAL_CLOSE, NULL);
 
-    // Free all buffers still waiting in the RX queue.
-    // TODO: use list data structure and clean this up.
-    void *buf;
-    while ((buf = utils_dequeue(&userial_cb.rx_q)) != NULL)
-        bt_hc_cbacks->dealloc(buf);
+    // Drop whatever the parser has not consumed yet; the reader is gone.
+    userial_cb.rx_ring.tail = userial_cb.rx_ring.head;
 
     userial_cb.fd = -1;
 }
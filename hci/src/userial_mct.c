@@ -411,6 +411,22 @@ void userial_close_reader(void) {
     ALOGW("%s Already closed userial reader thread", __func__);
 }
 
+/*******************************************************************************
+**
+** Function        userial_get_rx_stats
+**
+** Description     Report receive ring counters. The MCT transport parses
+**                 straight from the channel fds in the reader thread and has
+**                 no receive ring, so every counter reads as zero.
+**
+** Returns         None
+**
+*******************************************************************************/
+void userial_get_rx_stats(userial_rx_stats_t *p_stats)
+{
+    memset(p_stats, 0, sizeof(*p_stats));
+}
+
 /*******************************************************************************
 **
 ** Function        userial_close
@@ -364,6 +364,45 @@
 #define BTIF_DM_OOB_TEST  TRUE
 #endif
 
+/* Number of pre-allocated slots in the btif context switch ring. Events posted
+** with btif_transfer_context() are copied into a slot instead of a GKI buffer
+** when their parameters fit in BTIF_CONTEXT_SLOT_PARAM_SIZE bytes and no deep
+** copy callback is given. */
+#ifndef BTIF_CONTEXT_RING_SLOTS
+#define BTIF_CONTEXT_RING_SLOTS  64
+#endif
+
+/* Sized to hold a btif_gattc_cb_t so LE scan results take the fast path */
+#ifndef BTIF_CONTEXT_SLOT_PARAM_SIZE
+#define BTIF_CONTEXT_SLOT_PARAM_SIZE  768
+#endif
+
+/* Default time in ms LE scan results are collected, one per address, before
+** being passed to btif together. 0 passes each result up as it arrives.
+** Overridden by BLE_SCAN_BATCH_WINDOW_MS in the BLE stack configuration. */
+#ifndef BTIF_GATTC_SCAN_BATCH_WINDOW_MS
+#define BTIF_GATTC_SCAN_BATCH_WINDOW_MS  0
+#endif
+
+/* Maximum number of LE scan results passed to btif in one batch, at most 127 */
+#ifndef BTIF_GATTC_SCAN_BATCH_MAX
+#define BTIF_GATTC_SCAN_BATCH_MAX  32
+#endif
+
+/* Time in ms btif_config waits for more changes after btif_config_save before
+** writing them out in the background, so that a burst of updates costs one write.
+** The delay runs on a monotonic timer that never holds a wake lock or wakes the
+** device; changes pending at suspend go out after resume, or at the next flush. */
+#ifndef BTIF_CONFIG_SAVE_DELAY_MS
+#define BTIF_CONFIG_SAVE_DELAY_MS  3000
+#endif
+
+/* Longest time in ms a saved btif_config change is held back while updates keep
+** coming. btif_config_flush writes everything out immediately. */
+#ifndef BTIF_CONFIG_SAVE_MAX_DELAY_MS
+#define BTIF_CONFIG_SAVE_MAX_DELAY_MS  30000
+#endif
+
 // How long to wait before activating sniff mode after entering the
 // idle state for FTS, OPS connections
 #ifndef BTA_FTS_OPS_IDLE_TO_SNIFF_DELAY_MS
@@ -704,6 +743,7 @@ BT_API extern void bte_main_lpm_allow_bt_device_sleep(void);
 #endif
 
 BT_API extern void bte_ssr_cleanup(void);
+BT_API extern void bte_main_dump_stats(int fd);
 
 #ifdef __cplusplus
 }
@@ -765,6 +805,11 @@ BT_API extern void bte_ssr_cleanup(void);
 #define QUICK_TIMER_TICKS_PER_SEC   10       /* 10ms timer */
 #endif
 
+/* Most BTU timers (regular, quick and oneshot together) that can run at once */
+#ifndef BTU_MAX_TIMERS
+#define BTU_MAX_TIMERS              256
+#endif
+
 /******************************************************************************
 **
 ** BTM
@@ -847,11 +892,18 @@ and USER_HW_DISABLE_API macros */
 #define BTM_SCO_MAX_BUF_CAP     (BTM_SCO_INIT_XMIT_CREDIT * 4)
 #endif
 
-/* The size in bytes of the BTM inquiry database. */
+/* The number of entries in the BTM inquiry database. When it is full, the
+** least recently seen device is evicted for a new one. */
 #ifndef BTM_INQ_DB_SIZE
 #define BTM_INQ_DB_SIZE             40
 #endif
 
+/* The number of address hash buckets indexing the BTM inquiry database.
+** Must be a power of 2, and should not be much smaller than BTM_INQ_DB_SIZE. */
+#ifndef BTM_INQ_DB_HASH_SIZE
+#define BTM_INQ_DB_HASH_SIZE        64
+#endif
+
 /* This is set to enable automatic periodic inquiry at startup. */
 #ifndef BTM_ENABLE_AUTO_INQUIRY
 #define BTM_ENABLE_AUTO_INQUIRY     FALSE
@@ -1004,6 +1056,13 @@ and USER_HW_DISABLE_API macros */
 #define BTM_SEC_MAX_DEVICE_RECORDS  100
 #endif
 
+/* The number of buckets in the BD address index of the security records.
+** Must be a power of 2, and should not be much smaller than
+** BTM_SEC_MAX_DEVICE_RECORDS. */
+#ifndef BTM_SEC_DEV_HASH_SIZE
+#define BTM_SEC_DEV_HASH_SIZE       128
+#endif
+
 /* The number of security records for services. */
 #ifndef BTM_SEC_MAX_SERVICE_RECORDS
 #define BTM_SEC_MAX_SERVICE_RECORDS 32
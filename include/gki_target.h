@@ -285,6 +285,32 @@ of order */
 #define GKI_ENABLE_BUF_CORRUPTION_CHECK TRUE
 #endif
 
+/* TRUE if each GKI task keeps a private cache of free buffers per pool, so
+** that most GKI_getbuf()/GKI_freebuf() calls complete without GKI_disable(). */
+#ifndef GKI_BUF_CACHE_INCLUDED
+#define GKI_BUF_CACHE_INCLUDED      TRUE
+#endif
+
+/* The maximum number of free buffers a task caches per pool. The depth used
+** for a pool is further limited so that task caches together never hold more
+** than a quarter of the pool. */
+#ifndef GKI_BUF_CACHE_MAX_DEPTH
+#define GKI_BUF_CACHE_MAX_DEPTH     8
+#endif
+
+/* TRUE to keep per-task mailbox statistics (message rate, mailbox depth and
+** the latency from posting to an empty mailbox until the task reads it). */
+#ifndef GKI_TASK_STATS_INCLUDED
+#define GKI_TASK_STATS_INCLUDED     TRUE
+#endif
+
+/* TRUE to build in the wake-up latency histograms of GKI tasks and the BTU
+** handler timing. Recording only happens while GKI_enable_latency_stats()
+** has turned it on. */
+#ifndef GKI_LATENCY_STATS_INCLUDED
+#define GKI_LATENCY_STATS_INCLUDED  TRUE
+#endif
+
 /* The GKI severe error macro. */
 #ifndef GKI_SEVERE
 #define GKI_SEVERE(code)
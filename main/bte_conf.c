@@ -20,19 +20,43 @@
 
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <utils/Log.h>
 
 #include "bta_api.h"
+#include "bt_hci_lib.h"
 #include "config.h"
 
 // TODO: eliminate these global variables.
 extern char hci_logfile[256];
 extern BOOLEAN hci_logging_enabled;
 extern BOOLEAN hci_save_log;
+extern bt_hc_logging_config_t hci_logging_cfg;
 extern BOOLEAN trace_conf_enabled;
 void bte_trace_conf_config(const config_t *config);
 
+// Parses a comma separated list of numbers (decimal or 0x prefixed hex) from
+// |config| into |list|, storing at most |max| entries. Returns the number of
+// entries stored.
+static uint8_t bte_conf_get_list(const config_t *config, const char *key, uint16_t *list, uint8_t max) {
+  const char *p = config_get_string(config, CONFIG_DEFAULT_SECTION, key, "");
+  uint8_t count = 0;
+
+  while (*p != '\0' && count < max) {
+    char *end;
+    unsigned long value = strtoul(p, &end, 0);
+    if (end == p)
+      break;
+    list[count++] = (uint16_t)value;
+    p = end;
+    while (*p == ',' || *p == ' ')
+      ++p;
+  }
+
+  return count;
+}
+
 // Reads the stack configuration file and populates global variables with
 // the contents of the file.
 void bte_load_conf(const char *path) {
@@ -49,7 +73,24 @@ void bte_load_conf(const char *path) {
   strlcpy(hci_logfile, config_get_string(config, CONFIG_DEFAULT_SECTION, "BtSnoopFileName", ""), sizeof(hci_logfile));
   hci_logging_enabled = config_get_bool(config, CONFIG_DEFAULT_SECTION, "BtSnoopLogOutput", false);
   hci_save_log = config_get_bool(config, CONFIG_DEFAULT_SECTION, "BtSnoopSaveLog", false);
+
+  const char *log_mode = config_get_string(config, CONFIG_DEFAULT_SECTION, "BtSnoopMode", "file");
+  if (!strcmp(log_mode, "rotate"))
+    hci_logging_cfg.mode = BT_HC_LOGGING_MODE_ROTATE;
+  else if (!strcmp(log_mode, "memory"))
+    hci_logging_cfg.mode = BT_HC_LOGGING_MODE_MEMORY;
+  else
+    hci_logging_cfg.mode = BT_HC_LOGGING_MODE_FILE;
+  hci_logging_cfg.max_size = config_get_int(config, CONFIG_DEFAULT_SECTION, "BtSnoopMaxSizeKb", 0) * 1024;
+  hci_logging_cfg.max_files = config_get_int(config, CONFIG_DEFAULT_SECTION, "BtSnoopMaxFiles", 0);
+  hci_logging_cfg.acl_snap_len = config_get_int(config, CONFIG_DEFAULT_SECTION, "BtSnoopAclSnapLen", 0);
+  hci_logging_cfg.sco_snap_len = config_get_int(config, CONFIG_DEFAULT_SECTION, "BtSnoopScoSnapLen", 0);
+  hci_logging_cfg.num_full_handles = bte_conf_get_list(config, "BtSnoopFullAclHandles",
+      hci_logging_cfg.full_handles, BT_HC_LOGGING_FILTER_MAX);
+  hci_logging_cfg.num_full_cids = bte_conf_get_list(config, "BtSnoopFullL2capCids",
+      hci_logging_cfg.full_cids, BT_HC_LOGGING_FILTER_MAX);
   trace_conf_enabled = config_get_bool(config, CONFIG_DEFAULT_SECTION, "TraceConf", false);
+  GKI_enable_latency_stats(config_get_bool(config, CONFIG_DEFAULT_SECTION, "BtLatencyStats", false));
 
   bte_trace_conf_config(config);
   config_free(config);
@@ -57,6 +98,7 @@ void bte_load_conf(const char *path) {
 
 #if (defined(BLE_INCLUDED) && (BLE_INCLUDED == TRUE))
 extern int btm_ble_tx_power[BTM_BLE_ADV_TX_POWER_MAX + 1];
+extern UINT16 btif_gattc_scan_batch_window_ms;
 void bte_load_ble_conf(const char* path)
 {
   assert(path != NULL);
@@ -76,6 +118,8 @@ void bte_load_ble_conf(const char* path)
     ALOGI("loaded btm_ble_tx_power: %d, %d, %d, %d, %d", (char)btm_ble_tx_power[0], (char)btm_ble_tx_power[1],
                                         btm_ble_tx_power[2], btm_ble_tx_power[3], btm_ble_tx_power[4]);
   }
+  btif_gattc_scan_batch_window_ms = config_get_int(config, CONFIG_DEFAULT_SECTION, "BLE_SCAN_BATCH_WINDOW_MS",
+                                                   btif_gattc_scan_batch_window_ms);
   config_free(config);
 }
 #endif
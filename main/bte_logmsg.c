@@ -28,12 +28,19 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sys/prctl.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
 #include "config.h"
 #include "gki.h"
 #include "bte.h"
 
 #include "bte_appl.h"
+#include "osi.h"
+#include "semaphore.h"
 
 #if MMI_INCLUDED == TRUE
 #include "mmi.h"
@@ -193,6 +200,21 @@ const char * const bt_layer_tags[] = {
 #endif
 #define BTE_LOG_MAX_SIZE  (BTE_LOG_BUF_SIZE - 12)
 
+/* Format and output traces on a background thread instead of the caller's. */
+#ifndef BTE_LOG_ASYNC
+#define BTE_LOG_ASYNC TRUE
+#endif
+
+/* Bytes in each tracing thread's ring; must be a power of two. */
+#ifndef BTE_LOG_RING_SIZE
+#define BTE_LOG_RING_SIZE (16 * 1024)
+#endif
+
+/* Most threads with a ring of their own; others format on their own stack. */
+#ifndef BTE_LOG_MAX_THREADS
+#define BTE_LOG_MAX_THREADS 32
+#endif
+
 
 //#define BTE_MAP_TRACE_LEVEL FALSE
 /* map by default BTE trace levels onto android trace levels */
@@ -222,33 +244,28 @@ const char * const bt_layer_tags[] = {
 #endif
 #define DBG_TRACE_DEBUG2( m, p0, p1 ) BT_TRACE( TRACE_LAYER_BTM, (TRACE_ORG_APPL|TRACE_TYPE_DEBUG), m, p0, p1 )
 
-void
-LogMsg(UINT32 trace_set_mask, const char *fmt_str, ...)
+#if (defined(ANDROID_USE_LOGCAT) && (ANDROID_USE_LOGCAT==TRUE))
+#define BTE_LOG_OUTPUT_IS_LOGCAT TRUE
+#else
+#define BTE_LOG_OUTPUT_IS_LOGCAT FALSE
+#endif
+
+/*******************************************************************************
+**
+** Function         bte_log_output
+**
+** Description      Hands a formatted trace line to logcat or stderr.
+**
+** Returns          void
+**
+*******************************************************************************/
+static void bte_log_output(UINT32 trace_set_mask, const char *buffer)
 {
-	static char buffer[BTE_LOG_BUF_SIZE];
     int trace_layer = TRACE_GET_LAYER(trace_set_mask);
     if (trace_layer >= TRACE_LAYER_MAX_NUM)
         trace_layer = 0;
 
-	va_list ap;
-#if (BTE_ANDROID_INTERNAL_TIMESTAMP==TRUE)
-	struct timeval tv;
-	struct timezone tz;
-	struct tm *tm;
-	time_t t;
-
-	gettimeofday(&tv, &tz);
-	time(&t);
-	tm = localtime(&t);
-        if (tm)
-            sprintf(buffer, "%02d:%02d:%02d.%03d ", tm->tm_hour, tm->tm_min, tm->tm_sec,
-            tv.tv_usec / 1000);
-#endif
-	va_start(ap, fmt_str);
-	vsnprintf(&buffer[MSG_BUFFER_OFFSET], BTE_LOG_MAX_SIZE, fmt_str, ap);
-	va_end(ap);
-
-#if (defined(ANDROID_USE_LOGCAT) && (ANDROID_USE_LOGCAT==TRUE))
+#if (BTE_LOG_OUTPUT_IS_LOGCAT == TRUE)
 #if (BTE_MAP_TRACE_LEVEL==TRUE)
     switch ( TRACE_GET_TYPE(trace_set_mask) )
     {
@@ -273,8 +290,847 @@ LogMsg(UINT32 trace_set_mask, const char *fmt_str, ...)
     LOGI0(bt_layer_tags[trace_layer], buffer);
 #endif
 #else
-	write(2, buffer, strlen(buffer));
-	write(2, "\n", 1);
+    struct iovec iov[2];
+    iov[0].iov_base = (void *)buffer;
+    iov[0].iov_len = strlen(buffer);
+    iov[1].iov_base = "\n";
+    iov[1].iov_len = 1;
+    writev(2, iov, 2);
+#endif
+}
+
+/*******************************************************************************
+**
+** Function         bte_log_timestamp
+**
+** Description      Writes the "hh:mm:ss.mmm " prefix for |timestamp_us| into
+**                  |buffer|.
+**
+** Returns          Number of characters written.
+**
+*******************************************************************************/
+#if (BTE_ANDROID_INTERNAL_TIMESTAMP==TRUE)
+static int bte_log_timestamp(UINT64 timestamp_us, char *buffer, size_t size)
+{
+    time_t sec = (time_t)(timestamp_us / 1000000);
+    struct tm tm;
+
+    if (localtime_r(&sec, &tm) == NULL)
+        return 0;
+
+    return snprintf(buffer, size, "%02d:%02d:%02d.%03d ", tm.tm_hour, tm.tm_min, tm.tm_sec,
+                    (int)((timestamp_us / 1000) % 1000));
+}
+#endif
+
+#if (BTE_LOG_ASYNC == TRUE) || (BTE_ANDROID_INTERNAL_TIMESTAMP==TRUE)
+static UINT64 bte_log_now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (UINT64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+#endif
+
+/*******************************************************************************
+**
+** Function         bte_log_format_now
+**
+** Description      Formats a trace on the calling thread into its own stack
+**                  buffer and outputs it. Used when the trace cannot be
+**                  deferred to the log thread.
+**
+** Returns          void
+**
+*******************************************************************************/
+static void bte_log_format_now(UINT32 trace_set_mask, const char *fmt_str, va_list ap)
+{
+    char buffer[BTE_LOG_BUF_SIZE];
+    int offset = 0;
+
+#if (BTE_ANDROID_INTERNAL_TIMESTAMP==TRUE)
+    offset = bte_log_timestamp(bte_log_now_us(), buffer, sizeof(buffer));
+#endif
+    vsnprintf(&buffer[offset], BTE_LOG_MAX_SIZE, fmt_str, ap);
+    bte_log_output(trace_set_mask, buffer);
+}
+
+#if (BTE_LOG_ASYNC == TRUE)
+/* Deferred tracing. Each thread that traces owns a single producer, single
+ * consumer ring, so the hot path never takes a lock or formats anything: it
+ * stores the format pointer, a timestamp and the raw arguments (strings are
+ * copied, since the caller's may not outlive the call) and returns. The log
+ * thread merges the rings in timestamp order, formats and outputs. A record
+ * that does not fit in its ring is dropped and counted.
+ */
+
+#define BTE_LOG_RING_MASK       (BTE_LOG_RING_SIZE - 1)
+#define BTE_LOG_MAX_ARGS        16
+#define BTE_LOG_MAX_STR         BTE_LOG_MAX_SIZE
+#define BTE_LOG_SLOT_ALIGN(len) (((len) + 7) & ~7u)
+
+/* Slot length flag for padding that skips to the start of the ring. */
+#define BTE_LOG_SLOT_SKIP       0x80000000u
+
+/* Argument value meaning a NULL string. */
+#define BTE_LOG_NULL_STR        0xFFFFFFFFu
+
+/* Argument kinds, as read from the format by bte_log_parse_spec(). */
+enum
+{
+    BTE_LOG_ARG_INT,
+    BTE_LOG_ARG_LONG,
+    BTE_LOG_ARG_LLONG,
+    BTE_LOG_ARG_SIZE,
+    BTE_LOG_ARG_PTRDIFF,
+    BTE_LOG_ARG_DOUBLE,
+    BTE_LOG_ARG_LDOUBLE,
+    BTE_LOG_ARG_PTR,
+    BTE_LOG_ARG_STR,
+    BTE_LOG_ARG_COUNT       /* %n, consumed and ignored */
+};
+
+typedef union
+{
+    long long           i;      /* integers, already narrowed per length modifier */
+    double              d;
+    const void         *p;
+    UINT32              str;    /* offset of the copied string in the record */
+} tBTE_LOG_ARG;
+
+/* A record in a ring. Arguments follow the header, copied strings follow the
+ * arguments and the copied format string comes last. */
+typedef struct
+{
+    UINT32              len;            /* slot length, or BTE_LOG_SLOT_SKIP | pad */
+    UINT32              trace_set_mask;
+    UINT64              timestamp_us;
+    const char         *fmt;            /* the copy in this slot */
+    UINT32              nargs;
+    UINT32              reserved;
+} tBTE_LOG_REC;
+
+typedef struct
+{
+    UINT8               buf[BTE_LOG_RING_SIZE] __attribute__((aligned(8)));
+    UINT32              head;           /* written by the owning thread only */
+    UINT32              tail;           /* written by the log thread only */
+    UINT32              drops;          /* written by the owning thread only */
+    UINT32              owned;          /* non-zero while a live thread owns the ring */
+} tBTE_LOG_RING;
+
+/* A specifier parsed out of a format string. */
+typedef struct
+{
+    const char         *start;          /* the '%' */
+    const char         *end;            /* one past the conversion character */
+    UINT8               stars;          /* '*' width and/or precision arguments */
+    UINT8               type;           /* BTE_LOG_ARG_* */
+    UINT8               narrow_bits;    /* 8 for hh, 16 for h, otherwise 0 */
+    char                conv;
+} tBTE_LOG_SPEC;
+
+static const char *LOG_THREAD_NAME = "bt_logmsg";
+
+/* Rings are never freed; one left behind by an exited thread is handed to the
+ * next thread that traces. */
+static tBTE_LOG_RING *log_rings[BTE_LOG_MAX_THREADS];
+static UINT32 log_ring_count;
+
+/* Thread specific value of a thread that found no ring; it logs synchronously
+ * from then on instead of looking for one on every trace. */
+static char log_no_ring;
+
+static pthread_once_t log_once = PTHREAD_ONCE_INIT;
+static pthread_key_t log_ring_key;
+static pthread_mutex_t log_consumer_lock = PTHREAD_MUTEX_INITIALIZER;
+static semaphore_t *log_sem;
+static BOOLEAN log_thread_valid = FALSE;
+static UINT32 log_idle;
+
+/* Records dropped so far, as last reported by the log thread. */
+static UINT32 log_drops_reported;
+
+/*******************************************************************************
+**
+** Function         bte_log_parse_spec
+**
+** Description      Parses the conversion specifier at |p|, which points at a
+**                  '%' that does not start "%%".
+**
+** Returns          TRUE if the specifier can be deferred.
+**
+*******************************************************************************/
+static BOOLEAN bte_log_parse_spec(const char *p, tBTE_LOG_SPEC *p_spec)
+{
+    enum { LEN_NONE, LEN_HH, LEN_H, LEN_L, LEN_LL, LEN_Z, LEN_T, LEN_LD } len = LEN_NONE;
+
+    p_spec->start = p++;
+    p_spec->stars = 0;
+    p_spec->narrow_bits = 0;
+
+    while (*p && strchr("-+ #0'", *p))
+        p++;
+    if (*p == '*')
+    {
+        p_spec->stars++;
+        p++;
+    }
+    else
+    {
+        while (*p >= '0' && *p <= '9')
+            p++;
+    }
+    if (*p == '.')
+    {
+        p++;
+        if (*p == '*')
+        {
+            p_spec->stars++;
+            p++;
+        }
+        else
+        {
+            while (*p >= '0' && *p <= '9')
+                p++;
+        }
+    }
+
+    switch (*p)
+    {
+        case 'h':
+            len = (p[1] == 'h') ? LEN_HH : LEN_H;
+            p += (len == LEN_HH) ? 2 : 1;
+            break;
+        case 'l':
+            len = (p[1] == 'l') ? LEN_LL : LEN_L;
+            p += (len == LEN_LL) ? 2 : 1;
+            break;
+        case 'q':
+        case 'j':
+            len = LEN_LL;
+            p++;
+            break;
+        case 'z':
+            len = LEN_Z;
+            p++;
+            break;
+        case 't':
+            len = LEN_T;
+            p++;
+            break;
+        case 'L':
+            len = LEN_LD;
+            p++;
+            break;
+    }
+
+    p_spec->conv = *p;
+    p_spec->end = p + 1;
+
+    switch (*p)
+    {
+        case 'd': case 'i': case 'o': case 'u': case 'x': case 'X':
+            /* Narrowing for hh and h happens when the argument is stored. */
+            if (len == LEN_L)
+                p_spec->type = BTE_LOG_ARG_LONG;
+            else if (len == LEN_LL)
+                p_spec->type = BTE_LOG_ARG_LLONG;
+            else if (len == LEN_Z)
+                p_spec->type = BTE_LOG_ARG_SIZE;
+            else if (len == LEN_T)
+                p_spec->type = BTE_LOG_ARG_PTRDIFF;
+            else
+                p_spec->type = BTE_LOG_ARG_INT;
+            p_spec->narrow_bits = (len == LEN_HH) ? 8 : (len == LEN_H) ? 16 : 0;
+            return len != LEN_LD;
+
+        case 'c':
+            p_spec->type = BTE_LOG_ARG_INT;
+            return len == LEN_NONE;
+
+        case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+            p_spec->type = (len == LEN_LD) ? BTE_LOG_ARG_LDOUBLE : BTE_LOG_ARG_DOUBLE;
+            return TRUE;
+
+        case 's':
+            p_spec->type = BTE_LOG_ARG_STR;
+            return len == LEN_NONE;
+
+        case 'p':
+            p_spec->type = BTE_LOG_ARG_PTR;
+            return TRUE;
+
+        case 'n':
+            p_spec->type = BTE_LOG_ARG_COUNT;
+            return TRUE;
+
+        default:
+            return FALSE;
+    }
+}
+
+/*******************************************************************************
+**
+** Function         bte_log_thread_exit
+**
+** Description      pthread key destructor; leaves the thread's ring for the
+**                  next thread that traces once the log thread drains it.
+**
+** Returns          void
+**
+*******************************************************************************/
+static void bte_log_thread_exit(void *context)
+{
+    tBTE_LOG_RING *p_ring = (tBTE_LOG_RING *)context;
+
+    if (context != &log_no_ring)
+        __atomic_store_n(&p_ring->owned, 0, __ATOMIC_RELEASE);
+}
+
+/*******************************************************************************
+**
+** Function         bte_log_get_ring
+**
+** Description      Returns the calling thread's ring, claiming an abandoned
+**                  ring or allocating a new one on the thread's first trace.
+**
+** Returns          The ring, or NULL if none is available. A thread that
+**                  gets NULL keeps getting it without searching again.
+**
+*******************************************************************************/
+static tBTE_LOG_RING *bte_log_get_ring(void)
+{
+    void *p_specific = pthread_getspecific(log_ring_key);
+    tBTE_LOG_RING *p_ring = NULL;
+    UINT32 count, i;
+
+    if (p_specific == &log_no_ring)
+        return NULL;
+    if (p_specific != NULL)
+        return (tBTE_LOG_RING *)p_specific;
+
+    count = __atomic_load_n(&log_ring_count, __ATOMIC_ACQUIRE);
+    if (count > BTE_LOG_MAX_THREADS)
+        count = BTE_LOG_MAX_THREADS;
+    for (i = 0; i < count && p_ring == NULL; i++)
+    {
+        tBTE_LOG_RING *p_candidate = __atomic_load_n(&log_rings[i], __ATOMIC_ACQUIRE);
+        UINT32 expected = 0;
+
+        if (p_candidate != NULL &&
+            __atomic_compare_exchange_n(&p_candidate->owned, &expected, 1, FALSE,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            p_ring = p_candidate;
+    }
+
+    if (p_ring == NULL)
+    {
+        /* take the next free index, never moving the count past the array */
+        i = __atomic_load_n(&log_ring_count, __ATOMIC_ACQUIRE);
+        do
+        {
+            if (i >= BTE_LOG_MAX_THREADS)
+            {
+                pthread_setspecific(log_ring_key, &log_no_ring);
+                return NULL;
+            }
+        } while (!__atomic_compare_exchange_n(&log_ring_count, &i, i + 1, FALSE,
+                                              __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+        /* on failure the index stays NULL, which every reader skips */
+        if ((p_ring = calloc(1, sizeof(*p_ring))) == NULL)
+        {
+            pthread_setspecific(log_ring_key, &log_no_ring);
+            return NULL;
+        }
+        p_ring->owned = 1;
+        __atomic_store_n(&log_rings[i], p_ring, __ATOMIC_RELEASE);
+    }
+
+    pthread_setspecific(log_ring_key, p_ring);
+    return p_ring;
+}
+
+/*******************************************************************************
+**
+** Function         bte_log_reserve
+**
+** Description      Finds a contiguous |slot_len| byte slot in |p_ring|,
+**                  padding to the start of the ring when needed. The slot
+**                  (and any padding) is published by advancing the ring head.
+**
+** Returns          TRUE with the ring position of the slot in |p_pos|, or
+**                  FALSE if the ring is full.
+**
+*******************************************************************************/
+static BOOLEAN bte_log_reserve(tBTE_LOG_RING *p_ring, UINT32 slot_len, UINT32 *p_pos)
+{
+    UINT32 head = p_ring->head;
+    UINT32 tail = __atomic_load_n(&p_ring->tail, __ATOMIC_ACQUIRE);
+    UINT32 to_end = BTE_LOG_RING_SIZE - (head & BTE_LOG_RING_MASK);
+    UINT32 pad = (slot_len > to_end) ? to_end : 0;
+
+    if (head + pad + slot_len - tail > BTE_LOG_RING_SIZE)
+        return FALSE;
+
+    if (pad)
+        ((tBTE_LOG_REC *)&p_ring->buf[head & BTE_LOG_RING_MASK])->len = BTE_LOG_SLOT_SKIP | pad;
+
+    *p_pos = head + pad;
+    return TRUE;
+}
+
+static void bte_log_wake(void)
+{
+    if (__atomic_exchange_n(&log_idle, 0, __ATOMIC_SEQ_CST))
+        semaphore_post(log_sem);
+}
+
+/*******************************************************************************
+**
+** Function         bte_log_defer
+**
+** Description      Stores a trace in the calling thread's ring for the log
+**                  thread to format.
+**
+** Returns          FALSE if the trace must be formatted right away instead.
+**
+*******************************************************************************/
+static BOOLEAN bte_log_defer(UINT32 trace_set_mask, const char *fmt_str, va_list ap)
+{
+    tBTE_LOG_ARG args[BTE_LOG_MAX_ARGS];
+    const char *strs[BTE_LOG_MAX_ARGS];
+    UINT32 str_lens[BTE_LOG_MAX_ARGS];
+    UINT32 nargs = 0, str_bytes = 0, fmt_len, slot_len, pos, i;
+    tBTE_LOG_RING *p_ring;
+    tBTE_LOG_REC *p_rec;
+    tBTE_LOG_SPEC spec;
+    const char *p;
+    char *p_fmt;
+
+    if (!log_thread_valid || (p_ring = bte_log_get_ring()) == NULL)
+        return FALSE;
+
+    for (p = strchr(fmt_str, '%'); p != NULL; p = strchr(p, '%'))
+    {
+        if (p[1] == '%')
+        {
+            p += 2;
+            continue;
+        }
+        if (!bte_log_parse_spec(p, &spec))
+            return FALSE;
+        p = spec.end;
+
+        if (nargs + spec.stars + 1 > BTE_LOG_MAX_ARGS)
+            return FALSE;
+        for (i = 0; i < spec.stars; i++)
+        {
+            strs[nargs] = NULL;
+            args[nargs++].i = va_arg(ap, int);
+        }
+
+        strs[nargs] = NULL;
+        switch (spec.type)
+        {
+            case BTE_LOG_ARG_INT:
+            {
+                int value = va_arg(ap, int);
+                BOOLEAN is_signed = (spec.conv == 'd' || spec.conv == 'i');
+
+                if (spec.narrow_bits == 8)
+                    args[nargs].i = is_signed ? (long long)(signed char)value : (long long)(unsigned char)value;
+                else if (spec.narrow_bits == 16)
+                    args[nargs].i = is_signed ? (long long)(short)value : (long long)(unsigned short)value;
+                else
+                    args[nargs].i = is_signed || spec.conv == 'c' ? (long long)value : (long long)(unsigned int)value;
+                break;
+            }
+            case BTE_LOG_ARG_LONG:
+            {
+                long value = va_arg(ap, long);
+                args[nargs].i = (spec.conv == 'd' || spec.conv == 'i') ? (long long)value : (long long)(unsigned long)value;
+                break;
+            }
+            case BTE_LOG_ARG_LLONG:
+                args[nargs].i = va_arg(ap, long long);
+                break;
+            case BTE_LOG_ARG_SIZE:
+                args[nargs].i = (long long)va_arg(ap, size_t);
+                break;
+            case BTE_LOG_ARG_PTRDIFF:
+                args[nargs].i = (long long)va_arg(ap, ptrdiff_t);
+                break;
+            case BTE_LOG_ARG_DOUBLE:
+                args[nargs].d = va_arg(ap, double);
+                break;
+            case BTE_LOG_ARG_LDOUBLE:
+                args[nargs].d = (double)va_arg(ap, long double);
+                break;
+            case BTE_LOG_ARG_PTR:
+            case BTE_LOG_ARG_COUNT:
+                args[nargs].p = va_arg(ap, void *);
+                break;
+            case BTE_LOG_ARG_STR:
+                strs[nargs] = va_arg(ap, const char *);
+                if (strs[nargs] == NULL)
+                {
+                    args[nargs].str = BTE_LOG_NULL_STR;
+                }
+                else
+                {
+                    str_lens[nargs] = strnlen(strs[nargs], BTE_LOG_MAX_STR - 1);
+                    args[nargs].str = str_bytes;
+                    str_bytes += str_lens[nargs] + 1;
+                }
+                break;
+        }
+        nargs++;
+    }
+
+    /* Some callers build the format itself in a stack buffer, so it is copied
+     * like any string argument. */
+    fmt_len = strnlen(fmt_str, BTE_LOG_MAX_STR - 1);
+    slot_len = BTE_LOG_SLOT_ALIGN(sizeof(tBTE_LOG_REC) + nargs * sizeof(tBTE_LOG_ARG) +
+                                  str_bytes + fmt_len + 1);
+    if (slot_len > BTE_LOG_RING_SIZE / 2 || !bte_log_reserve(p_ring, slot_len, &pos))
+    {
+        __atomic_store_n(&p_ring->drops, p_ring->drops + 1, __ATOMIC_RELAXED);
+        return TRUE;
+    }
+
+    p_rec = (tBTE_LOG_REC *)&p_ring->buf[pos & BTE_LOG_RING_MASK];
+    p_rec->len = slot_len;
+    p_rec->trace_set_mask = trace_set_mask;
+    p_rec->timestamp_us = bte_log_now_us();
+    p_rec->nargs = nargs;
+    memcpy(p_rec + 1, args, nargs * sizeof(tBTE_LOG_ARG));
+    p_fmt = (char *)((tBTE_LOG_ARG *)(p_rec + 1) + nargs) + str_bytes;
+    memcpy(p_fmt, fmt_str, fmt_len);
+    p_fmt[fmt_len] = '\0';
+    p_rec->fmt = p_fmt;
+    for (i = 0; i < nargs; i++)
+    {
+        if (strs[i] != NULL)
+        {
+            char *p_str = (char *)((tBTE_LOG_ARG *)(p_rec + 1) + nargs) + args[i].str;
+            memcpy(p_str, strs[i], str_lens[i]);
+            p_str[str_lens[i]] = '\0';
+        }
+    }
+
+    __atomic_store_n(&p_ring->head, pos + slot_len, __ATOMIC_RELEASE);
+    bte_log_wake();
+    return TRUE;
+}
+
+/*******************************************************************************
+**
+** Function         bte_log_render
+**
+** Description      Formats a deferred record into |buffer|. Each specifier is
+**                  rebuilt with its '*' arguments spelled out and a length
+**                  modifier matching the stored argument.
+**
+** Returns          void
+**
+*******************************************************************************/
+static void bte_log_render(const tBTE_LOG_REC *p_rec, char *buffer, size_t size)
+{
+    const tBTE_LOG_ARG *args = (const tBTE_LOG_ARG *)(p_rec + 1);
+    const char *strs = (const char *)(args + p_rec->nargs);
+    const char *p = p_rec->fmt;
+    size_t n = 0;
+    UINT32 a = 0;
+
+    while (*p && n + 1 < size)
+    {
+        tBTE_LOG_SPEC spec;
+        char spec_str[48];
+        size_t spec_len = 0;
+        const char *q;
+        int written = 0;
+
+        if (*p != '%')
+        {
+            buffer[n++] = *p++;
+            continue;
+        }
+        if (p[1] == '%')
+        {
+            buffer[n++] = '%';
+            p += 2;
+            continue;
+        }
+        if (!bte_log_parse_spec(p, &spec) || a + spec.stars >= p_rec->nargs + 1)
+            break;
+
+        /* Flags, width and precision, with the length modifier dropped. */
+        for (q = spec.start; q < spec.end - 1 && spec_len < sizeof(spec_str) - 24; q++)
+        {
+            if (*q == '*')
+            {
+                int value = (int)args[a++].i;
+
+                /* A negative precision means none was given. */
+                if (q > spec.start && q[-1] == '.' && value < 0)
+                    spec_len--;
+                else
+                    spec_len += snprintf(&spec_str[spec_len], sizeof(spec_str) - spec_len, "%d", value);
+            }
+            else if (!strchr("hlqjztL", *q))
+            {
+                spec_str[spec_len++] = *q;
+            }
+        }
+        if (spec.type <= BTE_LOG_ARG_PTRDIFF && spec.conv != 'c')
+        {
+            spec_str[spec_len++] = 'l';
+            spec_str[spec_len++] = 'l';
+        }
+        spec_str[spec_len++] = spec.conv;
+        spec_str[spec_len] = '\0';
+
+        switch (spec.type)
+        {
+            case BTE_LOG_ARG_INT:
+            case BTE_LOG_ARG_LONG:
+            case BTE_LOG_ARG_LLONG:
+            case BTE_LOG_ARG_SIZE:
+            case BTE_LOG_ARG_PTRDIFF:
+                if (spec.conv == 'c')
+                    written = snprintf(&buffer[n], size - n, spec_str, (int)args[a].i);
+                else
+                    written = snprintf(&buffer[n], size - n, spec_str, args[a].i);
+                break;
+            case BTE_LOG_ARG_DOUBLE:
+            case BTE_LOG_ARG_LDOUBLE:
+                written = snprintf(&buffer[n], size - n, spec_str, args[a].d);
+                break;
+            case BTE_LOG_ARG_PTR:
+                written = snprintf(&buffer[n], size - n, spec_str, args[a].p);
+                break;
+            case BTE_LOG_ARG_STR:
+                written = snprintf(&buffer[n], size - n, spec_str,
+                                   args[a].str == BTE_LOG_NULL_STR ? "(null)" : &strs[args[a].str]);
+                break;
+            case BTE_LOG_ARG_COUNT:
+                break;
+        }
+        a++;
+
+        if (written > 0)
+            n += ((size_t)written < size - n) ? (size_t)written : size - n - 1;
+        p = spec.end;
+    }
+
+    buffer[n] = '\0';
+}
+
+/*******************************************************************************
+**
+** Function         bte_log_next
+**
+** Description      Finds the oldest record waiting in any ring, stepping over
+**                  padding on the way.
+**
+** Returns          The record, or NULL if every ring is empty.
+**
+*******************************************************************************/
+static tBTE_LOG_REC *bte_log_next(tBTE_LOG_RING **pp_ring)
+{
+    UINT32 count = __atomic_load_n(&log_ring_count, __ATOMIC_ACQUIRE);
+    tBTE_LOG_REC *p_oldest = NULL;
+    UINT32 i;
+
+    if (count > BTE_LOG_MAX_THREADS)
+        count = BTE_LOG_MAX_THREADS;
+
+    for (i = 0; i < count; i++)
+    {
+        tBTE_LOG_RING *p_ring = __atomic_load_n(&log_rings[i], __ATOMIC_ACQUIRE);
+        tBTE_LOG_REC *p_rec;
+        UINT32 head;
+
+        if (p_ring == NULL)
+            continue;
+
+        head = __atomic_load_n(&p_ring->head, __ATOMIC_ACQUIRE);
+        if (p_ring->tail == head)
+            continue;
+
+        p_rec = (tBTE_LOG_REC *)&p_ring->buf[p_ring->tail & BTE_LOG_RING_MASK];
+        if (p_rec->len & BTE_LOG_SLOT_SKIP)
+        {
+            __atomic_store_n(&p_ring->tail, p_ring->tail + (p_rec->len & ~BTE_LOG_SLOT_SKIP),
+                             __ATOMIC_RELEASE);
+            if (p_ring->tail == head)
+                continue;
+            p_rec = (tBTE_LOG_REC *)&p_ring->buf[p_ring->tail & BTE_LOG_RING_MASK];
+        }
+
+        if (p_oldest == NULL || p_rec->timestamp_us < p_oldest->timestamp_us)
+        {
+            p_oldest = p_rec;
+            *pp_ring = p_ring;
+        }
+    }
+
+    return p_oldest;
+}
+
+/*******************************************************************************
+**
+** Function         bte_log_service
+**
+** Description      Formats and outputs every waiting record, then reports any
+**                  records dropped since the last report. Only one thread
+**                  services the rings at a time.
+**
+** Returns          TRUE if anything was output.
+**
+*******************************************************************************/
+static BOOLEAN bte_log_service(void)
+{
+    char buffer[BTE_LOG_BUF_SIZE];
+    tBTE_LOG_RING *p_ring = NULL;
+    tBTE_LOG_REC *p_rec;
+    BOOLEAN busy = FALSE;
+    UINT32 drops = 0, count, i;
+
+    pthread_mutex_lock(&log_consumer_lock);
+
+    while ((p_rec = bte_log_next(&p_ring)) != NULL)
+    {
+        int offset = 0;
+
+#if (BTE_ANDROID_INTERNAL_TIMESTAMP==TRUE)
+        offset = bte_log_timestamp(p_rec->timestamp_us, buffer, sizeof(buffer));
+#endif
+        bte_log_render(p_rec, &buffer[offset], BTE_LOG_MAX_SIZE);
+        bte_log_output(p_rec->trace_set_mask, buffer);
+
+        __atomic_store_n(&p_ring->tail, p_ring->tail + p_rec->len, __ATOMIC_RELEASE);
+        busy = TRUE;
+    }
+
+    count = __atomic_load_n(&log_ring_count, __ATOMIC_ACQUIRE);
+    for (i = 0; i < count && i < BTE_LOG_MAX_THREADS; i++)
+    {
+        tBTE_LOG_RING *p_ring = __atomic_load_n(&log_rings[i], __ATOMIC_ACQUIRE);
+        if (p_ring != NULL)
+            drops += __atomic_load_n(&p_ring->drops, __ATOMIC_RELAXED);
+    }
+    if (drops != log_drops_reported)
+    {
+        snprintf(buffer, sizeof(buffer), "bte_logmsg: %u trace records dropped (%u total)",
+                 drops - log_drops_reported, drops);
+        bte_log_output(TRACE_LAYER_NONE | TRACE_TYPE_WARNING, buffer);
+        log_drops_reported = drops;
+        busy = TRUE;
+    }
+
+    pthread_mutex_unlock(&log_consumer_lock);
+    return busy;
+}
+
+static void *bte_log_thread(UNUSED_ATTR void *context)
+{
+    prctl(PR_SET_NAME, (unsigned long)LOG_THREAD_NAME, 0, 0, 0);
+
+    for (;;)
+    {
+        if (bte_log_service())
+            continue;
+
+        /* Announce that we are about to sleep, then look once more so that a
+         * record stored in between is not left waiting for the next trace. */
+        __atomic_store_n(&log_idle, 1, __ATOMIC_SEQ_CST);
+        if (bte_log_service())
+        {
+            if (!__atomic_exchange_n(&log_idle, 0, __ATOMIC_SEQ_CST))
+                semaphore_wait(log_sem);  /* Consume the wakeup a producer posted. */
+            continue;
+        }
+        semaphore_wait(log_sem);
+    }
+
+    return NULL;
+}
+
+/* Outputs whatever is still queued when the process exits normally. */
+static void bte_log_flush_at_exit(void)
+{
+    while (bte_log_service())
+        ;
+}
+
+static void bte_log_init(void)
+{
+    pthread_t thread;
+
+    if (pthread_key_create(&log_ring_key, bte_log_thread_exit) != 0)
+        return;
+
+    log_sem = semaphore_new(0);
+    if (log_sem == NULL)
+        return;
+
+    if (pthread_create(&thread, NULL, bte_log_thread, NULL) != 0)
+    {
+        semaphore_free(log_sem);
+        log_sem = NULL;
+        return;
+    }
+    pthread_detach(thread);
+
+    atexit(bte_log_flush_at_exit);
+    log_thread_valid = TRUE;
+}
+
+/* Defers a trace, or formats it right away if the log thread is unavailable. */
+static void bte_log_put(UINT32 trace_set_mask, const char *fmt_str, ...)
+{
+    va_list ap, ap_copy;
+
+    va_start(ap, fmt_str);
+    va_copy(ap_copy, ap);
+    if (!bte_log_defer(trace_set_mask, fmt_str, ap_copy))
+        bte_log_format_now(trace_set_mask, fmt_str, ap);
+    va_end(ap_copy);
+    va_end(ap);
+}
+#endif  /* BTE_LOG_ASYNC */
+
+void
+LogMsg(UINT32 trace_set_mask, const char *fmt_str, ...)
+{
+    va_list ap;
+
+#if (BTE_LOG_ASYNC == TRUE)
+    va_list ap_copy;
+    BOOLEAN deferred;
+
+    pthread_once(&log_once, bte_log_init);
+
+    va_start(ap, fmt_str);
+    va_copy(ap_copy, ap);
+    deferred = bte_log_defer(trace_set_mask, fmt_str, ap_copy);
+    va_end(ap_copy);
+    if (!deferred)
+    {
+        /* A format the ring cannot carry; format it here but still queue it
+         * so the thread's traces stay in order. */
+        char buffer[BTE_LOG_MAX_SIZE];
+        vsnprintf(buffer, sizeof(buffer), fmt_str, ap);
+        bte_log_put(trace_set_mask, "%s", buffer);
+    }
+    va_end(ap);
+#else
+    va_start(ap, fmt_str);
+    bte_log_format_now(trace_set_mask, fmt_str, ap);
+    va_end(ap);
 #endif
 }
 
@@ -28,6 +28,9 @@
 #include <assert.h>
 #include <signal.h>
 #include <time.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
 #include <hardware/bluetooth.h>
 
 #include "gki.h"
@@ -56,6 +59,11 @@
 #define HCI_LOGGING_FILENAME  "/data/misc/bluedroid/btsnoop_hci.log"
 #endif
 
+/* statistics written by bte_main_disable when BtLatencyStats is on */
+#ifndef BTE_STATS_FILENAME
+#define BTE_STATS_FILENAME  "/data/misc/bluedroid/bt_stats.txt"
+#endif
+
 /* Stack preload process timeout period  */
 #ifndef PRELOAD_START_TIMEOUT_MS
 #define PRELOAD_START_TIMEOUT_MS 5000  // 3 seconds
@@ -84,6 +92,7 @@ BOOLEAN hci_logging_enabled = FALSE;    /* by default, turn hci log off */
 BOOLEAN hci_logging_config = FALSE;    /* configured from bluetooth framework */
 BOOLEAN hci_save_log = FALSE; /* save a copy of the log before starting again */
 char hci_logfile[256] = HCI_LOGGING_FILENAME;
+bt_hc_logging_config_t hci_logging_cfg = { BT_HC_LOGGING_MODE_FILE, 0, 0 };
 
 /*******************************************************************************
 **  Static variables
@@ -103,8 +112,10 @@ static void bte_hci_enable(void);
 static void bte_hci_disable(void);
 static void preload_start_wait_timer(void);
 static void preload_stop_wait_timer(void);
+static void bte_main_write_stats(void);
 
 BOOLEAN btif_is_shutdown(void);
+void btif_dump_context_stats(int fd);
 /*******************************************************************************
 **  Externs
 *******************************************************************************/
@@ -239,6 +250,8 @@ void bte_main_disable(void)
 
     preload_stop_wait_timer();
     bte_hci_disable();
+    /* before BTU is gone, the GKI task statistics skip dead tasks */
+    bte_main_write_stats();
     GKI_destroy_task(BTU_TASK);
 }
 
@@ -291,6 +304,8 @@ static void bte_hci_enable(void)
 
         assert(result == BT_HC_STATUS_SUCCESS);
 
+        bt_hc_if->logging_config(&hci_logging_cfg);
+
         if (hci_logging_enabled == TRUE || hci_logging_config == TRUE)
             bt_hc_if->logging(BT_HC_LOGGING_ON, hci_logfile, hci_save_log);
 
@@ -623,6 +638,58 @@ void bte_main_hci_send (BT_HDR *p_msg, UINT16 event)
     }
 }
 
+/******************************************************************************
+**
+** Function         bte_main_dump_stats
+**
+** Description      BTE MAIN API - Debug interface writing the GKI task
+**                  statistics, the btif context switch counters, the HCI
+**                  event and command counters and, when BtLatencyStats is on,
+**                  the task wake-up, BTU handler and HCI command round trip
+**                  latencies to a file descriptor
+**
+** Returns          None
+**
+******************************************************************************/
+void bte_main_dump_stats(int fd)
+{
+    GKI_dump_task_stats(fd);
+#if (GKI_LATENCY_STATS_INCLUDED == TRUE)
+    btu_dump_handler_stats(fd);
+    btu_hcif_dump_stats(fd);
+#endif
+    btif_dump_context_stats(fd);
+}
+
+/******************************************************************************
+**
+** Function         bte_main_write_stats
+**
+** Description      Internal function to write bte_main_dump_stats to
+**                  BTE_STATS_FILENAME once the stack is disabled, if
+**                  BtLatencyStats is on. The file is replaced every time.
+**
+** Returns          None
+**
+******************************************************************************/
+static void bte_main_write_stats(void)
+{
+    int fd;
+
+    if (!GKI_latency_stats_enabled())
+        return;
+
+    fd = open(BTE_STATS_FILENAME, O_WRONLY | O_CREAT | O_TRUNC, 0660);
+    if (fd < 0)
+    {
+        APPL_TRACE_ERROR("%s unable to open %s: %s", __FUNCTION__, BTE_STATS_FILENAME, strerror(errno));
+        return;
+    }
+
+    bte_main_dump_stats(fd);
+    close(fd);
+}
+
 /******************************************************************************
 **
 ** Function         bte_main_post_reset_init
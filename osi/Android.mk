@@ -32,6 +32,7 @@ LOCAL_C_INCLUDES := \
 LOCAL_SRC_FILES := \
     ./test/alarm_test.cpp \
     ./test/config_test.cpp \
+    ./test/fixed_queue_test.cpp \
     ./test/list_test.cpp \
     ./test/reactor_test.cpp \
     ./test/thread_test.cpp
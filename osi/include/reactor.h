@@ -52,6 +52,7 @@ struct reactor_object_t {
   void *context;                       // a context that's passed back to the *_ready functions.
   int fd;                              // the file descriptor to monitor for events.
   reactor_interest_t interest;         // the event types to monitor the file descriptor for.
+  bool edge_triggered;                 // report readiness only when it changes rather than while it lasts.
 
   void (*read_ready)(void *context);   // function to call when the file descriptor becomes readable.
   void (*write_ready)(void *context);  // function to call when the file descriptor becomes writeable.
@@ -80,10 +81,13 @@ reactor_status_t reactor_run_once_timeout(reactor_t *reactor, timeout_t timeout_
 void reactor_stop(reactor_t *reactor);
 
 // Registers an object with the reactor. |obj| is neither copied nor is its ownership transferred
-// so the pointer must remain valid until it is unregistered with |reactor_unregister|. Neither
-// |reactor| nor |obj| may be NULL.
+// so the pointer must remain valid until it is unregistered with |reactor_unregister|. Its |fd|,
+// |interest| and |edge_triggered| fields are read once here. Registration and unregistration
+// take constant time regardless of how many objects are registered. Neither |reactor| nor |obj|
+// may be NULL.
 void reactor_register(reactor_t *reactor, reactor_object_t *obj);
 
-// Unregisters a previously registered object with the |reactor|. Neither |reactor| nor |obj|
-// may be NULL.
+// Unregisters a previously registered object with the |reactor|. It is safe to call this from
+// a *_ready callback; |obj| will not be called back again. Neither |reactor| nor |obj| may be
+// NULL.
 void reactor_unregister(reactor_t *reactor, reactor_object_t *obj);
@@ -26,7 +26,6 @@
 #include <utils/Log.h>
 
 #include "alarm.h"
-#include "list.h"
 #include "osi.h"
 
 struct alarm_t {
@@ -39,6 +38,10 @@ struct alarm_t {
   period_ms_t deadline;
   alarm_callback_t callback;
   void *data;
+
+  // Position of this alarm in |heap| while it is pending, i.e. while
+  // |callback| is not NULL.
+  size_t heap_index;
 };
 
 extern bt_os_callouts_t *bt_os_callouts;
@@ -51,22 +54,34 @@ int64_t TIMER_INTERVAL_FOR_WAKELOCK_IN_MS = 3000;
 static const clockid_t CLOCK_ID = CLOCK_BOOTTIME;
 static const char *WAKE_LOCK_ID = "bluedroid_timer";
 
+// Initial number of pending alarms |heap| has room for.
+static const size_t HEAP_INITIAL_CAPACITY = 32;
+
 // This mutex ensures that the |alarm_set|, |alarm_cancel|, and alarm callback
 // functions execute serially and not concurrently. As a result, this mutex also
-// protects the |alarms| list.
+// protects the |heap| of pending alarms.
 static pthread_mutex_t monitor;
-static list_t *alarms;
+static bool initialized;
 static timer_t timer;
 static bool timer_set;
 
+// Binary min-heap of pending alarms ordered by deadline, so that setting or
+// cancelling an alarm costs O(log n) and the earliest deadline is at |heap[0]|.
+static alarm_t **heap;
+static size_t heap_size;
+static size_t heap_capacity;
+
 static bool lazy_initialize(void);
 static period_ms_t now(void);
 static void timer_callback(void *data);
 static void reschedule(void);
+static bool heap_insert(alarm_t *alarm);
+static void heap_remove(alarm_t *alarm);
+static void heap_update(alarm_t *alarm);
 
 alarm_t *alarm_new(void) {
-  // Make sure we have a list we can insert alarms into.
-  if (!alarms && !lazy_initialize())
+  // Make sure we have a heap we can insert alarms into.
+  if (!initialized && !lazy_initialize())
     return NULL;
 
   pthread_mutexattr_t attr;
@@ -112,50 +127,51 @@ void alarm_free(alarm_t *alarm) {
 
 // Runs in exclusion with alarm_cancel and timer_callback.
 void alarm_set(alarm_t *alarm, period_ms_t deadline, alarm_callback_t cb, void *data) {
-  assert(alarms != NULL);
+  assert(initialized);
   assert(alarm != NULL);
   assert(cb != NULL);
 
   pthread_mutex_lock(&monitor);
 
-  // If the alarm is currently set and it's at the start of the list,
+  // If the alarm is currently set and it's at the top of the heap,
   // we'll need to re-schedule since we've adjusted the earliest deadline.
-  bool needs_reschedule = (!list_is_empty(alarms) && list_front(alarms) == alarm);
-  if (alarm->callback)
-    list_remove(alarms, alarm);
+  bool pending = (alarm->callback != NULL);
+  bool needs_reschedule = (pending && heap[0] == alarm);
 
   alarm->deadline = now() + deadline;
   alarm->callback = cb;
   alarm->data = data;
 
-  // Add it into the timer list sorted by deadline (earliest deadline first).
-  if (list_is_empty(alarms))
-    list_prepend(alarms, alarm);
-  else
-    for (list_node_t *node = list_begin(alarms); node != list_end(alarms); node = list_next(node)) {
-      list_node_t *next = list_next(node);
-      if (next == list_end(alarms) || ((alarm_t *)list_node(next))->deadline >= alarm->deadline) {
-        list_insert_after(alarms, node, alarm);
-        break;
-      }
-    }
+  if (pending) {
+    heap_update(alarm);
+  } else if (!heap_insert(alarm)) {
+    ALOGE("%s unable to grow alarm heap, dropping alarm.", __func__);
+    alarm->deadline = 0;
+    alarm->callback = NULL;
+    alarm->data = NULL;
+    pthread_mutex_unlock(&monitor);
+    return;
+  }
 
   // If the new alarm has the earliest deadline, we need to re-evaluate our schedule.
-  if (needs_reschedule || (!list_is_empty(alarms) && list_front(alarms) == alarm))
+  if (needs_reschedule || heap[0] == alarm)
     reschedule();
 
   pthread_mutex_unlock(&monitor);
 }
 
 void alarm_cancel(alarm_t *alarm) {
-  assert(alarms != NULL);
+  assert(initialized);
   assert(alarm != NULL);
 
   pthread_mutex_lock(&monitor);
 
-  bool needs_reschedule = (!list_is_empty(alarms) && list_front(alarms) == alarm);
+  bool needs_reschedule = false;
+  if (alarm->callback) {
+    needs_reschedule = (heap[0] == alarm);
+    heap_remove(alarm);
+  }
 
-  list_remove(alarms, alarm);
   alarm->deadline = 0;
   alarm->callback = NULL;
   alarm->data = NULL;
@@ -171,21 +187,23 @@ void alarm_cancel(alarm_t *alarm) {
 }
 
 static bool lazy_initialize(void) {
-  assert(alarms == NULL);
+  assert(!initialized);
 
   pthread_mutex_init(&monitor, NULL);
 
-  alarms = list_new(NULL);
-  if (!alarms) {
-    ALOGE("%s unable to allocate alarm list.", __func__);
+  heap = calloc(HEAP_INITIAL_CAPACITY, sizeof(alarm_t *));
+  if (!heap) {
+    ALOGE("%s unable to allocate alarm heap.", __func__);
     return false;
   }
 
+  heap_capacity = HEAP_INITIAL_CAPACITY;
+  initialized = true;
   return true;
 }
 
 static period_ms_t now(void) {
-  assert(alarms != NULL);
+  assert(initialized);
 
   struct timespec ts;
   if (clock_gettime(CLOCK_ID, &ts) == -1) {
@@ -198,58 +216,67 @@ static period_ms_t now(void) {
 
 // Warning: this function is called in the context of an unknown thread.
 // As a result, it must be thread-safe relative to other operations on
-// the alarm list.
-static void timer_callback(void *ptr) {
-  alarm_t *alarm = (alarm_t *)ptr;
-  assert(alarm != NULL);
-
+// the alarm heap.
+//
+// Fires every alarm whose deadline has passed, not only the one the timer was
+// armed for, so a burst of alarms with close deadlines costs one wakeup. The
+// timer is only re-armed once the remaining alarms are all in the future.
+static void timer_callback(UNUSED_ATTR void *ptr) {
   pthread_mutex_lock(&monitor);
 
-  bool alarm_valid = list_remove(alarms, alarm);
-  alarm_callback_t callback = alarm->callback;
-  void *data = alarm->data;
+  for (;;) {
+    if (heap_size == 0 || heap[0]->deadline > now()) {
+      reschedule();
+      break;
+    }
 
-  alarm->deadline = 0;
-  alarm->callback = NULL;
-  alarm->data = NULL;
+    alarm_t *alarm = heap[0];
+    alarm_callback_t callback = alarm->callback;
+    void *data = alarm->data;
+
+    heap_remove(alarm);
+    alarm->deadline = 0;
+    alarm->callback = NULL;
+    alarm->data = NULL;
 
-  reschedule();
+    // Nothing else is due right now; arm the timer for what is left before
+    // handing control to the callback.
+    bool last_due = (heap_size == 0 || heap[0]->deadline > now());
+    if (last_due)
+      reschedule();
 
-  // The alarm was cancelled before we got to it. Release the monitor
-  // lock and exit right away since there's nothing left to do.
-  if (!alarm_valid) {
+    // Downgrade lock.
+    pthread_mutex_lock(&alarm->callback_lock);
     pthread_mutex_unlock(&monitor);
-    return;
-  }
 
-  // Downgrade lock.
-  pthread_mutex_lock(&alarm->callback_lock);
-  pthread_mutex_unlock(&monitor);
+    callback(data);
 
-  callback(data);
+    pthread_mutex_unlock(&alarm->callback_lock);
 
-  pthread_mutex_unlock(&alarm->callback_lock);
+    if (last_due)
+      return;
+
+    pthread_mutex_lock(&monitor);
+  }
+
+  pthread_mutex_unlock(&monitor);
 }
 
 // NOTE: must be called with monitor lock.
 static void reschedule(void) {
-  assert(alarms != NULL);
+  assert(initialized);
 
   if (timer_set) {
     timer_delete(timer);
     timer_set = false;
   }
 
-  if (list_is_empty(alarms)) {
+  if (heap_size == 0) {
     bt_os_callouts->release_wake_lock(WAKE_LOCK_ID);
     return;
   }
 
-  alarm_t *next = list_front(alarms);
-  if (!next) {
-    bt_os_callouts->release_wake_lock(WAKE_LOCK_ID);
-    return;
-  }
+  alarm_t *next = heap[0];
   int64_t next_exp = next->deadline - now();
   if (next_exp < TIMER_INTERVAL_FOR_WAKELOCK_IN_MS) {
     int status = bt_os_callouts->acquire_wake_lock(WAKE_LOCK_ID);
@@ -285,3 +312,72 @@ static void reschedule(void) {
     bt_os_callouts->release_wake_lock(WAKE_LOCK_ID);
   }
 }
+
+// NOTE: the heap functions below must be called with monitor lock.
+static void heap_place(alarm_t *alarm, size_t index) {
+  heap[index] = alarm;
+  alarm->heap_index = index;
+}
+
+static void heap_sift_up(size_t index) {
+  alarm_t *alarm = heap[index];
+  while (index > 0) {
+    size_t parent = (index - 1) / 2;
+    if (heap[parent]->deadline <= alarm->deadline)
+      break;
+    heap_place(heap[parent], index);
+    index = parent;
+  }
+  heap_place(alarm, index);
+}
+
+static void heap_sift_down(size_t index) {
+  alarm_t *alarm = heap[index];
+  for (;;) {
+    size_t child = 2 * index + 1;
+    if (child >= heap_size)
+      break;
+    if (child + 1 < heap_size && heap[child + 1]->deadline < heap[child]->deadline)
+      ++child;
+    if (alarm->deadline <= heap[child]->deadline)
+      break;
+    heap_place(heap[child], index);
+    index = child;
+  }
+  heap_place(alarm, index);
+}
+
+static bool heap_insert(alarm_t *alarm) {
+  if (heap_size == heap_capacity) {
+    alarm_t **grown = realloc(heap, 2 * heap_capacity * sizeof(alarm_t *));
+    if (!grown)
+      return false;
+    heap = grown;
+    heap_capacity *= 2;
+  }
+
+  heap_place(alarm, heap_size++);
+  heap_sift_up(alarm->heap_index);
+  return true;
+}
+
+static void heap_remove(alarm_t *alarm) {
+  size_t index = alarm->heap_index;
+  assert(index < heap_size && heap[index] == alarm);
+
+  alarm_t *last = heap[--heap_size];
+  if (last == alarm)
+    return;
+
+  heap_place(last, index);
+  heap_update(last);
+}
+
+// Restores heap order after the deadline of |alarm| has changed.
+static void heap_update(alarm_t *alarm) {
+  size_t index = alarm->heap_index;
+  if (index > 0 && heap[(index - 1) / 2]->deadline > alarm->deadline)
+    heap_sift_up(index);
+  else
+    heap_sift_down(index);
+}
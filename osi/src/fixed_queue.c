@@ -16,52 +16,113 @@
  *
  ******************************************************************************/
 
+#define LOG_TAG "bt_osi_fixed_queue"
+
 #include <assert.h>
+#include <errno.h>
+#include <poll.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <utils/Log.h>
 
 #include "fixed_queue.h"
-#include "list.h"
 #include "osi.h"
-#include "semaphore.h"
 
+#if !defined(EFD_NONBLOCK)
+#  define EFD_NONBLOCK O_NONBLOCK
+#endif
+
+// Keeps the producer and consumer positions on separate cache lines.
+#define CACHE_LINE_SIZE 64
+
+// A slot in the ring. |sequence| tells producers and consumers whose turn it
+// is: a producer at position |pos| may fill the cell once |sequence| == pos,
+// and a consumer at |pos| may empty it once |sequence| == pos + 1.
+typedef struct {
+  size_t sequence;
+  void *data;
+} cell_t;
+
+// Bounded multi-producer/multi-consumer ring. Enqueue and dequeue only touch
+// the ring, |count| and |free_slots| with atomic operations. A producer takes
+// a free slot before it fills a cell and adds to |count| once the cell is
+// published; a consumer takes from |count| before it empties a cell and gives
+// the slot back once the cell is free again. Neither counter can go below
+// zero, and neither counts a cell that is still being filled or emptied.
+//
+// The two eventfds are level indicators that are written only when a counter
+// crosses zero; |signal_lock| serializes those rare updates so that each fd is
+// readable exactly when its condition holds once all updates have run.
 typedef struct fixed_queue_t {
-  list_t *list;
-  semaphore_t *enqueue_sem;
-  semaphore_t *dequeue_sem;
-  pthread_mutex_t lock;
+  cell_t *cells;
   size_t capacity;
+
+  size_t enqueue_pos;
+  char enqueue_pad[CACHE_LINE_SIZE - sizeof(size_t)];
+  size_t dequeue_pos;
+  char dequeue_pad[CACHE_LINE_SIZE - sizeof(size_t)];
+  size_t count;           // published items no consumer has taken yet.
+  size_t free_slots;      // free cells no producer has taken yet.
+
+  pthread_mutex_t signal_lock;
+  int enqueue_fd;         // readable while |free_slots| > 0.
+  int dequeue_fd;         // readable while |count| > 0.
+  bool enqueue_signaled;
+  bool dequeue_signaled;
 } fixed_queue_t;
 
+static bool ring_push(fixed_queue_t *queue, void *data);
+static void *ring_pop(fixed_queue_t *queue);
+static bool take(size_t *counter);
+static void update_signals(fixed_queue_t *queue);
+static void wait_readable(int fd);
+
 fixed_queue_t *fixed_queue_new(size_t capacity) {
   fixed_queue_t *ret = calloc(1, sizeof(fixed_queue_t));
   if (!ret)
     goto error;
 
-  ret->list = list_new(NULL);
-  if (!ret->list)
+  ret->enqueue_fd = -1;
+  ret->dequeue_fd = -1;
+
+  // A zero capacity queue could never hand anything over; give it one slot.
+  ret->capacity = capacity ? capacity : 1;
+  ret->cells = calloc(ret->capacity, sizeof(cell_t));
+  if (!ret->cells)
     goto error;
 
-  ret->enqueue_sem = semaphore_new(capacity);
-  if (!ret->enqueue_sem)
+  for (size_t i = 0; i < ret->capacity; ++i)
+    ret->cells[i].sequence = i;
+  ret->free_slots = ret->capacity;
+
+  ret->enqueue_fd = eventfd(1, EFD_NONBLOCK);
+  if (ret->enqueue_fd == -1) {
+    ALOGE("%s unable to create enqueue eventfd: %s", __func__, strerror(errno));
     goto error;
+  }
+  ret->enqueue_signaled = true;
 
-  ret->dequeue_sem = semaphore_new(0);
-  if (!ret->dequeue_sem)
+  ret->dequeue_fd = eventfd(0, EFD_NONBLOCK);
+  if (ret->dequeue_fd == -1) {
+    ALOGE("%s unable to create dequeue eventfd: %s", __func__, strerror(errno));
     goto error;
+  }
 
-  pthread_mutex_init(&ret->lock, NULL);
-  ret->capacity = capacity;
+  pthread_mutex_init(&ret->signal_lock, NULL);
 
   return ret;
 
 error:
   if (ret) {
-    list_free(ret->list);
-    if (ret->enqueue_sem)
-      semaphore_free(ret->enqueue_sem);
-    if (ret->dequeue_sem)
-      semaphore_free(ret->dequeue_sem);
+    free(ret->cells);
+    if (ret->enqueue_fd != -1)
+      close(ret->enqueue_fd);
+    if (ret->dequeue_fd != -1)
+      close(ret->dequeue_fd);
   }
 
   free(ret);
@@ -72,14 +133,15 @@ void fixed_queue_free(fixed_queue_t *queue, fixed_queue_free_cb free_cb) {
   if (!queue)
     return;
 
-  if (free_cb)
-    for (const list_node_t *node = list_begin(queue->list); node != list_end(queue->list); node = list_next(node))
-      free_cb(list_node(node));
+  void *data;
+  while ((data = ring_pop(queue)) != NULL)
+    if (free_cb)
+      free_cb(data);
 
-  list_free(queue->list);
-  semaphore_free(queue->enqueue_sem);
-  semaphore_free(queue->dequeue_sem);
-  pthread_mutex_destroy(&queue->lock);
+  free(queue->cells);
+  close(queue->enqueue_fd);
+  close(queue->dequeue_fd);
+  pthread_mutex_destroy(&queue->signal_lock);
   free(queue);
 }
 
@@ -87,26 +149,16 @@ void fixed_queue_enqueue(fixed_queue_t *queue, void *data) {
   assert(queue != NULL);
   assert(data != NULL);
 
-  semaphore_wait(queue->enqueue_sem);
-
-  pthread_mutex_lock(&queue->lock);
-  list_append(queue->list, data);
-  pthread_mutex_unlock(&queue->lock);
-
-  semaphore_post(queue->dequeue_sem);
+  while (!fixed_queue_try_enqueue(queue, data))
+    wait_readable(queue->enqueue_fd);
 }
 
 void *fixed_queue_dequeue(fixed_queue_t *queue) {
   assert(queue != NULL);
 
-  semaphore_wait(queue->dequeue_sem);
-
-  pthread_mutex_lock(&queue->lock);
-  void *ret = list_front(queue->list);
-  list_remove(queue->list, ret);
-  pthread_mutex_unlock(&queue->lock);
-
-  semaphore_post(queue->enqueue_sem);
+  void *ret;
+  while ((ret = fixed_queue_try_dequeue(queue)) == NULL)
+    wait_readable(queue->dequeue_fd);
 
   return ret;
 }
@@ -115,39 +167,146 @@ bool fixed_queue_try_enqueue(fixed_queue_t *queue, void *data) {
   assert(queue != NULL);
   assert(data != NULL);
 
-  if (!semaphore_try_wait(queue->enqueue_sem))
+  if (!take(&queue->free_slots))
     return false;
+  if (__atomic_load_n(&queue->free_slots, __ATOMIC_SEQ_CST) == 0)
+    update_signals(queue);
+
+  // The slot taken is free, but it may not be the cell at this producer's
+  // position yet if consumers finish out of order; that is a short wait.
+  while (!ring_push(queue, data))
+    sched_yield();
 
-  pthread_mutex_lock(&queue->lock);
-  list_append(queue->list, data);
-  pthread_mutex_unlock(&queue->lock);
+  if (__atomic_add_fetch(&queue->count, 1, __ATOMIC_SEQ_CST) == 1)
+    update_signals(queue);
 
-  semaphore_post(queue->dequeue_sem);
   return true;
 }
 
 void *fixed_queue_try_dequeue(fixed_queue_t *queue) {
   assert(queue != NULL);
 
-  if (!semaphore_try_wait(queue->dequeue_sem))
+  if (!take(&queue->count))
     return NULL;
+  if (__atomic_load_n(&queue->count, __ATOMIC_SEQ_CST) == 0)
+    update_signals(queue);
 
-  pthread_mutex_lock(&queue->lock);
-  void *ret = list_front(queue->list);
-  list_remove(queue->list, ret);
-  pthread_mutex_unlock(&queue->lock);
+  // As in |fixed_queue_try_enqueue|, producers may publish out of order.
+  void *ret;
+  while ((ret = ring_pop(queue)) == NULL)
+    sched_yield();
 
-  semaphore_post(queue->enqueue_sem);
+  if (__atomic_add_fetch(&queue->free_slots, 1, __ATOMIC_SEQ_CST) == 1)
+    update_signals(queue);
 
   return ret;
 }
 
 int fixed_queue_get_dequeue_fd(const fixed_queue_t *queue) {
   assert(queue != NULL);
-  return semaphore_get_fd(queue->dequeue_sem);
+  return queue->dequeue_fd;
 }
 
 int fixed_queue_get_enqueue_fd(const fixed_queue_t *queue) {
   assert(queue != NULL);
-  return semaphore_get_fd(queue->enqueue_sem);
+  return queue->enqueue_fd;
+}
+
+static bool ring_push(fixed_queue_t *queue, void *data) {
+  size_t pos = __atomic_load_n(&queue->enqueue_pos, __ATOMIC_RELAXED);
+
+  for (;;) {
+    cell_t *cell = &queue->cells[pos % queue->capacity];
+    size_t sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+    intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+
+    if (diff == 0) {
+      if (__atomic_compare_exchange_n(&queue->enqueue_pos, &pos, pos + 1, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        cell->data = data;
+        __atomic_store_n(&cell->sequence, pos + 1, __ATOMIC_RELEASE);
+        return true;
+      }
+    } else if (diff < 0) {
+      return false;  // Full.
+    } else {
+      pos = __atomic_load_n(&queue->enqueue_pos, __ATOMIC_RELAXED);
+    }
+  }
+}
+
+static void *ring_pop(fixed_queue_t *queue) {
+  size_t pos = __atomic_load_n(&queue->dequeue_pos, __ATOMIC_RELAXED);
+
+  for (;;) {
+    cell_t *cell = &queue->cells[pos % queue->capacity];
+    size_t sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+    intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+
+    if (diff == 0) {
+      if (__atomic_compare_exchange_n(&queue->dequeue_pos, &pos, pos + 1, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        void *data = cell->data;
+        __atomic_store_n(&cell->sequence, pos + queue->capacity, __ATOMIC_RELEASE);
+        return data;
+      }
+    } else if (diff < 0) {
+      return NULL;  // Empty.
+    } else {
+      pos = __atomic_load_n(&queue->dequeue_pos, __ATOMIC_RELAXED);
+    }
+  }
+}
+
+// Decrements |*counter| unless it is zero. Returns true if it did.
+static bool take(size_t *counter) {
+  size_t value = __atomic_load_n(counter, __ATOMIC_SEQ_CST);
+  do {
+    if (value == 0)
+      return false;
+  } while (!__atomic_compare_exchange_n(counter, &value, value - 1, true,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+  return true;
+}
+
+// Brings both eventfds in line with the current counters. Called after either
+// counter may have reached or left zero.
+static void update_signals(fixed_queue_t *queue) {
+  pthread_mutex_lock(&queue->signal_lock);
+
+  size_t count = __atomic_load_n(&queue->count, __ATOMIC_SEQ_CST);
+  size_t free_slots = __atomic_load_n(&queue->free_slots, __ATOMIC_SEQ_CST);
+  eventfd_t value;
+
+  bool not_empty = (count > 0);
+  if (not_empty != queue->dequeue_signaled) {
+    if (not_empty)
+      eventfd_write(queue->dequeue_fd, 1);
+    else
+      eventfd_read(queue->dequeue_fd, &value);
+    queue->dequeue_signaled = not_empty;
+  }
+
+  bool not_full = (free_slots > 0);
+  if (not_full != queue->enqueue_signaled) {
+    if (not_full)
+      eventfd_write(queue->enqueue_fd, 1);
+    else
+      eventfd_read(queue->enqueue_fd, &value);
+    queue->enqueue_signaled = not_full;
+  }
+
+  pthread_mutex_unlock(&queue->signal_lock);
+}
+
+// Blocks until |fd| is readable. The fd is only observed, never read, so the
+// indicator it carries is left for |update_signals| to manage.
+static void wait_readable(int fd) {
+  struct pollfd pfd;
+  pfd.fd = fd;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+
+  while (poll(&pfd, 1, -1) == -1 && errno == EINTR)
+    ;
 }
@@ -20,45 +20,77 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <pthread.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
 #include <sys/eventfd.h>
-#include <sys/select.h>
+#include <unistd.h>
 #include <utils/Log.h>
 
-#include "list.h"
 #include "reactor.h"
 
 #if !defined(EFD_SEMAPHORE)
 #  define EFD_SEMAPHORE (1 << 0)
 #endif
 
+// Maximum number of ready objects collected by a single epoll_wait call.
+#define MAX_EVENTS 64
+
 struct reactor_t {
+  int epoll_fd;
   int event_fd;
-  list_t *objects;
+
+  // Events returned by the last epoll_wait that are still being dispatched.
+  // |reactor_unregister| clears an object's entries here so that it is not
+  // called back after it has been unregistered.
+  pthread_mutex_t lock;
+  struct epoll_event events[MAX_EVENTS];
+  int event_count;
 };
 
-static reactor_status_t run_reactor(reactor_t *reactor, int iterations, struct timeval *tv);
+static reactor_status_t run_reactor(reactor_t *reactor, int iterations, int timeout_ms);
 
 reactor_t *reactor_new(void) {
   reactor_t *ret = (reactor_t *)calloc(1, sizeof(reactor_t));
   if (!ret)
     return NULL;
 
+  ret->epoll_fd = -1;
+  ret->event_fd = -1;
+
+  ret->epoll_fd = epoll_create(MAX_EVENTS);
+  if (ret->epoll_fd == -1) {
+    ALOGE("%s unable to create epoll instance: %s", __func__, strerror(errno));
+    goto error;
+  }
+
   ret->event_fd = eventfd(0, EFD_SEMAPHORE);
   if (ret->event_fd == -1) {
     ALOGE("%s unable to create eventfd: %s", __func__, strerror(errno));
     goto error;
   }
 
-  ret->objects = list_new(NULL);
-  if (!ret->objects)
+  pthread_mutex_init(&ret->lock, NULL);
+
+  // The stop event is the only one registered without an object.
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN;
+  event.data.ptr = NULL;
+  if (epoll_ctl(ret->epoll_fd, EPOLL_CTL_ADD, ret->event_fd, &event) == -1) {
+    ALOGE("%s unable to register eventfd with epoll set: %s", __func__, strerror(errno));
+    pthread_mutex_destroy(&ret->lock);
     goto error;
+  }
 
   return ret;
 
 error:;
-  list_free(ret->objects);
-  close(ret->event_fd);
+  if (ret->epoll_fd != -1)
+    close(ret->epoll_fd);
+  if (ret->event_fd != -1)
+    close(ret->event_fd);
   free(ret);
   return NULL;
 }
@@ -67,15 +99,16 @@ void reactor_free(reactor_t *reactor) {
   if (!reactor)
     return;
 
-  list_free(reactor->objects);
   close(reactor->event_fd);
+  close(reactor->epoll_fd);
+  pthread_mutex_destroy(&reactor->lock);
   free(reactor);
 }
 
 reactor_status_t reactor_start(reactor_t *reactor) {
   assert(reactor != NULL);
   if(reactor)
-     return run_reactor(reactor, 0, NULL);
+     return run_reactor(reactor, 0, -1);
   else {
      ALOGE("%s :reactor is NULL",__func__);
      return REACTOR_STATUS_ERROR;
@@ -85,7 +118,7 @@ reactor_status_t reactor_start(reactor_t *reactor) {
 reactor_status_t reactor_run_once(reactor_t *reactor) {
   assert(reactor != NULL);
   if(reactor)
-     return run_reactor(reactor, 1, NULL);
+     return run_reactor(reactor, 1, -1);
   else {
      ALOGE("%s :reactor is NULL",__func__);
      return REACTOR_STATUS_ERROR;
@@ -94,12 +127,8 @@ reactor_status_t reactor_run_once(reactor_t *reactor) {
 
 reactor_status_t reactor_run_once_timeout(reactor_t *reactor, timeout_t timeout_ms) {
   assert(reactor != NULL);
-
-  struct timeval tv;
-  tv.tv_sec = timeout_ms / 1000;
-  tv.tv_usec = (timeout_ms % 1000) * 1000;
   if(reactor)
-     return run_reactor(reactor, 1, &tv);
+     return run_reactor(reactor, 1, (int)timeout_ms);
   else {
      ALOGE("%s :reactor is NULL",__func__);
      return REACTOR_STATUS_ERROR;
@@ -115,10 +144,23 @@ void reactor_stop(reactor_t *reactor) {
 void reactor_register(reactor_t *reactor, reactor_object_t *obj) {
   assert(reactor != NULL);
   assert(obj != NULL);
-  if(reactor && obj)
-     list_append(reactor->objects, obj);
-  else
+  if(!reactor || !obj) {
      ALOGE("%s :reactor or reactor obj is NULL",__func__);
+     return;
+  }
+
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  if (obj->interest & REACTOR_INTEREST_READ)
+    event.events |= (EPOLLIN | EPOLLRDHUP);
+  if (obj->interest & REACTOR_INTEREST_WRITE)
+    event.events |= EPOLLOUT;
+  if (obj->edge_triggered)
+    event.events |= EPOLLET;
+  event.data.ptr = obj;
+
+  if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, obj->fd, &event) == -1)
+    ALOGE("%s unable to register fd %d with epoll set: %s", __func__, obj->fd, strerror(errno));
 }
 
 void reactor_unregister(reactor_t *reactor, reactor_object_t *obj) {
@@ -128,70 +170,83 @@ void reactor_unregister(reactor_t *reactor, reactor_object_t *obj) {
      ALOGE("%s :reactor or obj is NULL",__func__);
      return;
   }
-  list_remove(reactor->objects, obj);
+
+  if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_DEL, obj->fd, NULL) == -1)
+    ALOGE("%s unable to unregister fd %d from epoll set: %s", __func__, obj->fd, strerror(errno));
+
+  pthread_mutex_lock(&reactor->lock);
+  for (int i = 0; i < reactor->event_count; ++i) {
+    if (reactor->events[i].data.ptr == obj)
+      reactor->events[i].data.ptr = NULL;
+  }
+  pthread_mutex_unlock(&reactor->lock);
 }
 
-// Runs the reactor loop for a maximum of |iterations| with the given timeout, |tv|.
+// Runs the reactor loop for a maximum of |iterations| with the given timeout, |timeout_ms|.
 // 0 |iterations| means loop forever.
-// NULL |tv| means no timeout (block until an event occurs).
+// -1 |timeout_ms| means no timeout (block until an event occurs).
 // |reactor| may not be NULL.
-static reactor_status_t run_reactor(reactor_t *reactor, int iterations, struct timeval *tv) {
+static reactor_status_t run_reactor(reactor_t *reactor, int iterations, int timeout_ms) {
   assert(reactor != NULL);
   if(!reactor) {
      ALOGE("%s :reactor is NULL",__func__);
      return REACTOR_STATUS_ERROR;
   }
-  for (int i = 0; iterations == 0 || i < iterations; ++i) {
-    fd_set read_set;
-    fd_set write_set;
-    FD_ZERO(&read_set);
-    FD_ZERO(&write_set);
-    FD_SET(reactor->event_fd, &read_set);
-
-    int max_fd = reactor->event_fd;
-    for (const list_node_t *iter = list_begin(reactor->objects); iter != list_end(reactor->objects); iter = list_next(iter)) {
-      reactor_object_t *object = (reactor_object_t *)list_node(iter);
-      int fd = object->fd;
-      reactor_interest_t interest = object->interest;
-      if (interest & REACTOR_INTEREST_READ)
-        FD_SET(fd, &read_set);
-      if (interest & REACTOR_INTEREST_WRITE)
-        FD_SET(fd, &write_set);
-      if (fd > max_fd)
-        max_fd = fd;
-    }
 
+  struct epoll_event events[MAX_EVENTS];
+  for (int i = 0; iterations == 0 || i < iterations; ++i) {
     int ret;
     do {
-      ret = select(max_fd + 1, &read_set, &write_set, NULL, tv);
+      ret = epoll_wait(reactor->epoll_fd, events, MAX_EVENTS, timeout_ms);
     } while (ret == -1 && errno == EINTR);
 
     if (ret == -1) {
-      ALOGE("%s error in select: %s", __func__, strerror(errno));
+      ALOGE("%s error in epoll_wait: %s", __func__, strerror(errno));
       return REACTOR_STATUS_ERROR;
     }
 
     if (ret == 0)
       return REACTOR_STATUS_TIMEOUT;
 
-    if (FD_ISSET(reactor->event_fd, &read_set)) {
-      eventfd_t value;
-      eventfd_read(reactor->event_fd, &value);
-      return REACTOR_STATUS_STOP;
+    for (int j = 0; j < ret; ++j) {
+      if (events[j].data.ptr == NULL) {
+        eventfd_t value;
+        eventfd_read(reactor->event_fd, &value);
+        return REACTOR_STATUS_STOP;
+      }
     }
 
-    for (const list_node_t *iter = list_begin(reactor->objects); ret > 0 && iter != list_end(reactor->objects); iter = list_next(iter)) {
-      reactor_object_t *object = (reactor_object_t *)list_node(iter);
-      int fd = object->fd;
-      if (FD_ISSET(fd, &read_set)) {
+    pthread_mutex_lock(&reactor->lock);
+    memcpy(reactor->events, events, ret * sizeof(struct epoll_event));
+    reactor->event_count = ret;
+    pthread_mutex_unlock(&reactor->lock);
+
+    for (int j = 0; j < ret; ++j) {
+      // Fetch the object again: a callback may have unregistered it.
+      pthread_mutex_lock(&reactor->lock);
+      reactor_object_t *object = (reactor_object_t *)reactor->events[j].data.ptr;
+      pthread_mutex_unlock(&reactor->lock);
+
+      if (!object)
+        continue;
+
+      uint32_t ready = events[j].events;
+      if ((ready & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) && (object->interest & REACTOR_INTEREST_READ))
         object->read_ready(object->context);
-        --ret;
-      }
-      if (FD_ISSET(fd, &write_set)) {
-        object->write_ready(object->context);
-        --ret;
+
+      // The read callback may have unregistered the object.
+      if ((ready & EPOLLOUT) && (object->interest & REACTOR_INTEREST_WRITE)) {
+        pthread_mutex_lock(&reactor->lock);
+        object = (reactor_object_t *)reactor->events[j].data.ptr;
+        pthread_mutex_unlock(&reactor->lock);
+        if (object)
+          object->write_ready(object->context);
       }
     }
+
+    pthread_mutex_lock(&reactor->lock);
+    reactor->event_count = 0;
+    pthread_mutex_unlock(&reactor->lock);
   }
   return REACTOR_STATUS_DONE;
 }
@@ -182,6 +182,7 @@ static void *run_thread(void *start_arg) {
   work_queue_object.context = thread->work_queue;
   work_queue_object.fd = fixed_queue_get_dequeue_fd(thread->work_queue);
   work_queue_object.interest = REACTOR_INTEREST_READ;
+  work_queue_object.edge_triggered = false;
   work_queue_object.read_ready = work_queue_read_cb;
 
   reactor_register(thread->reactor, &work_queue_object);
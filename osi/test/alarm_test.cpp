@@ -1,5 +1,7 @@
 #include <gtest/gtest.h>
 #include <hardware/bluetooth.h>
+#include <stdio.h>
+#include <time.h>
 #include <unistd.h>
 
 extern "C" {
@@ -244,3 +246,94 @@ TEST_F(AlarmTest, test_callback_free_race) {
     alarm_free(alarm);
   }
 }
+
+TEST_F(AlarmTest, test_set_many_short) {
+  static const int ALARM_COUNT = 100;
+  alarm_t *alarms[ALARM_COUNT];
+
+  // Set in reverse deadline order, with many equal deadlines, so they all
+  // come due close together and are fired in batches.
+  for (int i = 0; i < ALARM_COUNT; ++i) {
+    alarms[i] = alarm_new();
+    alarm_set(alarms[i], 10 + (ALARM_COUNT - i) / 10, cb, NULL);
+  }
+
+  for (int i = 0; i < ALARM_COUNT; ++i)
+    semaphore_wait(semaphore);
+
+  EXPECT_EQ(cb_counter, ALARM_COUNT);
+  EXPECT_EQ(lock_count, 0);
+
+  for (int i = 0; i < ALARM_COUNT; ++i)
+    alarm_free(alarms[i]);
+}
+
+TEST_F(AlarmTest, test_reset_and_cancel_many) {
+  static const int ALARM_COUNT = 100;
+  alarm_t *alarms[ALARM_COUNT];
+
+  for (int i = 0; i < ALARM_COUNT; ++i) {
+    alarms[i] = alarm_new();
+    alarm_set(alarms[i], 10 * TIMER_INTERVAL_FOR_WAKELOCK_IN_MS + i, cb, NULL);
+  }
+
+  // Pull every other alarm in and cancel the rest.
+  for (int i = 0; i < ALARM_COUNT; ++i) {
+    if (i % 2)
+      alarm_cancel(alarms[i]);
+    else
+      alarm_set(alarms[i], 10, cb, NULL);
+  }
+
+  for (int i = 0; i < ALARM_COUNT / 2; ++i)
+    semaphore_wait(semaphore);
+
+  msleep(10 + EPSILON_MS);
+  EXPECT_EQ(cb_counter, ALARM_COUNT / 2);
+  EXPECT_EQ(lock_count, 0);
+
+  for (int i = 0; i < ALARM_COUNT; ++i)
+    alarm_free(alarms[i]);
+}
+
+static uint64_t get_timestamp_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+TEST_F(AlarmTest, test_benchmark_10k_alarms) {
+  static const int ALARM_COUNT = 10000;
+  static alarm_t *alarms[ALARM_COUNT];
+
+  for (int i = 0; i < ALARM_COUNT; ++i)
+    alarms[i] = alarm_new();
+
+  // Deadlines far enough out that none of them fire, in scrambled order.
+  uint64_t start = get_timestamp_us();
+  for (int i = 0; i < ALARM_COUNT; ++i)
+    alarm_set(alarms[i], 60 * 1000 + (i * 7919) % ALARM_COUNT, cb, NULL);
+  uint64_t set_us = get_timestamp_us() - start;
+
+  start = get_timestamp_us();
+  for (int i = 0; i < ALARM_COUNT; ++i)
+    alarm_set(alarms[i], 60 * 1000 + (i * 104729) % ALARM_COUNT, cb, NULL);
+  uint64_t reset_us = get_timestamp_us() - start;
+
+  start = get_timestamp_us();
+  for (int i = 0; i < ALARM_COUNT; ++i)
+    alarm_cancel(alarms[(i * 7919) % ALARM_COUNT]);
+  uint64_t cancel_us = get_timestamp_us() - start;
+
+  printf("%d alarms: set %.2fus, reset %.2fus, cancel %.2fus per alarm\n",
+      ALARM_COUNT,
+      (double)set_us / ALARM_COUNT,
+      (double)reset_us / ALARM_COUNT,
+      (double)cancel_us / ALARM_COUNT);
+
+  EXPECT_EQ(cb_counter, 0);
+  EXPECT_EQ(lock_count, 0);
+
+  for (int i = 0; i < ALARM_COUNT; ++i)
+    alarm_free(alarms[i]);
+}
@@ -0,0 +1,187 @@
+#include <gtest/gtest.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+
+extern "C" {
+#include "fixed_queue.h"
+#include "osi.h"
+}
+
+static bool is_readable(int fd) {
+  struct pollfd pfd;
+  pfd.fd = fd;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+  return poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLIN);
+}
+
+static int free_counter;
+
+static void free_cb(UNUSED_ATTR void *data) {
+  ++free_counter;
+}
+
+TEST(FixedQueueTest, test_new_simple) {
+  fixed_queue_t *queue = fixed_queue_new(4);
+  ASSERT_TRUE(queue != NULL);
+  fixed_queue_free(queue, NULL);
+}
+
+TEST(FixedQueueTest, test_free_null) {
+  fixed_queue_free(NULL, NULL);
+}
+
+TEST(FixedQueueTest, test_fifo_order) {
+  fixed_queue_t *queue = fixed_queue_new(8);
+  int items[8];
+
+  for (int i = 0; i < 8; ++i)
+    fixed_queue_enqueue(queue, &items[i]);
+  for (int i = 0; i < 8; ++i)
+    EXPECT_EQ(fixed_queue_dequeue(queue), &items[i]);
+
+  fixed_queue_free(queue, NULL);
+}
+
+TEST(FixedQueueTest, test_try_enqueue_full) {
+  fixed_queue_t *queue = fixed_queue_new(2);
+  int items[3];
+
+  EXPECT_TRUE(fixed_queue_try_enqueue(queue, &items[0]));
+  EXPECT_TRUE(fixed_queue_try_enqueue(queue, &items[1]));
+  EXPECT_FALSE(fixed_queue_try_enqueue(queue, &items[2]));
+
+  EXPECT_EQ(fixed_queue_try_dequeue(queue), &items[0]);
+  EXPECT_TRUE(fixed_queue_try_enqueue(queue, &items[2]));
+
+  fixed_queue_free(queue, NULL);
+}
+
+TEST(FixedQueueTest, test_try_dequeue_empty) {
+  fixed_queue_t *queue = fixed_queue_new(2);
+  EXPECT_TRUE(fixed_queue_try_dequeue(queue) == NULL);
+  fixed_queue_free(queue, NULL);
+}
+
+TEST(FixedQueueTest, test_fds_track_state) {
+  fixed_queue_t *queue = fixed_queue_new(2);
+  int enqueue_fd = fixed_queue_get_enqueue_fd(queue);
+  int dequeue_fd = fixed_queue_get_dequeue_fd(queue);
+  int items[2];
+
+  EXPECT_TRUE(is_readable(enqueue_fd));
+  EXPECT_FALSE(is_readable(dequeue_fd));
+
+  fixed_queue_enqueue(queue, &items[0]);
+  EXPECT_TRUE(is_readable(enqueue_fd));
+  EXPECT_TRUE(is_readable(dequeue_fd));
+
+  fixed_queue_enqueue(queue, &items[1]);
+  EXPECT_FALSE(is_readable(enqueue_fd));
+  EXPECT_TRUE(is_readable(dequeue_fd));
+
+  fixed_queue_dequeue(queue);
+  EXPECT_TRUE(is_readable(enqueue_fd));
+  EXPECT_TRUE(is_readable(dequeue_fd));
+
+  fixed_queue_dequeue(queue);
+  EXPECT_TRUE(is_readable(enqueue_fd));
+  EXPECT_FALSE(is_readable(dequeue_fd));
+
+  fixed_queue_free(queue, NULL);
+}
+
+TEST(FixedQueueTest, test_free_cb) {
+  fixed_queue_t *queue = fixed_queue_new(4);
+  int items[3];
+
+  free_counter = 0;
+  for (int i = 0; i < 3; ++i)
+    fixed_queue_enqueue(queue, &items[i]);
+  fixed_queue_free(queue, free_cb);
+
+  EXPECT_EQ(free_counter, 3);
+}
+
+static const size_t BENCHMARK_CAPACITY = 128;
+static const int BENCHMARK_ITEMS = 1000000;
+
+typedef struct {
+  fixed_queue_t *queue;
+  int count;
+  uint64_t sum;
+} benchmark_arg_t;
+
+static void *benchmark_producer(void *context) {
+  benchmark_arg_t *arg = (benchmark_arg_t *)context;
+  for (int i = 1; i <= arg->count; ++i)
+    fixed_queue_enqueue(arg->queue, (void *)(uintptr_t)i);
+  return NULL;
+}
+
+static void *benchmark_consumer(void *context) {
+  benchmark_arg_t *arg = (benchmark_arg_t *)context;
+  for (int i = 0; i < arg->count; ++i)
+    arg->sum += (uintptr_t)fixed_queue_dequeue(arg->queue);
+  return NULL;
+}
+
+static uint64_t get_timestamp_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+// Moves BENCHMARK_ITEMS through a queue with |producers| producer threads and
+// |consumers| consumer threads and checks that every item arrived once.
+static void run_benchmark(int producers, int consumers) {
+  fixed_queue_t *queue = fixed_queue_new(BENCHMARK_CAPACITY);
+  pthread_t threads[producers + consumers];
+  benchmark_arg_t args[producers + consumers];
+
+  int per_producer = BENCHMARK_ITEMS / producers;
+  int per_consumer = BENCHMARK_ITEMS / consumers;
+  ASSERT_EQ(per_producer * producers, BENCHMARK_ITEMS);
+  ASSERT_EQ(per_consumer * consumers, BENCHMARK_ITEMS);
+
+  uint64_t start = get_timestamp_us();
+  for (int i = 0; i < producers + consumers; ++i) {
+    args[i].queue = queue;
+    args[i].count = (i < producers) ? per_producer : per_consumer;
+    args[i].sum = 0;
+    pthread_create(&threads[i], NULL,
+        (i < producers) ? benchmark_producer : benchmark_consumer, &args[i]);
+  }
+  for (int i = 0; i < producers + consumers; ++i)
+    pthread_join(threads[i], NULL);
+  uint64_t elapsed_us = get_timestamp_us() - start;
+
+  uint64_t sum = 0;
+  for (int i = producers; i < producers + consumers; ++i)
+    sum += args[i].sum;
+  EXPECT_EQ(sum, (uint64_t)producers * per_producer * (per_producer + 1) / 2);
+  EXPECT_TRUE(fixed_queue_try_dequeue(queue) == NULL);
+
+  // Once everything has drained the fds must have settled on empty.
+  EXPECT_TRUE(is_readable(fixed_queue_get_enqueue_fd(queue)));
+  EXPECT_FALSE(is_readable(fixed_queue_get_dequeue_fd(queue)));
+
+  printf("%dP%dC: %d items in %.1fms, %.0f items/s\n", producers, consumers,
+      BENCHMARK_ITEMS, elapsed_us / 1000.0, BENCHMARK_ITEMS * 1000000.0 / elapsed_us);
+
+  fixed_queue_free(queue, NULL);
+}
+
+TEST(FixedQueueTest, test_benchmark_1p1c) {
+  run_benchmark(1, 1);
+}
+
+TEST(FixedQueueTest, test_benchmark_4p4c) {
+  run_benchmark(4, 4);
+}
+
+TEST(FixedQueueTest, test_benchmark_4p1c) {
+  run_benchmark(4, 1);
+}
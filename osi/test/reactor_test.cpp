@@ -1,6 +1,9 @@
 #include <gtest/gtest.h>
 #include <pthread.h>
+#include <stdio.h>
+#include <sys/eventfd.h>
 #include <sys/time.h>
+#include <time.h>
 #include <unistd.h>
 
 extern "C" {
@@ -99,3 +102,129 @@ TEST(ReactorTest, reactor_run_once_timeout) {
 
   reactor_free(reactor);
 }
+
+static reactor_t *unregister_reactor;
+static int unregister_dispatch_count;
+
+static void unregister_read_ready(void *context) {
+  reactor_object_t *object = (reactor_object_t *)context;
+  ++unregister_dispatch_count;
+  reactor_unregister(unregister_reactor, object);
+}
+
+TEST(ReactorTest, reactor_unregister_from_callback) {
+  reactor_t *reactor = reactor_new();
+  unregister_reactor = reactor;
+  unregister_dispatch_count = 0;
+
+  int fd = eventfd(1, 0);
+  reactor_object_t object;
+  object.context = &object;
+  object.fd = fd;
+  object.interest = REACTOR_INTEREST_READ;
+  object.edge_triggered = false;
+  object.read_ready = unregister_read_ready;
+  reactor_register(reactor, &object);
+
+  EXPECT_EQ(reactor_run_once_timeout(reactor, 50), REACTOR_STATUS_DONE);
+  EXPECT_EQ(reactor_run_once_timeout(reactor, 50), REACTOR_STATUS_TIMEOUT);
+  EXPECT_EQ(unregister_dispatch_count, 1);
+
+  close(fd);
+  reactor_free(reactor);
+}
+
+static int edge_dispatch_count;
+
+static void edge_read_ready(UNUSED_ATTR void *context) {
+  ++edge_dispatch_count;
+}
+
+TEST(ReactorTest, reactor_edge_triggered) {
+  reactor_t *reactor = reactor_new();
+  edge_dispatch_count = 0;
+
+  // The fd stays readable because the callback never drains it.
+  int fd = eventfd(1, 0);
+  reactor_object_t object;
+  object.context = NULL;
+  object.fd = fd;
+  object.interest = REACTOR_INTEREST_READ;
+  object.edge_triggered = true;
+  object.read_ready = edge_read_ready;
+  reactor_register(reactor, &object);
+
+  EXPECT_EQ(reactor_run_once_timeout(reactor, 50), REACTOR_STATUS_DONE);
+  EXPECT_EQ(reactor_run_once_timeout(reactor, 50), REACTOR_STATUS_TIMEOUT);
+  EXPECT_EQ(edge_dispatch_count, 1);
+
+  reactor_unregister(reactor, &object);
+  close(fd);
+  reactor_free(reactor);
+}
+
+static const int BENCHMARK_FD_COUNT = 500;
+static const int BENCHMARK_ITERATIONS = 10000;
+
+static reactor_object_t benchmark_objects[BENCHMARK_FD_COUNT];
+static int benchmark_last_ready;
+
+static void benchmark_read_ready(void *context) {
+  reactor_object_t *object = (reactor_object_t *)context;
+  eventfd_t value;
+  eventfd_read(object->fd, &value);
+  benchmark_last_ready = object - benchmark_objects;
+}
+
+static uint64_t get_timestamp_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+TEST(ReactorTest, reactor_benchmark_500_fds) {
+  reactor_t *reactor = reactor_new();
+  reactor_object_t *objects = benchmark_objects;
+
+  uint64_t start = get_timestamp_us();
+  for (int i = 0; i < BENCHMARK_FD_COUNT; ++i) {
+    objects[i].context = &objects[i];
+    objects[i].fd = eventfd(0, 0);
+    ASSERT_NE(objects[i].fd, -1);
+    objects[i].interest = REACTOR_INTEREST_READ;
+    objects[i].edge_triggered = false;
+    objects[i].read_ready = benchmark_read_ready;
+    reactor_register(reactor, &objects[i]);
+  }
+  uint64_t register_us = get_timestamp_us() - start;
+
+  // Wake a different fd each time and time how long it takes the reactor
+  // to find and dispatch it.
+  uint64_t dispatch_us = 0;
+  for (int i = 0; i < BENCHMARK_ITERATIONS; ++i) {
+    int index = (i * 7919) % BENCHMARK_FD_COUNT;
+    benchmark_last_ready = -1;
+
+    start = get_timestamp_us();
+    eventfd_write(objects[index].fd, 1);
+    EXPECT_EQ(reactor_run_once(reactor), REACTOR_STATUS_DONE);
+    dispatch_us += get_timestamp_us() - start;
+
+    EXPECT_EQ(benchmark_last_ready, index);
+  }
+
+  start = get_timestamp_us();
+  for (int i = 0; i < BENCHMARK_FD_COUNT; ++i)
+    reactor_unregister(reactor, &objects[i]);
+  uint64_t unregister_us = get_timestamp_us() - start;
+
+  printf("%d fds: register %.2fus/fd, unregister %.2fus/fd, dispatch latency %.2fus\n",
+      BENCHMARK_FD_COUNT,
+      (double)register_us / BENCHMARK_FD_COUNT,
+      (double)unregister_us / BENCHMARK_FD_COUNT,
+      (double)dispatch_us / BENCHMARK_ITERATIONS);
+
+  for (int i = 0; i < BENCHMARK_FD_COUNT; ++i)
+    close(objects[i].fd);
+  reactor_free(reactor);
+}
@@ -2503,7 +2503,8 @@ static void btm_ble_process_adv_pkt_cont(BD_ADDR bda, UINT8 addr_type, UINT8 evt
     BOOLEAN     update = TRUE;
     UINT8       result = 0;
 
-    p_i = btm_inq_db_find (bda);
+    if ((p_i = btm_inq_db_find (bda)) != NULL)
+        btm_inq_db_touch (p_i);
 
     /* Check if this address has already been processed for this inquiry */
     if (btm_inq_find_bdaddr(bda))
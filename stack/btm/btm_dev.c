@@ -33,11 +33,15 @@
 #include "btu.h"
 #include "btm_api.h"
 #include "btm_int.h"
+#include "bt_utils.h"
 #include "hcidefs.h"
 #include "l2c_api.h"
 #include "vendor_ble.h"
 
 static tBTM_SEC_DEV_REC *btm_find_oldest_dev (void);
+static void btm_sec_unindex_dev (tBTM_SEC_DEV_REC *p_dev_rec);
+
+#define BTM_SEC_DEV_INDEX(p_dev_rec)    ((UINT16)((p_dev_rec) - btm_cb.sec_dev_rec))
 
 /*******************************************************************************
 **
@@ -86,10 +90,13 @@ BOOLEAN BTM_SecAddDevice (BD_ADDR bd_addr, DEV_CLASS dev_class, BD_NAME bd_name,
                 p_dev_rec->hci_handle = BTM_GetHCIConnHandle (bd_addr, BT_TRANSPORT_BR_EDR);
 
 #if BLE_INCLUDED == TRUE
+                p_dev_rec->ble_hci_handle = BTM_GetHCIConnHandle (bd_addr, BT_TRANSPORT_LE);
+
                 /* use default value for background connection params */
                 /* update conn params, use default value for background connection params */
                 memset(&p_dev_rec->conn_params, 0xff, sizeof(tBTM_LE_CONN_PRAMS));
 #endif
+                btm_sec_index_dev (p_dev_rec);
                 break;
             }
         }
@@ -274,6 +281,9 @@ tBTM_SEC_DEV_REC *btm_sec_alloc_dev (BD_ADDR bd_addr)
             memcpy (old_cod, p_dev_rec->dev_class, DEV_CLASS_LEN);
         }
     }
+
+    /* The oldest record may still be in use */
+    btm_sec_unindex_dev (p_dev_rec);
     memset (p_dev_rec, 0, sizeof (tBTM_SEC_DEV_REC));
 
     /* Retain the old COD for device */
@@ -327,6 +337,8 @@ tBTM_SEC_DEV_REC *btm_sec_alloc_dev (BD_ADDR bd_addr)
     p_dev_rec->hci_handle = BTM_GetHCIConnHandle (bd_addr, BT_TRANSPORT_BR_EDR);
     p_dev_rec->timestamp = btm_cb.dev_rec_count++;
 
+    btm_sec_index_dev (p_dev_rec);
+
     p_dev_rec->pin_key_len = 0;
 
     return(p_dev_rec);
@@ -342,6 +354,7 @@ tBTM_SEC_DEV_REC *btm_sec_alloc_dev (BD_ADDR bd_addr)
 *******************************************************************************/
 void btm_sec_free_dev (tBTM_SEC_DEV_REC *p_dev_rec)
 {
+    btm_sec_unindex_dev (p_dev_rec);
     p_dev_rec->sec_flags = 0;
 
     p_dev_rec->pin_key_len = 0;
@@ -354,6 +367,181 @@ void btm_sec_free_dev (tBTM_SEC_DEV_REC *p_dev_rec)
 
 }
 
+/*******************************************************************************
+**
+** Function         btm_sec_addr_hash
+**
+** Description      Returns the address index bucket of a BD address
+**
+*******************************************************************************/
+static UINT16 btm_sec_addr_hash (BD_ADDR bd_addr)
+{
+    UINT32 hash = 2166136261u;
+    int    i;
+
+    for (i = 0; i < BD_ADDR_LEN; i++)
+        hash = (hash ^ bd_addr[i]) * 16777619u;
+
+    return (UINT16)(hash & (BTM_SEC_DEV_HASH_SIZE - 1));
+}
+
+/*******************************************************************************
+**
+** Function         btm_sec_holds_handle
+**
+** Description      Checks if an in use device record is connected over the
+**                  specified handle
+**
+*******************************************************************************/
+static BOOLEAN btm_sec_holds_handle (tBTM_SEC_DEV_REC *p_dev_rec, UINT16 handle)
+{
+    return ((p_dev_rec->sec_flags & BTM_SEC_IN_USE)
+            && ((p_dev_rec->hci_handle == handle)
+#if BLE_INCLUDED == TRUE
+            || (p_dev_rec->ble_hci_handle == handle)
+#endif
+            ));
+}
+
+/*******************************************************************************
+**
+** Function         btm_sec_map_handle
+**
+** Description      Points the handle index entry for handle at the record
+**
+*******************************************************************************/
+static void btm_sec_map_handle (tBTM_SEC_DEV_REC *p_dev_rec, UINT16 handle)
+{
+    if (handle < BTM_SEC_HANDLE_INDEX_SIZE)
+        btm_cb.sec_dev_by_handle[handle] = BTM_SEC_DEV_INDEX(p_dev_rec) + 1;
+}
+
+/*******************************************************************************
+**
+** Function         btm_sec_unmap_handle
+**
+** Description      Called when a record stops holding a handle. If the handle
+**                  index pointed at it, it is moved to any other record that
+**                  still holds the handle, or cleared.
+**
+*******************************************************************************/
+static void btm_sec_unmap_handle (UINT16 handle)
+{
+    tBTM_SEC_DEV_REC *p_dev_rec;
+    UINT16            idx;
+    int               i;
+
+    if (handle >= BTM_SEC_HANDLE_INDEX_SIZE)
+        return;
+
+    if ((idx = btm_cb.sec_dev_by_handle[handle]) == 0
+        || btm_sec_holds_handle (&btm_cb.sec_dev_rec[idx - 1], handle))
+        return;
+
+    btm_cb.sec_dev_by_handle[handle] = 0;
+
+    p_dev_rec = &btm_cb.sec_dev_rec[0];
+    for (i = 0; i < BTM_SEC_MAX_DEVICE_RECORDS; i++, p_dev_rec++)
+    {
+        if (btm_sec_holds_handle (p_dev_rec, handle))
+        {
+            btm_cb.sec_dev_by_handle[handle] = i + 1;
+            break;
+        }
+    }
+}
+
+/*******************************************************************************
+**
+** Function         btm_sec_index_dev
+**
+** Description      Adds a newly allocated device record to the address and
+**                  handle indexes used by btm_find_dev and
+**                  btm_find_dev_by_handle. The record must be marked in use
+**                  and its address set.
+**
+*******************************************************************************/
+void btm_sec_index_dev (tBTM_SEC_DEV_REC *p_dev_rec)
+{
+    UINT16 idx = BTM_SEC_DEV_INDEX(p_dev_rec);
+    UINT16 bucket = btm_sec_addr_hash (p_dev_rec->bd_addr);
+
+    btm_cb.sec_dev_addr_next[idx] = btm_cb.sec_dev_addr_hash[bucket];
+    btm_cb.sec_dev_addr_hash[bucket] = idx + 1;
+
+    btm_sec_map_handle (p_dev_rec, p_dev_rec->hci_handle);
+#if BLE_INCLUDED == TRUE
+    btm_sec_map_handle (p_dev_rec, p_dev_rec->ble_hci_handle);
+#endif
+}
+
+/*******************************************************************************
+**
+** Function         btm_sec_unindex_dev
+**
+** Description      Removes a device record from the indexes and marks it as
+**                  not in use. Does nothing if the record is not in use.
+**
+*******************************************************************************/
+static void btm_sec_unindex_dev (tBTM_SEC_DEV_REC *p_dev_rec)
+{
+    UINT16  idx = BTM_SEC_DEV_INDEX(p_dev_rec) + 1;
+    UINT16 *p_link;
+
+    if (!(p_dev_rec->sec_flags & BTM_SEC_IN_USE))
+        return;
+
+    p_link = &btm_cb.sec_dev_addr_hash[btm_sec_addr_hash (p_dev_rec->bd_addr)];
+    while (*p_link)
+    {
+        if (*p_link == idx)
+        {
+            *p_link = btm_cb.sec_dev_addr_next[idx - 1];
+            break;
+        }
+        p_link = &btm_cb.sec_dev_addr_next[*p_link - 1];
+    }
+
+    p_dev_rec->sec_flags &= ~BTM_SEC_IN_USE;
+
+    btm_sec_unmap_handle (p_dev_rec->hci_handle);
+#if BLE_INCLUDED == TRUE
+    btm_sec_unmap_handle (p_dev_rec->ble_hci_handle);
+#endif
+}
+
+/*******************************************************************************
+**
+** Function         btm_sec_set_dev_handle
+**
+** Description      Sets the connection handle of a device record for the
+**                  specified transport, keeping the handle index up to date.
+**                  Use this instead of writing hci_handle / ble_hci_handle.
+**
+*******************************************************************************/
+void btm_sec_set_dev_handle (tBTM_SEC_DEV_REC *p_dev_rec, tBT_TRANSPORT transport, UINT16 handle)
+{
+    UINT16 *p_handle = &p_dev_rec->hci_handle;
+    UINT16  old_handle;
+
+#if BLE_INCLUDED == TRUE
+    if (transport == BT_TRANSPORT_LE)
+        p_handle = &p_dev_rec->ble_hci_handle;
+#else
+    UNUSED(transport);
+#endif
+
+    old_handle = *p_handle;
+    *p_handle = handle;
+
+    if (p_dev_rec->sec_flags & BTM_SEC_IN_USE)
+    {
+        if (old_handle != handle)
+            btm_sec_unmap_handle (old_handle);
+        btm_sec_map_handle (p_dev_rec, handle);
+    }
+}
+
 /*******************************************************************************
 **
 ** Function         btm_dev_support_switch
@@ -429,6 +617,12 @@ tBTM_SEC_DEV_REC *btm_find_dev_by_handle (UINT16 handle)
         return (NULL);
     }
 
+    if (handle < BTM_SEC_HANDLE_INDEX_SIZE)
+    {
+        i = btm_cb.sec_dev_by_handle[handle];
+        return ((i != 0) ? &btm_cb.sec_dev_rec[i - 1] : NULL);
+    }
+
     for (i = 0; i < BTM_SEC_MAX_DEVICE_RECORDS; i++, p_dev_rec++)
     {
         if ((p_dev_rec->sec_flags & BTM_SEC_IN_USE)
@@ -479,15 +673,16 @@ tBTM_SEC_DEV_REC *btm_find_dev_by_sec_state(UINT8 sec_state)
 *******************************************************************************/
 tBTM_SEC_DEV_REC *btm_find_dev (BD_ADDR bd_addr)
 {
-    tBTM_SEC_DEV_REC *p_dev_rec = &btm_cb.sec_dev_rec[0];
-    int i;
+    tBTM_SEC_DEV_REC *p_dev_rec;
+    UINT16 idx;
 
     if (bd_addr)
     {
-        for (i = 0; i < BTM_SEC_MAX_DEVICE_RECORDS; i++, p_dev_rec++)
+        for (idx = btm_cb.sec_dev_addr_hash[btm_sec_addr_hash (bd_addr)]; idx != 0;
+             idx = btm_cb.sec_dev_addr_next[idx - 1])
         {
-            if ((p_dev_rec->sec_flags & BTM_SEC_IN_USE)
-                && (!memcmp (p_dev_rec->bd_addr, bd_addr, BD_ADDR_LEN)))
+            p_dev_rec = &btm_cb.sec_dev_rec[idx - 1];
+            if (!memcmp (p_dev_rec->bd_addr, bd_addr, BD_ADDR_LEN))
                 return(p_dev_rec);
         }
     }
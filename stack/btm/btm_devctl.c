@@ -127,6 +127,9 @@ static void btm_get_local_features (void);
 static void btm_issue_host_support_for_lmp_features (void);
 static void btm_read_local_supported_cmds (UINT8 local_controller_id);
 static void btm_hci_vs_event_handler(UINT8 evt_len, UINT8 *p);
+static BOOLEAN btm_reset_join (UINT8 step);
+static void btm_read_local_capabilities (void);
+static void btm_read_local_features_done (void);
 
 #if (defined(BTM_SECURE_CONN_HOST_INCLUDED) && BTM_SECURE_CONN_HOST_INCLUDED == TRUE)
 #if (defined(BTM_READ_CTLR_CAP_INCLUDED) && BTM_READ_CTLR_CAP_INCLUDED == TRUE)
@@ -136,6 +139,9 @@ static void btm_vendor_capability_vsc_cmpl_cback (tBTM_VSC_CMPL *p_vcs_cplt_para
 
 #if BLE_INCLUDED == TRUE
 static void btm_read_ble_local_supported_features (void);
+static void btm_read_ble_local_supported_states (void);
+static void btm_read_ble_local_info (void);
+static void btm_read_ble_local_info_done (void);
 #endif
 
 /*******************************************************************************
@@ -707,6 +713,9 @@ void btm_reset_complete (void)
 *******************************************************************************/
 void btm_continue_reset (void)
 {
+    /* The buffer sizes and the version are independent reads; issue them
+    ** together and move on once both have completed */
+    btm_cb.devcb.reset_pend = BTM_RESET_PEND_BUF_SIZE | BTM_RESET_PEND_VERSION;
 
     /* Reinitialize the default class of device */
 #if BTM_INTERNAL_BB == TRUE
@@ -717,6 +726,9 @@ void btm_continue_reset (void)
 #endif
 
     btm_get_hci_buf_size ();
+#if BTM_INTERNAL_BB == FALSE
+    btm_get_local_version ();
+#endif
 
     /* default device class */
     BTM_SetDeviceClass((UINT8 *) BTM_INIT_CLASS_OF_DEVICE);
@@ -749,13 +761,100 @@ void btm_after_reset_hold_complete (void)
 }
 
 
+/*******************************************************************************
+**
+** Function         btm_reset_join
+**
+** Description      Mark one read of the current startup stage as completed.
+**                  While other reads of the stage are outstanding the reply
+**                  timer is restarted for them.
+**
+** Returns          TRUE if this was the last outstanding read of the stage
+**
+*******************************************************************************/
+static BOOLEAN btm_reset_join (UINT8 step)
+{
+    tBTM_DEVCB *p_devcb = &btm_cb.devcb;
+
+    /* not part of a startup sequence, or a late duplicate */
+    if (!(p_devcb->reset_pend & step))
+        return FALSE;
+
+    p_devcb->reset_pend &= ~step;
+
+    if (p_devcb->reset_pend)
+    {
+        btu_start_timer (&p_devcb->reset_timer, BTU_TTYPE_BTM_DEV_CTL, BTM_DEV_REPLY_TIMEOUT);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/*******************************************************************************
+**
+** Function         btm_read_local_capabilities
+**
+** Description      Called once the buffer sizes and the local version are
+**                  known. Reads the supported commands and the LMP features.
+**                  Both are issued together unless the controller is older
+**                  than HCI 2.0, in which case the features read depends on
+**                  the supported commands.
+**
+** Returns          void
+**
+*******************************************************************************/
+static void btm_read_local_capabilities (void)
+{
+    btm_cb.devcb.reset_pend = BTM_RESET_PEND_FEATURES;
+
+    if (btm_cb.devcb.local_version.hci_version >= HCI_PROTO_VERSION_1_2)
+    {
+        btm_cb.devcb.reset_pend |= BTM_RESET_PEND_SUPP_CMDS;
+        btm_read_local_supported_cmds(LOCAL_BR_EDR_CONTROLLER_ID);
+
+        if (btm_cb.devcb.local_version.hci_version < HCI_PROTO_VERSION_2_0)
+            return;
+    }
+
+    btm_get_local_features ();
+}
+
+/*******************************************************************************
+**
+** Function         btm_read_local_features_done
+**
+** Description      Called once the supported commands and all the LMP feature
+**                  pages have been read and the host supported features set.
+**
+** Returns          void
+**
+*******************************************************************************/
+static void btm_read_local_features_done (void)
+{
+#if BLE_INCLUDED == TRUE
+    if (HCI_LE_HOST_SUPPORTED(btm_cb.devcb.local_lmp_features[HCI_EXT_FEATURES_PAGE_1]))
+    {
+        btm_read_ble_local_info();
+    }
+    else
+#elif BTM_INTERNAL_BB == TRUE
+    {
+        UINT8 buf[9] = BTM_INTERNAL_LOCAL_FEA;
+        btm_read_local_features_complete( buf, 9 );
+    }
+#endif
+    {
+        btm_reset_ctrlr_complete();
+    }
+}
+
 /*******************************************************************************
 **
 ** Function         btm_read_hci_buf_size_complete
 **
 ** Description      This function is called when command complete for
-**                  get HCI buffer size is received.  Start timer and send
-**                  read local features request
+**                  get HCI buffer size is received.  Once the local version
+**                  has been read too, go on with the local capabilities.
 **
 ** Returns          void
 **
@@ -808,9 +907,10 @@ void btm_read_hci_buf_size_complete (UINT8 *p, UINT16 evt_len)
         UINT8 buf[9] = BTM_INTERNAL_LOCAL_VER;
         btm_read_local_version_complete( buf, 9 );
     }
-#else
-    btm_get_local_version ();
 #endif
+
+    if (btm_reset_join (BTM_RESET_PEND_BUF_SIZE))
+        btm_read_local_capabilities ();
 }
 
 #if (BLE_INCLUDED == TRUE)
@@ -819,8 +919,7 @@ void btm_read_hci_buf_size_complete (UINT8 *p, UINT16 evt_len)
 ** Function         btm_read_ble_buf_size_complete
 **
 ** Description      This function is called when command complete for
-**                  get HCI buffer size is received.  Start timer and send
-**                  read local supported features request
+**                  get LE buffer size is received.
 **
 ** Returns          void
 **
@@ -845,7 +944,9 @@ void btm_read_ble_buf_size_complete (UINT8 *p, UINT16 evt_len)
 
         l2c_link_processs_ble_num_bufs (lm_num_le_bufs);
     }
-    btm_read_ble_local_supported_states();
+
+    if (btm_reset_join (BTM_RESET_PEND_BLE_BUF_SIZE))
+        btm_read_ble_local_info_done ();
 }
 /*******************************************************************************
 **
@@ -876,7 +977,8 @@ void btm_read_ble_local_supported_states_complete (UINT8 *p, UINT16 evt_len)
         BTM_TRACE_WARNING ("btm_read_ble_local_supported_features_complete status = %d", status);
     }
 
-    btm_read_ble_local_supported_features();
+    if (btm_reset_join (BTM_RESET_PEND_BLE_STATES))
+        btm_read_ble_local_info_done ();
 }
 
 /*******************************************************************************
@@ -884,8 +986,7 @@ void btm_read_ble_local_supported_states_complete (UINT8 *p, UINT16 evt_len)
 ** Function         btm_read_ble_local_supported_features_complete
 **
 ** Description      This function is called when command complete for
-**                  Read LE Local Supported Features is received.  Start timer and send
-**                  read LMP local features request
+**                  Read LE Local Supported Features is received.
 **
 ** Returns          void
 **
@@ -909,19 +1010,8 @@ void btm_read_ble_local_supported_features_complete (UINT8 *p, UINT16 evt_len)
         BTM_TRACE_WARNING ("btm_read_ble_local_supported_features_complete status = %d", status);
     }
 
-    btsnd_hcic_ble_set_evt_mask((UINT8 *)HCI_BLE_EVENT_MASK_DEF);
-
-#if BTM_INTERNAL_BB == TRUE
-    {
-        UINT8 buf[9] = BTM_INTERNAL_LOCAL_FEA;
-        btm_read_local_features_complete( buf, 9 );
-    }
-#else
-
-    /* get local feature if BRCM specific feature is not included  */
-    btm_reset_ctrlr_complete();
-#endif
-
+    if (btm_reset_join (BTM_RESET_PEND_BLE_FEATURES))
+        btm_read_ble_local_info_done ();
 }
 
 /*******************************************************************************
@@ -943,10 +1033,60 @@ void btm_read_white_list_size_complete(UINT8 *p, UINT16 evt_len)
         STREAM_TO_UINT8(btm_cb.ble_ctr_cb.max_filter_entries, p);
         btm_cb.ble_ctr_cb.num_empty_filter = btm_cb.ble_ctr_cb.max_filter_entries;
     }
+
+    if (btm_reset_join (BTM_RESET_PEND_BLE_WL_SIZE))
+        btm_read_ble_local_info_done ();
+}
+
+/*******************************************************************************
+**
+** Function         btm_read_ble_local_info
+**
+** Description      Last stage of the startup sequence for an LE capable
+**                  controller. The LE reads do not depend on each other, so
+**                  they are issued together behind the LE host supported write.
+**
+** Returns          void
+**
+*******************************************************************************/
+static void btm_read_ble_local_info (void)
+{
+    btm_cb.devcb.reset_pend = BTM_RESET_PEND_BLE_WL_SIZE | BTM_RESET_PEND_BLE_BUF_SIZE |
+                              BTM_RESET_PEND_BLE_STATES | BTM_RESET_PEND_BLE_FEATURES;
+
     /* write LE host support and simultatunous LE supported */
     btsnd_hcic_ble_write_host_supported(BTM_BLE_HOST_SUPPORT, BTM_BLE_SIMULTANEOUS_HOST);
 
+    btm_read_ble_wl_size();
     btm_get_ble_buffer_size();
+    btm_read_ble_local_supported_states();
+    btm_read_ble_local_supported_features();
+}
+
+/*******************************************************************************
+**
+** Function         btm_read_ble_local_info_done
+**
+** Description      This function is called once all the LE reads issued by
+**                  btm_read_ble_local_info have completed.
+**
+** Returns          void
+**
+*******************************************************************************/
+static void btm_read_ble_local_info_done (void)
+{
+    btsnd_hcic_ble_set_evt_mask((UINT8 *)HCI_BLE_EVENT_MASK_DEF);
+
+#if BTM_INTERNAL_BB == TRUE
+    {
+        UINT8 buf[9] = BTM_INTERNAL_LOCAL_FEA;
+        btm_read_local_features_complete( buf, 9 );
+    }
+#else
+
+    /* get local feature if BRCM specific feature is not included  */
+    btm_reset_ctrlr_complete();
+#endif
 }
 
 #endif
@@ -982,14 +1122,8 @@ void btm_read_local_version_complete (UINT8 *p, UINT16 evt_len)
         STREAM_TO_UINT16 (p_vi->lmp_subversion, p);
     }
 
-    if (p_vi->hci_version >= HCI_PROTO_VERSION_1_2)
-    {
-        btm_read_local_supported_cmds(LOCAL_BR_EDR_CONTROLLER_ID);
-    }
-    else
-    {
-        btm_get_local_features ();
-    }
+    if (btm_reset_join (BTM_RESET_PEND_VERSION))
+        btm_read_local_capabilities ();
 }
 
 /*******************************************************************************
@@ -1279,7 +1413,7 @@ void btm_reset_ctrlr_complete ()
 **                    a time);
 **                  - after this is done it issues command to re-read LMP features
 **                    page 1;
-**                  - after this is done it calls the last step of BR/EDR
+**                  - after this is done it ends the LMP features stage of the
 **                    controller startup sequence.
 **
 ** Returns          void
@@ -1355,21 +1489,8 @@ static void btm_issue_host_support_for_lmp_features (void)
 
     if (!btm_cb.devcb.lmp_features_host_may_support)
     {
-#if BLE_INCLUDED == TRUE
-        if (HCI_LE_HOST_SUPPORTED(btm_cb.devcb.local_lmp_features[HCI_EXT_FEATURES_PAGE_1]))
-        {
-            btm_read_ble_wl_size();
-        }
-        else
-#elif BTM_INTERNAL_BB == TRUE
-        {
-            UINT8 buf[9] = BTM_INTERNAL_LOCAL_FEA;
-            btm_read_local_features_complete( buf, 9 );
-        }
-#endif
-        {
-            btm_reset_ctrlr_complete();
-        }
+        if (btm_reset_join (BTM_RESET_PEND_FEATURES))
+            btm_read_local_features_done ();
         return;
     }
 
@@ -1604,7 +1725,13 @@ void btm_read_local_supported_cmds_complete (UINT8 *p)
         STREAM_TO_ARRAY(p_devcb->supported_cmds, p, HCI_NUM_SUPP_COMMANDS_BYTES);
     }
 
-    btm_get_local_features();
+    /* the legacy features read needs the supported commands, see
+    ** btm_read_local_capabilities */
+    if (p_devcb->local_version.hci_version < HCI_PROTO_VERSION_2_0)
+        btm_get_local_features();
+
+    if (btm_reset_join (BTM_RESET_PEND_SUPP_CMDS))
+        btm_read_local_features_done ();
 }
 
 /*******************************************************************************
@@ -40,6 +40,8 @@
 
 #define BTM_INQ_REPLY_TIMEOUT   3       /* 3 second timeout waiting for responses */
 
+#define BTM_INQ_DB_INDEX(p_ent)     ((UINT16)((p_ent) - btm_cb.btm_inq_vars.inq_db))
+
 /* TRUE to enable DEBUG traces for btm_inq */
 #ifndef BTM_INQ_DEBUG
 #define BTM_INQ_DEBUG   FALSE
@@ -145,6 +147,7 @@ extern UINT16 BTM_EIR_UUID_LKUP_TBL[BTM_EIR_MAX_SERVICES];
 static void         btm_initiate_inquiry (tBTM_INQUIRY_VAR_ST *p_inq);
 static tBTM_STATUS  btm_set_inq_event_filter (UINT8 filter_cond_type, tBTM_INQ_FILT_COND *p_filt_cond);
 static void         btm_clr_inq_result_flt (void);
+static void         btm_inq_db_index_reset (void);
 
 #if ((BTM_EIR_SERVER_INCLUDED == TRUE)||(BTM_EIR_CLIENT_INCLUDED == TRUE))
 static UINT8        btm_convert_uuid_to_eir_service( UINT16 uuid16 );
@@ -1240,17 +1243,13 @@ tBTM_INQ_INFO *BTM_InqNextResult (tBTM_INQ_INFO *p_cur)
 *******************************************************************************/
 tBTM_INQ_INFO *BTM_InqDbRead (BD_ADDR p_bda)
 {
-    UINT16       xx;
-    tINQ_DB_ENT  *p_ent = btm_cb.btm_inq_vars.inq_db;
+    tINQ_DB_ENT  *p_ent;
 
     BTM_TRACE_API ("BTM_InqDbRead: bd addr [%02x%02x%02x%02x%02x%02x]",
                p_bda[0], p_bda[1], p_bda[2], p_bda[3], p_bda[4], p_bda[5]);
 
-    for (xx = 0; xx < BTM_INQ_DB_SIZE; xx++, p_ent++)
-    {
-        if ((p_ent->in_use) && (!memcmp (p_ent->inq_info.results.remote_bd_addr, p_bda, BD_ADDR_LEN)))
-            return (&p_ent->inq_info);
-    }
+    if ((p_ent = btm_inq_db_find (p_bda)) != NULL)
+        return (&p_ent->inq_info);
 
     /* If here, not found */
     return ((tBTM_INQ_INFO *)NULL);
@@ -1356,10 +1355,10 @@ tBTM_STATUS BTM_ClearInqDb (BD_ADDR p_bda)
 ** Returns          This function returns the number of entries in the inquiry database.
 **
 *******************************************************************************/
-UINT8 BTM_ReadNumInqDbEntries (void)
+UINT16 BTM_ReadNumInqDbEntries (void)
 {
-    UINT8         num_entries;
-    UINT8         num_results;
+    UINT16        num_entries;
+    UINT16        num_results;
     tINQ_DB_ENT  *p_ent = btm_cb.btm_inq_vars.inq_db;
 
     for (num_entries = 0, num_results = 0; num_entries < BTM_INQ_DB_SIZE; num_entries++, p_ent++)
@@ -1573,6 +1572,7 @@ void btm_inq_db_init (void)
     memset (&btm_cb.btm_inq_vars, 0, sizeof (tBTM_INQUIRY_VAR_ST));
 #endif
     btm_cb.btm_inq_vars.no_inc_ssp = BTM_NO_SSP_ON_INQUIRY;
+    btm_inq_db_index_reset();
 }
 
 /*********************************************************************************
@@ -1625,6 +1625,188 @@ void btm_inq_clear_ssp(void)
     btm_cb.btm_inq_vars.inq_active &= ~BTM_SSP_INQUIRY_ACTIVE;
 }
 
+/*******************************************************************************
+**
+** Function         btm_inq_addr_hash
+**
+** Description      Returns the address hash bucket of a BD address
+**
+*******************************************************************************/
+static UINT16 btm_inq_addr_hash (BD_ADDR bd_addr)
+{
+    UINT32 hash = 2166136261u;
+    int    i;
+
+    for (i = 0; i < BD_ADDR_LEN; i++)
+        hash = (hash ^ bd_addr[i]) * 16777619u;
+
+    return (UINT16)(hash & (BTM_INQ_DB_HASH_SIZE - 1));
+}
+
+/*******************************************************************************
+**
+** Function         btm_inq_db_index_reset
+**
+** Description      Empties the address hash and the LRU list of the inquiry
+**                  database and puts every entry on the free list, lowest
+**                  entry first. The entries themselves must already be unused.
+**
+*******************************************************************************/
+static void btm_inq_db_index_reset (void)
+{
+    tBTM_INQUIRY_VAR_ST *p_inq = &btm_cb.btm_inq_vars;
+    UINT16               xx;
+
+    memset (p_inq->inq_db_hash, 0, sizeof (p_inq->inq_db_hash));
+    memset (p_inq->inq_db_hash_next, 0, sizeof (p_inq->inq_db_hash_next));
+    memset (p_inq->inq_db_lru_prev, 0, sizeof (p_inq->inq_db_lru_prev));
+
+    for (xx = 0; xx < BTM_INQ_DB_SIZE; xx++)
+        p_inq->inq_db_lru_next[xx] = (xx + 1 < BTM_INQ_DB_SIZE) ? xx + 2 : 0;
+
+    p_inq->inq_db_lru_head = 0;
+    p_inq->inq_db_lru_tail = 0;
+    p_inq->inq_db_free     = 1;
+}
+
+/*******************************************************************************
+**
+** Function         btm_inq_db_lru_insert
+**
+** Description      Puts an entry at the most recently seen end of the LRU list
+**
+*******************************************************************************/
+static void btm_inq_db_lru_insert (UINT16 idx)
+{
+    tBTM_INQUIRY_VAR_ST *p_inq = &btm_cb.btm_inq_vars;
+
+    p_inq->inq_db_lru_prev[idx] = 0;
+    p_inq->inq_db_lru_next[idx] = p_inq->inq_db_lru_head;
+
+    if (p_inq->inq_db_lru_head)
+        p_inq->inq_db_lru_prev[p_inq->inq_db_lru_head - 1] = idx + 1;
+    else
+        p_inq->inq_db_lru_tail = idx + 1;
+
+    p_inq->inq_db_lru_head = idx + 1;
+}
+
+/*******************************************************************************
+**
+** Function         btm_inq_db_lru_remove
+**
+** Description      Takes an entry off the LRU list
+**
+*******************************************************************************/
+static void btm_inq_db_lru_remove (UINT16 idx)
+{
+    tBTM_INQUIRY_VAR_ST *p_inq = &btm_cb.btm_inq_vars;
+    UINT16               prev = p_inq->inq_db_lru_prev[idx];
+    UINT16               next = p_inq->inq_db_lru_next[idx];
+
+    if (prev)
+        p_inq->inq_db_lru_next[prev - 1] = next;
+    else
+        p_inq->inq_db_lru_head = next;
+
+    if (next)
+        p_inq->inq_db_lru_prev[next - 1] = prev;
+    else
+        p_inq->inq_db_lru_tail = prev;
+}
+
+/*******************************************************************************
+**
+** Function         btm_inq_db_link
+**
+** Description      Adds an entry to the address hash, as the most recently
+**                  seen device.
+**
+*******************************************************************************/
+static void btm_inq_db_link (tINQ_DB_ENT *p_ent)
+{
+    tBTM_INQUIRY_VAR_ST *p_inq = &btm_cb.btm_inq_vars;
+    UINT16               idx = BTM_INQ_DB_INDEX(p_ent);
+    UINT16               bucket = btm_inq_addr_hash (p_ent->inq_info.results.remote_bd_addr);
+
+    p_inq->inq_db_hash_next[idx] = p_inq->inq_db_hash[bucket];
+    p_inq->inq_db_hash[bucket] = idx + 1;
+
+    btm_inq_db_lru_insert (idx);
+}
+
+/*******************************************************************************
+**
+** Function         btm_inq_db_unlink
+**
+** Description      Removes an in use entry from the address hash and the LRU
+**                  list, and puts it on the free list.
+**
+*******************************************************************************/
+static void btm_inq_db_unlink (tINQ_DB_ENT *p_ent)
+{
+    tBTM_INQUIRY_VAR_ST *p_inq = &btm_cb.btm_inq_vars;
+    UINT16               idx = BTM_INQ_DB_INDEX(p_ent);
+    UINT16              *p_link;
+
+    p_link = &p_inq->inq_db_hash[btm_inq_addr_hash (p_ent->inq_info.results.remote_bd_addr)];
+    while (*p_link)
+    {
+        if (*p_link == idx + 1)
+        {
+            *p_link = p_inq->inq_db_hash_next[idx];
+            break;
+        }
+        p_link = &p_inq->inq_db_hash_next[*p_link - 1];
+    }
+
+    btm_inq_db_lru_remove (idx);
+
+    p_inq->inq_db_lru_next[idx] = p_inq->inq_db_free;
+    p_inq->inq_db_free = idx + 1;
+}
+
+/*******************************************************************************
+**
+** Function         btm_inq_db_release
+**
+** Description      Marks an entry as not in use and tells the registered
+**                  application (if any) that the device was deleted.
+**
+*******************************************************************************/
+static void btm_inq_db_release (tINQ_DB_ENT *p_ent)
+{
+    p_ent->in_use = FALSE;
+#if (BTM_INQ_GET_REMOTE_NAME == TRUE)
+    p_ent->inq_info.remote_name_state = BTM_INQ_RMT_NAME_EMPTY;
+#endif
+
+    if (btm_cb.btm_inq_vars.p_inq_change_cb)
+        (*btm_cb.btm_inq_vars.p_inq_change_cb) (&p_ent->inq_info, FALSE);
+}
+
+/*******************************************************************************
+**
+** Function         btm_inq_db_touch
+**
+** Description      This function is called when a response is received from
+**                  a device already in the inquiry database. It makes the
+**                  entry the last one to be evicted.
+**
+** Returns          void
+**
+*******************************************************************************/
+void btm_inq_db_touch (tINQ_DB_ENT *p_ent)
+{
+    UINT16 idx = BTM_INQ_DB_INDEX(p_ent);
+
+    if (btm_cb.btm_inq_vars.inq_db_lru_head != idx + 1)
+    {
+        btm_inq_db_lru_remove (idx);
+        btm_inq_db_lru_insert (idx);
+    }
+}
+
 /*********************************************************************************
 **
 ** Function         btm_clr_inq_db
@@ -1648,23 +1830,22 @@ void btm_clr_inq_db (BD_ADDR p_bda)
     BTM_TRACE_DEBUG ("btm_clr_inq_db: inq_active:0x%x state:%d",
         btm_cb.btm_inq_vars.inq_active, btm_cb.btm_inq_vars.state);
 #endif
-    for (xx = 0; xx < BTM_INQ_DB_SIZE; xx++, p_ent++)
+    if (p_bda != NULL)
     {
-        if (p_ent->in_use)
+        if ((p_ent = btm_inq_db_find (p_bda)) != NULL)
         {
-            /* If this is the specified BD_ADDR or clearing all devices */
-            if (p_bda == NULL ||
-                (!memcmp (p_ent->inq_info.results.remote_bd_addr, p_bda, BD_ADDR_LEN)))
-            {
-                p_ent->in_use = FALSE;
-#if (BTM_INQ_GET_REMOTE_NAME == TRUE)
-                p_ent->inq_info.remote_name_state = BTM_INQ_RMT_NAME_EMPTY;
-#endif
-
-                if (btm_cb.btm_inq_vars.p_inq_change_cb)
-                    (*btm_cb.btm_inq_vars.p_inq_change_cb) (&p_ent->inq_info, FALSE);
-            }
+            btm_inq_db_unlink (p_ent);
+            btm_inq_db_release (p_ent);
+        }
+    }
+    else
+    {
+        for (xx = 0; xx < BTM_INQ_DB_SIZE; xx++, p_ent++)
+        {
+            if (p_ent->in_use)
+                btm_inq_db_release (p_ent);
         }
+        btm_inq_db_index_reset();
     }
 #if (BTM_INQ_DEBUG == TRUE)
     BTM_TRACE_DEBUG ("inq_active:0x%x state:%d",
@@ -1750,12 +1931,15 @@ BOOLEAN btm_inq_find_bdaddr (BD_ADDR p_bda)
 *******************************************************************************/
 tINQ_DB_ENT *btm_inq_db_find (BD_ADDR p_bda)
 {
-    UINT16       xx;
-    tINQ_DB_ENT  *p_ent = btm_cb.btm_inq_vars.inq_db;
+    tBTM_INQUIRY_VAR_ST *p_inq = &btm_cb.btm_inq_vars;
+    tINQ_DB_ENT         *p_ent;
+    UINT16               idx;
 
-    for (xx = 0; xx < BTM_INQ_DB_SIZE; xx++, p_ent++)
+    for (idx = p_inq->inq_db_hash[btm_inq_addr_hash (p_bda)]; idx != 0;
+         idx = p_inq->inq_db_hash_next[idx - 1])
     {
-        if ((p_ent->in_use) && (!memcmp (p_ent->inq_info.results.remote_bd_addr, p_bda, BD_ADDR_LEN)))
+        p_ent = &p_inq->inq_db[idx - 1];
+        if (!memcmp (p_ent->inq_info.results.remote_bd_addr, p_bda, BD_ADDR_LEN))
             return (p_ent);
     }
 
@@ -1768,57 +1952,44 @@ tINQ_DB_ENT *btm_inq_db_find (BD_ADDR p_bda)
 **
 ** Function         btm_inq_db_new
 **
-** Description      This function looks through the inquiry database for an unused
-**                  entry. If no entry is free, it allocates the oldest entry.
+** Description      This function takes an unused entry of the inquiry database.
+**                  If no entry is free, it reuses the least recently seen one.
 **
 ** Returns          pointer to entry
 **
 *******************************************************************************/
 tINQ_DB_ENT *btm_inq_db_new (BD_ADDR p_bda)
 {
-    UINT16       xx;
-    tINQ_DB_ENT  *p_ent = btm_cb.btm_inq_vars.inq_db;
-    tINQ_DB_ENT  *p_old = btm_cb.btm_inq_vars.inq_db;
-    UINT32       ot = 0xFFFFFFFF;
+    tBTM_INQUIRY_VAR_ST *p_inq = &btm_cb.btm_inq_vars;
+    tINQ_DB_ENT         *p_ent;
 
-    for (xx = 0; xx < BTM_INQ_DB_SIZE; xx++, p_ent++)
+    if (!p_inq->inq_db_free)
     {
-        if (!p_ent->in_use)
-        {
-            memset (p_ent, 0, sizeof (tINQ_DB_ENT));
-            memcpy (p_ent->inq_info.results.remote_bd_addr, p_bda, BD_ADDR_LEN);
-            p_ent->in_use = TRUE;
+        /* If here, no free entry found. Reuse the least recently seen one. */
+        p_ent = &p_inq->inq_db[p_inq->inq_db_lru_tail - 1];
 
-#if (BTM_INQ_GET_REMOTE_NAME==TRUE)
-            p_ent->inq_info.remote_name_state = BTM_INQ_RMT_NAME_EMPTY;
-#endif
+        /* Before deleting the oldest, if anyone is registered for change */
+        /* notifications, then tell him we are deleting an entry.         */
+        if (p_inq->p_inq_change_cb)
+            (*p_inq->p_inq_change_cb) (&p_ent->inq_info, FALSE);
 
-            return (p_ent);
-        }
-
-        if (p_ent->time_of_resp < ot)
-        {
-            p_old = p_ent;
-            ot    = p_ent->time_of_resp;
-        }
+        btm_inq_db_unlink (p_ent);
     }
 
-    /* If here, no free entry found. Return the oldest. */
+    p_ent = &p_inq->inq_db[p_inq->inq_db_free - 1];
+    p_inq->inq_db_free = p_inq->inq_db_lru_next[p_inq->inq_db_free - 1];
 
-    /* Before deleting the oldest, if anyone is registered for change */
-    /* notifications, then tell him we are deleting an entry.         */
-    if (btm_cb.btm_inq_vars.p_inq_change_cb)
-        (*btm_cb.btm_inq_vars.p_inq_change_cb) (&p_old->inq_info, FALSE);
-
-    memset (p_old, 0, sizeof (tINQ_DB_ENT));
-    memcpy (p_old->inq_info.results.remote_bd_addr, p_bda, BD_ADDR_LEN);
-    p_old->in_use = TRUE;
+    memset (p_ent, 0, sizeof (tINQ_DB_ENT));
+    memcpy (p_ent->inq_info.results.remote_bd_addr, p_bda, BD_ADDR_LEN);
+    p_ent->in_use = TRUE;
 
 #if (BTM_INQ_GET_REMOTE_NAME==TRUE)
-    p_old->inq_info.remote_name_state = BTM_INQ_RMT_NAME_EMPTY;
+    p_ent->inq_info.remote_name_state = BTM_INQ_RMT_NAME_EMPTY;
 #endif
 
-    return (p_old);
+    btm_inq_db_link (p_ent);
+
+    return (p_ent);
 }
 
 
@@ -2029,8 +2200,13 @@ static void btm_initiate_inquiry (tBTM_INQUIRY_VAR_ST *p_inq)
         return;
     }
 
-    /* Make sure the number of responses doesn't overflow the database configuration */
-    p_inqparms->max_resps = (UINT8)((p_inqparms->max_resps <= BTM_INQ_DB_SIZE) ? p_inqparms->max_resps : BTM_INQ_DB_SIZE);
+    /* Make sure the number of responses doesn't overflow the database configuration.
+    ** max_resps is the one byte HCI field, so a database of 255 entries or more
+    ** never needs clamping (0 still means unlimited). */
+#if (BTM_INQ_DB_SIZE < 0xFF)
+    if (p_inqparms->max_resps > BTM_INQ_DB_SIZE)
+        p_inqparms->max_resps = BTM_INQ_DB_SIZE;
+#endif
 
     lap = (p_inq->inq_active & BTM_LIMITED_INQUIRY_ACTIVE) ? &limited_inq_lap : &general_inq_lap;
 
@@ -2133,7 +2309,8 @@ void btm_process_inq_results (UINT8 *p, UINT8 inq_res_mode)
             STREAM_TO_UINT8(rssi, p);
         }
 
-        p_i = btm_inq_db_find (bda);
+        if ((p_i = btm_inq_db_find (bda)) != NULL)
+            btm_inq_db_touch (p_i);
 
 #if BTM_USE_INQ_RESULTS_FILTER == TRUE
         /* Only process the num_resp is smaller than max_resps.
@@ -2365,19 +2542,28 @@ void btm_process_inq_results (UINT8 *p, UINT8 inq_res_mode)
 *******************************************************************************/
 void btm_sort_inq_result(void)
 {
-    UINT8               xx, yy, num_resp;
+    tBTM_INQUIRY_VAR_ST *p_inq = &btm_cb.btm_inq_vars;
+    UINT16              xx, yy, num_resp, idx, num_used;
+    UINT16              lru_rank[BTM_INQ_DB_SIZE];
+    UINT16              lru_order[BTM_INQ_DB_SIZE];
     tINQ_DB_ENT         *p_tmp  = NULL;
-    tINQ_DB_ENT         *p_ent  = btm_cb.btm_inq_vars.inq_db;
-    tINQ_DB_ENT         *p_next = btm_cb.btm_inq_vars.inq_db+1;
+    tINQ_DB_ENT         *p_ent  = p_inq->inq_db;
+    tINQ_DB_ENT         *p_next = p_inq->inq_db+1;
     int                 size;
 
-    num_resp = (btm_cb.btm_inq_vars.inq_cmpl_info.num_resp<BTM_INQ_DB_SIZE)?
-                btm_cb.btm_inq_vars.inq_cmpl_info.num_resp: BTM_INQ_DB_SIZE;
+    num_resp = (p_inq->inq_cmpl_info.num_resp<BTM_INQ_DB_SIZE)?
+                p_inq->inq_cmpl_info.num_resp: BTM_INQ_DB_SIZE;
 
     if((p_tmp = (tINQ_DB_ENT *)GKI_getbuf(sizeof(tINQ_DB_ENT))) != NULL)
     {
+        /* Remember the place of each entry in the LRU list; it moves with the entry */
+        memset (lru_rank, 0xFF, sizeof (lru_rank));
+        for (idx = p_inq->inq_db_lru_head, num_used = 0; idx != 0;
+             idx = p_inq->inq_db_lru_next[idx - 1], num_used++)
+            lru_rank[idx - 1] = num_used;
+
         size = sizeof(tINQ_DB_ENT);
-        for(xx = 0; xx < num_resp-1; xx++, p_ent++)
+        for(xx = 0; xx + 1 < num_resp; xx++, p_ent++)
         {
             for(yy = xx+1, p_next = p_ent+1; yy < num_resp; yy++, p_next++)
             {
@@ -2386,11 +2572,31 @@ void btm_sort_inq_result(void)
                     memcpy (p_tmp,  p_next, size);
                     memcpy (p_next, p_ent,  size);
                     memcpy (p_ent,  p_tmp,  size);
+
+                    idx          = lru_rank[yy];
+                    lru_rank[yy] = lru_rank[xx];
+                    lru_rank[xx] = idx;
                 }
             }
         }
 
         GKI_freebuf(p_tmp);
+
+        /* Entries have changed places; index them again in the same LRU order */
+        btm_inq_db_index_reset();
+        p_inq->inq_db_free = 0;
+        for (xx = BTM_INQ_DB_SIZE; xx-- > 0; )
+        {
+            if (p_inq->inq_db[xx].in_use)
+                lru_order[lru_rank[xx]] = xx;
+            else
+            {
+                p_inq->inq_db_lru_next[xx] = p_inq->inq_db_free;
+                p_inq->inq_db_free = xx + 1;
+            }
+        }
+        for (idx = num_used; idx-- > 0; )
+            btm_inq_db_link (&p_inq->inq_db[lru_order[idx]]);
     }
 }
 
@@ -221,6 +221,19 @@ UINT8                   le_supported_states[BTM_LE_SUPPORT_STATE_SIZE];
 #define BTM_DEV_STATE_READY             2
 
     UINT8                state;
+
+/* Controller reads of the current startup stage that are still outstanding.
+** The reads of a stage are issued together and the next stage starts once
+** the last of them has completed. */
+#define BTM_RESET_PEND_BUF_SIZE         0x01
+#define BTM_RESET_PEND_VERSION          0x02
+#define BTM_RESET_PEND_SUPP_CMDS        0x04
+#define BTM_RESET_PEND_FEATURES         0x08    /* LMP feature pages and host supported writes */
+#define BTM_RESET_PEND_BLE_WL_SIZE      0x10
+#define BTM_RESET_PEND_BLE_BUF_SIZE     0x20
+#define BTM_RESET_PEND_BLE_STATES       0x40
+#define BTM_RESET_PEND_BLE_FEATURES     0x80
+    UINT8                reset_pend;
     tBTM_IO_CAP          loc_io_caps;       /* IO capability of the local device */
     tBTM_AUTH_REQ        loc_auth_req;      /* the auth_req flag  */
     BD_FEATURES          brcm_features;     /* Broadcom specific features bit mask  */
@@ -334,6 +347,13 @@ typedef struct
     UINT16           max_bd_entries;        /* Maximum number of entries that can be stored */
 #endif
     tINQ_DB_ENT      inq_db[BTM_INQ_DB_SIZE];
+    UINT16           inq_db_hash[BTM_INQ_DB_HASH_SIZE]; /* first entry + 1 in each address bucket, 0 if none */
+    UINT16           inq_db_hash_next[BTM_INQ_DB_SIZE]; /* next entry + 1 in the same bucket */
+    UINT16           inq_db_lru_prev[BTM_INQ_DB_SIZE];  /* more recently seen entry + 1, 0 if none */
+    UINT16           inq_db_lru_next[BTM_INQ_DB_SIZE];  /* less recently seen entry + 1 (next free entry + 1 if not in use) */
+    UINT16           inq_db_lru_head;       /* most recently seen entry + 1, 0 if database is empty */
+    UINT16           inq_db_lru_tail;       /* least recently seen entry + 1, evicted first */
+    UINT16           inq_db_free;           /* first free entry + 1, 0 if database is full */
     tBTM_INQ_PARMS   inqparms;              /* Contains the parameters for the current inquiry */
     tBTM_INQUIRY_CMPL inq_cmpl_info;        /* Status and number of responses from the last inquiry */
 
@@ -367,6 +387,15 @@ typedef struct
 
 #define BTM_SEC_INVALID_HANDLE  0xFFFF
 
+/* HCI connection handles are 0x0000 - 0x0EFF */
+#define BTM_SEC_HANDLE_INDEX_SIZE   0x0F00
+
+/* Security records are indexed with UINT16 everywhere, and the indexes store
+** record + 1 so that 0 can mean none. */
+#if (BTM_SEC_MAX_DEVICE_RECORDS > 0xFFFE)
+#error "BTM_SEC_MAX_DEVICE_RECORDS does not fit the UINT16 security record indexes"
+#endif
+
 typedef UINT8 *BTM_BD_NAME_PTR;                        /* Pointer to Device name */
 
 /* Security callback is called by this unit when security
@@ -924,6 +953,9 @@ typedef struct
     UINT8                    disc_reason;   /* for legacy devices */
     tBTM_SEC_SERV_REC        sec_serv_rec[BTM_SEC_MAX_SERVICE_RECORDS];
     tBTM_SEC_DEV_REC         sec_dev_rec[BTM_SEC_MAX_DEVICE_RECORDS];
+    UINT16                   sec_dev_addr_hash[BTM_SEC_DEV_HASH_SIZE];     /* first record + 1 in each bucket, 0 if none */
+    UINT16                   sec_dev_addr_next[BTM_SEC_MAX_DEVICE_RECORDS]; /* next record + 1 in the same bucket */
+    UINT16                   sec_dev_by_handle[BTM_SEC_HANDLE_INDEX_SIZE];  /* record + 1 holding each handle, 0 if none */
     tBTM_SEC_SERV_REC       *p_out_serv;
     tBTM_MKEY_CALLBACK      *mkey_cback;
 
@@ -998,6 +1030,7 @@ extern void         btm_event_filter_complete (UINT8 *p);
 extern void         btm_inq_stop_on_ssp(void);
 extern void         btm_inq_clear_ssp(void);
 extern tINQ_DB_ENT *btm_inq_db_find (BD_ADDR p_bda);
+extern void         btm_inq_db_touch (tINQ_DB_ENT *p_ent);
 extern BOOLEAN      btm_inq_find_bdaddr (BD_ADDR p_bda);
 
 #if (BTM_EIR_CLIENT_INCLUDED == TRUE)
@@ -1143,6 +1176,9 @@ extern UINT8 btm_get_voice_coding_support (void);
 
 extern tBTM_SEC_DEV_REC  *btm_sec_alloc_dev (BD_ADDR bd_addr);
 extern void               btm_sec_free_dev (tBTM_SEC_DEV_REC *p_dev_rec);
+extern void               btm_sec_index_dev (tBTM_SEC_DEV_REC *p_dev_rec);
+extern void               btm_sec_set_dev_handle (tBTM_SEC_DEV_REC *p_dev_rec, tBT_TRANSPORT transport,
+                                                  UINT16 handle);
 extern tBTM_SEC_DEV_REC  *btm_find_dev (BD_ADDR bd_addr);
 extern tBTM_SEC_DEV_REC  *btm_find_or_alloc_dev (BD_ADDR bd_addr);
 extern tBTM_SEC_DEV_REC  *btm_find_dev_by_handle (UINT16 handle);
@@ -1189,7 +1225,7 @@ extern void  btm_sec_dev_rec_cback_event (tBTM_SEC_DEV_REC *p_dev_rec, UINT8 res
 
 #if BLE_INCLUDED == TRUE
 extern void  btm_sec_clear_ble_keys (tBTM_SEC_DEV_REC  *p_dev_rec);
-extern  BOOLEAN btm_sec_find_bonded_dev (UINT8 start_idx, UINT8 *p_found_idx, tBTM_SEC_DEV_REC **p_rec);
+extern  BOOLEAN btm_sec_find_bonded_dev (UINT16 start_idx, UINT16 *p_found_idx, tBTM_SEC_DEV_REC **p_rec);
 extern BOOLEAN btm_sec_is_a_bonded_dev (BD_ADDR bda);
 extern BOOLEAN btm_sec_is_le_capable_dev (BD_ADDR bda);
 #endif /* BLE_INCLUDED */
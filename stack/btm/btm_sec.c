@@ -2272,7 +2272,7 @@ tBTM_STATUS btm_sec_l2cap_access_req (BD_ADDR bd_addr, UINT16 psm, UINT16 handle
     /* Find or get oldest record */
     p_dev_rec = btm_find_or_alloc_dev (bd_addr);
 
-    p_dev_rec->hci_handle = handle;
+    btm_sec_set_dev_handle (p_dev_rec, BT_TRANSPORT_BR_EDR, handle);
 
     /* Find the service record for the PSM */
     p_serv_rec = btm_sec_find_first_serv (conn_type, psm);
@@ -4652,7 +4652,7 @@ void btm_sec_connected (UINT8 *bda, UINT16 handle, UINT8 status, UINT8 enc_mode)
         return;
     }
 
-    p_dev_rec->hci_handle = handle;
+    btm_sec_set_dev_handle (p_dev_rec, BT_TRANSPORT_BR_EDR, handle);
 
     /* role may not be correct here, it will be updated by l2cap, but we need to */
     /* notify btm_acl that link is up, so starting of rmt name request will not */
@@ -4842,13 +4842,13 @@ void btm_sec_disconnected (UINT16 handle, UINT8 reason)
 
     if (transport == BT_TRANSPORT_LE)
     {
-        p_dev_rec->ble_hci_handle = BTM_SEC_INVALID_HANDLE;
+        btm_sec_set_dev_handle (p_dev_rec, BT_TRANSPORT_LE, BTM_SEC_INVALID_HANDLE);
         p_dev_rec->sec_flags &= ~(BTM_SEC_LE_AUTHENTICATED|BTM_SEC_LE_ENCRYPTED);
     }
     else
 #endif
     {
-        p_dev_rec->hci_handle = BTM_SEC_INVALID_HANDLE;
+        btm_sec_set_dev_handle (p_dev_rec, BT_TRANSPORT_BR_EDR, BTM_SEC_INVALID_HANDLE);
         p_dev_rec->sec_flags &= ~(BTM_SEC_AUTHORIZED | BTM_SEC_AUTHENTICATED | BTM_SEC_ENCRYPTED | BTM_SEC_ROLE_SWITCHED);
     }
 
@@ -6262,7 +6262,7 @@ BOOLEAN btm_sec_is_le_capable_dev (BD_ADDR bda)
 ** Returns          TRUE - found a bonded device
 **
 *******************************************************************************/
-BOOLEAN btm_sec_find_bonded_dev (UINT8 start_idx, UINT8 *p_found_idx, tBTM_SEC_DEV_REC **p_rec)
+BOOLEAN btm_sec_find_bonded_dev (UINT16 start_idx, UINT16 *p_found_idx, tBTM_SEC_DEV_REC **p_rec)
 {
     BOOLEAN found= FALSE;
 
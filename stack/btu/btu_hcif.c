@@ -64,68 +64,68 @@ static int num_hci_cmds_timed_out;
 /********************************************************************************/
 /*              L O C A L    F U N C T I O N     P R O T O T Y P E S            */
 /********************************************************************************/
-static void btu_hcif_inquiry_comp_evt (UINT8 *p);
-static void btu_hcif_inquiry_result_evt (UINT8 *p);
-static void btu_hcif_inquiry_rssi_result_evt (UINT8 *p);
+static void btu_hcif_inquiry_comp_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len);
+static void btu_hcif_inquiry_result_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len);
+static void btu_hcif_inquiry_rssi_result_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len);
 #if (BTM_EIR_CLIENT_INCLUDED == TRUE)
-static void btu_hcif_extended_inquiry_result_evt (UINT8 *p);
+static void btu_hcif_extended_inquiry_result_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len);
 #endif
 
-static void btu_hcif_connection_comp_evt (UINT8 *p);
-static void btu_hcif_connection_request_evt (UINT8 *p);
-static void btu_hcif_disconnection_comp_evt (UINT8 *p);
-static void btu_hcif_authentication_comp_evt (UINT8 *p);
-static void btu_hcif_rmt_name_request_comp_evt (UINT8 *p, UINT16 evt_len);
-static void btu_hcif_encryption_change_evt (UINT8 *p);
-static void btu_hcif_change_conn_link_key_evt (UINT8 *p);
-static void btu_hcif_master_link_key_comp_evt (UINT8 *p);
-static void btu_hcif_read_rmt_features_comp_evt (UINT8 *p);
-static void btu_hcif_read_rmt_ext_features_comp_evt (UINT8 *p);
-static void btu_hcif_read_rmt_version_comp_evt (UINT8 *p);
-static void btu_hcif_qos_setup_comp_evt (UINT8 *p);
+static void btu_hcif_connection_comp_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len);
+static void btu_hcif_connection_request_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len);
+static void btu_hcif_disconnection_comp_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len);
+static void btu_hcif_authentication_comp_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len);
+static void btu_hcif_rmt_name_request_comp_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len);
+static void btu_hcif_encryption_change_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len);
+static void btu_hcif_change_conn_link_key_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len);
+static void btu_hcif_master_link_key_comp_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len);
+static void btu_hcif_read_rmt_features_comp_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len);
+static void btu_hcif_read_rmt_ext_features_comp_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len);
+static void btu_hcif_read_rmt_version_comp_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len);
+static void btu_hcif_qos_setup_comp_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len);
 static void btu_hcif_command_complete_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len);
-static void btu_hcif_command_status_evt (UINT8 controller_id, UINT8 *p);
-static void btu_hcif_hardware_error_evt (UINT8 *p);
-static void btu_hcif_flush_occured_evt (void);
-static void btu_hcif_role_change_evt (UINT8 *p);
-static void btu_hcif_num_compl_data_pkts_evt (UINT8 *p);
-static void btu_hcif_mode_change_evt (UINT8 *p);
-static void btu_hcif_return_link_keys_evt (UINT8 *p);
-static void btu_hcif_pin_code_request_evt (UINT8 *p);
-static void btu_hcif_link_key_request_evt (UINT8 *p);
-static void btu_hcif_link_key_notification_evt (UINT8 *p);
-static void btu_hcif_loopback_command_evt (void);
-static void btu_hcif_data_buf_overflow_evt (void);
-static void btu_hcif_max_slots_changed_evt (void);
-static void btu_hcif_read_clock_off_comp_evt (UINT8 *p);
-static void btu_hcif_conn_pkt_type_change_evt (void);
-static void btu_hcif_qos_violation_evt (UINT8 *p);
-static void btu_hcif_page_scan_mode_change_evt (void);
-static void btu_hcif_page_scan_rep_mode_chng_evt (void);
-static void btu_hcif_esco_connection_comp_evt(UINT8 *p);
-static void btu_hcif_esco_connection_chg_evt(UINT8 *p);
+static void btu_hcif_command_status_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len);
+static void btu_hcif_hardware_error_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len);
+static void btu_hcif_flush_occured_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len);
+static void btu_hcif_role_change_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len);
+static void btu_hcif_num_compl_data_pkts_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len);
+static void btu_hcif_mode_change_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len);
+static void btu_hcif_return_link_keys_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len);
+static void btu_hcif_pin_code_request_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len);
+static void btu_hcif_link_key_request_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len);
+static void btu_hcif_link_key_notification_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len);
+static void btu_hcif_loopback_command_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len);
+static void btu_hcif_data_buf_overflow_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len);
+static void btu_hcif_max_slots_changed_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len);
+static void btu_hcif_read_clock_off_comp_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len);
+static void btu_hcif_conn_pkt_type_change_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len);
+static void btu_hcif_qos_violation_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len);
+static void btu_hcif_page_scan_mode_change_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len);
+static void btu_hcif_page_scan_rep_mode_chng_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len);
+static void btu_hcif_esco_connection_comp_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len);
+static void btu_hcif_esco_connection_chg_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len);
 
 /* Simple Pairing Events */
-static void btu_hcif_host_support_evt (UINT8 *p);
-static void btu_hcif_io_cap_request_evt (UINT8 *p);
-static void btu_hcif_io_cap_response_evt (UINT8 *p);
-static void btu_hcif_user_conf_request_evt (UINT8 *p);
-static void btu_hcif_user_passkey_request_evt (UINT8 *p);
-static void btu_hcif_user_passkey_notif_evt (UINT8 *p);
-static void btu_hcif_keypress_notif_evt (UINT8 *p);
-static void btu_hcif_link_super_tout_evt (UINT8 *p);
+static void btu_hcif_host_support_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len);
+static void btu_hcif_io_cap_request_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len);
+static void btu_hcif_io_cap_response_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len);
+static void btu_hcif_user_conf_request_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len);
+static void btu_hcif_user_passkey_request_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len);
+static void btu_hcif_user_passkey_notif_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len);
+static void btu_hcif_keypress_notif_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len);
+static void btu_hcif_link_super_tout_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len);
 
     #if BTM_OOB_INCLUDED == TRUE
-static void btu_hcif_rem_oob_request_evt (UINT8 *p);
+static void btu_hcif_rem_oob_request_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len);
     #endif
 
-static void btu_hcif_simple_pair_complete_evt (UINT8 *p);
+static void btu_hcif_simple_pair_complete_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len);
     #if L2CAP_NON_FLUSHABLE_PB_INCLUDED == TRUE
-static void btu_hcif_enhanced_flush_complete_evt (void);
+static void btu_hcif_enhanced_flush_complete_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len);
     #endif
 
     #if (BTM_SSR_INCLUDED == TRUE)
-static void btu_hcif_ssr_evt (UINT8 *p, UINT16 evt_len);
+static void btu_hcif_ssr_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len);
     #endif /* BTM_SSR_INCLUDED == TRUE */
 
     #if (HID_DEV_INCLUDED == TRUE) && (HID_DEV_PM_INCLUDED == TRUE)
@@ -134,16 +134,346 @@ extern void hidd_pm_proc_mode_change( UINT8 hci_status, UINT8 mode, UINT16 inter
 
 
     #if BLE_INCLUDED == TRUE
-static void btu_ble_ll_conn_complete_evt (UINT8 *p, UINT16 evt_len);
-static void btu_ble_process_adv_pkt (UINT8 *p);
-static void btu_ble_read_remote_feat_evt (UINT8 *p);
-static void btu_ble_ll_conn_param_upd_evt (UINT8 *p, UINT16 evt_len);
-static void btu_ble_proc_ltk_req (UINT8 *p);
-static void btu_hcif_encryption_key_refresh_cmpl_evt (UINT8 *p);
+static void btu_ble_ll_conn_complete_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len);
+static void btu_ble_process_adv_pkt (UINT8 controller_id, UINT8 *p, UINT16 evt_len);
+static void btu_ble_read_remote_feat_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len);
+static void btu_ble_ll_conn_param_upd_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len);
+static void btu_ble_proc_ltk_req (UINT8 controller_id, UINT8 *p, UINT16 evt_len);
+static void btu_hcif_encryption_key_refresh_cmpl_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len);
 #if (BLE_LLT_INCLUDED == TRUE)
-static void btu_ble_rc_param_req_evt(UINT8 *p);
+static void btu_ble_rc_param_req_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len);
 #endif
+static void btu_hcif_ble_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len);
     #endif
+static void btu_hcif_vendor_specific_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len);
+
+/********************************************************************************/
+/*              E V E N T    D I S P A T C H    T A B L E S                     */
+/********************************************************************************/
+/* Handler of an HCI event, called with the event parameters */
+typedef void (tBTU_HCIF_EVT_HDLR) (UINT8 controller_id, UINT8 *p, UINT16 evt_len);
+
+/* Number of HCI event codes, and of LE meta event subevent codes */
+#define BTU_HCIF_NUM_EVTS       256
+#define BTU_HCIF_NUM_BLE_EVTS   32
+
+/* Handlers indexed by HCI event code, NULL for events that are ignored */
+static tBTU_HCIF_EVT_HDLR * const btu_hcif_evt_hdlr[BTU_HCIF_NUM_EVTS] =
+{
+    [HCI_INQUIRY_COMP_EVT]              = btu_hcif_inquiry_comp_evt,
+    [HCI_INQUIRY_RESULT_EVT]            = btu_hcif_inquiry_result_evt,
+    [HCI_INQUIRY_RSSI_RESULT_EVT]       = btu_hcif_inquiry_rssi_result_evt,
+#if (BTM_EIR_CLIENT_INCLUDED == TRUE)
+    [HCI_EXTENDED_INQUIRY_RESULT_EVT]   = btu_hcif_extended_inquiry_result_evt,
+#endif
+    [HCI_CONNECTION_COMP_EVT]           = btu_hcif_connection_comp_evt,
+    [HCI_CONNECTION_REQUEST_EVT]        = btu_hcif_connection_request_evt,
+    [HCI_DISCONNECTION_COMP_EVT]        = btu_hcif_disconnection_comp_evt,
+    [HCI_AUTHENTICATION_COMP_EVT]       = btu_hcif_authentication_comp_evt,
+    [HCI_RMT_NAME_REQUEST_COMP_EVT]     = btu_hcif_rmt_name_request_comp_evt,
+    [HCI_ENCRYPTION_CHANGE_EVT]         = btu_hcif_encryption_change_evt,
+#if BLE_INCLUDED == TRUE
+    [HCI_ENCRYPTION_KEY_REFRESH_COMP_EVT] = btu_hcif_encryption_key_refresh_cmpl_evt,
+#endif
+    [HCI_CHANGE_CONN_LINK_KEY_EVT]      = btu_hcif_change_conn_link_key_evt,
+    [HCI_MASTER_LINK_KEY_COMP_EVT]      = btu_hcif_master_link_key_comp_evt,
+    [HCI_READ_RMT_FEATURES_COMP_EVT]    = btu_hcif_read_rmt_features_comp_evt,
+    [HCI_READ_RMT_EXT_FEATURES_COMP_EVT] = btu_hcif_read_rmt_ext_features_comp_evt,
+    [HCI_READ_RMT_VERSION_COMP_EVT]     = btu_hcif_read_rmt_version_comp_evt,
+    [HCI_QOS_SETUP_COMP_EVT]            = btu_hcif_qos_setup_comp_evt,
+    [HCI_COMMAND_COMPLETE_EVT]          = btu_hcif_command_complete_evt,
+    [HCI_COMMAND_STATUS_EVT]            = btu_hcif_command_status_evt,
+    [HCI_HARDWARE_ERROR_EVT]            = btu_hcif_hardware_error_evt,
+    [HCI_FLUSH_OCCURED_EVT]             = btu_hcif_flush_occured_evt,
+    [HCI_ROLE_CHANGE_EVT]               = btu_hcif_role_change_evt,
+    [HCI_NUM_COMPL_DATA_PKTS_EVT]       = btu_hcif_num_compl_data_pkts_evt,
+    [HCI_MODE_CHANGE_EVT]               = btu_hcif_mode_change_evt,
+    [HCI_RETURN_LINK_KEYS_EVT]          = btu_hcif_return_link_keys_evt,
+    [HCI_PIN_CODE_REQUEST_EVT]          = btu_hcif_pin_code_request_evt,
+    [HCI_LINK_KEY_REQUEST_EVT]          = btu_hcif_link_key_request_evt,
+    [HCI_LINK_KEY_NOTIFICATION_EVT]     = btu_hcif_link_key_notification_evt,
+    [HCI_LOOPBACK_COMMAND_EVT]          = btu_hcif_loopback_command_evt,
+    [HCI_DATA_BUF_OVERFLOW_EVT]         = btu_hcif_data_buf_overflow_evt,
+    [HCI_MAX_SLOTS_CHANGED_EVT]         = btu_hcif_max_slots_changed_evt,
+    [HCI_READ_CLOCK_OFF_COMP_EVT]       = btu_hcif_read_clock_off_comp_evt,
+    [HCI_CONN_PKT_TYPE_CHANGE_EVT]      = btu_hcif_conn_pkt_type_change_evt,
+    [HCI_QOS_VIOLATION_EVT]             = btu_hcif_qos_violation_evt,
+    [HCI_PAGE_SCAN_MODE_CHANGE_EVT]     = btu_hcif_page_scan_mode_change_evt,
+    [HCI_PAGE_SCAN_REP_MODE_CHNG_EVT]   = btu_hcif_page_scan_rep_mode_chng_evt,
+    [HCI_ESCO_CONNECTION_COMP_EVT]      = btu_hcif_esco_connection_comp_evt,
+    [HCI_ESCO_CONNECTION_CHANGED_EVT]   = btu_hcif_esco_connection_chg_evt,
+#if (BTM_SSR_INCLUDED == TRUE)
+    [HCI_SNIFF_SUB_RATE_EVT]            = btu_hcif_ssr_evt,
+#endif
+    [HCI_RMT_HOST_SUP_FEAT_NOTIFY_EVT]  = btu_hcif_host_support_evt,
+    [HCI_IO_CAPABILITY_REQUEST_EVT]     = btu_hcif_io_cap_request_evt,
+    [HCI_IO_CAPABILITY_RESPONSE_EVT]    = btu_hcif_io_cap_response_evt,
+    [HCI_USER_CONFIRMATION_REQUEST_EVT] = btu_hcif_user_conf_request_evt,
+    [HCI_USER_PASSKEY_REQUEST_EVT]      = btu_hcif_user_passkey_request_evt,
+#if BTM_OOB_INCLUDED == TRUE
+    [HCI_REMOTE_OOB_DATA_REQUEST_EVT]   = btu_hcif_rem_oob_request_evt,
+#endif
+    [HCI_SIMPLE_PAIRING_COMPLETE_EVT]   = btu_hcif_simple_pair_complete_evt,
+    [HCI_USER_PASSKEY_NOTIFY_EVT]       = btu_hcif_user_passkey_notif_evt,
+    [HCI_KEYPRESS_NOTIFY_EVT]           = btu_hcif_keypress_notif_evt,
+    [HCI_LINK_SUPER_TOUT_CHANGED_EVT]   = btu_hcif_link_super_tout_evt,
+#if L2CAP_NON_FLUSHABLE_PB_INCLUDED == TRUE
+    [HCI_ENHANCED_FLUSH_COMPLETE_EVT]   = btu_hcif_enhanced_flush_complete_evt,
+#endif
+#if (BLE_INCLUDED == TRUE)
+    [HCI_BLE_EVENT]                     = btu_hcif_ble_evt,
+#endif
+    [HCI_VENDOR_SPECIFIC_EVT]           = btu_hcif_vendor_specific_evt,
+};
+
+#if (BLE_INCLUDED == TRUE)
+/* Handlers indexed by LE meta event subevent code */
+static tBTU_HCIF_EVT_HDLR * const btu_hcif_ble_evt_hdlr[BTU_HCIF_NUM_BLE_EVTS] =
+{
+    [HCI_BLE_ADV_PKT_RPT_EVT]           = btu_ble_process_adv_pkt,
+    [HCI_BLE_CONN_COMPLETE_EVT]         = btu_ble_ll_conn_complete_evt,
+    [HCI_BLE_LL_CONN_PARAM_UPD_EVT]     = btu_ble_ll_conn_param_upd_evt,
+    [HCI_BLE_READ_REMOTE_FEAT_CMPL_EVT] = btu_ble_read_remote_feat_evt,
+    [HCI_BLE_LTK_REQ_EVT]               = btu_ble_proc_ltk_req,
+#if (BLE_LLT_INCLUDED == TRUE)
+    [HCI_BLE_RC_PARAM_REQ_EVT]          = btu_ble_rc_param_req_evt,
+#endif
+};
+#endif
+
+#if (GKI_LATENCY_STATS_INCLUDED == TRUE)
+/* Number of distinct command opcodes with statistics. Must be a power of 2. */
+#define BTU_HCIF_NUM_OPCODE_STATS   128
+
+/* Size of the issue time stamp appended to the stored copy of a command */
+#define BTU_HCIF_CMD_STAMP_SIZE     sizeof(UINT32)
+
+/* TRUE if the buffer of a stored command has room for the time stamp. A
+** fixed size command pool buffer may not. */
+#define BTU_HCIF_CMD_HAS_STAMP(p_cmd) \
+    (GKI_get_buf_size (p_cmd) >= BT_HDR_SIZE + (p_cmd)->offset + (p_cmd)->len + BTU_HCIF_CMD_STAMP_SIZE)
+
+/* Number of times a handler ran, and its execution time while GKI latency
+** recording is on */
+typedef struct
+{
+    UINT32          count;
+    UINT32          timed;
+    UINT32          max_us;
+    UINT64          total_us;
+} tBTU_HCIF_HDLR_STATS;
+
+typedef struct
+{
+    UINT16                  opcode;         /* 0 if the entry is unused */
+    tBTU_HCIF_HDLR_STATS    cmpl;           /* Command Complete handling */
+    tBTU_HCIF_HDLR_STATS    status;         /* Command Status handling */
+    tGKI_LAT_HIST           round_trip;     /* issue to Command Complete or Status */
+} tBTU_HCIF_OPCODE_STATS;
+
+/* HCI event statistics, only written by btu_task */
+typedef struct
+{
+    tBTU_HCIF_HDLR_STATS    evt[BTU_HCIF_NUM_EVTS];
+    tBTU_HCIF_HDLR_STATS    ble_evt[BTU_HCIF_NUM_BLE_EVTS];
+    tBTU_HCIF_OPCODE_STATS  opcode[BTU_HCIF_NUM_OPCODE_STATS];
+    UINT32                  opcode_dropped; /* events of opcodes that did not fit */
+} tBTU_HCIF_STATS;
+
+static tBTU_HCIF_STATS btu_hcif_stats;
+
+/* Start time of a handler, or 0 when latency recording is off */
+#define BTU_HCIF_START()    (GKI_latency_stats_enabled() ? GKI_get_time_us() : 0)
+
+/*******************************************************************************
+**
+** Function         btu_hcif_hdlr_done
+**
+** Description      Count one run of a handler and, if it was started with
+**                  latency recording on, accumulate its execution time.
+**
+** Returns          void
+**
+*******************************************************************************/
+static void btu_hcif_hdlr_done (tBTU_HCIF_HDLR_STATS *p_stats, UINT64 start_us)
+{
+    UINT32 us;
+
+    p_stats->count++;
+
+    if (start_us == 0)
+        return;
+
+    us = (UINT32)(GKI_get_time_us() - start_us);
+    p_stats->timed++;
+    p_stats->total_us += us;
+    if (us > p_stats->max_us)
+        p_stats->max_us = us;
+}
+
+/*******************************************************************************
+**
+** Function         btu_hcif_opcode_stats
+**
+** Description      Find the statistics of a command opcode, taking a new entry
+**                  the first time the opcode is seen.
+**
+** Returns          pointer to the entry, or NULL if the table is full
+**
+*******************************************************************************/
+static tBTU_HCIF_OPCODE_STATS *btu_hcif_opcode_stats (UINT16 opcode)
+{
+    tBTU_HCIF_OPCODE_STATS *p_stats;
+    UINT16 i, xx;
+
+    if (opcode == 0)
+        return NULL;
+
+    i = (UINT16)((opcode ^ (opcode >> 7)) & (BTU_HCIF_NUM_OPCODE_STATS - 1));
+    for (xx = 0; xx < BTU_HCIF_NUM_OPCODE_STATS; xx++)
+    {
+        p_stats = &btu_hcif_stats.opcode[i];
+        if (p_stats->opcode == opcode)
+            return p_stats;
+
+        if (p_stats->opcode == 0)
+        {
+            p_stats->opcode = opcode;
+            return p_stats;
+        }
+        i = (i + 1) & (BTU_HCIF_NUM_OPCODE_STATS - 1);
+    }
+
+    btu_hcif_stats.opcode_dropped++;
+    return NULL;
+}
+
+/*******************************************************************************
+**
+** Function         btu_hcif_cmd_done
+**
+** Description      Record the Command Complete or Command Status event of a
+**                  command: the round trip from issue_us, when the stored
+**                  command was stamped, and the handler time from start_us.
+**
+** Returns          void
+**
+*******************************************************************************/
+static void btu_hcif_cmd_done (UINT16 opcode, BOOLEAN is_status, UINT32 issue_us,
+                               UINT64 start_us)
+{
+    tBTU_HCIF_OPCODE_STATS *p_stats;
+
+    if ((p_stats = btu_hcif_opcode_stats (opcode)) == NULL)
+        return;
+
+    if (issue_us != 0 && start_us != 0)
+        GKI_lat_hist_add (&p_stats->round_trip, (UINT32)start_us - issue_us);
+
+    btu_hcif_hdlr_done (is_status ? &p_stats->status : &p_stats->cmpl, start_us);
+}
+
+/*******************************************************************************
+**
+** Function         btu_hcif_stamp_cmd
+**
+** Description      Append the issue time to the stored copy of a command, or
+**                  0 when latency recording is off.
+**
+** Returns          void
+**
+*******************************************************************************/
+static void btu_hcif_stamp_cmd (BT_HDR *p_cmd)
+{
+    UINT32 issue_us = (UINT32)BTU_HCIF_START();
+
+    if (BTU_HCIF_CMD_HAS_STAMP(p_cmd))
+        memcpy ((UINT8 *)(p_cmd + 1) + p_cmd->offset + p_cmd->len, &issue_us, BTU_HCIF_CMD_STAMP_SIZE);
+}
+
+/*******************************************************************************
+**
+** Function         btu_hcif_cmd_issue_time
+**
+** Description      Read the issue time of a stored command.
+**
+** Returns          the time stamp, 0 if not recorded
+**
+*******************************************************************************/
+static UINT32 btu_hcif_cmd_issue_time (BT_HDR *p_cmd)
+{
+    UINT32 issue_us = 0;
+
+    if (BTU_HCIF_CMD_HAS_STAMP(p_cmd))
+        memcpy (&issue_us, (UINT8 *)(p_cmd + 1) + p_cmd->offset + p_cmd->len, BTU_HCIF_CMD_STAMP_SIZE);
+
+    return issue_us;
+}
+
+/*******************************************************************************
+**
+** Function         btu_hcif_dump_hdlr_stats
+**
+** Description      Write the statistics of one handler to a file descriptor.
+**
+** Returns          void
+**
+*******************************************************************************/
+static void btu_hcif_dump_hdlr_stats (int fd, const char *p_name, UINT16 code,
+                                      const tBTU_HCIF_HDLR_STATS *p_stats)
+{
+    if (p_stats->count == 0)
+        return;
+
+    dprintf(fd, "  %s 0x%04x n %u", p_name, code, p_stats->count);
+    if (p_stats->timed != 0)
+        dprintf(fd, " timed %u avg %u us max %u us", p_stats->timed,
+                (UINT32)(p_stats->total_us / p_stats->timed), p_stats->max_us);
+    dprintf(fd, "\n");
+}
+
+/*******************************************************************************
+**
+** Function         btu_hcif_dump_stats
+**
+** Description      Write the HCI event counters, handler execution times and
+**                  command round trip times to a file descriptor.
+**
+** Returns          void
+**
+*******************************************************************************/
+void btu_hcif_dump_stats (int fd)
+{
+    tBTU_HCIF_STATS        *p_stats = &btu_hcif_stats;
+    tBTU_HCIF_OPCODE_STATS *p_op;
+    char                    name[32];
+    UINT16                  i;
+
+    dprintf(fd, "BTU HCI events\n");
+    for (i = 0; i < BTU_HCIF_NUM_EVTS; i++)
+        btu_hcif_dump_hdlr_stats (fd, "event", i, &p_stats->evt[i]);
+    for (i = 0; i < BTU_HCIF_NUM_BLE_EVTS; i++)
+        btu_hcif_dump_hdlr_stats (fd, "le event", i, &p_stats->ble_evt[i]);
+
+    dprintf(fd, "BTU HCI commands (%u events of untracked opcodes)\n", p_stats->opcode_dropped);
+    for (i = 0; i < BTU_HCIF_NUM_OPCODE_STATS; i++)
+    {
+        p_op = &p_stats->opcode[i];
+        if (p_op->opcode == 0)
+            continue;
+
+        btu_hcif_dump_hdlr_stats (fd, "complete", p_op->opcode, &p_op->cmpl);
+        btu_hcif_dump_hdlr_stats (fd, "status", p_op->opcode, &p_op->status);
+        snprintf(name, sizeof(name), "round trip 0x%04x", p_op->opcode);
+        GKI_lat_hist_dump(fd, name, &p_op->round_trip);
+    }
+}
+#else
+#define BTU_HCIF_START()                                    0
+#define btu_hcif_hdlr_done(p_stats, start)                  ((void)(start))
+#define btu_hcif_cmd_done(opcode, is_status, issue, start)  ((void)(issue), (void)(start))
+#endif
+
 /*******************************************************************************
 **
 ** Function         btu_hcif_store_cmd
@@ -179,7 +509,12 @@ static void btu_hcif_store_cmd (UINT8 controller_id, BT_HDR *p_buf)
     }
 
     /* allocate buffer (HCI_GET_CMD_BUF will either get a buffer from HCI_CMD_POOL or from 'best-fit' pool) */
+#if (GKI_LATENCY_STATS_INCLUDED == TRUE)
+    if ((p_cmd = HCI_GET_CMD_BUF(p_buf->len + p_buf->offset - HCIC_PREAMBLE_SIZE
+                                 + BTU_HCIF_CMD_STAMP_SIZE)) == NULL)
+#else
     if ((p_cmd = HCI_GET_CMD_BUF(p_buf->len + p_buf->offset - HCIC_PREAMBLE_SIZE)) == NULL)
+#endif
     {
         return;
     }
@@ -201,6 +536,10 @@ static void btu_hcif_store_cmd (UINT8 controller_id, BT_HDR *p_buf)
     memcpy ((UINT8 *)(p_cmd + 1) + p_cmd->offset,
             (UINT8 *)(p_buf + 1) + p_buf->offset, p_buf->len);
 
+#if (GKI_LATENCY_STATS_INCLUDED == TRUE)
+    btu_hcif_stamp_cmd (p_cmd);
+#endif
+
     /* queue copy of cmd */
     GKI_enqueue(&(p_hci_cmd_cb->cmd_cmpl_q), p_cmd);
 
@@ -230,215 +569,96 @@ void btu_hcif_process_event (UINT8 controller_id, BT_HDR *p_msg)
 {
     UINT8   *p = (UINT8 *)(p_msg + 1) + p_msg->offset;
     UINT8   hci_evt_code, hci_evt_len;
-#if BLE_INCLUDED == TRUE
-    UINT8   ble_sub_code;
-#endif
+    UINT64  start_us;
+
     STREAM_TO_UINT8  (hci_evt_code, p);
     STREAM_TO_UINT8  (hci_evt_len, p);
 
-    switch (hci_evt_code)
+    if (btu_hcif_evt_hdlr[hci_evt_code] != NULL)
     {
-        case HCI_INQUIRY_COMP_EVT:
-            btu_hcif_inquiry_comp_evt (p);
-            break;
-        case HCI_INQUIRY_RESULT_EVT:
-            btu_hcif_inquiry_result_evt (p);
-            break;
-        case HCI_INQUIRY_RSSI_RESULT_EVT:
-            btu_hcif_inquiry_rssi_result_evt (p);
-            break;
-#if (BTM_EIR_CLIENT_INCLUDED == TRUE)
-        case HCI_EXTENDED_INQUIRY_RESULT_EVT:
-            btu_hcif_extended_inquiry_result_evt (p);
-            break;
-#endif
-        case HCI_CONNECTION_COMP_EVT:
-            btu_hcif_connection_comp_evt (p);
-            break;
-        case HCI_CONNECTION_REQUEST_EVT:
-            btu_hcif_connection_request_evt (p);
-            break;
-        case HCI_DISCONNECTION_COMP_EVT:
-            btu_hcif_disconnection_comp_evt (p);
-            break;
-        case HCI_AUTHENTICATION_COMP_EVT:
-            btu_hcif_authentication_comp_evt (p);
-            break;
-        case HCI_RMT_NAME_REQUEST_COMP_EVT:
-            btu_hcif_rmt_name_request_comp_evt (p, hci_evt_len);
-            break;
-        case HCI_ENCRYPTION_CHANGE_EVT:
-            btu_hcif_encryption_change_evt (p);
-            break;
-#if BLE_INCLUDED == TRUE
-        case HCI_ENCRYPTION_KEY_REFRESH_COMP_EVT:
-            btu_hcif_encryption_key_refresh_cmpl_evt(p);
-            break;
-#endif
-        case HCI_CHANGE_CONN_LINK_KEY_EVT:
-            btu_hcif_change_conn_link_key_evt (p);
-            break;
-        case HCI_MASTER_LINK_KEY_COMP_EVT:
-            btu_hcif_master_link_key_comp_evt (p);
-            break;
-        case HCI_READ_RMT_FEATURES_COMP_EVT:
-            btu_hcif_read_rmt_features_comp_evt (p);
-            break;
-        case HCI_READ_RMT_EXT_FEATURES_COMP_EVT:
-            btu_hcif_read_rmt_ext_features_comp_evt (p);
-            break;
-        case HCI_READ_RMT_VERSION_COMP_EVT:
-            btu_hcif_read_rmt_version_comp_evt (p);
-            break;
-        case HCI_QOS_SETUP_COMP_EVT:
-            btu_hcif_qos_setup_comp_evt (p);
-            break;
-        case HCI_COMMAND_COMPLETE_EVT:
-            btu_hcif_command_complete_evt (controller_id, p, hci_evt_len);
-            break;
-        case HCI_COMMAND_STATUS_EVT:
-            btu_hcif_command_status_evt (controller_id, p);
-            break;
-        case HCI_HARDWARE_ERROR_EVT:
-            btu_hcif_hardware_error_evt (p);
-            break;
-        case HCI_FLUSH_OCCURED_EVT:
-            btu_hcif_flush_occured_evt ();
-            break;
-        case HCI_ROLE_CHANGE_EVT:
-            btu_hcif_role_change_evt (p);
-            break;
-        case HCI_NUM_COMPL_DATA_PKTS_EVT:
-            btu_hcif_num_compl_data_pkts_evt (p);
-            break;
-        case HCI_MODE_CHANGE_EVT:
-            btu_hcif_mode_change_evt (p);
-            break;
-        case HCI_RETURN_LINK_KEYS_EVT:
-            btu_hcif_return_link_keys_evt (p);
-            break;
-        case HCI_PIN_CODE_REQUEST_EVT:
-            btu_hcif_pin_code_request_evt (p);
-            break;
-        case HCI_LINK_KEY_REQUEST_EVT:
-            btu_hcif_link_key_request_evt (p);
-            break;
-        case HCI_LINK_KEY_NOTIFICATION_EVT:
-            btu_hcif_link_key_notification_evt (p);
-            break;
-        case HCI_LOOPBACK_COMMAND_EVT:
-            btu_hcif_loopback_command_evt ();
-            break;
-        case HCI_DATA_BUF_OVERFLOW_EVT:
-            btu_hcif_data_buf_overflow_evt ();
-            break;
-        case HCI_MAX_SLOTS_CHANGED_EVT:
-            btu_hcif_max_slots_changed_evt ();
-            break;
-        case HCI_READ_CLOCK_OFF_COMP_EVT:
-            btu_hcif_read_clock_off_comp_evt (p);
-            break;
-        case HCI_CONN_PKT_TYPE_CHANGE_EVT:
-            btu_hcif_conn_pkt_type_change_evt ();
-            break;
-        case HCI_QOS_VIOLATION_EVT:
-            btu_hcif_qos_violation_evt (p);
-            break;
-        case HCI_PAGE_SCAN_MODE_CHANGE_EVT:
-            btu_hcif_page_scan_mode_change_evt ();
-            break;
-        case HCI_PAGE_SCAN_REP_MODE_CHNG_EVT:
-            btu_hcif_page_scan_rep_mode_chng_evt ();
-            break;
-        case HCI_ESCO_CONNECTION_COMP_EVT:
-            btu_hcif_esco_connection_comp_evt (p);
-            break;
-        case HCI_ESCO_CONNECTION_CHANGED_EVT:
-            btu_hcif_esco_connection_chg_evt (p);
-            break;
-#if (BTM_SSR_INCLUDED == TRUE)
-        case HCI_SNIFF_SUB_RATE_EVT:
-            btu_hcif_ssr_evt (p, hci_evt_len);
-            break;
-#endif  /* BTM_SSR_INCLUDED == TRUE */
-        case HCI_RMT_HOST_SUP_FEAT_NOTIFY_EVT:
-            btu_hcif_host_support_evt (p);
-            break;
-        case HCI_IO_CAPABILITY_REQUEST_EVT:
-            btu_hcif_io_cap_request_evt (p);
-            break;
-        case HCI_IO_CAPABILITY_RESPONSE_EVT:
-            btu_hcif_io_cap_response_evt (p);
-            break;
-        case HCI_USER_CONFIRMATION_REQUEST_EVT:
-            btu_hcif_user_conf_request_evt (p);
-            break;
-        case HCI_USER_PASSKEY_REQUEST_EVT:
-            btu_hcif_user_passkey_request_evt (p);
-            break;
-#if BTM_OOB_INCLUDED == TRUE
-        case HCI_REMOTE_OOB_DATA_REQUEST_EVT:
-            btu_hcif_rem_oob_request_evt (p);
-            break;
-#endif
-        case HCI_SIMPLE_PAIRING_COMPLETE_EVT:
-            btu_hcif_simple_pair_complete_evt (p);
-            break;
-        case HCI_USER_PASSKEY_NOTIFY_EVT:
-            btu_hcif_user_passkey_notif_evt (p);
-            break;
-        case HCI_KEYPRESS_NOTIFY_EVT:
-            btu_hcif_keypress_notif_evt (p);
-            break;
-        case HCI_LINK_SUPER_TOUT_CHANGED_EVT:
-            btu_hcif_link_super_tout_evt (p);
-            break;
-#if L2CAP_NON_FLUSHABLE_PB_INCLUDED == TRUE
-        case HCI_ENHANCED_FLUSH_COMPLETE_EVT:
-            btu_hcif_enhanced_flush_complete_evt ();
-            break;
-#endif
+        start_us = BTU_HCIF_START();
+        (*btu_hcif_evt_hdlr[hci_evt_code]) (controller_id, p, hci_evt_len);
+        btu_hcif_hdlr_done (&btu_hcif_stats.evt[hci_evt_code], start_us);
+    }
 
-#if (BLE_INCLUDED == TRUE)
-        case HCI_BLE_EVENT:
-            STREAM_TO_UINT8  (ble_sub_code, p);
+    // reset the  num_hci_cmds_timed_out upon receving any event from controller.
+    num_hci_cmds_timed_out = 0;
+}
 
-            HCI_TRACE_EVENT("BLE HCI(id=%d) event = 0x%02x)", hci_evt_code,  ble_sub_code);
 
-            switch (ble_sub_code)
-            {
-                case HCI_BLE_ADV_PKT_RPT_EVT: /* result of inquiry */
-                    btu_ble_process_adv_pkt(p);
-                    break;
-                case HCI_BLE_CONN_COMPLETE_EVT:
-                    btu_ble_ll_conn_complete_evt(p, hci_evt_len);
-                    break;
-                case HCI_BLE_LL_CONN_PARAM_UPD_EVT:
-                    btu_ble_ll_conn_param_upd_evt(p, hci_evt_len);
-                    break;
-                case HCI_BLE_READ_REMOTE_FEAT_CMPL_EVT:
-                    btu_ble_read_remote_feat_evt(p);
-                    break;
-                case HCI_BLE_LTK_REQ_EVT: /* received only at slave device */
-                    btu_ble_proc_ltk_req(p);
-                    break;
-#if (BLE_LLT_INCLUDED == TRUE)
-               case HCI_BLE_RC_PARAM_REQ_EVT:
-                    btu_ble_rc_param_req_evt(p);
-                    break;
-#endif
+/* Commands that later commands depend on. A barrier is sent only once every
+** earlier command has completed, and nothing is sent after it until it has
+** completed itself. Everything else is pipelined up to the command credits
+** granted by the controller. */
+static const UINT16 btu_hcif_barrier_cmds[] =
+{
+    HCI_RESET,
+    HCI_SET_HC_TO_HOST_FLOW_CTRL,       /* Host Buffer Size must have completed */
+    HCI_WRITE_SIMPLE_PAIRING_MODE,      /* these change the features page 1 reads */
+    HCI_WRITE_LE_HOST_SUPPORTED,
+    HCI_WRITE_SECURE_CONN_HOST_SUPPORT
+};
 
-            }
-            break;
-#endif /* BLE_INCLUDED */
-        case HCI_VENDOR_SPECIFIC_EVT:
-                btm_vendor_specific_evt (p, hci_evt_len);
-            break;
+/*******************************************************************************
+**
+** Function         btu_hcif_is_barrier
+**
+** Description      Check whether a command is an ordering barrier.
+**
+** Returns          TRUE if the opcode is in btu_hcif_barrier_cmds
+**
+*******************************************************************************/
+static BOOLEAN btu_hcif_is_barrier (UINT16 opcode)
+{
+    UINT8 i;
+
+    for (i = 0; i < sizeof(btu_hcif_barrier_cmds) / sizeof(btu_hcif_barrier_cmds[0]); i++)
+    {
+        if (btu_hcif_barrier_cmds[i] == opcode)
+            return TRUE;
     }
-    // reset the  num_hci_cmds_timed_out upon receving any event from controller.
-    num_hci_cmds_timed_out = 0;
+    return FALSE;
+}
+
+/*******************************************************************************
+**
+** Function         btu_hcif_cmd_blocked
+**
+** Description      Check whether a command has to wait for an ordering barrier,
+**                  either one that is in flight or one that it is itself and
+**                  which still has earlier commands outstanding.
+**
+** Returns          TRUE if the command must stay queued
+**
+*******************************************************************************/
+static BOOLEAN btu_hcif_cmd_blocked (tHCI_CMD_CB *p_hci_cmd_cb, BT_HDR *p_buf)
+{
+    UINT8   *p = (UINT8 *)(p_buf + 1) + p_buf->offset;
+    UINT16  opcode;
+
+    if (p_hci_cmd_cb->cmd_barrier != HCI_COMMAND_NONE)
+        return TRUE;
+
+    STREAM_TO_UINT16 (opcode, p);
+
+    return (btu_hcif_is_barrier (opcode) && !GKI_queue_is_empty (&p_hci_cmd_cb->cmd_cmpl_q));
 }
 
+/*******************************************************************************
+**
+** Function         btu_hcif_cmd_released
+**
+** Description      Called when a command has completed, failed or timed out.
+**                  Lifts the ordering barrier if it was that command.
+**
+** Returns          void
+**
+*******************************************************************************/
+static void btu_hcif_cmd_released (tHCI_CMD_CB *p_hci_cmd_cb, UINT16 opcode)
+{
+    if (p_hci_cmd_cb->cmd_barrier == opcode)
+        p_hci_cmd_cb->cmd_barrier = HCI_COMMAND_NONE;
+}
 
 /*******************************************************************************
 **
@@ -446,7 +666,9 @@ void btu_hcif_process_event (UINT8 controller_id, BT_HDR *p_msg)
 **
 ** Description      This function is called to check if it can send commands
 **                  to the Host Controller. It may be passed the address of
-**                  a packet to send.
+**                  a packet to send. Commands are sent in order for as long
+**                  as the controller has command credits, except that no
+**                  command passes an ordering barrier (btu_hcif_barrier_cmds).
 **
 ** Returns          void
 **
@@ -454,14 +676,12 @@ void btu_hcif_process_event (UINT8 controller_id, BT_HDR *p_msg)
 void btu_hcif_send_cmd (UINT8 controller_id, BT_HDR *p_buf)
 {
     tHCI_CMD_CB * p_hci_cmd_cb = &(btu_cb.hci_cmd_cb[controller_id]);
-
-#if ((L2CAP_HOST_FLOW_CTRL == TRUE)||defined(HCI_TESTER))
     UINT8 *pp;
     UINT16 code;
-#endif
 
-    /* If there are already commands in the queue, then enqueue this command */
-    if ((p_buf) && (p_hci_cmd_cb->cmd_xmit_q.count))
+    /* If there are already commands in the queue, or this one has to wait
+    ** for a barrier, then enqueue this command */
+    if ((p_buf) && ((p_hci_cmd_cb->cmd_xmit_q.count) || btu_hcif_cmd_blocked (p_hci_cmd_cb, p_buf)))
     {
         GKI_enqueue (&(p_hci_cmd_cb->cmd_xmit_q), p_buf);
         p_buf = NULL;
@@ -479,40 +699,46 @@ void btu_hcif_send_cmd (UINT8 controller_id, BT_HDR *p_buf)
     while (p_hci_cmd_cb->cmd_window != 0)
     {
         if (!p_buf)
-            p_buf = (BT_HDR *)GKI_dequeue (&(p_hci_cmd_cb->cmd_xmit_q));
-
-        if (p_buf)
         {
-            btu_hcif_store_cmd(controller_id, p_buf);
+            /* the head of the queue holds everything behind it */
+            p_buf = (BT_HDR *)GKI_getfirst (&(p_hci_cmd_cb->cmd_xmit_q));
+            if ((p_buf == NULL) || btu_hcif_cmd_blocked (p_hci_cmd_cb, p_buf))
+            {
+                p_buf = NULL;
+                break;
+            }
+            GKI_dequeue (&(p_hci_cmd_cb->cmd_xmit_q));
+        }
 
-#if ((L2CAP_HOST_FLOW_CTRL == TRUE)||defined(HCI_TESTER))
-            pp = (UINT8 *)(p_buf + 1) + p_buf->offset;
+        pp = (UINT8 *)(p_buf + 1) + p_buf->offset;
+        STREAM_TO_UINT16 (code, pp);
 
-            STREAM_TO_UINT16 (code, pp);
+        if (btu_hcif_is_barrier (code))
+            p_hci_cmd_cb->cmd_barrier = code;
 
-            /*
-             * We do not need to decrease window for host flow control,
-             * host flow control does not receive an event back from controller
-             */
-            if (code != HCI_HOST_NUM_PACKETS_DONE)
-#endif
-                p_hci_cmd_cb->cmd_window--;
+        btu_hcif_store_cmd(controller_id, p_buf);
 
-            if (controller_id == LOCAL_BR_EDR_CONTROLLER_ID)
-            {
-                HCI_CMD_TO_LOWER(p_buf);
-            }
-            else
-            {
-                /* Unknown controller */
-                HCI_TRACE_WARNING("BTU HCI(ctrl id=%d) controller ID not recognized", controller_id);
-                GKI_freebuf(p_buf);;
-            }
+#if ((L2CAP_HOST_FLOW_CTRL == TRUE)||defined(HCI_TESTER))
+        /*
+         * We do not need to decrease window for host flow control,
+         * host flow control does not receive an event back from controller
+         */
+        if (code != HCI_HOST_NUM_PACKETS_DONE)
+#endif
+            p_hci_cmd_cb->cmd_window--;
 
-            p_buf = NULL;
+        if (controller_id == LOCAL_BR_EDR_CONTROLLER_ID)
+        {
+            HCI_CMD_TO_LOWER(p_buf);
         }
         else
-            break;
+        {
+            /* Unknown controller */
+            HCI_TRACE_WARNING("BTU HCI(ctrl id=%d) controller ID not recognized", controller_id);
+            GKI_freebuf(p_buf);;
+        }
+
+        p_buf = NULL;
     }
 
     if (p_buf)
@@ -567,7 +793,7 @@ void btu_hcif_send_host_rdy_for_data(void)
 ** Returns          void
 **
 *******************************************************************************/
-static void btu_hcif_inquiry_comp_evt (UINT8 *p)
+static void btu_hcif_inquiry_comp_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len)
 {
     UINT8   status;
 
@@ -587,7 +813,7 @@ static void btu_hcif_inquiry_comp_evt (UINT8 *p)
 ** Returns          void
 **
 *******************************************************************************/
-static void btu_hcif_inquiry_result_evt (UINT8 *p)
+static void btu_hcif_inquiry_result_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len)
 {
     /* Store results in the cache */
     btm_process_inq_results (p, BTM_INQ_RESULT_STANDARD);
@@ -602,7 +828,7 @@ static void btu_hcif_inquiry_result_evt (UINT8 *p)
 ** Returns          void
 **
 *******************************************************************************/
-static void btu_hcif_inquiry_rssi_result_evt (UINT8 *p)
+static void btu_hcif_inquiry_rssi_result_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len)
 {
     /* Store results in the cache */
     btm_process_inq_results (p, BTM_INQ_RESULT_WITH_RSSI);
@@ -618,7 +844,7 @@ static void btu_hcif_inquiry_rssi_result_evt (UINT8 *p)
 **
 *******************************************************************************/
 #if (BTM_EIR_CLIENT_INCLUDED == TRUE)
-static void btu_hcif_extended_inquiry_result_evt (UINT8 *p)
+static void btu_hcif_extended_inquiry_result_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len)
 {
     /* Store results in the cache */
     btm_process_inq_results (p, BTM_INQ_RESULT_EXTENDED);
@@ -634,7 +860,7 @@ static void btu_hcif_extended_inquiry_result_evt (UINT8 *p)
 ** Returns          void
 **
 *******************************************************************************/
-static void btu_hcif_connection_comp_evt (UINT8 *p)
+static void btu_hcif_connection_comp_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len)
 {
     UINT8       status;
     UINT16      handle;
@@ -680,7 +906,7 @@ static void btu_hcif_connection_comp_evt (UINT8 *p)
 ** Returns          void
 **
 *******************************************************************************/
-static void btu_hcif_connection_request_evt (UINT8 *p)
+static void btu_hcif_connection_request_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len)
 {
     BD_ADDR     bda;
     DEV_CLASS   dc;
@@ -714,7 +940,7 @@ static void btu_hcif_connection_request_evt (UINT8 *p)
 ** Returns          void
 **
 *******************************************************************************/
-static void btu_hcif_disconnection_comp_evt (UINT8 *p)
+static void btu_hcif_disconnection_comp_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len)
 {
     UINT8   status;
     UINT16  handle;
@@ -747,7 +973,7 @@ static void btu_hcif_disconnection_comp_evt (UINT8 *p)
 ** Returns          void
 **
 *******************************************************************************/
-static void btu_hcif_authentication_comp_evt (UINT8 *p)
+static void btu_hcif_authentication_comp_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len)
 {
     UINT8   status;
     UINT16  handle;
@@ -768,7 +994,7 @@ static void btu_hcif_authentication_comp_evt (UINT8 *p)
 ** Returns          void
 **
 *******************************************************************************/
-static void btu_hcif_rmt_name_request_comp_evt (UINT8 *p, UINT16 evt_len)
+static void btu_hcif_rmt_name_request_comp_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len)
 {
     UINT8   status;
     BD_ADDR bd_addr;
@@ -793,7 +1019,7 @@ static void btu_hcif_rmt_name_request_comp_evt (UINT8 *p, UINT16 evt_len)
 ** Returns          void
 **
 *******************************************************************************/
-static void btu_hcif_encryption_change_evt (UINT8 *p)
+static void btu_hcif_encryption_change_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len)
 {
     UINT8   status;
     UINT16  handle;
@@ -817,7 +1043,7 @@ static void btu_hcif_encryption_change_evt (UINT8 *p)
 ** Returns          void
 **
 *******************************************************************************/
-static void btu_hcif_change_conn_link_key_evt (UINT8 *p)
+static void btu_hcif_change_conn_link_key_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len)
 {
     UINT8   status;
     UINT16  handle;
@@ -838,7 +1064,7 @@ static void btu_hcif_change_conn_link_key_evt (UINT8 *p)
 ** Returns          void
 **
 *******************************************************************************/
-static void btu_hcif_master_link_key_comp_evt (UINT8 *p)
+static void btu_hcif_master_link_key_comp_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len)
 {
     UINT8   status;
     UINT16  handle;
@@ -861,7 +1087,7 @@ static void btu_hcif_master_link_key_comp_evt (UINT8 *p)
 ** Returns          void
 **
 *******************************************************************************/
-static void btu_hcif_read_rmt_features_comp_evt (UINT8 *p)
+static void btu_hcif_read_rmt_features_comp_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len)
 {
     btm_read_remote_features_complete(p);
 }
@@ -875,7 +1101,7 @@ static void btu_hcif_read_rmt_features_comp_evt (UINT8 *p)
 ** Returns          void
 **
 *******************************************************************************/
-static void btu_hcif_read_rmt_ext_features_comp_evt (UINT8 *p)
+static void btu_hcif_read_rmt_ext_features_comp_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len)
 {
     UINT8 *p_cur = p;
     UINT8 status;
@@ -901,7 +1127,7 @@ static void btu_hcif_read_rmt_ext_features_comp_evt (UINT8 *p)
 ** Returns          void
 **
 *******************************************************************************/
-static void btu_hcif_read_rmt_version_comp_evt (UINT8 *p)
+static void btu_hcif_read_rmt_version_comp_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len)
 {
     btm_read_remote_version_complete (p);
 }
@@ -916,7 +1142,7 @@ static void btu_hcif_read_rmt_version_comp_evt (UINT8 *p)
 ** Returns          void
 **
 *******************************************************************************/
-static void btu_hcif_qos_setup_comp_evt (UINT8 *p)
+static void btu_hcif_qos_setup_comp_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len)
 {
     UINT8 status;
     UINT16 handle;
@@ -944,7 +1170,7 @@ static void btu_hcif_qos_setup_comp_evt (UINT8 *p)
 ** Returns          void
 **
 *******************************************************************************/
-static void btu_hcif_esco_connection_comp_evt (UINT8 *p)
+static void btu_hcif_esco_connection_comp_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len)
 {
 #if BTM_SCO_INCLUDED == TRUE
     tBTM_ESCO_DATA  data;
@@ -978,7 +1204,7 @@ static void btu_hcif_esco_connection_comp_evt (UINT8 *p)
 ** Returns          void
 **
 *******************************************************************************/
-static void btu_hcif_esco_connection_chg_evt (UINT8 *p)
+static void btu_hcif_esco_connection_chg_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len)
 {
 #if BTM_SCO_INCLUDED == TRUE
     UINT16  handle;
@@ -1208,6 +1434,8 @@ static void btu_hcif_command_complete_evt (UINT8 controller_id, UINT8 *p, UINT16
     UINT16      cc_opcode;
     BT_HDR      *p_cmd;
     void        *p_cplt_cback = NULL;
+    UINT32      issue_us = 0;
+    UINT64      start_us = BTU_HCIF_START();
 
     STREAM_TO_UINT8  (p_hci_cmd_cb->cmd_window, p);
 
@@ -1266,6 +1494,9 @@ static void btu_hcif_command_complete_evt (UINT8 controller_id, UINT8 *p, UINT16
                 p_cplt_cback = *((void **)(p_cmd + 1));
             }
 
+#if (GKI_LATENCY_STATS_INCLUDED == TRUE)
+            issue_us = btu_hcif_cmd_issue_time (p_cmd);
+#endif
             GKI_freebuf (p_cmd);
 
             break;
@@ -1290,8 +1521,11 @@ static void btu_hcif_command_complete_evt (UINT8 controller_id, UINT8 *p, UINT16
         }
     }
 
+    btu_hcif_cmd_released (p_hci_cmd_cb, cc_opcode);
+
     /* handle event */
     btu_hcif_hdl_command_complete (cc_opcode, p, evt_len, p_cplt_cback);
+    btu_hcif_cmd_done (cc_opcode, FALSE, issue_us, start_us);
 
     /* see if we can send more commands */
     btu_hcif_send_cmd (controller_id, NULL);
@@ -1479,7 +1713,7 @@ static void btu_hcif_hdl_command_status (UINT16 opcode, UINT8 status, UINT8 *p_c
 ** Returns          void
 **
 *******************************************************************************/
-static void btu_hcif_command_status_evt (UINT8 controller_id, UINT8 *p)
+static void btu_hcif_command_status_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len)
 {
     tHCI_CMD_CB * p_hci_cmd_cb = &(btu_cb.hci_cmd_cb[controller_id]);
     UINT8       status;
@@ -1488,6 +1722,8 @@ static void btu_hcif_command_status_evt (UINT8 controller_id, UINT8 *p)
     BT_HDR      *p_cmd = NULL;
     UINT8       *p_data = NULL;
     void        *p_vsc_status_cback = NULL;
+    UINT32      issue_us = 0;
+    UINT64      start_us = BTU_HCIF_START();
 
     STREAM_TO_UINT8  (status, p);
     STREAM_TO_UINT8  (p_hci_cmd_cb->cmd_window, p);
@@ -1526,6 +1762,9 @@ static void btu_hcif_command_status_evt (UINT8 controller_id, UINT8 *p)
                 {
                     p_vsc_status_cback = *((void **)(p_cmd + 1));
                 }
+#if (GKI_LATENCY_STATS_INCLUDED == TRUE)
+                issue_us = btu_hcif_cmd_issue_time (p_cmd);
+#endif
                 break;
             }
         }
@@ -1549,8 +1788,11 @@ static void btu_hcif_command_status_evt (UINT8 controller_id, UINT8 *p)
         }
     }
 
+    btu_hcif_cmd_released (p_hci_cmd_cb, opcode);
+
     /* handle command */
     btu_hcif_hdl_command_status (opcode, status, p_data, p_vsc_status_cback);
+    btu_hcif_cmd_done (opcode, TRUE, issue_us, start_us);
 
     /* free stored command */
     if (p_cmd != NULL)
@@ -1640,6 +1882,8 @@ void btu_hcif_cmd_timeout (UINT8 controller_id)
     /* get opcode from stored command */
     STREAM_TO_UINT16 (opcode, p);
 
+    btu_hcif_cmd_released (p_hci_cmd_cb, opcode);
+
 // btla-specific ++
 #if (defined(ANDROID_APP_INCLUDED) && (ANDROID_APP_INCLUDED == TRUE))
     ALOGE("######################################################################");
@@ -1731,7 +1975,7 @@ void btu_hcif_cmd_timeout (UINT8 controller_id)
 ** Returns          void
 **
 *******************************************************************************/
-static void btu_hcif_hardware_error_evt (UINT8 *p)
+static void btu_hcif_hardware_error_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len)
 {
     HCI_TRACE_ERROR("Ctlr H/w error event - code:0x%x", *p);
 
@@ -1761,7 +2005,7 @@ static void btu_hcif_hardware_error_evt (UINT8 *p)
 ** Returns          void
 **
 *******************************************************************************/
-static void btu_hcif_flush_occured_evt (void)
+static void btu_hcif_flush_occured_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len)
 {
 }
 
@@ -1775,7 +2019,7 @@ static void btu_hcif_flush_occured_evt (void)
 ** Returns          void
 **
 *******************************************************************************/
-static void btu_hcif_role_change_evt (UINT8 *p)
+static void btu_hcif_role_change_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len)
 {
     UINT8       status;
     BD_ADDR     bda;
@@ -1799,7 +2043,7 @@ static void btu_hcif_role_change_evt (UINT8 *p)
 ** Returns          void
 **
 *******************************************************************************/
-static void btu_hcif_num_compl_data_pkts_evt (UINT8 *p)
+static void btu_hcif_num_compl_data_pkts_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len)
 {
     /* Process for L2CAP and SCO */
     l2c_link_process_num_completed_pkts (p);
@@ -1817,7 +2061,7 @@ static void btu_hcif_num_compl_data_pkts_evt (UINT8 *p)
 ** Returns          void
 **
 *******************************************************************************/
-static void btu_hcif_mode_change_evt (UINT8 *p)
+static void btu_hcif_mode_change_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len)
 {
     UINT8       status;
     UINT16      handle;
@@ -1853,7 +2097,7 @@ static void btu_hcif_mode_change_evt (UINT8 *p)
 **
 *******************************************************************************/
     #if (BTM_SSR_INCLUDED == TRUE)
-static void btu_hcif_ssr_evt (UINT8 *p, UINT16 evt_len)
+static void btu_hcif_ssr_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len)
 {
 #if (BTM_PWR_MGR_INCLUDED == TRUE)
     btm_pm_proc_ssr_evt(p, evt_len);
@@ -1872,7 +2116,7 @@ static void btu_hcif_ssr_evt (UINT8 *p, UINT16 evt_len)
 **
 *******************************************************************************/
 
-static void btu_hcif_return_link_keys_evt (UINT8 *p)
+static void btu_hcif_return_link_keys_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len)
 {
     UINT8                       num_keys;
     tBTM_RETURN_LINK_KEYS_EVT   *result;
@@ -1902,7 +2146,7 @@ static void btu_hcif_return_link_keys_evt (UINT8 *p)
 ** Returns          void
 **
 *******************************************************************************/
-static void btu_hcif_pin_code_request_evt (UINT8 *p)
+static void btu_hcif_pin_code_request_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len)
 {
     BD_ADDR  bda;
 
@@ -1925,7 +2169,7 @@ static void btu_hcif_pin_code_request_evt (UINT8 *p)
 ** Returns          void
 **
 *******************************************************************************/
-static void btu_hcif_link_key_request_evt (UINT8 *p)
+static void btu_hcif_link_key_request_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len)
 {
     BD_ADDR  bda;
 
@@ -1943,7 +2187,7 @@ static void btu_hcif_link_key_request_evt (UINT8 *p)
 ** Returns          void
 **
 *******************************************************************************/
-static void btu_hcif_link_key_notification_evt (UINT8 *p)
+static void btu_hcif_link_key_notification_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len)
 {
     BD_ADDR  bda;
     LINK_KEY key;
@@ -1966,7 +2210,7 @@ static void btu_hcif_link_key_notification_evt (UINT8 *p)
 ** Returns          void
 **
 *******************************************************************************/
-static void btu_hcif_loopback_command_evt (void)
+static void btu_hcif_loopback_command_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len)
 {
 }
 
@@ -1980,7 +2224,7 @@ static void btu_hcif_loopback_command_evt (void)
 ** Returns          void
 **
 *******************************************************************************/
-static void btu_hcif_data_buf_overflow_evt (void)
+static void btu_hcif_data_buf_overflow_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len)
 {
 }
 
@@ -1994,7 +2238,7 @@ static void btu_hcif_data_buf_overflow_evt (void)
 ** Returns          void
 **
 *******************************************************************************/
-static void btu_hcif_max_slots_changed_evt (void)
+static void btu_hcif_max_slots_changed_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len)
 {
 }
 
@@ -2008,7 +2252,7 @@ static void btu_hcif_max_slots_changed_evt (void)
 ** Returns          void
 **
 *******************************************************************************/
-static void btu_hcif_read_clock_off_comp_evt (UINT8 *p)
+static void btu_hcif_read_clock_off_comp_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len)
 {
     UINT8       status;
     UINT16      handle;
@@ -2039,7 +2283,7 @@ static void btu_hcif_read_clock_off_comp_evt (UINT8 *p)
 ** Returns          void
 **
 *******************************************************************************/
-static void btu_hcif_conn_pkt_type_change_evt (void)
+static void btu_hcif_conn_pkt_type_change_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len)
 {
 }
 
@@ -2053,7 +2297,7 @@ static void btu_hcif_conn_pkt_type_change_evt (void)
 ** Returns          void
 **
 *******************************************************************************/
-static void btu_hcif_qos_violation_evt (UINT8 *p)
+static void btu_hcif_qos_violation_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len)
 {
     UINT16   handle;
 
@@ -2075,7 +2319,7 @@ static void btu_hcif_qos_violation_evt (UINT8 *p)
 ** Returns          void
 **
 *******************************************************************************/
-static void btu_hcif_page_scan_mode_change_evt (void)
+static void btu_hcif_page_scan_mode_change_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len)
 {
 }
 
@@ -2089,10 +2333,24 @@ static void btu_hcif_page_scan_mode_change_evt (void)
 ** Returns          void
 **
 *******************************************************************************/
-static void btu_hcif_page_scan_rep_mode_chng_evt (void)
+static void btu_hcif_page_scan_rep_mode_chng_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len)
 {
 }
 
+/*******************************************************************************
+**
+** Function         btu_hcif_vendor_specific_evt
+**
+** Description      Process event HCI_VENDOR_SPECIFIC_EVT
+**
+** Returns          void
+**
+*******************************************************************************/
+static void btu_hcif_vendor_specific_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len)
+{
+    btm_vendor_specific_evt (p, (UINT8)evt_len);
+}
+
 /**********************************************
 ** Simple Pairing Events
 ***********************************************/
@@ -2106,7 +2364,7 @@ static void btu_hcif_page_scan_rep_mode_chng_evt (void)
 ** Returns          void
 **
 *******************************************************************************/
-static void btu_hcif_host_support_evt (UINT8 *p)
+static void btu_hcif_host_support_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len)
 {
     btm_sec_rmt_host_support_feat_evt(p);
 }
@@ -2120,7 +2378,7 @@ static void btu_hcif_host_support_evt (UINT8 *p)
 ** Returns          void
 **
 *******************************************************************************/
-static void btu_hcif_io_cap_request_evt (UINT8 *p)
+static void btu_hcif_io_cap_request_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len)
 {
     btm_io_capabilities_req(p);
 }
@@ -2135,7 +2393,7 @@ static void btu_hcif_io_cap_request_evt (UINT8 *p)
 ** Returns          void
 **
 *******************************************************************************/
-static void btu_hcif_io_cap_response_evt (UINT8 *p)
+static void btu_hcif_io_cap_response_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len)
 {
     btm_io_capabilities_rsp(p);
 }
@@ -2150,7 +2408,7 @@ static void btu_hcif_io_cap_response_evt (UINT8 *p)
 ** Returns          void
 **
 *******************************************************************************/
-static void btu_hcif_user_conf_request_evt (UINT8 *p)
+static void btu_hcif_user_conf_request_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len)
 {
     btm_proc_sp_req_evt(BTM_SP_CFM_REQ_EVT, p);
 }
@@ -2165,7 +2423,7 @@ static void btu_hcif_user_conf_request_evt (UINT8 *p)
 ** Returns          void
 **
 *******************************************************************************/
-static void btu_hcif_user_passkey_request_evt (UINT8 *p)
+static void btu_hcif_user_passkey_request_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len)
 {
     btm_proc_sp_req_evt(BTM_SP_KEY_REQ_EVT, p);
 }
@@ -2179,7 +2437,7 @@ static void btu_hcif_user_passkey_request_evt (UINT8 *p)
 ** Returns          void
 **
 *******************************************************************************/
-static void btu_hcif_user_passkey_notif_evt (UINT8 *p)
+static void btu_hcif_user_passkey_notif_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len)
 {
     btm_proc_sp_req_evt(BTM_SP_KEY_NOTIF_EVT, p);
 }
@@ -2193,7 +2451,7 @@ static void btu_hcif_user_passkey_notif_evt (UINT8 *p)
 ** Returns          void
 **
 *******************************************************************************/
-static void btu_hcif_keypress_notif_evt (UINT8 *p)
+static void btu_hcif_keypress_notif_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len)
 {
     btm_keypress_notif_evt(p);
 }
@@ -2207,7 +2465,7 @@ static void btu_hcif_keypress_notif_evt (UINT8 *p)
 ** Returns          void
 **
 *******************************************************************************/
-static void btu_hcif_link_super_tout_evt (UINT8 *p)
+static void btu_hcif_link_super_tout_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len)
 {
     UINT16 handle, timeout;
     STREAM_TO_UINT16 (handle, p);
@@ -2226,7 +2484,7 @@ static void btu_hcif_link_super_tout_evt (UINT8 *p)
 **
 *******************************************************************************/
     #if BTM_OOB_INCLUDED == TRUE
-static void btu_hcif_rem_oob_request_evt (UINT8 *p)
+static void btu_hcif_rem_oob_request_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len)
 {
     btm_rem_oob_req(p);
 }
@@ -2241,7 +2499,7 @@ static void btu_hcif_rem_oob_request_evt (UINT8 *p)
 ** Returns          void
 **
 *******************************************************************************/
-static void btu_hcif_simple_pair_complete_evt (UINT8 *p)
+static void btu_hcif_simple_pair_complete_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len)
 {
     btm_simple_pair_complete(p);
 }
@@ -2260,6 +2518,7 @@ void btu_hcif_flush_cmd_queue(void)
     BT_HDR *p_cmd;
 
     btu_cb.hci_cmd_cb[0].cmd_window = 0;
+    btu_cb.hci_cmd_cb[0].cmd_barrier = HCI_COMMAND_NONE;
     while ((p_cmd = (BT_HDR *) GKI_dequeue (&btu_cb.hci_cmd_cb[0].cmd_cmpl_q)) != NULL)
     {
         GKI_freebuf (p_cmd);
@@ -2280,7 +2539,7 @@ void btu_hcif_flush_cmd_queue(void)
 **
 *******************************************************************************/
 #if L2CAP_NON_FLUSHABLE_PB_INCLUDED == TRUE
-static void btu_hcif_enhanced_flush_complete_evt (void)
+static void btu_hcif_enhanced_flush_complete_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len)
 {
 /* This is empty until an upper layer cares about returning event */
 }
@@ -2294,7 +2553,33 @@ static void btu_hcif_enhanced_flush_complete_evt (void)
 ** BLE Events
 ***********************************************/
 #if (defined BLE_INCLUDED) && (BLE_INCLUDED == TRUE)
-static void btu_hcif_encryption_key_refresh_cmpl_evt (UINT8 *p)
+/*******************************************************************************
+**
+** Function         btu_hcif_ble_evt
+**
+** Description      Process event HCI_BLE_EVENT, dispatching on the subevent code
+**
+** Returns          void
+**
+*******************************************************************************/
+static void btu_hcif_ble_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len)
+{
+    UINT8   ble_sub_code;
+    UINT64  start_us;
+
+    STREAM_TO_UINT8  (ble_sub_code, p);
+
+    HCI_TRACE_EVENT("BLE HCI(id=%d) event = 0x%02x)", HCI_BLE_EVENT,  ble_sub_code);
+
+    if (ble_sub_code < BTU_HCIF_NUM_BLE_EVTS && btu_hcif_ble_evt_hdlr[ble_sub_code] != NULL)
+    {
+        start_us = BTU_HCIF_START();
+        (*btu_hcif_ble_evt_hdlr[ble_sub_code]) (controller_id, p, evt_len);
+        btu_hcif_hdlr_done (&btu_hcif_stats.ble_evt[ble_sub_code], start_us);
+    }
+}
+
+static void btu_hcif_encryption_key_refresh_cmpl_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len)
 {
     UINT8   status;
     UINT8   enc_enable = 0;
@@ -2308,19 +2593,19 @@ static void btu_hcif_encryption_key_refresh_cmpl_evt (UINT8 *p)
     btm_sec_encrypt_change (handle, status, enc_enable);
 }
 
-static void btu_ble_process_adv_pkt (UINT8 *p)
+static void btu_ble_process_adv_pkt (UINT8 controller_id, UINT8 *p, UINT16 evt_len)
 {
     HCI_TRACE_EVENT("btu_ble_process_adv_pkt");
 
     btm_ble_process_adv_pkt(p);
 }
 
-static void btu_ble_ll_conn_complete_evt ( UINT8 *p, UINT16 evt_len)
+static void btu_ble_ll_conn_complete_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len)
 {
     btm_ble_conn_complete(p, evt_len);
 }
 
-static void btu_ble_ll_conn_param_upd_evt (UINT8 *p, UINT16 evt_len)
+static void btu_ble_ll_conn_param_upd_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len)
 {
     /* LE connection update has completed successfully as a master. */
     /* We can enable the update request if the result is a success. */
@@ -2333,12 +2618,12 @@ static void btu_ble_ll_conn_param_upd_evt (UINT8 *p, UINT16 evt_len)
     l2cble_process_conn_update_evt(handle, status);
 }
 
-static void btu_ble_read_remote_feat_evt (UINT8 *p)
+static void btu_ble_read_remote_feat_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len)
 {
     btm_ble_read_remote_features_complete(p);
 }
 
-static void btu_ble_proc_ltk_req (UINT8 *p)
+static void btu_ble_proc_ltk_req (UINT8 controller_id, UINT8 *p, UINT16 evt_len)
 {
     UINT16 ediv, handle;
     UINT8   *pp;
@@ -2355,7 +2640,7 @@ static void btu_ble_proc_ltk_req (UINT8 *p)
 ** End of BLE Events Handler
 ***********************************************/
 #if (defined BLE_LLT_INCLUDED) && (BLE_LLT_INCLUDED == TRUE)
-static void btu_ble_rc_param_req_evt(UINT8 *p)
+static void btu_ble_rc_param_req_evt (UINT8 controller_id, UINT8 *p, UINT16 evt_len)
 {
     UINT16 handle;
     UINT16  int_min, int_max, latency, timeout;
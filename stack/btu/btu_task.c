@@ -149,6 +149,121 @@ tBTU_CB  btu_cb;
 /* Define a function prototype to allow a generic timeout handler */
 typedef void (tUSER_TIMEOUT_FUNC) (TIMER_LIST_ENT *p_tle);
 
+static void btu_timer_rearm (void);
+static void btu_process_timers (void);
+
+#if (GKI_LATENCY_STATS_INCLUDED == TRUE)
+/* Number of distinct HCI mailbox message types that are timed */
+#define BTU_HANDLER_MSG_TYPES   24
+
+/* Handler execution times of btu_task, recorded while GKI latency recording
+** is on. Messages of the HCI mailbox are timed per BT_EVT_* type; all other
+** work is timed per GKI event bit. Only btu_task writes these.
+*/
+typedef struct
+{
+    UINT16          msg_type[BTU_HANDLER_MSG_TYPES];
+    tGKI_LAT_HIST   msg_hist[BTU_HANDLER_MSG_TYPES];
+    UINT8           num_msg_types;
+    tGKI_LAT_HIST   evt_hist[16];
+} tBTU_HANDLER_STATS;
+
+static tBTU_HANDLER_STATS btu_handler_stats;
+
+/* Start time of a handler, or 0 when latency recording is off */
+#define BTU_HANDLER_START() (GKI_latency_stats_enabled() ? GKI_get_time_us() : 0)
+
+/*******************************************************************************
+**
+** Function         btu_handler_msg_done
+**
+** Description      Record the execution time of an HCI mailbox message
+**                  handler started at start_us.
+**
+** Returns          void
+**
+*******************************************************************************/
+static void btu_handler_msg_done (UINT16 msg_type, UINT64 start_us)
+{
+    tBTU_HANDLER_STATS *p_stats = &btu_handler_stats;
+    UINT8 i;
+
+    if (start_us == 0)
+        return;
+
+    for (i = 0; i < p_stats->num_msg_types; i++)
+    {
+        if (p_stats->msg_type[i] == msg_type)
+            break;
+    }
+
+    if (i == p_stats->num_msg_types)
+    {
+        if (i == BTU_HANDLER_MSG_TYPES)
+            return;
+
+        p_stats->msg_type[i] = msg_type;
+        p_stats->num_msg_types++;
+    }
+
+    GKI_lat_hist_add(&p_stats->msg_hist[i], (UINT32)(GKI_get_time_us() - start_us));
+}
+
+/*******************************************************************************
+**
+** Function         btu_handler_evt_done
+**
+** Description      Record the execution time of the handling of one GKI
+**                  event started at start_us.
+**
+** Returns          void
+**
+*******************************************************************************/
+static void btu_handler_evt_done (UINT16 evt_mask, UINT64 start_us)
+{
+    if (start_us == 0)
+        return;
+
+    GKI_lat_hist_add(&btu_handler_stats.evt_hist[__builtin_ctz(evt_mask)],
+                     (UINT32)(GKI_get_time_us() - start_us));
+}
+
+/*******************************************************************************
+**
+** Function         btu_dump_handler_stats
+**
+** Description      Write the btu_task handler execution time histograms to a
+**                  file descriptor.
+**
+** Returns          void
+**
+*******************************************************************************/
+void btu_dump_handler_stats (int fd)
+{
+    tBTU_HANDLER_STATS *p_stats = &btu_handler_stats;
+    char name[32];
+    UINT8 i;
+
+    dprintf(fd, "BTU handler execution time\n");
+
+    for (i = 0; i < p_stats->num_msg_types; i++)
+    {
+        snprintf(name, sizeof(name), "msg 0x%04x", p_stats->msg_type[i]);
+        GKI_lat_hist_dump(fd, name, &p_stats->msg_hist[i]);
+    }
+
+    for (i = 0; i < 16; i++)
+    {
+        snprintf(name, sizeof(name), "event 0x%04x", EVENT_MASK(i));
+        GKI_lat_hist_dump(fd, name, &p_stats->evt_hist[i]);
+    }
+}
+#else
+#define BTU_HANDLER_START()                     0
+#define btu_handler_msg_done(msg_type, start)   ((void)(msg_type), (void)(start))
+#define btu_handler_evt_done(evt_mask, start)   ((void)(start))
+#endif
+
 /*******************************************************************************
 **
 ** Function         btu_task
@@ -167,8 +282,13 @@ BTU_API UINT32 btu_task (UINT32 param)
     UINT8            i;
     UINT16           mask;
     BOOLEAN          handled;
+    BUFFER_Q         msg_q;
+    UINT16           msg_type;
+    UINT64           start_us;
     UNUSED(param);
 
+    GKI_init_q(&msg_q);
+
 #if (defined(HCISU_H4_INCLUDED) && HCISU_H4_INCLUDED == TRUE)
     /* wait an event that HCISU is ready */
     BT_TRACE(TRACE_LAYER_BTU, TRACE_TYPE_API,
@@ -233,11 +353,16 @@ BTU_API UINT32 btu_task (UINT32 param)
 
         if (event & TASK_MBOX_0_EVT_MASK)
         {
-            /* Process all messages in the queue */
-            while ((p_msg = (BT_HDR *) GKI_read_mbox (BTU_HCI_RCV_MBOX)) != NULL)
+            /* Take all messages in the queue in one go, then process them */
+            GKI_read_mbox_all (BTU_HCI_RCV_MBOX, &msg_q);
+            while ((p_msg = (BT_HDR *) GKI_dequeue_batch (&msg_q)) != NULL)
             {
+                /* p_msg is freed by the handlers, keep the type for the timing */
+                msg_type = p_msg->event & BT_EVT_MASK;
+                start_us = BTU_HANDLER_START();
+
                 /* Determine the input message type. */
-                switch (p_msg->event & BT_EVT_MASK)
+                switch (msg_type)
                 {
                     case BT_EVT_TO_BTU_HCI_ACL:
                         /* All Acl Data goes to L2CAP */
@@ -328,45 +453,11 @@ BTU_API UINT32 btu_task (UINT32 param)
                         break;
 #endif
                     case BT_EVT_TO_START_TIMER :
-                        /* Start free running 1 second timer for list management */
-                        GKI_start_timer (TIMER_0, GKI_SECS_TO_TICKS (1), TRUE);
-                        GKI_freebuf (p_msg);
-                        break;
-
-                    case BT_EVT_TO_STOP_TIMER:
-                        if (GKI_timer_queue_is_empty(&btu_cb.timer_queue)) {
-                            GKI_stop_timer(TIMER_0);
-                        }
+                        /* A timer started on another task became the earliest */
+                        btu_timer_rearm();
                         GKI_freebuf (p_msg);
                         break;
 
-                    case BT_EVT_TO_START_TIMER_ONESHOT:
-                        if (!GKI_timer_queue_is_empty(&btu_cb.timer_queue_oneshot)) {
-                            TIMER_LIST_ENT *tle = GKI_timer_getfirst(&btu_cb.timer_queue_oneshot);
-                            // Start non-repeating timer.
-                            GKI_start_timer(TIMER_3, tle->ticks, FALSE);
-                        } else {
-                            BTM_TRACE_WARNING("Oneshot timer queue empty when received start request");
-                        }
-                        GKI_freebuf(p_msg);
-                        break;
-
-                    case BT_EVT_TO_STOP_TIMER_ONESHOT:
-                        if (GKI_timer_queue_is_empty(&btu_cb.timer_queue_oneshot)) {
-                            GKI_stop_timer(TIMER_3);
-                        } else {
-                            BTM_TRACE_WARNING("Oneshot timer queue not empty when received stop request");
-                        }
-                        GKI_freebuf (p_msg);
-                        break;
-
-#if defined(QUICK_TIMER_TICKS_PER_SEC) && (QUICK_TIMER_TICKS_PER_SEC > 0)
-                    case BT_EVT_TO_START_QUICK_TIMER :
-                        GKI_start_timer (TIMER_2, QUICK_TIMER_TICKS, TRUE);
-                        GKI_freebuf (p_msg);
-                        break;
-#endif
-
                     default:
                         i = 0;
                         mask = (UINT16) (p_msg->event & BT_EVT_MASK);
@@ -392,169 +483,18 @@ BTU_API UINT32 btu_task (UINT32 param)
 
                         break;
                 }
-            }
-        }
-
-
-        if (event & TIMER_0_EVT_MASK) {
-            GKI_update_timer_list (&btu_cb.timer_queue, 1);
-
-            while (!GKI_timer_queue_is_empty(&btu_cb.timer_queue)) {
-                TIMER_LIST_ENT *p_tle = GKI_timer_getfirst(&btu_cb.timer_queue);
-                if (p_tle->ticks != 0)
-                    break;
-
-                GKI_remove_from_timer_list(&btu_cb.timer_queue, p_tle);
-
-                switch (p_tle->event) {
-                    case BTU_TTYPE_BTM_DEV_CTL:
-                        btm_dev_timeout(p_tle);
-                        break;
-
-                    case BTU_TTYPE_BTM_ACL:
-                        btm_acl_timeout(p_tle);
-                        break;
-
-                    case BTU_TTYPE_L2CAP_LINK:
-                    case BTU_TTYPE_L2CAP_CHNL:
-                    case BTU_TTYPE_L2CAP_HOLD:
-                    case BTU_TTYPE_L2CAP_INFO:
-                    case BTU_TTYPE_L2CAP_FCR_ACK:
-                        l2c_process_timeout (p_tle);
-                        break;
-
-                    case BTU_TTYPE_SDP:
-                        sdp_conn_timeout ((tCONN_CB *)p_tle->param);
-                        break;
-
-                    case BTU_TTYPE_BTM_RMT_NAME:
-                        btm_inq_rmt_name_failed();
-                        break;
-
-#if (defined(RFCOMM_INCLUDED) && RFCOMM_INCLUDED == TRUE)
-                    case BTU_TTYPE_RFCOMM_MFC:
-                    case BTU_TTYPE_RFCOMM_PORT:
-                        rfcomm_process_timeout (p_tle);
-                        break;
-
-#endif /* If defined(RFCOMM_INCLUDED) && RFCOMM_INCLUDED == TRUE */
-
-#if ((defined(BNEP_INCLUDED) && BNEP_INCLUDED == TRUE))
-                    case BTU_TTYPE_BNEP:
-                        bnep_process_timeout(p_tle);
-                        break;
-#endif
-
-
-#if (defined(AVDT_INCLUDED) && AVDT_INCLUDED == TRUE)
-                    case BTU_TTYPE_AVDT_CCB_RET:
-                    case BTU_TTYPE_AVDT_CCB_RSP:
-                    case BTU_TTYPE_AVDT_CCB_IDLE:
-                    case BTU_TTYPE_AVDT_SCB_TC:
-                        avdt_process_timeout(p_tle);
-                        break;
-#endif
-
-#if (defined(OBX_INCLUDED) && OBX_INCLUDED == TRUE)
-#if (defined(OBX_CLIENT_INCLUDED) && OBX_CLIENT_INCLUDED == TRUE)
-                    case BTU_TTYPE_OBX_CLIENT_TO:
-                        obx_cl_timeout(p_tle);
-                        break;
-#endif
-#if (defined(OBX_SERVER_INCLUDED) && OBX_SERVER_INCLUDED == TRUE)
-                    case BTU_TTYPE_OBX_SERVER_TO:
-                        obx_sr_timeout(p_tle);
-                        break;
-
-                    case BTU_TTYPE_OBX_SVR_SESS_TO:
-                        obx_sr_sess_timeout(p_tle);
-                        break;
-#endif
-#endif
-
-#if (defined(SAP_SERVER_INCLUDED) && SAP_SERVER_INCLUDED == TRUE)
-                    case BTU_TTYPE_SAP_TO:
-                        sap_process_timeout(p_tle);
-                        break;
-#endif
-
-                    case BTU_TTYPE_BTU_CMD_CMPL:
-                        btu_hcif_cmd_timeout((UINT8)(p_tle->event - BTU_TTYPE_BTU_CMD_CMPL));
-                        break;
-
-#if (defined(HID_HOST_INCLUDED) && HID_HOST_INCLUDED == TRUE)
-                    case BTU_TTYPE_HID_HOST_REPAGE_TO :
-                        hidh_proc_repage_timeout(p_tle);
-                        break;
-#endif
-
-#if (defined(BLE_INCLUDED) && BLE_INCLUDED == TRUE)
-                    case BTU_TTYPE_BLE_INQUIRY:
-                    case BTU_TTYPE_BLE_GAP_LIM_DISC:
-                    case BTU_TTYPE_BLE_GAP_FAST_ADV:
-                    case BTU_TTYPE_BLE_OBSERVE:
-                        btm_ble_timeout(p_tle);
-                        break;
-
-                    case BTU_TTYPE_ATT_WAIT_FOR_RSP:
-                        gatt_rsp_timeout(p_tle);
-                        break;
-
-                    case BTU_TTYPE_ATT_WAIT_FOR_IND_ACK:
-                        gatt_ind_ack_timeout(p_tle);
-                        break;
-#if (defined(SMP_INCLUDED) && SMP_INCLUDED == TRUE)
-                    case BTU_TTYPE_SMP_PAIRING_CMD:
-                        smp_rsp_timeout(p_tle);
-                        break;
-#endif
-
-#endif
-
-#if (MCA_INCLUDED == TRUE)
-                    case BTU_TTYPE_MCA_CCB_RSP:
-                        mca_process_timeout(p_tle);
-                        break;
-#endif
-                    case BTU_TTYPE_USER_FUNC:
-                        {
-                            tUSER_TIMEOUT_FUNC  *p_uf = (tUSER_TIMEOUT_FUNC *)p_tle->param;
-                            (*p_uf)(p_tle);
-                        }
-                        break;
-
-                    default:
-                        i = 0;
-                        handled = FALSE;
-
-                        for (; !handled && i < BTU_MAX_REG_TIMER; i++)
-                        {
-                            if (btu_cb.timer_reg[i].timer_cb == NULL)
-                                continue;
-                            if (btu_cb.timer_reg[i].p_tle == p_tle)
-                            {
-                                btu_cb.timer_reg[i].timer_cb(p_tle);
-                                handled = TRUE;
-                            }
-                        }
-                        break;
-                }
-            }
 
-            /* if timer list is empty stop periodic GKI timer */
-            if (btu_cb.timer_queue.p_first == NULL)
-            {
-                GKI_stop_timer(TIMER_0);
+                btu_handler_msg_done(msg_type, start_us);
             }
         }
 
-#if defined(QUICK_TIMER_TICKS_PER_SEC) && (QUICK_TIMER_TICKS_PER_SEC > 0)
-        if (event & TIMER_2_EVT_MASK)
+
+        if (event & TIMER_0_EVT_MASK)
         {
-            btu_process_quick_timer_evt();
+            start_us = BTU_HANDLER_START();
+            btu_process_timers();
+            btu_handler_evt_done(TIMER_0_EVT_MASK, start_us);
         }
-#endif
-
 
 #if (RPC_INCLUDED == TRUE)
         /* if RPC message queue event */
@@ -568,65 +508,23 @@ BTU_API UINT32 btu_task (UINT32 param)
 #if (defined(BTU_BTA_INCLUDED) && BTU_BTA_INCLUDED == TRUE)
         if (event & TASK_MBOX_2_EVT_MASK)
         {
-            while ((p_msg = (BT_HDR *) GKI_read_mbox(TASK_MBOX_2)) != NULL)
+            GKI_read_mbox_all(TASK_MBOX_2, &msg_q);
+            while ((p_msg = (BT_HDR *) GKI_dequeue_batch(&msg_q)) != NULL)
             {
+                start_us = BTU_HANDLER_START();
                 bta_sys_event(p_msg);
+                btu_handler_evt_done(TASK_MBOX_2_EVT_MASK, start_us);
             }
         }
 
         if (event & TIMER_1_EVT_MASK)
         {
+            start_us = BTU_HANDLER_START();
             bta_sys_timer_update();
+            btu_handler_evt_done(TIMER_1_EVT_MASK, start_us);
         }
 #endif
 
-        if (event & TIMER_3_EVT_MASK) {
-            BTM_TRACE_API("Received oneshot timer event complete");
-            if (!GKI_timer_queue_is_empty(&btu_cb.timer_queue_oneshot)) {
-                TIMER_LIST_ENT *p_tle = GKI_timer_getfirst(&btu_cb.timer_queue_oneshot);
-                INT32 ticks_since_last_update = GKI_timer_ticks_getinitial(GKI_timer_getfirst(&btu_cb.timer_queue_oneshot));
-                GKI_update_timer_list(&btu_cb.timer_queue_oneshot, ticks_since_last_update);
-            }
-
-            while (!GKI_timer_queue_is_empty(&btu_cb.timer_queue_oneshot)) {
-                TIMER_LIST_ENT *p_tle = GKI_timer_getfirst(&btu_cb.timer_queue_oneshot);
-                if (p_tle->ticks != 0)
-                    break;
-
-                GKI_remove_from_timer_list(&btu_cb.timer_queue_oneshot, p_tle);
-
-                switch (p_tle->event) {
-#if (defined(BLE_INCLUDED) && BLE_INCLUDED == TRUE)
-                    case BTU_TTYPE_BLE_RANDOM_ADDR:
-                        btm_ble_timeout(p_tle);
-                        break;
-#endif
-
-                    case BTU_TTYPE_USER_FUNC:
-                        {
-                            tUSER_TIMEOUT_FUNC  *p_uf = (tUSER_TIMEOUT_FUNC *)p_tle->param;
-                            (*p_uf)(p_tle);
-                        }
-                        break;
-
-                    default:
-                        // FAIL
-                        BTM_TRACE_WARNING("Received unexpected oneshot timer event:0x%x\n",
-                            p_tle->event);
-                        break;
-                }
-            }
-
-            /* Update GKI timer with new tick value from first timer. */
-            if (!GKI_timer_queue_is_empty(&btu_cb.timer_queue_oneshot)) {
-                TIMER_LIST_ENT *p_tle = GKI_timer_getfirst(&btu_cb.timer_queue_oneshot);
-                if (p_tle->ticks > 0)
-                  GKI_start_timer(TIMER_3, p_tle->ticks, FALSE);
-            } else {
-                GKI_stop_timer(TIMER_3);
-            }
-        }
-
         if (event & EVENT_MASK(APPL_EVT_7))
             break;
     }
@@ -636,219 +534,451 @@ BTU_API UINT32 btu_task (UINT32 param)
 
 /*******************************************************************************
 **
-** Function         btu_start_timer
+** Function         btu_timer_place
 **
-** Description      Start a timer for the specified amount of time.
-**                  NOTE: The timeout resolution is in SECONDS! (Even
-**                          though the timer structure field is ticks)
+** Description      Store a timer at a position of the deadline heap.
 **
 ** Returns          void
 **
 *******************************************************************************/
-void btu_start_timer (TIMER_LIST_ENT *p_tle, UINT16 type, UINT32 timeout)
+static void btu_timer_place (TIMER_LIST_ENT *p_tle, UINT16 index)
 {
-    BT_HDR *p_msg;
-    GKI_disable();
-    /* if timer list is currently empty, start periodic GKI timer */
-    if (btu_cb.timer_queue.p_first == NULL)
-    {
-        /* if timer starts on other than BTU task */
-        if (GKI_get_taskid() != BTU_TASK)
-        {
-            /* post event to start timer in BTU task */
-            if ((p_msg = (BT_HDR *)GKI_getbuf(BT_HDR_SIZE)) != NULL)
-            {
-                p_msg->event = BT_EVT_TO_START_TIMER;
-                GKI_send_msg (BTU_TASK, TASK_MBOX_0, p_msg);
-            }
-        }
-        else
-        {
-            /* Start free running 1 second timer for list management */
-            GKI_start_timer (TIMER_0, GKI_SECS_TO_TICKS (1), TRUE);
-        }
-    }
-
-    GKI_remove_from_timer_list (&btu_cb.timer_queue, p_tle);
-
-    p_tle->event = type;
-    p_tle->ticks = timeout;
-    p_tle->ticks_initial = timeout;
-
-    GKI_add_to_timer_list (&btu_cb.timer_queue, p_tle);
-    GKI_enable();
+    btu_cb.timer_heap[index] = p_tle;
+    p_tle->heap_index = index;
 }
 
 /*******************************************************************************
 **
-** Function         btu_remaining_time
+** Function         btu_timer_sift
 **
-** Description      Return amount of time to expire
+** Description      Move the timer at index up or down the deadline heap until
+**                  the heap is ordered again.
 **
-** Returns          time in second
+** Returns          void
 **
 *******************************************************************************/
-UINT32 btu_remaining_time (TIMER_LIST_ENT *p_tle)
+static void btu_timer_sift (UINT16 index)
 {
-    return(GKI_get_remaining_ticks (&btu_cb.timer_queue, p_tle));
+    TIMER_LIST_ENT *p_tle = btu_cb.timer_heap[index];
+
+    while (index > 0)
+    {
+        UINT16 parent = (index - 1) / 2;
+        if (btu_cb.timer_heap[parent]->deadline_ms <= p_tle->deadline_ms)
+            break;
+        btu_timer_place(btu_cb.timer_heap[parent], index);
+        index = parent;
+    }
+
+    for (;;)
+    {
+        UINT16 child = 2 * index + 1;
+        if (child >= btu_cb.timer_heap_size)
+            break;
+        if (child + 1 < btu_cb.timer_heap_size &&
+            btu_cb.timer_heap[child + 1]->deadline_ms < btu_cb.timer_heap[child]->deadline_ms)
+            child++;
+        if (p_tle->deadline_ms <= btu_cb.timer_heap[child]->deadline_ms)
+            break;
+        btu_timer_place(btu_cb.timer_heap[child], index);
+        index = child;
+    }
+
+    btu_timer_place(p_tle, index);
 }
 
 /*******************************************************************************
 **
-** Function         btu_stop_timer
+** Function         btu_timer_remove
 **
-** Description      Stop a timer.
+** Description      Take a timer out of the deadline heap if it is running.
+**                  Must be called with GKI disabled.
 **
 ** Returns          void
 **
 *******************************************************************************/
-void btu_stop_timer (TIMER_LIST_ENT *p_tle)
+static void btu_timer_remove (TIMER_LIST_ENT *p_tle)
 {
-    BT_HDR *p_msg;
-    GKI_disable();
-    GKI_remove_from_timer_list (&btu_cb.timer_queue, p_tle);
+    UINT16 index = p_tle->heap_index;
+    TIMER_LIST_ENT *p_last;
 
-    /* if timer is stopped on other than BTU task */
-    if (GKI_get_taskid() != BTU_TASK)
-    {
-        /* post event to stop timer in BTU task */
-        if ((p_msg = (BT_HDR *)GKI_getbuf(BT_HDR_SIZE)) != NULL)
-        {
-            p_msg->event = BT_EVT_TO_STOP_TIMER;
-            GKI_send_msg (BTU_TASK, TASK_MBOX_0, p_msg);
-        }
-    }
-    else
+    if (!p_tle->in_use || index >= btu_cb.timer_heap_size || btu_cb.timer_heap[index] != p_tle)
+        return;
+
+    p_tle->in_use = FALSE;
+    p_last = btu_cb.timer_heap[--btu_cb.timer_heap_size];
+    if (p_last != p_tle)
     {
-        /* if timer list is empty stop periodic GKI timer */
-        if (btu_cb.timer_queue.p_first == NULL)
-        {
-            GKI_stop_timer(TIMER_0);
-        }
+        btu_timer_place(p_last, index);
+        btu_timer_sift(index);
     }
-    GKI_enable();
 }
 
-#if defined(QUICK_TIMER_TICKS_PER_SEC) && (QUICK_TIMER_TICKS_PER_SEC > 0)
 /*******************************************************************************
 **
-** Function         btu_start_quick_timer
-**
-** Description      Start a timer for the specified amount of time.
-**                  NOTE: The timeout resolution depends on including modules.
-**                  QUICK_TIMER_TICKS_PER_SEC should be used to convert from
-**                  time to ticks.
+** Function         btu_timer_add
 **
+** Description      (Re)start a timer to expire timeout_ms from now, and make
+**                  sure TIMER_0 is armed for the earliest deadline.
 **
 ** Returns          void
 **
 *******************************************************************************/
-void btu_start_quick_timer (TIMER_LIST_ENT *p_tle, UINT16 type, UINT32 timeout)
+static void btu_timer_add (TIMER_LIST_ENT *p_tle, UINT16 type, UINT32 timeout, UINT64 timeout_ms)
 {
     BT_HDR *p_msg;
+    BOOLEAN is_first;
 
     GKI_disable();
-    /* if timer list is currently empty, start periodic GKI timer */
-    if (btu_cb.quick_timer_queue.p_first == NULL)
+    btu_timer_remove(p_tle);
+
+    if (btu_cb.timer_heap_size == BTU_MAX_TIMERS)
     {
-        /* script test calls stack API without posting event */
-        if (GKI_get_taskid() != BTU_TASK)
-        {
-            /* post event to start timer in BTU task */
-            if ((p_msg = (BT_HDR *)GKI_getbuf(BT_HDR_SIZE)) != NULL)
-            {
-                p_msg->event = BT_EVT_TO_START_QUICK_TIMER;
-                GKI_send_msg (BTU_TASK, TASK_MBOX_0, p_msg);
-            }
-        }
-        else
-            GKI_start_timer(TIMER_2, QUICK_TIMER_TICKS, TRUE);
+        GKI_enable();
+        BT_ERROR_TRACE(TRACE_LAYER_BTU, "btu_timer_add: all %d timers running, type %d not started",
+                       BTU_MAX_TIMERS, type);
+        return;
     }
 
-    GKI_remove_from_timer_list (&btu_cb.quick_timer_queue, p_tle);
-
     p_tle->event = type;
     p_tle->ticks = timeout;
     p_tle->ticks_initial = timeout;
+    p_tle->deadline_ms = GKI_get_boot_time_ms() + timeout_ms;
+    p_tle->in_use = TRUE;
+    btu_timer_place(p_tle, btu_cb.timer_heap_size++);
+    btu_timer_sift(p_tle->heap_index);
 
-    GKI_add_to_timer_list (&btu_cb.quick_timer_queue, p_tle);
+    is_first = (btu_cb.timer_heap[0] == p_tle);
     GKI_enable();
-}
 
+    if (!is_first)
+        return;
+
+    /* GKI timers belong to the task that starts them */
+    if (GKI_get_taskid() == BTU_TASK)
+    {
+        btu_timer_rearm();
+    }
+    else if ((p_msg = (BT_HDR *)GKI_getbuf(BT_HDR_SIZE)) != NULL)
+    {
+        p_msg->event = BT_EVT_TO_START_TIMER;
+        GKI_send_msg (BTU_TASK, TASK_MBOX_0, p_msg);
+    }
+}
 
 /*******************************************************************************
 **
-** Function         btu_stop_quick_timer
+** Function         btu_timer_del
 **
-** Description      Stop a timer.
+** Description      Stop a timer. A stop never needs to reach the BTU task:
+**                  if TIMER_0 was armed for this timer it just finds nothing
+**                  due when it fires and re-arms for the next deadline.
 **
 ** Returns          void
 **
 *******************************************************************************/
-void btu_stop_quick_timer (TIMER_LIST_ENT *p_tle)
+static void btu_timer_del (TIMER_LIST_ENT *p_tle)
 {
     GKI_disable();
-    GKI_remove_from_timer_list (&btu_cb.quick_timer_queue, p_tle);
-
-    /* if timer list is empty stop periodic GKI timer */
-    if (btu_cb.quick_timer_queue.p_first == NULL)
-    {
-        GKI_stop_timer(TIMER_2);
-    }
+    btu_timer_remove(p_tle);
     GKI_enable();
+
+    if (GKI_get_taskid() == BTU_TASK)
+        btu_timer_rearm();
 }
 
 /*******************************************************************************
 **
-** Function         btu_process_quick_timer_evt
+** Function         btu_timer_rearm
 **
-** Description      Process quick timer event
+** Description      Arm TIMER_0 for the earliest deadline, or stop it if no
+**                  timer is running. Must be called on the BTU task.
 **
 ** Returns          void
 **
 *******************************************************************************/
-void btu_process_quick_timer_evt(void)
+static void btu_timer_rearm (void)
 {
-    process_quick_timer_evt(&btu_cb.quick_timer_queue);
+    UINT64 deadline_ms, now_ms, ticks;
+
+    GKI_disable();
+    deadline_ms = btu_cb.timer_heap_size ? btu_cb.timer_heap[0]->deadline_ms : 0;
+    GKI_enable();
+
+    if (deadline_ms == btu_cb.timer_armed_ms)
+        return;
 
-    /* if timer list is empty stop periodic GKI timer */
-    if (btu_cb.quick_timer_queue.p_first == NULL)
+    btu_cb.timer_armed_ms = deadline_ms;
+    if (deadline_ms == 0)
     {
-        GKI_stop_timer(TIMER_2);
+        GKI_stop_timer(TIMER_0);
+        return;
     }
+
+    /* Round up so that the timer never fires before the deadline */
+    now_ms = GKI_get_boot_time_ms();
+    ticks = (deadline_ms > now_ms) ? deadline_ms - now_ms : 0;
+    ticks = (ticks + GKI_TICKS_TO_MS(1) - 1) / GKI_TICKS_TO_MS(1);
+    GKI_start_timer(TIMER_0, (ticks > INT32_MAX) ? INT32_MAX : (INT32)ticks, FALSE);
 }
 
 /*******************************************************************************
 **
-** Function         process_quick_timer_evt
+** Function         btu_process_timers
 **
-** Description      Process quick timer event
+** Description      Run every timer whose deadline has passed, then arm TIMER_0
+**                  for the next one. Timeout handlers may start and stop
+**                  timers, including the one that expired.
 **
 ** Returns          void
 **
 *******************************************************************************/
-void process_quick_timer_evt(TIMER_LIST_Q *p_tlq)
+static void btu_process_timers (void)
 {
-    TIMER_LIST_ENT  *p_tle;
+    UINT64 now_ms = GKI_get_boot_time_ms();
+    TIMER_LIST_ENT *p_tle;
+    BOOLEAN handled;
+    UINT8 i;
 
-    GKI_update_timer_list (p_tlq, 1);
+    /* TIMER_0 is one-shot; whatever it was armed for has fired */
+    btu_cb.timer_armed_ms = 0;
 
-    while ((p_tlq->p_first) && (!p_tlq->p_first->ticks))
+    for (;;)
     {
-        p_tle = p_tlq->p_first;
-        GKI_remove_from_timer_list (p_tlq, p_tle);
-
-        switch (p_tle->event)
+        GKI_disable();
+        if (btu_cb.timer_heap_size == 0 || btu_cb.timer_heap[0]->deadline_ms > now_ms)
         {
-            case BTU_TTYPE_L2CAP_CHNL:      /* monitor or retransmission timer */
-            case BTU_TTYPE_L2CAP_FCR_ACK:   /* ack timer */
+            GKI_enable();
+            break;
+        }
+        p_tle = btu_cb.timer_heap[0];
+        btu_timer_remove(p_tle);
+        p_tle->ticks = 0;
+        GKI_enable();
+
+        switch (p_tle->event) {
+            case BTU_TTYPE_BTM_DEV_CTL:
+                btm_dev_timeout(p_tle);
+                break;
+
+            case BTU_TTYPE_BTM_ACL:
+                btm_acl_timeout(p_tle);
+                break;
+
+            case BTU_TTYPE_L2CAP_LINK:
+            case BTU_TTYPE_L2CAP_CHNL:
+            case BTU_TTYPE_L2CAP_HOLD:
+            case BTU_TTYPE_L2CAP_INFO:
+            case BTU_TTYPE_L2CAP_FCR_ACK:
                 l2c_process_timeout (p_tle);
                 break;
 
+            case BTU_TTYPE_SDP:
+                sdp_conn_timeout ((tCONN_CB *)p_tle->param);
+                break;
+
+            case BTU_TTYPE_BTM_RMT_NAME:
+                btm_inq_rmt_name_failed();
+                break;
+
+#if (defined(RFCOMM_INCLUDED) && RFCOMM_INCLUDED == TRUE)
+            case BTU_TTYPE_RFCOMM_MFC:
+            case BTU_TTYPE_RFCOMM_PORT:
+                rfcomm_process_timeout (p_tle);
+                break;
+
+#endif /* If defined(RFCOMM_INCLUDED) && RFCOMM_INCLUDED == TRUE */
+
+#if ((defined(BNEP_INCLUDED) && BNEP_INCLUDED == TRUE))
+            case BTU_TTYPE_BNEP:
+                bnep_process_timeout(p_tle);
+                break;
+#endif
+
+
+#if (defined(AVDT_INCLUDED) && AVDT_INCLUDED == TRUE)
+            case BTU_TTYPE_AVDT_CCB_RET:
+            case BTU_TTYPE_AVDT_CCB_RSP:
+            case BTU_TTYPE_AVDT_CCB_IDLE:
+            case BTU_TTYPE_AVDT_SCB_TC:
+                avdt_process_timeout(p_tle);
+                break;
+#endif
+
+#if (defined(OBX_INCLUDED) && OBX_INCLUDED == TRUE)
+#if (defined(OBX_CLIENT_INCLUDED) && OBX_CLIENT_INCLUDED == TRUE)
+            case BTU_TTYPE_OBX_CLIENT_TO:
+                obx_cl_timeout(p_tle);
+                break;
+#endif
+#if (defined(OBX_SERVER_INCLUDED) && OBX_SERVER_INCLUDED == TRUE)
+            case BTU_TTYPE_OBX_SERVER_TO:
+                obx_sr_timeout(p_tle);
+                break;
+
+            case BTU_TTYPE_OBX_SVR_SESS_TO:
+                obx_sr_sess_timeout(p_tle);
+                break;
+#endif
+#endif
+
+#if (defined(SAP_SERVER_INCLUDED) && SAP_SERVER_INCLUDED == TRUE)
+            case BTU_TTYPE_SAP_TO:
+                sap_process_timeout(p_tle);
+                break;
+#endif
+
+            case BTU_TTYPE_BTU_CMD_CMPL:
+                btu_hcif_cmd_timeout((UINT8)(p_tle->event - BTU_TTYPE_BTU_CMD_CMPL));
+                break;
+
+#if (defined(HID_HOST_INCLUDED) && HID_HOST_INCLUDED == TRUE)
+            case BTU_TTYPE_HID_HOST_REPAGE_TO :
+                hidh_proc_repage_timeout(p_tle);
+                break;
+#endif
+
+#if (defined(BLE_INCLUDED) && BLE_INCLUDED == TRUE)
+            case BTU_TTYPE_BLE_RANDOM_ADDR:
+            case BTU_TTYPE_BLE_INQUIRY:
+            case BTU_TTYPE_BLE_GAP_LIM_DISC:
+            case BTU_TTYPE_BLE_GAP_FAST_ADV:
+            case BTU_TTYPE_BLE_OBSERVE:
+                btm_ble_timeout(p_tle);
+                break;
+
+            case BTU_TTYPE_ATT_WAIT_FOR_RSP:
+                gatt_rsp_timeout(p_tle);
+                break;
+
+            case BTU_TTYPE_ATT_WAIT_FOR_IND_ACK:
+                gatt_ind_ack_timeout(p_tle);
+                break;
+#if (defined(SMP_INCLUDED) && SMP_INCLUDED == TRUE)
+            case BTU_TTYPE_SMP_PAIRING_CMD:
+                smp_rsp_timeout(p_tle);
+                break;
+#endif
+
+#endif
+
+#if (MCA_INCLUDED == TRUE)
+            case BTU_TTYPE_MCA_CCB_RSP:
+                mca_process_timeout(p_tle);
+                break;
+#endif
+            case BTU_TTYPE_USER_FUNC:
+                {
+                    tUSER_TIMEOUT_FUNC  *p_uf = (tUSER_TIMEOUT_FUNC *)p_tle->param;
+                    (*p_uf)(p_tle);
+                }
+                break;
+
             default:
+                i = 0;
+                handled = FALSE;
+
+                for (; !handled && i < BTU_MAX_REG_TIMER; i++)
+                {
+                    if (btu_cb.timer_reg[i].timer_cb == NULL)
+                        continue;
+                    if (btu_cb.timer_reg[i].p_tle == p_tle)
+                    {
+                        btu_cb.timer_reg[i].timer_cb(p_tle);
+                        handled = TRUE;
+                    }
+                }
                 break;
         }
     }
+
+    btu_timer_rearm();
+}
+
+/*******************************************************************************
+**
+** Function         btu_start_timer
+**
+** Description      Start a timer for the specified amount of time.
+**                  NOTE: The timeout is in SECONDS! (Even though the timer
+**                          structure field is ticks)
+**
+** Returns          void
+**
+*******************************************************************************/
+void btu_start_timer (TIMER_LIST_ENT *p_tle, UINT16 type, UINT32 timeout)
+{
+    btu_timer_add(p_tle, type, timeout, (UINT64)timeout * 1000);
+}
+
+/*******************************************************************************
+**
+** Function         btu_remaining_time
+**
+** Description      Return amount of time to expire
+**
+** Returns          time in second
+**
+*******************************************************************************/
+UINT32 btu_remaining_time (TIMER_LIST_ENT *p_tle)
+{
+    UINT64 now_ms;
+
+    if (!p_tle->in_use)
+        return 0;
+
+    now_ms = GKI_get_boot_time_ms();
+    if (p_tle->deadline_ms <= now_ms)
+        return 0;
+
+    return (UINT32)((p_tle->deadline_ms - now_ms + 999) / 1000);
+}
+
+/*******************************************************************************
+**
+** Function         btu_stop_timer
+**
+** Description      Stop a timer.
+**
+** Returns          void
+**
+*******************************************************************************/
+void btu_stop_timer (TIMER_LIST_ENT *p_tle)
+{
+    btu_timer_del(p_tle);
+}
+
+#if defined(QUICK_TIMER_TICKS_PER_SEC) && (QUICK_TIMER_TICKS_PER_SEC > 0)
+/*******************************************************************************
+**
+** Function         btu_start_quick_timer
+**
+** Description      Start a timer for the specified amount of time.
+**                  NOTE: The timeout resolution depends on including modules.
+**                  QUICK_TIMER_TICKS_PER_SEC should be used to convert from
+**                  time to ticks.
+**
+**
+** Returns          void
+**
+*******************************************************************************/
+void btu_start_quick_timer (TIMER_LIST_ENT *p_tle, UINT16 type, UINT32 timeout)
+{
+    btu_timer_add(p_tle, type, timeout, (UINT64)timeout * 1000 / QUICK_TIMER_TICKS_PER_SEC);
+}
+
+/*******************************************************************************
+**
+** Function         btu_stop_quick_timer
+**
+** Description      Stop a timer.
+**
+** Returns          void
+**
+*******************************************************************************/
+void btu_stop_quick_timer (TIMER_LIST_ENT *p_tle)
+{
+    btu_timer_del(p_tle);
 }
 #endif /* defined(QUICK_TIMER_TICKS_PER_SEC) && (QUICK_TIMER_TICKS_PER_SEC > 0) */
 
@@ -856,55 +986,12 @@ void process_quick_timer_evt(TIMER_LIST_Q *p_tlq)
  * Starts a oneshot timer with a timeout in seconds.
  */
 void btu_start_timer_oneshot(TIMER_LIST_ENT *p_tle, UINT16 type, UINT32 timeout_in_secs) {
-    INT32 timeout_in_ticks = GKI_SECS_TO_TICKS(timeout_in_secs);
     BTM_TRACE_DEBUG("Starting oneshot timer type:%d timeout:%ds", type, timeout_in_secs);
-    GKI_disable();
-    if (GKI_timer_queue_is_empty(&btu_cb.timer_queue_oneshot)) {
-    }
-
-    GKI_remove_from_timer_list(&btu_cb.timer_queue_oneshot, p_tle);
-
-    p_tle->event = type;
-    p_tle->ticks = timeout_in_ticks;
-    p_tle->ticks_initial = timeout_in_ticks;
-
-    GKI_add_to_timer_list(&btu_cb.timer_queue_oneshot, p_tle);
-    /* RPC to BTU thread if timer start request from non-BTU task */
-    if (GKI_get_taskid() != BTU_TASK) {
-        /* post event to start timer in BTU task */
-        BTM_TRACE_WARNING("Posting oneshot timer event to btu_task");
-        BT_HDR *p_msg = (BT_HDR *)GKI_getbuf(BT_HDR_SIZE);
-        if (p_msg != NULL) {
-            p_msg->event = BT_EVT_TO_START_TIMER_ONESHOT;
-            GKI_send_msg (BTU_TASK, TASK_MBOX_0, p_msg);
-        }
-    } else {
-        TIMER_LIST_ENT *tle = GKI_timer_getfirst(&btu_cb.timer_queue_oneshot);
-        GKI_start_timer(TIMER_3, tle->ticks, FALSE);
-    }
-    GKI_enable();
+    btu_timer_add(p_tle, type, timeout_in_secs, (UINT64)timeout_in_secs * 1000);
 }
 
 void btu_stop_timer_oneshot(TIMER_LIST_ENT *p_tle) {
-    GKI_disable();
-    GKI_remove_from_timer_list(&btu_cb.timer_queue_oneshot, p_tle);
-
-    if (GKI_get_taskid() != BTU_TASK) {
-        /* post event to stop timer in BTU task */
-        BT_HDR *p_msg = (BT_HDR *)GKI_getbuf(BT_HDR_SIZE);
-        if (p_msg != NULL) {
-            p_msg->event = BT_EVT_TO_STOP_TIMER_ONESHOT;
-            GKI_send_msg (BTU_TASK, TASK_MBOX_0, p_msg);
-        }
-    } else {
-        if (GKI_timer_queue_is_empty(&btu_cb.timer_queue_oneshot)) {
-            BTM_TRACE_WARNING("Stopping oneshot timer");
-            GKI_stop_timer(TIMER_3);
-        } else {
-            BTM_TRACE_WARNING("Request to stop oneshot timer with non empty queue");
-        }
-    }
-    GKI_enable();
+    btu_timer_del(p_tle);
 }
 
 #if (defined(HCILP_INCLUDED) && HCILP_INCLUDED == TRUE)
@@ -198,6 +198,7 @@
 
 #define BT_EVT_TRIGGER_STACK_INIT   EVENT_MASK(APPL_EVT_0)
 #define BT_EVT_HARDWARE_INIT_FAIL   EVENT_MASK(APPL_EVT_1)
+#define BT_EVT_CONTEXT_SWITCH_RING  EVENT_MASK(APPL_EVT_2)
 
 #define BT_EVT_PRELOAD_CMPL         EVENT_MASK(APPL_EVT_6)
 
@@ -2903,7 +2903,7 @@ BTM_API extern BOOLEAN BTM_TryAllocateSCN(UINT8 scn);
 ** Returns          This function returns the number of entries in the inquiry database.
 **
 *******************************************************************************/
-    BTM_API extern UINT8 BTM_ReadNumInqDbEntries (void);
+    BTM_API extern UINT16 BTM_ReadNumInqDbEntries (void);
 
 
 /*******************************************************************************
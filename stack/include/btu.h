@@ -216,6 +216,7 @@ typedef struct
     BUFFER_Q         cmd_xmit_q;
     BUFFER_Q         cmd_cmpl_q;
     UINT16           cmd_window;
+    UINT16           cmd_barrier;           /* opcode of the ordering barrier in flight, or HCI_COMMAND_NONE */
     TIMER_LIST_ENT   cmd_cmpl_timer;        /* Command complete timer */
 #if (defined(BTU_CMD_CMPL_TOUT_DOUBLE_CHECK) && BTU_CMD_CMPL_TOUT_DOUBLE_CHECK == TRUE)
     BOOLEAN          checked_hcisu;
@@ -229,9 +230,11 @@ typedef struct
     tBTU_TIMER_REG   timer_reg[BTU_MAX_REG_TIMER];
     tBTU_EVENT_REG   event_reg[BTU_MAX_REG_EVENT];
 
-    TIMER_LIST_Q  quick_timer_queue;        /* Timer queue for transport level (100/10 msec)*/
-    TIMER_LIST_Q  timer_queue;              /* Timer queue for normal BTU task (1 second)   */
-    TIMER_LIST_Q  timer_queue_oneshot;      /* Timer queue for oneshot BTU tasks */
+    /* Running regular, quick and oneshot timers in one min-heap ordered by
+    ** deadline_ms. TIMER_0 is armed for the deadline of timer_heap[0] only. */
+    TIMER_LIST_ENT  *timer_heap[BTU_MAX_TIMERS];
+    UINT16        timer_heap_size;
+    UINT64        timer_armed_ms;           /* deadline TIMER_0 is armed for, 0 if stopped */
 
     TIMER_LIST_ENT   cmd_cmpl_timer;        /* Command complete timer */
 
@@ -278,6 +281,11 @@ BTU_API extern UINT32 btu_remaining_time (TIMER_LIST_ENT *p_tle);
 BTU_API extern void btu_uipc_rx_cback(BT_HDR *p_msg);
 
 BTU_API extern void btu_hcif_flush_cmd_queue(void);
+
+#if (GKI_LATENCY_STATS_INCLUDED == TRUE)
+BTU_API extern void btu_dump_handler_stats(int fd);
+BTU_API extern void btu_hcif_dump_stats(int fd);
+#endif
 /*
 ** Quick Timer
 */
@@ -285,8 +293,6 @@ BTU_API extern void btu_hcif_flush_cmd_queue(void);
 #define QUICK_TIMER_TICKS (GKI_SECS_TO_TICKS (1)/QUICK_TIMER_TICKS_PER_SEC)
 BTU_API extern void btu_start_quick_timer (TIMER_LIST_ENT *p_tle, UINT16 type, UINT32 timeout);
 BTU_API extern void btu_stop_quick_timer (TIMER_LIST_ENT *p_tle);
-BTU_API extern void btu_process_quick_timer_evt (void);
-BTU_API extern void process_quick_timer_evt (TIMER_LIST_Q *p_tlq);
 #endif
 
 #if (defined(HCILP_INCLUDED) && HCILP_INCLUDED == TRUE)
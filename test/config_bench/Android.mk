@@ -0,0 +1,53 @@
+#
+#  Copyright (C) 2014 Google, Inc.
+#
+#  Licensed under the Apache License, Version 2.0 (the "License");
+#  you may not use this file except in compliance with the License.
+#  You may obtain a copy of the License at:
+#
+#  http://www.apache.org/licenses/LICENSE-2.0
+#
+#  Unless required by applicable law or agreed to in writing, software
+#  distributed under the License is distributed on an "AS IS" BASIS,
+#  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#  See the License for the specific language governing permissions and
+#  limitations under the License.
+#
+
+LOCAL_PATH := $(call my-dir)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE_TAGS := optional
+LOCAL_MODULE := bt_config_bench
+
+LOCAL_SRC_FILES := \
+	config_bench.c \
+	../../btif/src/btif_config.c \
+	../../btif/src/btif_config_util.cpp
+
+LOCAL_C_INCLUDES := \
+	$(LOCAL_PATH)/../../include \
+	$(LOCAL_PATH)/../../gki/common \
+	$(LOCAL_PATH)/../../gki/ulinux \
+	$(LOCAL_PATH)/../../stack/include \
+	$(LOCAL_PATH)/../../bta/include \
+	$(LOCAL_PATH)/../../btif/include \
+	$(LOCAL_PATH)/../../utils/include \
+	$(bdroid_C_INCLUDES) \
+	external/tinyxml2
+
+# Keep the benchmark away from the real /data/misc/bluedroid.
+LOCAL_CFLAGS += $(bdroid_CFLAGS) -DCFG_PATH=\"/data/local/tmp/bt_config_bench/\"
+LOCAL_CONLYFLAGS := -std=gnu99
+
+LOCAL_SHARED_LIBRARIES := \
+	libcutils \
+	liblog
+
+LOCAL_STATIC_LIBRARIES := \
+	libtinyxml2
+
+LOCAL_MULTILIB := 32
+
+include $(BUILD_EXECUTABLE)
@@ -0,0 +1,249 @@
+/******************************************************************************
+ *
+ *  Copyright (C) 2014 Google, Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at:
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+
+// Times what btif_config costs at Bluetooth startup with many bonded
+// devices. btif_config.c is built into this program with CFG_PATH pointing at
+// a scratch directory, so the real /data/misc/bluedroid is never touched. The
+// sock thread is replaced by a queue that is drained between the timed parts.
+//
+// The program writes a config with the given number of bonded devices, then,
+// each in a fresh process, loads it back from the snapshot and from the xml
+// alone and runs the gets btif_in_fetch_bonded_devices and
+// btif_storage_load_bonded_devices do for every device.
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bt_target.h"
+#include "bt_trace.h"
+#include "btif_config.h"
+#include "btif_sock_thread.h"
+
+#define DEFAULT_DEVICES 1000
+#define LINK_KEY_LEN    16
+
+UINT8 appl_trace_level = BT_TRACE_LEVEL_ERROR;
+
+static btsock_signaled_cb signaled_callback;
+static btsock_cmd_cb cmd_callback;
+static int cmds_pending;
+static int timer_fd = -1;
+
+static const char* files[] = {
+  "bt_config.xml", "bt_config.old", "bt_config.new",
+  "bt_config.bin", "bt_config.bin.new", "bt_config.journal"
+};
+
+void LogMsg(UINT32 trace_set_mask, const char *fmt_str, ...) {
+  va_list ap;
+  va_start(ap, fmt_str);
+  vfprintf(stderr, fmt_str, ap);
+  va_end(ap);
+  fputc('\n', stderr);
+}
+
+// btif_config runs its writes on a sock thread of its own. Here the posted
+// commands and the save timer are left alone until drain_cmds() runs them,
+// outside the timed sections, as if the save delay had already passed.
+int btsock_thread_init(void) {
+  return TRUE;
+}
+
+int btsock_thread_create(btsock_signaled_cb callback, btsock_cmd_cb cmd_cb) {
+  signaled_callback = callback;
+  cmd_callback = cmd_cb;
+  return 0;
+}
+
+int btsock_thread_add_fd(int h, int fd, int type, int flags, uint32_t user_id) {
+  timer_fd = fd;
+  return TRUE;
+}
+
+int btsock_thread_post_cmd(int h, int type, const unsigned char *data, int size, uint32_t user_id) {
+  cmds_pending++;
+  return TRUE;
+}
+
+static void drain_cmds(void) {
+  struct itimerspec its;
+
+  // CFG_CMD_SAVE, the only command btif_config posts.
+  for (; cmds_pending > 0; cmds_pending--)
+    cmd_callback(-1, 1, 0, 0);
+  if (timer_fd >= 0 && timerfd_gettime(timer_fd, &its) == 0 &&
+      (its.it_value.tv_sec || its.it_value.tv_nsec))
+    signaled_callback(timer_fd, 0, SOCK_THREAD_FD_RD, 0);
+}
+
+static uint64_t now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static double ms_since(uint64_t start) {
+  return (now_us() - start) / 1000.0;
+}
+
+static long file_size(const char *name) {
+  char path[256];
+  struct stat st;
+  snprintf(path, sizeof(path), "%s%s", CFG_PATH, name);
+  return stat(path, &st) == 0 ? (long)st.st_size : -1;
+}
+
+static void remove_file(const char *name) {
+  char path[256];
+  snprintf(path, sizeof(path), "%s%s", CFG_PATH, name);
+  unlink(path);
+}
+
+static void device_name(int i, char *addr, size_t size) {
+  snprintf(addr, size, "00:22:5F:%02X:%02X:%02X", (i >> 16) & 0xff, (i >> 8) & 0xff, i & 0xff);
+}
+
+// The values btif_storage keeps for a bonded dual mode device.
+static void write_config(int devices) {
+  char addr[18], name[32];
+  char link_key[LINK_KEY_LEN];
+
+  uint64_t start = now_us();
+  btif_config_init();
+  for (int i = 0; i < devices; i++) {
+    device_name(i, addr, sizeof(addr));
+    snprintf(name, sizeof(name), "Headset %d", i);
+    memset(link_key, i, sizeof(link_key));
+    btif_config_set_int("Remote", addr, "Timestamp", (int)time(NULL));
+    btif_config_set_str("Remote", addr, "Name", name);
+    btif_config_set_int("Remote", addr, "DevClass", 0x240404);
+    btif_config_set_int("Remote", addr, "DevType", 3);
+    btif_config_set_int("Remote", addr, "AddrType", 0);
+    btif_config_set_int("Remote", addr, "Manufacturer", 15);
+    btif_config_set_int("Remote", addr, "LmpVer", 6);
+    btif_config_set_int("Remote", addr, "LmpSubVer", 0x220e);
+    btif_config_set_str("Remote", addr, "Service",
+                        "0000110b-0000-1000-8000-00805f9b34fb "
+                        "0000110e-0000-1000-8000-00805f9b34fb "
+                        "0000111e-0000-1000-8000-00805f9b34fb ");
+    btif_config_set("Remote", addr, "LinkKey", link_key, sizeof(link_key), BTIF_CFG_TYPE_BIN);
+    btif_config_set_int("Remote", addr, "LinkKeyType", 5);
+    btif_config_set_int("Remote", addr, "PinLength", 0);
+    btif_config_save();
+  }
+  // The flush makes the journal durable, the drain folds it into the xml.
+  btif_config_flush();
+  drain_cmds();
+  printf("write %d devices: %.1f ms, xml %ld bytes, snapshot %ld bytes\n", devices,
+         ms_since(start), file_size("bt_config.xml"), file_size("bt_config.bin"));
+}
+
+static int fetch_bonded_devices(void) {
+  char kname[128], name[256];
+  char link_key[LINK_KEY_LEN];
+  int kname_size, value, size, type;
+  short kpos = 0;
+  int found = 0;
+
+  do {
+    kname_size = sizeof(kname);
+    kname[0] = 0;
+    kpos = btif_config_next_key(kpos, "Remote", kname, &kname_size);
+    size = sizeof(link_key);
+    type = BTIF_CFG_TYPE_BIN;
+    if (!btif_config_get("Remote", kname, "LinkKey", link_key, &size, &type))
+      continue;
+    found += btif_config_get_int("Remote", kname, "LinkKeyType", &value);
+    found += btif_config_get_int("Remote", kname, "PinLength", &value);
+    found += btif_config_get_int("Remote", kname, "DevClass", &value);
+    found += btif_config_get_int("Remote", kname, "DevType", &value);
+    size = sizeof(name);
+    found += btif_config_get_str("Remote", kname, "Name", name, &size);
+    size = sizeof(name);
+    found += btif_config_get_str("Remote", kname, "Service", name, &size);
+    found += btif_config_get_int("Remote", kname, "AddrType", &value);
+    found++;
+  } while (kpos != -1);
+  return found;
+}
+
+static void load_config(const char *from, int devices) {
+  uint64_t start = now_us();
+  btif_config_init();
+  double load_ms = ms_since(start);
+  start = now_us();
+  int found = fetch_bonded_devices();
+  double fetch_ms = ms_since(start);
+  printf("load from %s: %.1f ms, fetch %.1f ms, %d of %d values found\n", from, load_ms,
+         fetch_ms, found, devices * 8);
+  drain_cmds();
+  btif_config_flush();
+}
+
+// Each phase runs in a process of its own, btif_config only loads once.
+static int run(void (*phase)(const char *, int), const char *arg, int devices) {
+  int status;
+  pid_t pid = fork();
+  if (pid < 0) {
+    fprintf(stderr, "fork failed: %s\n", strerror(errno));
+    return -1;
+  }
+  if (pid == 0) {
+    phase(arg, devices);
+    exit(0);
+  }
+  waitpid(pid, &status, 0);
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+static void write_phase(const char *unused, int devices) {
+  write_config(devices);
+}
+
+int main(int argc, char **argv) {
+  int devices = argc > 1 ? atoi(argv[1]) : DEFAULT_DEVICES;
+  if (devices <= 0) {
+    fprintf(stderr, "usage: %s [devices]\n", argv[0]);
+    return 1;
+  }
+  if (mkdir(CFG_PATH, 0770) != 0 && errno != EEXIST) {
+    fprintf(stderr, "cannot create %s: %s\n", CFG_PATH, strerror(errno));
+    return 1;
+  }
+  for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++)
+    remove_file(files[i]);
+
+  if (run(write_phase, NULL, devices) ||
+      run(load_config, "snapshot", devices))
+    return 1;
+  // Without the snapshot the tree is parsed from the xml, as on first boot
+  // after an update.
+  remove_file("bt_config.bin");
+  if (run(load_config, "xml", devices))
+    return 1;
+  return 0;
+}
@@ -0,0 +1,273 @@
+/******************************************************************************
+ *
+ *  Copyright (C) 2014 Google, Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at:
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+
+// Times Bluetooth enable against the fake controller in test/fake_controller.
+// For every command credits / command latency pair, the program writes a
+// fake controller script, points BT_FAKE_CONTROLLER_SCRIPT at it and then
+// repeatedly calls enable() and waits for the adapter to come up. The vendor
+// library is opened on every enable, so each pair gets a freshly configured
+// controller. See README.txt for the setup.
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <hardware/bluetooth.h>
+#include <hardware/hardware.h>
+
+#define SCRIPT_PATH       "/data/local/tmp/bt_enable_bench.conf"
+#define SCRIPT_ENV_VAR    "BT_FAKE_CONTROLLER_SCRIPT"
+#define DEFAULT_RUNS      5
+#define MAX_RUNS          100
+#define STATE_TIMEOUT_MS  10000
+
+typedef struct {
+  int credits;
+  int latency_us;
+} config_t;
+
+// The setups of the enable measurement in the HCI command pipelining change.
+static const config_t default_configs[] = {
+  { 1, 600 },
+  { 2, 600 },
+  { 4, 250 },
+  { 4, 600 },
+  { 4, 1500 },
+};
+
+static const bt_interface_t *bt_interface;
+
+static pthread_mutex_t state_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t state_cond = PTHREAD_COND_INITIALIZER;
+static bt_state_t adapter_state = BT_STATE_OFF;
+
+static timer_t alarm_timer;
+static alarm_cb alarm_callback;
+static void *alarm_data;
+
+static uint64_t now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void adapter_state_changed(bt_state_t state) {
+  pthread_mutex_lock(&state_lock);
+  adapter_state = state;
+  pthread_cond_broadcast(&state_cond);
+  pthread_mutex_unlock(&state_lock);
+}
+
+static bt_callbacks_t callbacks = {
+  sizeof(bt_callbacks_t),
+  adapter_state_changed,
+  NULL, /* adapter_properties_cb */
+  NULL, /* remote_device_properties_cb */
+  NULL, /* device_found_cb */
+  NULL, /* discovery_state_changed_cb */
+  NULL, /* pin_request_cb */
+  NULL, /* ssp_request_cb */
+  NULL, /* bond_state_changed_cb */
+  NULL, /* acl_state_changed_cb */
+  NULL, /* thread_evt_cb */
+  NULL, /* dut_mode_recv_cb */
+  NULL, /* le_test_mode_cb */
+  NULL, /* energy_info_cb */
+  NULL, /* le_lpp_write_rssi_thresh_cb */
+  NULL, /* le_lpp_read_rssi_thresh_cb */
+  NULL, /* le_lpp_enable_rssi_monitor_cb */
+  NULL  /* le_lpp_rssi_threshold_evt_cb */
+};
+
+static void alarm_expired(union sigval value) {
+  alarm_callback(alarm_data);
+}
+
+// The stack keeps at most one alarm armed, so one timer serves all of them.
+static bool set_wake_alarm(uint64_t delay_millis, bool should_wake, alarm_cb cb, void *data) {
+  struct itimerspec its;
+
+  alarm_callback = cb;
+  alarm_data = data;
+  memset(&its, 0, sizeof(its));
+  its.it_value.tv_sec = delay_millis / 1000;
+  its.it_value.tv_nsec = (delay_millis % 1000) * 1000 * 1000;
+  // A zero value would disarm the timer instead of firing it now.
+  if (!its.it_value.tv_sec && !its.it_value.tv_nsec)
+    its.it_value.tv_nsec = 1;
+  return timer_settime(alarm_timer, 0, &its, NULL) == 0;
+}
+
+static int acquire_wake_lock(const char *lock_name) {
+  return BT_STATUS_SUCCESS;
+}
+
+static int release_wake_lock(const char *lock_name) {
+  return BT_STATUS_SUCCESS;
+}
+
+static bt_os_callouts_t callouts = {
+  sizeof(bt_os_callouts_t),
+  set_wake_alarm,
+  acquire_wake_lock,
+  release_wake_lock,
+};
+
+static bool wait_for_state(bt_state_t state) {
+  struct timespec deadline;
+  int err = 0;
+
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += STATE_TIMEOUT_MS / 1000;
+  pthread_mutex_lock(&state_lock);
+  while (adapter_state != state && err != ETIMEDOUT)
+    err = pthread_cond_timedwait(&state_cond, &state_lock, &deadline);
+  bool reached = adapter_state == state;
+  pthread_mutex_unlock(&state_lock);
+  return reached;
+}
+
+static bool load_stack(void) {
+  const hw_module_t *module;
+  hw_device_t *device;
+  struct sigevent sigevent;
+
+  memset(&sigevent, 0, sizeof(sigevent));
+  sigevent.sigev_notify = SIGEV_THREAD;
+  sigevent.sigev_notify_function = alarm_expired;
+  if (timer_create(CLOCK_MONOTONIC, &sigevent, &alarm_timer)) {
+    fprintf(stderr, "unable to create the alarm timer: %s\n", strerror(errno));
+    return false;
+  }
+
+  int err = hw_get_module(BT_HARDWARE_MODULE_ID, &module);
+  if (!err)
+    err = module->methods->open(module, BT_HARDWARE_MODULE_ID, &device);
+  if (err) {
+    fprintf(stderr, "unable to load the Bluetooth HAL: %s\n", strerror(-err));
+    return false;
+  }
+  bt_interface = ((bluetooth_device_t *)device)->get_bluetooth_interface();
+  if (bt_interface->init(&callbacks) != BT_STATUS_SUCCESS ||
+      bt_interface->set_os_callouts(&callouts) != BT_STATUS_SUCCESS) {
+    fprintf(stderr, "unable to initialize the Bluetooth stack\n");
+    return false;
+  }
+  return true;
+}
+
+static bool write_script(const config_t *config) {
+  FILE *fp = fopen(SCRIPT_PATH, "w");
+  if (!fp) {
+    fprintf(stderr, "unable to write %s: %s\n", SCRIPT_PATH, strerror(errno));
+    return false;
+  }
+  fprintf(fp, "credits %d\n", config->credits);
+  fprintf(fp, "cmd_latency_us %d\n", config->latency_us);
+  fclose(fp);
+  return true;
+}
+
+static int compare_times(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+static bool measure(const config_t *config, int runs) {
+  uint64_t times[MAX_RUNS];
+
+  if (!write_script(config))
+    return false;
+  for (int i = 0; i < runs; i++) {
+    uint64_t start = now_us();
+    if (bt_interface->enable() != BT_STATUS_SUCCESS || !wait_for_state(BT_STATE_ON)) {
+      fprintf(stderr, "credits %d, latency %d us: enable failed\n", config->credits,
+              config->latency_us);
+      return false;
+    }
+    times[i] = now_us() - start;
+    if (bt_interface->disable() != BT_STATUS_SUCCESS || !wait_for_state(BT_STATE_OFF)) {
+      fprintf(stderr, "credits %d, latency %d us: disable failed\n", config->credits,
+              config->latency_us);
+      return false;
+    }
+  }
+  qsort(times, runs, sizeof(times[0]), compare_times);
+  printf("credits %d, latency %4d us: enable min %.2f ms, median %.2f ms, max %.2f ms\n",
+         config->credits, config->latency_us, times[0] / 1000.0, times[runs / 2] / 1000.0,
+         times[runs - 1] / 1000.0);
+  return true;
+}
+
+static void usage(const char *name) {
+  fprintf(stderr, "usage: %s [-n runs] [credits:latency_us ...]\n", name);
+}
+
+int main(int argc, char **argv) {
+  config_t configs[32];
+  int config_count = 0;
+  int runs = DEFAULT_RUNS;
+  int i = 1;
+
+  if (i + 1 < argc && !strcmp(argv[i], "-n")) {
+    runs = atoi(argv[i + 1]);
+    i += 2;
+  }
+  if (runs <= 0 || runs > MAX_RUNS) {
+    usage(argv[0]);
+    return 1;
+  }
+  for (; i < argc; i++) {
+    if (config_count == (int)(sizeof(configs) / sizeof(configs[0])) ||
+        sscanf(argv[i], "%d:%d", &configs[config_count].credits,
+               &configs[config_count].latency_us) != 2 ||
+        configs[config_count].credits <= 0 || configs[config_count].credits > 255 ||
+        configs[config_count].latency_us < 0) {
+      usage(argv[0]);
+      return 1;
+    }
+    config_count++;
+  }
+  if (!config_count) {
+    config_count = sizeof(default_configs) / sizeof(default_configs[0]);
+    memcpy(configs, default_configs, sizeof(default_configs));
+  }
+
+  // The fake controller reads its script each time the stack opens it.
+  setenv(SCRIPT_ENV_VAR, SCRIPT_PATH, 1);
+  if (!load_stack())
+    return 1;
+
+  int ret = 0;
+  for (i = 0; i < config_count; i++) {
+    if (!measure(&configs[i], runs)) {
+      ret = 1;
+      break;
+    }
+  }
+  bt_interface->cleanup();
+  unlink(SCRIPT_PATH);
+  return ret;
+}
@@ -0,0 +1,57 @@
+#
+#  Copyright (C) 2014 Google, Inc.
+#
+#  Licensed under the Apache License, Version 2.0 (the "License");
+#  you may not use this file except in compliance with the License.
+#  You may obtain a copy of the License at:
+#
+#  http://www.apache.org/licenses/LICENSE-2.0
+#
+#  Unless required by applicable law or agreed to in writing, software
+#  distributed under the License is distributed on an "AS IS" BASIS,
+#  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#  See the License for the specific language governing permissions and
+#  limitations under the License.
+#
+
+LOCAL_PATH := $(call my-dir)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE_TAGS := optional
+LOCAL_MODULE := libbt-vendor-fake
+
+LOCAL_SRC_FILES := \
+	fake_controller.c
+
+LOCAL_C_INCLUDES := \
+	$(LOCAL_PATH)/../../hci/include
+
+LOCAL_SHARED_LIBRARIES := \
+	liblog
+
+LOCAL_CFLAGS += -std=gnu99 -Wall -Wno-unused-parameter -Wno-missing-field-initializers -Werror
+
+LOCAL_MULTILIB := 32
+
+include $(BUILD_SHARED_LIBRARY)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE_TAGS := optional
+LOCAL_MODULE := libbt-vendor-fake
+
+LOCAL_SRC_FILES := \
+	fake_controller.c
+
+LOCAL_C_INCLUDES := \
+	$(LOCAL_PATH)/../../hci/include
+
+LOCAL_SHARED_LIBRARIES := \
+	liblog
+
+LOCAL_CFLAGS += -std=gnu99 -Wall -Wno-unused-parameter -Wno-missing-field-initializers -Werror
+
+LOCAL_LDLIBS := -lpthread -lrt
+
+include $(BUILD_HOST_SHARED_LIBRARY)
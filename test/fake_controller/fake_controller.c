@@ -0,0 +1,943 @@
+/******************************************************************************
+ *
+ *  Copyright (C) 2014 Google, Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at:
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+
+// A simulated Bluetooth controller packaged as a vendor library. The stack
+// talks H4 to it over one end of a socketpair; a controller thread on the
+// other end answers the reset/init command sequence, completes host
+// initiated connections and acknowledges outbound ACL data. A traffic thread
+// plays a script of inbound LE advertising reports and ACL data at controlled
+// rates. See README.txt for the script format.
+
+#define LOG_TAG "bt_fake_controller"
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <utils/Log.h>
+
+#include "bt_vendor_lib.h"
+
+#define DEFAULT_SCRIPT_PATH "/etc/bluetooth/fake_controller.conf"
+#define SCRIPT_ENV_VAR      "BT_FAKE_CONTROLLER_SCRIPT"
+
+#define H4_CMD 0x01
+#define H4_ACL 0x02
+#define H4_SCO 0x03
+#define H4_EVT 0x04
+
+#define EVT_CONN_COMPLETE          0x03
+#define EVT_DISCONN_COMPLETE       0x05
+#define EVT_RMT_NAME_COMPLETE      0x07
+#define EVT_RMT_FEATURES_COMPLETE  0x0B
+#define EVT_RMT_VERSION_COMPLETE   0x0C
+#define EVT_CMD_COMPLETE           0x0E
+#define EVT_CMD_STATUS             0x0F
+#define EVT_NUM_COMPL_PKTS         0x13
+#define EVT_RMT_EXT_FEAT_COMPLETE  0x23
+#define EVT_LE_META                0x3E
+
+#define LE_SUBEVT_CONN_COMPLETE    0x01
+#define LE_SUBEVT_ADV_REPORT       0x02
+#define LE_SUBEVT_CONN_UPDATE      0x03
+#define LE_SUBEVT_RMT_FEATURES     0x04
+
+#define OP_CREATE_CONN             0x0405
+#define OP_DISCONNECT              0x0406
+#define OP_RMT_NAME_REQ            0x0419
+#define OP_READ_RMT_FEATURES       0x041B
+#define OP_READ_RMT_EXT_FEATURES   0x041C
+#define OP_READ_RMT_VERSION        0x041D
+#define OP_RESET                   0x0C03
+#define OP_READ_LOCAL_NAME         0x0C14
+#define OP_HOST_NUM_PKTS_DONE      0x0C35
+#define OP_WRITE_SSP_MODE          0x0C56
+#define OP_WRITE_LE_HOST_SUPPORT   0x0C6D
+#define OP_READ_LOCAL_VERSION      0x1001
+#define OP_READ_LOCAL_CMDS         0x1002
+#define OP_READ_LOCAL_FEATURES     0x1003
+#define OP_READ_LOCAL_EXT_FEATURES 0x1004
+#define OP_READ_BUFFER_SIZE        0x1005
+#define OP_READ_BD_ADDR            0x1009
+#define OP_LE_READ_BUFFER_SIZE     0x2002
+#define OP_LE_READ_LOCAL_FEATURES  0x2003
+#define OP_LE_READ_ADV_TX_POWER    0x2007
+#define OP_LE_SET_SCAN_ENABLE      0x200C
+#define OP_LE_CREATE_CONN          0x200D
+#define OP_LE_READ_WL_SIZE         0x200F
+#define OP_LE_CONN_UPDATE          0x2013
+#define OP_LE_READ_RMT_FEATURES    0x2016
+#define OP_LE_RAND                 0x2018
+#define OP_LE_READ_STATES          0x201C
+#define OGF_VENDOR_SPECIFIC        0x3F
+
+#define STATUS_SUCCESS             0x00
+#define STATUS_UNKNOWN_CMD         0x01
+
+#define MAX_PACKET_SIZE            (4 + 0xFFFF)
+#define MAX_ACTIONS                64
+#define FIRST_CONN_HANDLE          0x0040
+
+typedef enum {
+  ACTION_DELAY,       // delay_ms <ms>
+  ACTION_WAIT_FOR,    // wait_for <opcode>
+  ACTION_LE_ADV,      // le_adv <count> <rate_hz>
+  ACTION_ACL,         // acl <count> <rate_hz> <cid> <len>
+} action_type_t;
+
+typedef struct {
+  action_type_t type;
+  uint32_t arg[4];
+} action_t;
+
+typedef struct {
+  // Script settings.
+  uint8_t credits;
+  uint32_t cmd_latency_us;
+  uint16_t acl_mtu;
+  uint16_t acl_buffers;
+  uint16_t le_acl_mtu;
+  uint8_t le_acl_buffers;
+  uint8_t peer_addr[6];
+  action_t actions[MAX_ACTIONS];
+  size_t action_count;
+
+  // Controller state, guarded by |lock|.
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  bool open;                  // only touched from vendor op calls
+  bool running;
+  int host_fd;
+  int controller_fd;
+  pthread_t controller_thread;
+  pthread_t traffic_thread;
+  uint8_t local_addr[6];
+  uint8_t host_features;
+  bool le_scanning;
+  uint16_t next_handle;
+  uint16_t link_handle;       // most recent link, 0 when none
+  bool link_is_le;
+  uint16_t opcodes_seen[256]; // small open-addressed set of opcodes sent by the host
+  size_t opcodes_seen_count;
+
+  // Statistics.
+  uint32_t commands;
+  uint32_t acl_rx_packets;
+  uint64_t acl_rx_bytes;
+  uint32_t acl_tx_packets;
+  uint64_t acl_tx_bytes;
+  uint32_t adv_reports;
+  uint64_t traffic_start_us;
+  uint64_t traffic_end_us;
+} fake_controller_t;
+
+static const bt_vendor_callbacks_t *callbacks;
+static fake_controller_t controller;
+
+static uint64_t now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Sleeps until |deadline_us| on the CLOCK_MONOTONIC timeline.
+static void sleep_until(uint64_t deadline_us) {
+  struct timespec ts;
+  ts.tv_sec = deadline_us / 1000000;
+  ts.tv_nsec = (deadline_us % 1000000) * 1000;
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+    ;
+}
+
+static bool write_all(int fd, const uint8_t *data, size_t len) {
+  while (len) {
+    ssize_t ret = send(fd, data, len, MSG_NOSIGNAL);
+    if (ret == -1 && errno == EINTR)
+      continue;
+    if (ret <= 0)
+      return false;
+    data += ret;
+    len -= ret;
+  }
+  return true;
+}
+
+// Writes one H4 packet. Both controller threads send, so the whole packet
+// goes out under the lock.
+static void send_packet(uint8_t type, const uint8_t *data, size_t len) {
+  uint8_t packet[1 + MAX_PACKET_SIZE];
+  packet[0] = type;
+  memcpy(packet + 1, data, len);
+
+  pthread_mutex_lock(&controller.lock);
+  if (controller.running && !write_all(controller.controller_fd, packet, len + 1)) {
+    // The transport is gone; stop both threads rather than retrying.
+    ALOGE("%s unable to write to the host: %s", __func__, strerror(errno));
+    controller.running = false;
+    pthread_cond_broadcast(&controller.cond);
+  }
+  pthread_mutex_unlock(&controller.lock);
+}
+
+static void send_event(uint8_t code, const uint8_t *params, uint8_t len) {
+  uint8_t event[2 + 255];
+  event[0] = code;
+  event[1] = len;
+  memcpy(event + 2, params, len);
+  send_packet(H4_EVT, event, 2 + len);
+}
+
+static void send_le_event(uint8_t subevent, const uint8_t *params, uint8_t len) {
+  uint8_t event[255];
+  event[0] = subevent;
+  memcpy(event + 1, params, len);
+  send_event(EVT_LE_META, event, 1 + len);
+}
+
+static void send_command_complete(uint16_t opcode, const uint8_t *ret, uint8_t len) {
+  uint8_t params[255];
+  params[0] = controller.credits;
+  params[1] = opcode & 0xFF;
+  params[2] = opcode >> 8;
+  memcpy(params + 3, ret, len);
+  send_event(EVT_CMD_COMPLETE, params, 3 + len);
+}
+
+static void send_command_status(uint16_t opcode, uint8_t status) {
+  uint8_t params[4] = { status, controller.credits, opcode & 0xFF, opcode >> 8 };
+  send_event(EVT_CMD_STATUS, params, sizeof(params));
+}
+
+static void record_opcode(uint16_t opcode) {
+  size_t size = sizeof(controller.opcodes_seen) / sizeof(controller.opcodes_seen[0]);
+  size_t i = (opcode * 31u) % size;
+
+  for (size_t probe = 0; probe < size; ++probe, i = (i + 1) % size) {
+    if (controller.opcodes_seen[i] == opcode)
+      return;
+    if (controller.opcodes_seen[i] == 0) {
+      controller.opcodes_seen[i] = opcode;
+      ++controller.opcodes_seen_count;
+      return;
+    }
+  }
+}
+
+static bool opcode_seen(uint16_t opcode) {
+  size_t size = sizeof(controller.opcodes_seen) / sizeof(controller.opcodes_seen[0]);
+  size_t i = (opcode * 31u) % size;
+
+  for (size_t probe = 0; probe < size && controller.opcodes_seen[i]; ++probe, i = (i + 1) % size) {
+    if (controller.opcodes_seen[i] == opcode)
+      return true;
+  }
+  return false;
+}
+
+static uint16_t new_link(bool is_le) {
+  pthread_mutex_lock(&controller.lock);
+  uint16_t handle = controller.next_handle++;
+  controller.link_handle = handle;
+  controller.link_is_le = is_le;
+  pthread_cond_broadcast(&controller.cond);
+  pthread_mutex_unlock(&controller.lock);
+  return handle;
+}
+
+static void drop_link(uint16_t handle) {
+  pthread_mutex_lock(&controller.lock);
+  if (controller.link_handle == handle)
+    controller.link_handle = 0;
+  pthread_mutex_unlock(&controller.lock);
+}
+
+// Link control commands answer with Command Status and finish with their own
+// completion event against the simulated peer.
+static bool handle_link_command(uint16_t opcode, const uint8_t *params) {
+  uint8_t evt[32];
+  uint16_t handle = params[0] | ((params[1] & 0x0F) << 8);
+
+  switch (opcode) {
+    case OP_CREATE_CONN: {
+      send_command_status(opcode, STATUS_SUCCESS);
+      handle = new_link(false);
+      evt[0] = STATUS_SUCCESS;
+      evt[1] = handle & 0xFF;
+      evt[2] = handle >> 8;
+      memcpy(evt + 3, params, 6);
+      evt[9] = 0x01;  // ACL link
+      evt[10] = 0x00; // encryption disabled
+      send_event(EVT_CONN_COMPLETE, evt, 11);
+      return true;
+    }
+
+    case OP_LE_CREATE_CONN: {
+      send_command_status(opcode, STATUS_SUCCESS);
+      handle = new_link(true);
+      memset(evt, 0, 18);
+      evt[0] = STATUS_SUCCESS;
+      evt[1] = handle & 0xFF;
+      evt[2] = handle >> 8;
+      evt[3] = 0x00;            // master
+      evt[4] = params[5];       // peer address type
+      memcpy(evt + 5, params + 6, 6);
+      evt[11] = params[13];     // conn interval min
+      evt[12] = params[14];
+      evt[15] = 0xC8;           // supervision timeout 2s
+      send_le_event(LE_SUBEVT_CONN_COMPLETE, evt, 18);
+      return true;
+    }
+
+    case OP_DISCONNECT:
+      send_command_status(opcode, STATUS_SUCCESS);
+      drop_link(handle);
+      evt[0] = STATUS_SUCCESS;
+      evt[1] = handle & 0xFF;
+      evt[2] = handle >> 8;
+      evt[3] = 0x16;            // connection terminated by local host
+      send_event(EVT_DISCONN_COMPLETE, evt, 4);
+      return true;
+
+    case OP_RMT_NAME_REQ: {
+      uint8_t name_evt[255];
+      memset(name_evt, 0, sizeof(name_evt));
+      send_command_status(opcode, STATUS_SUCCESS);
+      name_evt[0] = STATUS_SUCCESS;
+      memcpy(name_evt + 1, params, 6);
+      strcpy((char *)name_evt + 7, "fake_peer");
+      send_event(EVT_RMT_NAME_COMPLETE, name_evt, 255);
+      return true;
+    }
+
+    case OP_READ_RMT_FEATURES:
+      send_command_status(opcode, STATUS_SUCCESS);
+      evt[0] = STATUS_SUCCESS;
+      evt[1] = params[0];
+      evt[2] = params[1];
+      memset(evt + 3, 0, 8);
+      evt[3 + 7] = 0x80;        // extended features
+      send_event(EVT_RMT_FEATURES_COMPLETE, evt, 11);
+      return true;
+
+    case OP_READ_RMT_EXT_FEATURES:
+      send_command_status(opcode, STATUS_SUCCESS);
+      evt[0] = STATUS_SUCCESS;
+      evt[1] = params[0];
+      evt[2] = params[1];
+      evt[3] = params[2];       // page
+      evt[4] = 1;               // max page
+      memset(evt + 5, 0, 8);
+      send_event(EVT_RMT_EXT_FEAT_COMPLETE, evt, 13);
+      return true;
+
+    case OP_READ_RMT_VERSION:
+      send_command_status(opcode, STATUS_SUCCESS);
+      evt[0] = STATUS_SUCCESS;
+      evt[1] = params[0];
+      evt[2] = params[1];
+      evt[3] = 0x06;            // LMP 4.0
+      evt[4] = 0x0F;            // manufacturer
+      evt[5] = 0x00;
+      evt[6] = 0x01;            // subversion
+      evt[7] = 0x00;
+      send_event(EVT_RMT_VERSION_COMPLETE, evt, 8);
+      return true;
+
+    case OP_LE_CONN_UPDATE:
+      send_command_status(opcode, STATUS_SUCCESS);
+      evt[0] = STATUS_SUCCESS;
+      evt[1] = params[0];
+      evt[2] = params[1];
+      evt[3] = params[4];       // interval max
+      evt[4] = params[5];
+      evt[5] = params[6];       // latency
+      evt[6] = params[7];
+      evt[7] = params[8];       // supervision timeout
+      evt[8] = params[9];
+      send_le_event(LE_SUBEVT_CONN_UPDATE, evt, 9);
+      return true;
+
+    case OP_LE_READ_RMT_FEATURES:
+      send_command_status(opcode, STATUS_SUCCESS);
+      evt[0] = STATUS_SUCCESS;
+      evt[1] = params[0];
+      evt[2] = params[1];
+      memset(evt + 3, 0, 8);
+      evt[3] = 0x01;            // LE encryption
+      send_le_event(LE_SUBEVT_RMT_FEATURES, evt, 11);
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+// Returns the Command Complete return parameters for the reads the stack
+// issues while it brings the controller up. Anything else succeeds with no
+// further parameters.
+static uint8_t command_return(uint16_t opcode, const uint8_t *params, uint8_t *ret) {
+  static const uint8_t lmp_features[8] = { 0xFF, 0xFE, 0x8F, 0xFE, 0xD8, 0x3F, 0x5B, 0x87 };
+
+  ret[0] = STATUS_SUCCESS;
+  switch (opcode) {
+    case OP_READ_LOCAL_VERSION:
+      ret[1] = 0x06;            // HCI 4.0
+      ret[2] = 0x00;
+      ret[3] = 0x00;
+      ret[4] = 0x06;            // LMP 4.0
+      ret[5] = 0x0F;            // manufacturer
+      ret[6] = 0x00;
+      ret[7] = 0x01;            // subversion
+      ret[8] = 0x00;
+      return 9;
+
+    case OP_READ_LOCAL_CMDS:
+      memset(ret + 1, 0xFF, 64);
+      return 65;
+
+    case OP_READ_LOCAL_FEATURES:
+      memcpy(ret + 1, lmp_features, 8);
+      return 9;
+
+    case OP_READ_LOCAL_EXT_FEATURES:
+      ret[1] = params[0];
+      ret[2] = 1;               // max page
+      memset(ret + 3, 0, 8);
+      if (params[0] == 0)
+        memcpy(ret + 3, lmp_features, 8);
+      else if (params[0] == 1)
+        ret[3] = controller.host_features;
+      return 11;
+
+    case OP_READ_BUFFER_SIZE:
+      ret[1] = controller.acl_mtu & 0xFF;
+      ret[2] = controller.acl_mtu >> 8;
+      ret[3] = 64;              // SCO MTU
+      ret[4] = controller.acl_buffers & 0xFF;
+      ret[5] = controller.acl_buffers >> 8;
+      ret[6] = 0;               // SCO buffers
+      ret[7] = 0;
+      return 8;
+
+    case OP_READ_BD_ADDR:
+      memcpy(ret + 1, controller.local_addr, 6);
+      return 7;
+
+    case OP_READ_LOCAL_NAME:
+      memset(ret + 1, 0, 248);
+      strcpy((char *)ret + 1, "fake_controller");
+      return 249;
+
+    case OP_WRITE_SSP_MODE:
+      controller.host_features = (controller.host_features & ~0x01) | (params[0] ? 0x01 : 0);
+      return 1;
+
+    case OP_WRITE_LE_HOST_SUPPORT:
+      controller.host_features = (controller.host_features & ~0x06) |
+          (params[0] ? 0x02 : 0) | (params[1] ? 0x04 : 0);
+      return 1;
+
+    case OP_LE_READ_BUFFER_SIZE:
+      ret[1] = controller.le_acl_mtu & 0xFF;
+      ret[2] = controller.le_acl_mtu >> 8;
+      ret[3] = controller.le_acl_buffers;
+      return 4;
+
+    case OP_LE_READ_LOCAL_FEATURES:
+      memset(ret + 1, 0, 8);
+      ret[1] = 0x01;            // LE encryption
+      return 9;
+
+    case OP_LE_READ_ADV_TX_POWER:
+      ret[1] = 0;
+      return 2;
+
+    case OP_LE_SET_SCAN_ENABLE:
+      pthread_mutex_lock(&controller.lock);
+      controller.le_scanning = params[0] != 0;
+      pthread_cond_broadcast(&controller.cond);
+      pthread_mutex_unlock(&controller.lock);
+      return 1;
+
+    case OP_LE_READ_WL_SIZE:
+      ret[1] = 8;
+      return 2;
+
+    case OP_LE_RAND:
+      for (int i = 1; i <= 8; ++i)
+        ret[i] = (uint8_t)rand();
+      return 9;
+
+    case OP_LE_READ_STATES:
+      memset(ret + 1, 0xFF, 5);
+      memset(ret + 6, 0, 3);
+      return 9;
+
+    default:
+      return 1;
+  }
+}
+
+static void handle_command(const uint8_t *packet) {
+  uint16_t opcode = packet[0] | (packet[1] << 8);
+  const uint8_t *params = packet + 3;
+  uint8_t ret[255];
+
+  ++controller.commands;
+  pthread_mutex_lock(&controller.lock);
+  record_opcode(opcode);
+  pthread_cond_broadcast(&controller.cond);
+  pthread_mutex_unlock(&controller.lock);
+
+  // Host flow control is the only command without a reply.
+  if (opcode == OP_HOST_NUM_PKTS_DONE)
+    return;
+
+  if (controller.cmd_latency_us)
+    usleep(controller.cmd_latency_us);
+
+  if ((opcode >> 10) == OGF_VENDOR_SPECIFIC) {
+    ret[0] = STATUS_UNKNOWN_CMD;
+    send_command_complete(opcode, ret, 1);
+    return;
+  }
+
+  if (opcode == OP_RESET) {
+    pthread_mutex_lock(&controller.lock);
+    controller.host_features = 0;
+    controller.le_scanning = false;
+    controller.link_handle = 0;
+    pthread_mutex_unlock(&controller.lock);
+  }
+
+  if (!handle_link_command(opcode, params))
+    send_command_complete(opcode, ret, command_return(opcode, params, ret));
+}
+
+// Every outbound ACL packet is acknowledged straight away, so the host only
+// ever waits on its own buffer accounting.
+static void handle_acl(const uint8_t *packet, size_t len) {
+  uint8_t evt[5] = { 1, packet[0], packet[1] & 0x0F, 1, 0 };
+
+  ++controller.acl_rx_packets;
+  controller.acl_rx_bytes += len - 4;
+  send_event(EVT_NUM_COMPL_PKTS, evt, sizeof(evt));
+}
+
+static void *controller_thread(void *context) {
+  static uint8_t buffer[2 * MAX_PACKET_SIZE];
+  size_t used = 0;
+
+  while (true) {
+    ssize_t ret = read(controller.controller_fd, buffer + used, sizeof(buffer) - used);
+    if (ret == -1 && errno == EINTR)
+      continue;
+    if (ret <= 0)
+      break;
+    used += ret;
+
+    // Consume every complete H4 packet in the buffer.
+    size_t offset = 0;
+    while (offset < used) {
+      const uint8_t *p = buffer + offset;
+      size_t avail = used - offset;
+      size_t header, length;
+
+      if (p[0] == H4_CMD) {
+        header = 4;
+        length = avail >= header ? p[3] : 0;
+      } else if (p[0] == H4_ACL) {
+        header = 5;
+        length = avail >= header ? (p[3] | (p[4] << 8)) : 0;
+      } else if (p[0] == H4_SCO) {
+        header = 4;
+        length = avail >= header ? p[3] : 0;
+      } else {
+        ALOGE("%s unknown H4 packet type 0x%02x, dropping buffer", __func__, p[0]);
+        offset = used;
+        break;
+      }
+
+      if (avail < header || avail < header + length)
+        break;
+
+      if (p[0] == H4_CMD)
+        handle_command(p + 1);
+      else if (p[0] == H4_ACL)
+        handle_acl(p + 1, header - 1 + length);
+
+      offset += header + length;
+    }
+
+    memmove(buffer, buffer + offset, used - offset);
+    used -= offset;
+  }
+
+  return NULL;
+}
+
+static void send_adv_report(uint32_t index) {
+  uint8_t report[19];
+
+  report[0] = 1;                // number of reports
+  report[1] = 0x00;             // connectable undirected
+  report[2] = 0x00;             // public address
+  memcpy(report + 3, controller.peer_addr, 6);
+  report[3] = (uint8_t)index;   // spread reports over 256 advertisers
+  report[9] = 8;                // data length
+  report[10] = 2;               // flags
+  report[11] = 0x01;
+  report[12] = 0x06;
+  report[13] = 4;               // shortened local name
+  report[14] = 0x08;
+  report[15] = 'f';
+  report[16] = 'a';
+  report[17] = 'k';
+  report[18] = (uint8_t)-60;    // rssi
+  send_le_event(LE_SUBEVT_ADV_REPORT, report, sizeof(report));
+  ++controller.adv_reports;
+}
+
+static void send_acl(uint16_t handle, uint16_t cid, uint16_t len, uint32_t seq) {
+  static uint8_t packet[4 + 4 + 0xFFFF];
+  uint16_t acl_len = 4 + len;
+
+  packet[0] = handle & 0xFF;
+  packet[1] = (handle >> 8) | 0x20; // first automatically flushable
+  packet[2] = acl_len & 0xFF;
+  packet[3] = acl_len >> 8;
+  packet[4] = len & 0xFF;
+  packet[5] = len >> 8;
+  packet[6] = cid & 0xFF;
+  packet[7] = cid >> 8;
+  memset(packet + 8, (uint8_t)seq, len);
+  send_packet(H4_ACL, packet, 4 + acl_len);
+
+  ++controller.acl_tx_packets;
+  controller.acl_tx_bytes += len;
+}
+
+// Blocks until |ready| holds or the controller shuts down. Called with the
+// lock held.
+#define WAIT_UNTIL(ready) \
+  while (controller.running && !(ready)) \
+    pthread_cond_wait(&controller.cond, &controller.lock)
+
+static void run_paced(const action_t *action) {
+  uint32_t count = action->arg[0];
+  uint32_t rate_hz = action->arg[1];
+  uint64_t start = now_us();
+
+  for (uint32_t i = 0; i < count && controller.running; ++i) {
+    if (rate_hz)
+      sleep_until(start + (uint64_t)i * 1000000 / rate_hz);
+
+    if (action->type == ACTION_LE_ADV) {
+      send_adv_report(i);
+    } else {
+      pthread_mutex_lock(&controller.lock);
+      uint16_t handle = controller.link_handle;
+      pthread_mutex_unlock(&controller.lock);
+      if (!handle)
+        break;
+      send_acl(handle, action->arg[2], action->arg[3], i);
+    }
+  }
+}
+
+static void *traffic_thread(void *context) {
+  controller.traffic_start_us = now_us();
+
+  for (size_t i = 0; i < controller.action_count && controller.running; ++i) {
+    const action_t *action = &controller.actions[i];
+
+    switch (action->type) {
+      case ACTION_DELAY:
+        usleep(action->arg[0] * 1000);
+        break;
+
+      case ACTION_WAIT_FOR:
+        pthread_mutex_lock(&controller.lock);
+        WAIT_UNTIL(opcode_seen(action->arg[0]));
+        pthread_mutex_unlock(&controller.lock);
+        break;
+
+      case ACTION_LE_ADV:
+        pthread_mutex_lock(&controller.lock);
+        WAIT_UNTIL(controller.le_scanning);
+        pthread_mutex_unlock(&controller.lock);
+        run_paced(action);
+        break;
+
+      case ACTION_ACL:
+        pthread_mutex_lock(&controller.lock);
+        WAIT_UNTIL(controller.link_handle != 0);
+        pthread_mutex_unlock(&controller.lock);
+        run_paced(action);
+        break;
+    }
+  }
+
+  controller.traffic_end_us = now_us();
+  if (controller.action_count)
+    ALOGI("%s script done in %llu ms", __func__,
+        (unsigned long long)(controller.traffic_end_us - controller.traffic_start_us) / 1000);
+  return NULL;
+}
+
+static bool parse_addr(const char *str, uint8_t *addr) {
+  unsigned int v[6];
+  if (sscanf(str, "%02x:%02x:%02x:%02x:%02x:%02x", &v[0], &v[1], &v[2], &v[3], &v[4], &v[5]) != 6)
+    return false;
+  // BD_ADDRs go over HCI least significant byte first.
+  for (int i = 0; i < 6; ++i)
+    addr[i] = (uint8_t)v[5 - i];
+  return true;
+}
+
+static void load_script(const char *path) {
+  FILE *fp = fopen(path, "r");
+  if (!fp) {
+    ALOGI("%s no script at %s, answering commands only", __func__, path);
+    return;
+  }
+
+  char line[256];
+  int line_num = 0;
+  while (fgets(line, sizeof(line), fp)) {
+    char word[32], str[32];
+    unsigned int a[4] = { 0, 0, 0, 0 };
+    ++line_num;
+
+    if (sscanf(line, "%31s", word) != 1 || word[0] == '#')
+      continue;
+
+    action_t *action = &controller.actions[controller.action_count];
+    int n = sscanf(line, "%*s %i %i %i %i", &a[0], &a[1], &a[2], &a[3]);
+    bool ok = true;
+
+    if (!strcmp(word, "credits") && n == 1) {
+      controller.credits = a[0];
+    } else if (!strcmp(word, "cmd_latency_us") && n == 1) {
+      controller.cmd_latency_us = a[0];
+    } else if (!strcmp(word, "acl_buffers") && n == 2) {
+      controller.acl_mtu = a[0];
+      controller.acl_buffers = a[1];
+    } else if (!strcmp(word, "le_acl_buffers") && n == 2) {
+      controller.le_acl_mtu = a[0];
+      controller.le_acl_buffers = a[1];
+    } else if (!strcmp(word, "peer")) {
+      ok = sscanf(line, "%*s %31s", str) == 1 && parse_addr(str, controller.peer_addr);
+    } else if (controller.action_count == MAX_ACTIONS) {
+      ALOGE("%s %s:%d more than %d actions", __func__, path, line_num, MAX_ACTIONS);
+      break;
+    } else if (!strcmp(word, "delay_ms") && n == 1) {
+      action->type = ACTION_DELAY;
+    } else if (!strcmp(word, "wait_for") && n == 1) {
+      action->type = ACTION_WAIT_FOR;
+    } else if (!strcmp(word, "le_adv") && n == 2) {
+      action->type = ACTION_LE_ADV;
+    } else if (!strcmp(word, "acl") && n == 4 && a[3] <= 0xFFFF - 4) {
+      action->type = ACTION_ACL;
+    } else {
+      ok = false;
+    }
+
+    if (!ok) {
+      line[strcspn(line, "\n")] = '\0';
+      ALOGE("%s %s:%d unable to parse: %s", __func__, path, line_num, line);
+      continue;
+    }
+
+    if (strcmp(word, "credits") && strcmp(word, "cmd_latency_us") && strcmp(word, "acl_buffers") &&
+        strcmp(word, "le_acl_buffers") && strcmp(word, "peer")) {
+      memcpy(action->arg, a, sizeof(action->arg));
+      ++controller.action_count;
+    }
+  }
+
+  fclose(fp);
+  ALOGI("%s loaded %zu actions from %s", __func__, controller.action_count, path);
+}
+
+static void log_stats(void) {
+  uint64_t elapsed_us = controller.traffic_end_us - controller.traffic_start_us;
+
+  ALOGI("%s commands: %u, adv reports sent: %u", __func__, controller.commands, controller.adv_reports);
+  ALOGI("%s acl to host: %u packets, %llu bytes; acl from host: %u packets, %llu bytes", __func__,
+      controller.acl_tx_packets, (unsigned long long)controller.acl_tx_bytes,
+      controller.acl_rx_packets, (unsigned long long)controller.acl_rx_bytes);
+  if (controller.traffic_end_us && elapsed_us)
+    ALOGI("%s script throughput to host: %llu kbit/s", __func__,
+        (unsigned long long)(controller.acl_tx_bytes * 8 * 1000 / elapsed_us));
+}
+
+static int userial_open(int (*fd_array)[CH_MAX]) {
+  int fds[2];
+
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) {
+    ALOGE("%s unable to create socketpair: %s", __func__, strerror(errno));
+    return 0;
+  }
+
+  controller.host_fd = fds[0];
+  controller.controller_fd = fds[1];
+  controller.open = true;
+  controller.running = true;
+  controller.next_handle = FIRST_CONN_HANDLE;
+
+  if (pthread_create(&controller.controller_thread, NULL, controller_thread, NULL)) {
+    ALOGE("%s unable to spawn controller thread.", __func__);
+    goto error;
+  }
+
+  if (pthread_create(&controller.traffic_thread, NULL, traffic_thread, NULL)) {
+    ALOGE("%s unable to spawn traffic thread.", __func__);
+    // Same teardown as userial_close, for the one thread that is running.
+    shutdown(controller.controller_fd, SHUT_RDWR);
+    pthread_mutex_lock(&controller.lock);
+    controller.running = false;
+    pthread_cond_broadcast(&controller.cond);
+    pthread_mutex_unlock(&controller.lock);
+    pthread_join(controller.controller_thread, NULL);
+    goto error;
+  }
+
+  // CMD, EVT and both ACL directions share the one H4 stream.
+  for (int i = 0; i < CH_MAX; ++i)
+    (*fd_array)[i] = controller.host_fd;
+  return 1;
+
+error:
+  controller.running = false;
+  controller.open = false;
+  close(controller.controller_fd);
+  close(controller.host_fd);
+  return 0;
+}
+
+static void userial_close(void) {
+  if (!controller.open)
+    return;
+  controller.open = false;
+
+  // The host may have stopped reading already; shut the socket down first so
+  // a sender blocked on a full socket lets go of the lock.
+  shutdown(controller.controller_fd, SHUT_RDWR);
+
+  pthread_mutex_lock(&controller.lock);
+  controller.running = false;
+  pthread_cond_broadcast(&controller.cond);
+  pthread_mutex_unlock(&controller.lock);
+
+  pthread_join(controller.controller_thread, NULL);
+  pthread_join(controller.traffic_thread, NULL);
+  close(controller.controller_fd);
+  close(controller.host_fd);
+
+  log_stats();
+}
+
+static int fake_init(const bt_vendor_callbacks_t *p_cb, unsigned char *local_bdaddr) {
+  callbacks = p_cb;
+
+  memset(&controller, 0, sizeof(controller));
+  pthread_mutex_init(&controller.lock, NULL);
+  pthread_cond_init(&controller.cond, NULL);
+  controller.credits = 1;
+  controller.acl_mtu = 1021;
+  controller.acl_buffers = 8;
+  controller.le_acl_mtu = 251;
+  controller.le_acl_buffers = 8;
+  parse_addr("00:11:22:33:44:55", controller.peer_addr);
+  // The stack passes the address most significant byte first.
+  for (int i = 0; i < 6; ++i)
+    controller.local_addr[i] = local_bdaddr[5 - i];
+
+  const char *path = getenv(SCRIPT_ENV_VAR);
+  load_script(path ? path : DEFAULT_SCRIPT_PATH);
+  return 0;
+}
+
+static int fake_op(bt_vendor_opcode_t opcode, void *param) {
+  switch (opcode) {
+    case BT_VND_OP_POWER_CTRL:
+      return 0;
+
+    case BT_VND_OP_FW_CFG:
+      callbacks->fwcfg_cb(BT_VND_OP_RESULT_SUCCESS);
+      return 0;
+
+    case BT_VND_OP_SCO_CFG:
+      // No SCO configuration; the stack carries on with the postload.
+      return -1;
+
+    case BT_VND_OP_USERIAL_OPEN:
+      return userial_open((int (*)[CH_MAX])param);
+
+    case BT_VND_OP_USERIAL_CLOSE:
+      userial_close();
+      return 0;
+
+    case BT_VND_OP_GET_LPM_IDLE_TIMEOUT:
+      *(uint32_t *)param = 3000;
+      return 0;
+
+    case BT_VND_OP_LPM_SET_MODE:
+      callbacks->lpm_cb(BT_VND_OP_RESULT_SUCCESS);
+      return 0;
+
+    case BT_VND_OP_SET_AUDIO_STATE:
+      callbacks->audio_state_cb(BT_VND_OP_RESULT_SUCCESS);
+      return 0;
+
+    case BT_VND_OP_EPILOG:
+      callbacks->epilog_cb(BT_VND_OP_RESULT_SUCCESS);
+      return 0;
+
+    case BT_VND_OP_GET_LINESPEED:
+      return 3000000;
+
+    default:
+      return 0;
+  }
+}
+
+static void fake_cleanup(void) {
+  userial_close();
+  callbacks = NULL;
+}
+
+static void fake_ssr_cleanup(void) {
+  userial_close();
+}
+
+const bt_vendor_interface_t BLUETOOTH_VENDOR_LIB_INTERFACE = {
+  sizeof(bt_vendor_interface_t),
+  fake_init,
+  fake_op,
+  fake_cleanup,
+  fake_ssr_cleanup
+};
@@ -0,0 +1,51 @@
+#
+#  Copyright (C) 2014 Google, Inc.
+#
+#  Licensed under the Apache License, Version 2.0 (the "License");
+#  you may not use this file except in compliance with the License.
+#  You may obtain a copy of the License at:
+#
+#  http://www.apache.org/licenses/LICENSE-2.0
+#
+#  Unless required by applicable law or agreed to in writing, software
+#  distributed under the License is distributed on an "AS IS" BASIS,
+#  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#  See the License for the specific language governing permissions and
+#  limitations under the License.
+#
+
+LOCAL_PATH := $(call my-dir)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE_TAGS := optional
+LOCAL_MODULE := bt_inquiry_bench
+
+LOCAL_SRC_FILES := \
+	inquiry_bench.c \
+	../../stack/btm/btm_inq.c
+
+LOCAL_C_INCLUDES := \
+	$(LOCAL_PATH)/../../stack/include \
+	$(LOCAL_PATH)/../../stack/btm \
+	$(LOCAL_PATH)/../../vnd/include \
+	$(LOCAL_PATH)/../../include \
+	$(LOCAL_PATH)/../../gki/common \
+	$(LOCAL_PATH)/../../gki/ulinux \
+	$(LOCAL_PATH)/../../udrv/include \
+	$(LOCAL_PATH)/../../bta/include \
+	$(LOCAL_PATH)/../../bta/sys \
+	$(LOCAL_PATH)/../../utils/include \
+	$(bdroid_C_INCLUDES)
+
+LOCAL_CFLAGS += $(bdroid_CFLAGS) -std=c99
+
+# The database size is fixed at build time; set it with
+# mmm ... INQUIRY_BENCH_DB_SIZE=512 to benchmark a larger one.
+ifneq ($(INQUIRY_BENCH_DB_SIZE),)
+LOCAL_CFLAGS += -DBTM_INQ_DB_SIZE=$(INQUIRY_BENCH_DB_SIZE)
+endif
+
+LOCAL_MULTILIB := 32
+
+include $(BUILD_EXECUTABLE)
@@ -0,0 +1,334 @@
+/******************************************************************************
+ *
+ *  Copyright (C) 2014 Google, Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at:
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+
+// Measures how fast the BTM inquiry database takes in results when many
+// devices are in range. stack/btm/btm_inq.c is built into this program on its
+// own; everything else it calls is stubbed out below and aborts if reached.
+//
+// Two workloads are run against a population of simulated devices:
+// - BR/EDR: HCI Inquiry Result with RSSI events, several responses each, are
+//   handed to btm_process_inq_results as if they came from btu_hcif.
+// - LE: one advertising report at a time goes through the inquiry database
+//   lookup, touch and insert that btm_ble_process_adv_pkt_cont does before it
+//   parses the advertising data.
+//
+// See README.txt for how to build it with a larger BTM_INQ_DB_SIZE.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bt_target.h"
+#include "btm_int.h"
+#include "btu.h"
+#include "gki.h"
+#include "hcimsgs.h"
+
+#define DEFAULT_DEVICES   400
+#define DEFAULT_RESULTS   1000000
+#define RESULTS_PER_EVENT 8
+
+// Inquiry Result with RSSI: bd_addr, page scan repetition mode, reserved,
+// class of device, clock offset and RSSI.
+#define INQ_RESULT_WITH_RSSI_LEN 14
+
+#if BTM_DYNAMIC_MEMORY == FALSE
+tBTM_CB btm_cb;
+#endif
+
+static UINT8 event[1 + RESULTS_PER_EVENT * INQ_RESULT_WITH_RSSI_LEN];
+static int evictions;
+
+static uint64_t now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void device_addr(int device, BD_ADDR bda) {
+  bda[0] = 0x00;
+  bda[1] = 0x22;
+  bda[2] = (UINT8)(device >> 16);
+  bda[3] = (UINT8)(device >> 8);
+  bda[4] = (UINT8)device;
+  bda[5] = 0x5a;
+}
+
+static void inq_change_cb(void *p_info, BOOLEAN added) {
+  if (!added)
+    evictions++;
+}
+
+static void start_inquiry(void) {
+  tBTM_INQUIRY_VAR_ST *p_inq = &btm_cb.btm_inq_vars;
+
+  btm_clr_inq_db(NULL);
+  p_inq->inq_active = BTM_GENERAL_INQUIRY_ACTIVE;
+  p_inq->p_inq_change_cb = inq_change_cb;
+  p_inq->inq_counter++;
+  p_inq->inq_cmpl_info.num_resp = 0;
+  evictions = 0;
+}
+
+static void send_inquiry_results(const int *devices, int count) {
+  UINT8 *p = event;
+
+  *p++ = (UINT8)count;
+  for (int i = 0; i < count; i++) {
+    BD_ADDR bda;
+    device_addr(devices[i], bda);
+    for (int j = BD_ADDR_LEN - 1; j >= 0; j--)
+      *p++ = bda[j];
+    *p++ = 1;                                 // page scan repetition mode R1
+    *p++ = 0;                                 // reserved
+    *p++ = 0x0c;                              // class of device: phone
+    *p++ = 0x02;
+    *p++ = 0x5a;
+    *p++ = 0;                                 // clock offset
+    *p++ = 0;
+    *p++ = (UINT8)(-40 - devices[i] % 50);    // RSSI
+  }
+  btm_process_inq_results(event, BTM_INQ_RESULT_WITH_RSSI);
+}
+
+static void send_adv_report(int device) {
+  tBTM_INQUIRY_VAR_ST *p_inq = &btm_cb.btm_inq_vars;
+  tINQ_DB_ENT *p_i;
+  BD_ADDR bda;
+
+  device_addr(device, bda);
+  if ((p_i = btm_inq_db_find(bda)) != NULL)
+    btm_inq_db_touch(p_i);
+  else if ((p_i = btm_inq_db_new(bda)) != NULL)
+    p_inq->inq_cmpl_info.num_resp++;
+  else
+    return;
+  p_i->inq_count = p_inq->inq_counter;
+  p_i->inq_info.results.device_type |= BT_DEVICE_TYPE_BLE;
+}
+
+// Every device in range that the database has room for must be in it, and
+// reachable through BTM_InqDbRead.
+static int check_db(int devices) {
+  int expected = devices < BTM_INQ_DB_SIZE ? devices : BTM_INQ_DB_SIZE;
+  int entries = 0;
+
+  for (tBTM_INQ_INFO *p = BTM_InqDbFirst(); p; p = BTM_InqDbNext(p)) {
+    if (BTM_InqDbRead(p->results.remote_bd_addr) != p)
+      return -1;
+    entries++;
+  }
+  return entries == expected ? 0 : -1;
+}
+
+static int run(const char *name, int devices, int results, int per_event) {
+  int batch[RESULTS_PER_EVENT];
+
+  start_inquiry();
+  srand(7);
+  uint64_t start = now_us();
+  for (int sent = 0; sent < results; sent += per_event) {
+    for (int i = 0; i < per_event; i++)
+      batch[i] = rand() % devices;
+    if (per_event == 1)
+      send_adv_report(batch[0]);
+    else
+      send_inquiry_results(batch, per_event);
+  }
+  double seconds = (now_us() - start) / 1e6;
+  printf("%s: %d results from %d devices in %.1f ms, %.0f results/s, %d evictions\n",
+         name, results, devices, seconds * 1e3, results / seconds, evictions);
+  if (check_db(devices)) {
+    printf("%s: inquiry database is inconsistent\n", name);
+    return -1;
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  int devices = argc > 1 ? atoi(argv[1]) : DEFAULT_DEVICES;
+  int results = argc > 2 ? atoi(argv[2]) : DEFAULT_RESULTS;
+  if (devices <= 0 || devices > 0xffffff || results <= 0) {
+    fprintf(stderr, "usage: %s [devices] [results]\n", argv[0]);
+    return 1;
+  }
+
+  btm_inq_db_init();
+  printf("inquiry database of %d entries\n", BTM_INQ_DB_SIZE);
+  if (run("BR/EDR inquiry", devices, results, RESULTS_PER_EVENT) ||
+      run("LE advertising", devices, results, 1))
+    return 1;
+  return 0;
+}
+
+// Stubs for what btm_inq.c links against. None of them is reached while
+// results are only being taken in.
+void LogMsg(UINT32 trace_set_mask, const char *fmt_str, ...) {
+}
+
+UINT32 GKI_get_tick_count(void) {
+  return (UINT32)(now_us() / 1000);
+}
+
+void *GKI_getbuf(UINT16 size) {
+  return malloc(size);
+}
+
+void GKI_freebuf(void *p_buf) {
+  free(p_buf);
+}
+
+void btu_start_timer(TIMER_LIST_ENT *p_tle, UINT16 type, UINT32 timeout) {
+  abort();
+}
+
+void btu_stop_timer(TIMER_LIST_ENT *p_tle) {
+  abort();
+}
+
+BOOLEAN BTM_IsDeviceUp(void) {
+  abort();
+}
+
+UINT8 *BTM_ReadDeviceClass(void) {
+  abort();
+}
+
+tBTM_STATUS BTM_SetDeviceClass(DEV_CLASS dev_class) {
+  abort();
+}
+
+void btm_acl_update_busy_level(tBTM_BLI_EVENT event) {
+  abort();
+}
+
+void btm_sec_rmt_name_request_complete(UINT8 *bd_addr, UINT8 *bd_name, UINT8 status) {
+  abort();
+}
+
+BOOLEAN btsnd_hcic_exit_per_inq(void) {
+  abort();
+}
+
+BOOLEAN btsnd_hcic_inq_cancel(void) {
+  abort();
+}
+
+BOOLEAN btsnd_hcic_inquiry(const LAP inq_lap, UINT8 duration, UINT8 response_cnt) {
+  abort();
+}
+
+BOOLEAN btsnd_hcic_per_inq_mode(UINT16 max_period, UINT16 min_period, const LAP inq_lap,
+                                UINT8 duration, UINT8 response_cnt) {
+  abort();
+}
+
+BOOLEAN btsnd_hcic_read_inq_tx_power(void) {
+  abort();
+}
+
+BOOLEAN btsnd_hcic_rmt_name_req(BD_ADDR bd_addr, UINT8 page_scan_rep_mode,
+                                UINT8 page_scan_mode, UINT16 clock_offset) {
+  abort();
+}
+
+BOOLEAN btsnd_hcic_rmt_name_req_cancel(BD_ADDR bd_addr) {
+  abort();
+}
+
+BOOLEAN btsnd_hcic_set_event_filter(UINT8 filt_type, UINT8 filt_cond_type, UINT8 *filt_cond,
+                                    UINT8 filt_cond_len) {
+  abort();
+}
+
+BOOLEAN btsnd_hcic_write_cur_iac_lap(UINT8 num_cur_iac, LAP * const iac_lap) {
+  abort();
+}
+
+void btsnd_hcic_write_ext_inquiry_response(void *buffer, UINT8 fec_req) {
+  abort();
+}
+
+BOOLEAN btsnd_hcic_write_inq_tx_power(INT8 level) {
+  abort();
+}
+
+BOOLEAN btsnd_hcic_write_inqscan_cfg(UINT16 interval, UINT16 window) {
+  abort();
+}
+
+BOOLEAN btsnd_hcic_write_inqscan_type(UINT8 type) {
+  abort();
+}
+
+BOOLEAN btsnd_hcic_write_inquiry_mode(UINT8 type) {
+  abort();
+}
+
+BOOLEAN btsnd_hcic_write_pagescan_cfg(UINT16 interval, UINT16 window) {
+  abort();
+}
+
+BOOLEAN btsnd_hcic_write_pagescan_type(UINT8 type) {
+  abort();
+}
+
+BOOLEAN btsnd_hcic_write_scan_enable(UINT8 flag) {
+  abort();
+}
+
+#if BLE_INCLUDED == TRUE
+tBTM_STATUS BTM_BleObserve(BOOLEAN start, UINT8 duration, tBTM_INQ_RESULTS_CB *p_results_cb,
+                           tBTM_CMPL_CB *p_cmpl_cb) {
+  abort();
+}
+
+BOOLEAN BTM_UseLeLink(BD_ADDR bd_addr) {
+  abort();
+}
+
+BOOLEAN btm_ble_cancel_remote_name(BD_ADDR remote_bda) {
+  abort();
+}
+
+tBTM_STATUS btm_ble_read_remote_name(BD_ADDR remote_bda, tBTM_INQ_INFO *p_cur,
+                                     tBTM_CMPL_CB *p_cb) {
+  abort();
+}
+
+tBTM_STATUS btm_ble_set_connectability(UINT16 combined_mode) {
+  abort();
+}
+
+tBTM_STATUS btm_ble_set_discoverability(UINT16 combined_mode) {
+  abort();
+}
+
+tBTM_STATUS btm_ble_start_inquiry(UINT8 mode, UINT8 duration) {
+  abort();
+}
+
+void btm_ble_stop_inquiry(void) {
+  abort();
+}
+
+BOOLEAN btsnd_hcic_ble_set_scan_enable(UINT8 scan_enable, UINT8 duplicate) {
+  abort();
+}
+#endif
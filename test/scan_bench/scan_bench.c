@@ -0,0 +1,317 @@
+/******************************************************************************
+ *
+ *  Copyright (C) 2014 Google, Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at:
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+
+// Measures LE scan result delivery against the fake controller in
+// test/fake_controller. The program writes a fake controller script that
+// sends a number of advertising reports at a given rate once scanning is
+// enabled, brings the stack up, scans through the GATT client HAL and counts
+// the scan results that reach the application. See README.txt for the setup.
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <hardware/bluetooth.h>
+#include <hardware/bt_gatt.h>
+#include <hardware/hardware.h>
+
+#define SCRIPT_PATH       "/data/local/tmp/bt_scan_bench.conf"
+#define SCRIPT_ENV_VAR    "BT_FAKE_CONTROLLER_SCRIPT"
+#define DEFAULT_REPORTS   10000
+#define DEFAULT_RATE_HZ   1000
+#define STATE_TIMEOUT_MS  10000
+// Scanning stops once no result has come in for this long.
+#define QUIET_TIMEOUT_MS  2000
+
+static const bt_interface_t *bt_interface;
+static const btgatt_interface_t *gatt_interface;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static bt_state_t adapter_state = BT_STATE_OFF;
+static int client_if = -1;
+static bool registered;
+static uint32_t results;
+static uint64_t first_result_us;
+static uint64_t last_result_us;
+
+static timer_t alarm_timer;
+static alarm_cb alarm_callback;
+static void *alarm_data;
+
+static uint64_t now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void adapter_state_changed(bt_state_t state) {
+  pthread_mutex_lock(&lock);
+  adapter_state = state;
+  pthread_cond_broadcast(&cond);
+  pthread_mutex_unlock(&lock);
+}
+
+static bt_callbacks_t callbacks = {
+  sizeof(bt_callbacks_t),
+  adapter_state_changed,
+  NULL, /* adapter_properties_cb */
+  NULL, /* remote_device_properties_cb */
+  NULL, /* device_found_cb */
+  NULL, /* discovery_state_changed_cb */
+  NULL, /* pin_request_cb */
+  NULL, /* ssp_request_cb */
+  NULL, /* bond_state_changed_cb */
+  NULL, /* acl_state_changed_cb */
+  NULL, /* thread_evt_cb */
+  NULL, /* dut_mode_recv_cb */
+  NULL, /* le_test_mode_cb */
+  NULL, /* energy_info_cb */
+  NULL, /* le_lpp_write_rssi_thresh_cb */
+  NULL, /* le_lpp_read_rssi_thresh_cb */
+  NULL, /* le_lpp_enable_rssi_monitor_cb */
+  NULL  /* le_lpp_rssi_threshold_evt_cb */
+};
+
+static void register_client_cb(int status, int client, bt_uuid_t *app_uuid) {
+  pthread_mutex_lock(&lock);
+  if (status == 0)
+    client_if = client;
+  registered = true;
+  pthread_cond_broadcast(&cond);
+  pthread_mutex_unlock(&lock);
+}
+
+static void scan_result_cb(bt_bdaddr_t *bd_addr, int rssi, uint8_t *adv_data) {
+  uint64_t now = now_us();
+
+  pthread_mutex_lock(&lock);
+  if (!results++)
+    first_result_us = now;
+  last_result_us = now;
+  pthread_mutex_unlock(&lock);
+}
+
+static btgatt_client_callbacks_t gatt_client_callbacks = {
+  .register_client_cb = register_client_cb,
+  .scan_result_cb = scan_result_cb,
+};
+
+static btgatt_callbacks_t gatt_callbacks = {
+  sizeof(btgatt_callbacks_t),
+  &gatt_client_callbacks,
+  NULL,
+};
+
+static void alarm_expired(union sigval value) {
+  alarm_callback(alarm_data);
+}
+
+// The stack keeps at most one alarm armed, so one timer serves all of them.
+static bool set_wake_alarm(uint64_t delay_millis, bool should_wake, alarm_cb cb, void *data) {
+  struct itimerspec its;
+
+  alarm_callback = cb;
+  alarm_data = data;
+  memset(&its, 0, sizeof(its));
+  its.it_value.tv_sec = delay_millis / 1000;
+  its.it_value.tv_nsec = (delay_millis % 1000) * 1000 * 1000;
+  // A zero value would disarm the timer instead of firing it now.
+  if (!its.it_value.tv_sec && !its.it_value.tv_nsec)
+    its.it_value.tv_nsec = 1;
+  return timer_settime(alarm_timer, 0, &its, NULL) == 0;
+}
+
+static int acquire_wake_lock(const char *lock_name) {
+  return BT_STATUS_SUCCESS;
+}
+
+static int release_wake_lock(const char *lock_name) {
+  return BT_STATUS_SUCCESS;
+}
+
+static bt_os_callouts_t callouts = {
+  sizeof(bt_os_callouts_t),
+  set_wake_alarm,
+  acquire_wake_lock,
+  release_wake_lock,
+};
+
+static void deadline_after(struct timespec *deadline, int timeout_ms) {
+  clock_gettime(CLOCK_REALTIME, deadline);
+  deadline->tv_sec += timeout_ms / 1000;
+  deadline->tv_nsec += (timeout_ms % 1000) * 1000000L;
+  if (deadline->tv_nsec >= 1000000000L) {
+    deadline->tv_sec++;
+    deadline->tv_nsec -= 1000000000L;
+  }
+}
+
+static bool wait_for_state(bt_state_t state) {
+  struct timespec deadline;
+  int err = 0;
+
+  deadline_after(&deadline, STATE_TIMEOUT_MS);
+  pthread_mutex_lock(&lock);
+  while (adapter_state != state && err != ETIMEDOUT)
+    err = pthread_cond_timedwait(&cond, &lock, &deadline);
+  bool reached = adapter_state == state;
+  pthread_mutex_unlock(&lock);
+  return reached;
+}
+
+static bool register_client(void) {
+  struct timespec deadline;
+  bt_uuid_t uuid;
+  int err = 0;
+
+  memset(&uuid, 0, sizeof(uuid));
+  memcpy(uuid.uu, "bt_scan_bench", 13);
+  if (gatt_interface->client->register_client(&uuid) != BT_STATUS_SUCCESS)
+    return false;
+  deadline_after(&deadline, STATE_TIMEOUT_MS);
+  pthread_mutex_lock(&lock);
+  while (!registered && err != ETIMEDOUT)
+    err = pthread_cond_timedwait(&cond, &lock, &deadline);
+  bool ok = client_if >= 0;
+  pthread_mutex_unlock(&lock);
+  return ok;
+}
+
+// Returns once |expected| results have come in, or none for QUIET_TIMEOUT_MS.
+static void wait_for_results(uint32_t expected) {
+  uint32_t seen;
+
+  pthread_mutex_lock(&lock);
+  do {
+    seen = results;
+    pthread_mutex_unlock(&lock);
+    usleep(QUIET_TIMEOUT_MS * 1000);
+    pthread_mutex_lock(&lock);
+  } while (results < expected && results != seen);
+  pthread_mutex_unlock(&lock);
+}
+
+static bool load_stack(void) {
+  const hw_module_t *module;
+  hw_device_t *device;
+  struct sigevent sigevent;
+
+  memset(&sigevent, 0, sizeof(sigevent));
+  sigevent.sigev_notify = SIGEV_THREAD;
+  sigevent.sigev_notify_function = alarm_expired;
+  if (timer_create(CLOCK_MONOTONIC, &sigevent, &alarm_timer)) {
+    fprintf(stderr, "unable to create the alarm timer: %s\n", strerror(errno));
+    return false;
+  }
+
+  int err = hw_get_module(BT_HARDWARE_MODULE_ID, &module);
+  if (!err)
+    err = module->methods->open(module, BT_HARDWARE_MODULE_ID, &device);
+  if (err) {
+    fprintf(stderr, "unable to load the Bluetooth HAL: %s\n", strerror(-err));
+    return false;
+  }
+  bt_interface = ((bluetooth_device_t *)device)->get_bluetooth_interface();
+  if (bt_interface->init(&callbacks) != BT_STATUS_SUCCESS ||
+      bt_interface->set_os_callouts(&callouts) != BT_STATUS_SUCCESS) {
+    fprintf(stderr, "unable to initialize the Bluetooth stack\n");
+    return false;
+  }
+  gatt_interface = bt_interface->get_profile_interface(BT_PROFILE_GATT_ID);
+  if (!gatt_interface || gatt_interface->init(&gatt_callbacks) != BT_STATUS_SUCCESS) {
+    fprintf(stderr, "unable to initialize the GATT interface\n");
+    return false;
+  }
+  return true;
+}
+
+static bool write_script(uint32_t reports, uint32_t rate_hz) {
+  FILE *fp = fopen(SCRIPT_PATH, "w");
+  if (!fp) {
+    fprintf(stderr, "unable to write %s: %s\n", SCRIPT_PATH, strerror(errno));
+    return false;
+  }
+  fprintf(fp, "le_adv %u %u\n", reports, rate_hz);
+  fclose(fp);
+  return true;
+}
+
+static bool scan(uint32_t reports, uint32_t rate_hz) {
+  if (!register_client()) {
+    fprintf(stderr, "unable to register a GATT client\n");
+    return false;
+  }
+  uint64_t start = now_us();
+  if (gatt_interface->client->scan(true) != BT_STATUS_SUCCESS) {
+    fprintf(stderr, "unable to start scanning\n");
+    return false;
+  }
+  wait_for_results(reports);
+  gatt_interface->client->scan(false);
+  gatt_interface->client->unregister_client(client_if);
+
+  pthread_mutex_lock(&lock);
+  uint32_t delivered = results;
+  uint64_t first = first_result_us, last = last_result_us;
+  pthread_mutex_unlock(&lock);
+
+  printf("%u reports at %u Hz: %u results delivered (%.1f%%)\n", reports, rate_hz, delivered,
+         delivered * 100.0 / reports);
+  if (delivered > 1) {
+    printf("first result %.1f ms after starting the scan, %.1f ms from first to last, "
+           "%.0f results/s\n", (first - start) / 1000.0, (last - first) / 1000.0,
+           (delivered - 1) * 1e6 / (last - first ? last - first : 1));
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  uint32_t reports = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 0) : DEFAULT_REPORTS;
+  uint32_t rate_hz = argc > 2 ? (uint32_t)strtoul(argv[2], NULL, 0) : DEFAULT_RATE_HZ;
+  if (!reports) {
+    fprintf(stderr, "usage: %s [reports] [rate_hz]\n", argv[0]);
+    return 1;
+  }
+
+  if (!write_script(reports, rate_hz))
+    return 1;
+  setenv(SCRIPT_ENV_VAR, SCRIPT_PATH, 1);
+  if (!load_stack())
+    return 1;
+
+  int ret = 1;
+  if (bt_interface->enable() == BT_STATUS_SUCCESS && wait_for_state(BT_STATE_ON)) {
+    ret = scan(reports, rate_hz) ? 0 : 1;
+    bt_interface->disable();
+    wait_for_state(BT_STATE_OFF);
+  } else {
+    fprintf(stderr, "unable to enable Bluetooth\n");
+  }
+  gatt_interface->cleanup();
+  bt_interface->cleanup();
+  unlink(SCRIPT_PATH);
+  return ret;
+}
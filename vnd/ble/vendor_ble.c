@@ -529,8 +529,8 @@ tBTM_STATUS btm_ble_read_irk_entry(BD_ADDR target_bda)
 void btm_ble_vendor_irk_list_known_dev(BOOLEAN enable)
 {
 #if BLE_PRIVACY_SPT == TRUE
-    UINT8               i;
-    UINT8               count = 0;
+    UINT16              i;
+    UINT16              count = 0;
     tBTM_SEC_DEV_REC    *p_dev_rec = &btm_cb.sec_dev_rec[0];
 
     if (btm_cb.cmn_ble_vsc_cb.max_irk_list_sz == 0)